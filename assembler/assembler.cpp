@@ -1,90 +1,527 @@
-#include "lexer.h"
-#include "code_generator.h"
-#include "parser.h"
-#include "assembler.h"
-#include "object_file_generator.h"
+#include "file_cache.h"
+#include "include_cache.h"
+#include "nc16x32asm.h"
+#include "object_cache.h"
+#include "service.h"
+#include "source_buffer.h"
+#include "stats.h"
+#include "work_stealing_pool.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <string>
-#include <unistd.h>  // for getopt
+#include <getopt.h>
+#include <sys/stat.h>
+#include <thread>
 #include <vector>
 #include <unordered_map>
 
-int main(int argc, char* argv[]) {
-    std::string input_file;
-    std::string output_file;
+namespace {
+
+// Default amount of source text lexed, parsed and encoded at a time in streaming mode.
+constexpr size_t kDefaultStreamChunkBytes = 1 << 20;
+
+// One input file and what assembling it produced. What it reports goes to
+// 'report' (for std::cout) and 'diagnostics' (for std::cerr), so that the
+// output of inputs assembled at the same time can be printed in order.
+struct TranslationUnit {
+    std::string input;
+    std::string output;
+    std::string dependencies; // File to write a make rule to (-MD), or empty.
+    std::string rule_head;    // "object: source", as the makefile names them.
+    std::ostringstream report;
+    std::ostringstream diagnostics;
+    Stats stats; // With --stats.
+    int result = 0;
+};
+
+// Quote a path for a make rule.
+std::string make_escape(const std::string &path) {
+    std::string escaped;
+    for (char c : path) {
+        if (c == ' ' || c == '#') {
+            escaped += '\\';
+        } else if (c == '$') {
+            escaped += '$';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
 
+/**
+ * Write the make rule that names what the object of 'unit' depends on, its
+ * source and the headers it includes, with an empty rule for each header so
+ * that make does not stop when one is removed. Like gcc -MD -MP.
+ */
+bool write_dependencies(TranslationUnit &unit, const std::vector<std::string> &includes) {
+    std::ostringstream rule;
+    rule << unit.rule_head;
+    for (const std::string &header : includes) {
+        rule << " \\\n  " << make_escape(header);
+    }
+    rule << "\n";
+    for (const std::string &header : includes) {
+        rule << "\n" << make_escape(header) << ":\n";
+    }
+    std::ofstream out(unit.dependencies, std::ios::trunc);
+    out << rule.str();
+    out.close();
+    if (!out) {
+        unit.diagnostics << "Error writing dependency file " << unit.dependencies << ".\n";
+        return false;
+    }
+    return true;
+}
+
+// The directory part of 'path', or empty for the current directory.
+std::string directory_of(const std::string &path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return {};
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Assemble one input. With a cache, an object assembled before from the same
+// inputs is linked or copied to the output instead; only objects assembled
+// without a diagnostic are added to it. With a file cache, the source is
+// taken from it. Headers come from options.include_cache. Thread-safe: all
+// the state of the assembly is local, and it writes only to 'unit'.
+int assemble_unit(TranslationUnit &unit, AssemblyOptions options, const ObjectCache *cache, FileCache *files) {
+    // Map the input file; tokens are views into this buffer.
+    SourceBuffer source;
+    if (std::shared_ptr<const std::string> text = files ? files->read(unit.input) : nullptr) {
+        source.share(std::move(text));
+    } else if (!source.open(unit.input)) {
+        unit.diagnostics << "Error opening input file " << unit.input << ".\n";
+        return 1;
+    }
+
+    options.source_directory = directory_of(unit.input);
+
+    std::optional<ContentDigest> content_hash;
+    std::vector<std::string> includes;
+    if (options.deterministic) {
+        content_hash = assembly_hash(source, options, &includes);
+    }
+    if (cache) {
+        PhaseTimer timer(options.stats, "cache");
+        if (cache->fetch(*content_hash, unit.output)) {
+            if (options.stats) {
+                options.stats->add("cached_objects", 1);
+            }
+            return unit.dependencies.empty() || write_dependencies(unit, includes) ? 0 : 1;
+        }
+    }
+    ObjectCache::detach(unit.output);
+
+    AssemblyResult result = assemble_file(source, unit.output, options, content_hash);
+    unit.report << result.report;
+    unit.diagnostics << result.diagnostics;
+    if (cache && result.ok && result.diagnostics.empty()) {
+        PhaseTimer timer(options.stats, "cache");
+        cache->store(*content_hash, unit.output, unit.diagnostics);
+    }
+    if (result.ok && !unit.dependencies.empty() && !write_dependencies(unit, result.includes)) {
+        return 1;
+    }
+    return result.ok ? 0 : 1;
+}
+
+// 'path' relative to 'cwd': the client's directory for a request to the
+// server, or empty for the process's own.
+std::string resolve(const std::string &cwd, const std::string &path) {
+    if (cwd.empty() || path.empty() || path[0] == '/') {
+        return path;
+    }
+    return cwd + "/" + path;
+}
+
+/**
+ * Replace every "@file" argument by the arguments in 'file': words separated
+ * by white space, which may be quoted with ' or " and may contain
+ * backslash-escaped characters. Response files may name other response
+ * files.
+ *
+ * @return False if a response file cannot be read, or they nest too deeply.
+ */
+bool expand_response_files(std::vector<std::string> &args, const std::string &cwd, std::ostream &err,
+                           int depth = 0) {
+    std::vector<std::string> expanded;
+    for (std::string &arg : args) {
+        if (arg.size() < 2 || arg[0] != '@') {
+            expanded.push_back(std::move(arg));
+            continue;
+        }
+        std::ifstream file(resolve(cwd, arg.substr(1)));
+        if (!file || depth > 16) {
+            err << "Cannot read response file " << arg.substr(1) << ".\n";
+            return false;
+        }
+        std::vector<std::string> words;
+        std::string word;
+        bool in_word = false;
+        char quote = 0;
+        for (char c; file.get(c);) {
+            if (c == '\\' && quote != '\'') {
+                if (file.get(c)) {
+                    word += c;
+                }
+                in_word = true;
+            } else if (quote) {
+                if (c == quote) {
+                    quote = 0;
+                } else {
+                    word += c;
+                }
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+                in_word = true;
+            } else if (std::isspace(static_cast<unsigned char>(c))) {
+                if (in_word) {
+                    words.push_back(std::move(word));
+                    word.clear();
+                    in_word = false;
+                }
+            } else {
+                word += c;
+                in_word = true;
+            }
+        }
+        if (in_word) {
+            words.push_back(std::move(word));
+        }
+        if (!expand_response_files(words, cwd, err, depth + 1)) {
+            return false;
+        }
+        std::move(words.begin(), words.end(), std::back_inserter(expanded));
+    }
+    args = std::move(expanded);
+    return true;
+}
+
+// 'path' with its extension, if it has one, replaced by 'extension'.
+std::string replace_extension(const std::string &path, const char *extension) {
+    size_t slash = path.rfind('/');
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        return path.substr(0, dot) + extension;
+    }
+    return path + extension;
+}
+
+// Object file for an input given no -o: its name with .s replaced by .o.
+std::string default_output(const std::string &input) {
+    return replace_extension(input, ".o");
+}
+
+void print_usage(std::ostream &err) {
+    err << "Usage: nc16x32-as [-i] input_file [-o output_file] ... [@response_file] [-j jobs] [-O[2]]"
+           " [-I include_dir] ... [-MD [-MF dependency_file]]"
+           " [--stream[=chunk_bytes]] [--deterministic] [--cache-dir=directory] [--stats[=json]]\n"
+           "       nc16x32-as --serve[=socket]\n";
+}
+
+// A parsed command line. Paths are resolved against the directory it was given in.
+struct CommandLine {
+    std::string cwd;
+    AssemblyOptions options;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    bool write_dependencies = false; // -MD
+    std::string dependency_file;     // -MF
+    std::string cache_dir;
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::optional<std::string> serve_socket; // --serve
+    bool stats = false;      // --stats: print the time and heap use of each phase to std::cerr,
+    bool stats_json = false; // as JSON with --stats=json.
+};
+
+/**
+ * Parse the arguments after the program name, given in directory 'cwd'.
+ * getopt() keeps its state in globals, so the server parses one command
+ * line at a time.
+ *
+ * @return False after reporting a bad argument to 'err'.
+ */
+bool parse_command_line(std::vector<std::string> args, const std::string &cwd, CommandLine &command,
+                        std::ostream &err) {
+    if (!expand_response_files(args, cwd, err)) {
+        return false;
+    }
+    command.cwd = cwd;
+    // gcc spells -MD and -MF with one dash; getopt would take them for -M -D.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--") {
+            break;
+        }
+        if (args[i] == "-MD") {
+            args[i] = "--MD";
+        } else if (args[i] == "-MF" && i + 1 < args.size()) {
+            args[i] = "--MF=" + args[i + 1];
+            args.erase(args.begin() + static_cast<std::ptrdiff_t>(i) + 1);
+        } else if (args[i].starts_with("-MF")) {
+            args[i] = "--MF=" + args[i].substr(3);
+        }
+    }
+    std::string program = "nc16x32-as";
+    std::vector<char *> argv{program.data()};
+    for (std::string &arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+    const int argc = static_cast<int>(argv.size() - 1);
+
+    static const option long_options[] = {
+        {"input", required_argument, nullptr, 'i'},
+        {"output", required_argument, nullptr, 'o'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"stream", optional_argument, nullptr, 's'},
+        {"deterministic", no_argument, nullptr, 'D'},
+        {"cache-dir", required_argument, nullptr, 'C'},
+        {"serve", optional_argument, nullptr, 'S'},
+        {"MD", no_argument, nullptr, 'M'},
+        {"MF", required_argument, nullptr, 'F'},
+        {"stats", optional_argument, nullptr, 'T'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    static std::mutex getopt_mutex;
+    std::lock_guard lock(getopt_mutex);
+    // Start over, even after an earlier command line.
+#if defined(__GLIBC__)
+    optind = 0;
+#else
+    optreset = 1;
+    optind = 1;
+#endif
+    opterr = 0;
     int opt;
-    while ((opt = getopt(argc, argv, "i:o:")) != -1) {
+    while ((opt = getopt_long(argc, argv.data(), "i:o:j:I:sO::", long_options, nullptr)) != -1) {
         switch (opt) {
             case 'i':
-                input_file = optarg;
+                command.inputs.push_back(resolve(cwd, optarg));
                 break;
             case 'o':
-                output_file = optarg;
+                command.outputs.push_back(resolve(cwd, optarg));
+                break;
+            case 'j':
+                command.jobs = std::strtoull(optarg, nullptr, 0);
+                if (command.jobs == 0) {
+                    err << "Invalid number of jobs: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case 's':
+                command.options.stream_chunk_bytes = kDefaultStreamChunkBytes;
+                if (optarg) {
+                    command.options.stream_chunk_bytes = std::strtoull(optarg, nullptr, 0);
+                    if (command.options.stream_chunk_bytes == 0) {
+                        err << "Invalid stream chunk size: " << optarg << "\n";
+                        return false;
+                    }
+                }
+                break;
+            case 'I':
+                command.options.include_dirs.push_back(resolve(cwd, optarg));
+                break;
+            case 'M':
+                command.write_dependencies = true;
+                break;
+            case 'F':
+                command.dependency_file = resolve(cwd, optarg);
+                break;
+            case 'D':
+                command.options.deterministic = true;
+                break;
+            case 'C':
+                // Cached objects must not depend on when they were made.
+                command.cache_dir = resolve(cwd, optarg);
+                command.options.deterministic = true;
+                break;
+            case 'T':
+                command.stats = true;
+                command.stats_json = optarg && std::string_view(optarg) == "json";
+                if (optarg && !command.stats_json && std::string_view(optarg) != "text") {
+                    err << "Unknown statistics format: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case 'S':
+                command.serve_socket = resolve(cwd, optarg ? optarg : service::default_socket_path());
+                break;
+            case 'O':
+                // -O runs the peephole optimizer; -O2 removes dead stores
+                // and redundant reloads first.
+                command.options.optimization_level = optarg ? std::atoi(optarg) : 1;
+                if (command.options.optimization_level != 1 && command.options.optimization_level != 2) {
+                    err << "Unsupported optimization level: -O" << optarg << "\n";
+                    return false;
+                }
                 break;
             default:
-                std::cerr << "Usage: " << argv[0] << " -i input_file -o output_file\n";
-                return 1;
+                err << "Unknown option or missing argument: " << argv[optind - 1] << "\n";
+                print_usage(err);
+                return false;
         }
     }
+    // Inputs may also follow the options.
+    for (int i = optind; i < argc; ++i) {
+        command.inputs.push_back(resolve(cwd, argv[i]));
+    }
+    return true;
+}
 
-    if (input_file.empty()) {
-        std::cerr << "Input file required.\n";
+// 'path' as it was given on the command line: without the directory a
+// request to the server was made from.
+std::string as_given(const CommandLine &command, const std::string &path) {
+    if (!command.cwd.empty() && path.starts_with(command.cwd + "/")) {
+        return path.substr(command.cwd.size() + 1);
+    }
+    return path;
+}
+
+// Assemble the inputs of 'command', printing what they report to 'out' and
+// 'err'. Headers come from 'headers'.
+int assemble_files(CommandLine &command, FileCache *files, IncludeCache &headers, std::ostream &out,
+                   std::ostream &err) {
+    if (command.inputs.empty()) {
+        err << "Input file required.\n";
         return 1;
     }
-    if (output_file.empty()) {
-        std::cerr << "Output file required.\n";
+    if (!command.dependency_file.empty() && (!command.write_dependencies || command.inputs.size() != 1)) {
+        err << "-MF needs -MD and a single input file.\n";
         return 1;
     }
-
-    // Read the input file line by line.
-    std::vector<std::string> lines;
-    std::ifstream in(input_file);
-    if (!in) {
-        std::cerr << "Error opening input file.\n";
+    // The Nth -o names the object of the Nth input; the others are named after their input.
+    if (command.outputs.size() > command.inputs.size()) {
+        err << "More output files than input files.\n";
         return 1;
     }
-    std::string line;
-    while (std::getline(in, line)) {
-        lines.push_back(line);
+    const uint64_t start_ns = wall_clock_ns();
+    std::vector<TranslationUnit> units(command.inputs.size());
+    std::unordered_map<std::string_view, size_t> unit_by_output;
+    for (size_t i = 0; i < units.size(); ++i) {
+        units[i].input = std::move(command.inputs[i]);
+        units[i].output = i < command.outputs.size() ? std::move(command.outputs[i]) : default_output(units[i].input);
+        if (!unit_by_output.emplace(units[i].output, i).second) {
+            err << "Output file " << units[i].output << " given for more than one input.\n";
+            return 1;
+        }
+        if (command.write_dependencies) {
+            units[i].dependencies = command.dependency_file.empty() ? replace_extension(units[i].output, ".d")
+                                                                    : command.dependency_file;
+            units[i].rule_head = make_escape(as_given(command, units[i].output)) + ": " +
+                                 make_escape(as_given(command, units[i].input));
+        }
     }
-    in.close();
+    command.options.include_cache = &headers;
 
-    // Run lexer passes.
-    Lexer lexer;
-    lexer.firstPass(lines);
-    std::vector<Token> tokens = lexer.secondPass(lines);
+    std::optional<ObjectCache> cache;
+    if (!command.cache_dir.empty()) {
+        cache.emplace(command.cache_dir, err);
+    }
 
-    // Build the label table from the lexer's data.
-    std::unordered_map<std::string, uint16_t> label_table;
-    for (const auto& pair : lexer.getLabelTable()) {
-        label_table[pair.first] = static_cast<uint16_t>(pair.second);
+    // Start the largest inputs first.
+    std::vector<size_t> order(units.size());
+    std::vector<uint64_t> sizes(units.size());
+    for (size_t i = 0; i < units.size(); ++i) {
+        struct stat st{};
+        sizes[i] = ::stat(units[i].input.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+        order[i] = i;
     }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+    // Each input is assembled on its own; what it reports is printed once it
+    // and every input before it are done, so the output is in input order.
+    std::mutex output_mutex;
+    std::vector<bool> finished(units.size());
+    size_t next_to_print = 0;
+    run_work_stealing(command.jobs, order, [&](size_t i) {
+        TranslationUnit &unit = units[i];
+        AssemblyOptions options = command.options;
+        options.stats = command.stats ? &unit.stats : nullptr;
+        try {
+            unit.result = assemble_unit(unit, options, cache ? &*cache : nullptr, files);
+        } catch (const std::exception &e) {
+            unit.diagnostics << e.what() << "\n";
+            unit.result = 1;
+        }
 
-    // Create the code generator and parser as stack objects.
-    CodeGenerator code_generator(label_table);
-    Parser parser(tokens, Parser::Metadata(), code_generator);
-    parser.parse();
+        std::lock_guard lock(output_mutex);
+        finished[i] = true;
+        for (; next_to_print < units.size() && finished[next_to_print]; ++next_to_print) {
+            TranslationUnit &done = units[next_to_print];
+            out << done.report.view() << std::flush;
+            err << done.diagnostics.view();
+            done.report.str({});
+            done.diagnostics.str({});
+        }
+    });
 
-    // Build the object file using ObjectFileGenerator.
-    ObjectFileGenerator object_file_generator(
-        code_generator.relocation_entries,
-        parser.label_address_table,
-        parser.object_code
-    );
-    std::vector<uint8_t> object_file = object_file_generator.build();
+    if (command.stats) {
+        Stats total;
+        total.add("files", units.size());
+        for (const TranslationUnit &unit : units) {
+            total.merge(unit.stats);
+        }
+        total.print(err, "nc16x32-as", wall_clock_ns() - start_ns, command.stats_json);
+    }
 
-    // Write the final object file in binary mode.
-    std::ofstream out(output_file, std::ios::binary);
-    if (!out) {
-        std::cerr << "Error opening output file.\n";
+    bool failed = std::any_of(units.begin(), units.end(), [](const TranslationUnit &unit) { return unit.result != 0; });
+    return failed ? 1 : 0;
+}
+
+// Source files the server keeps in memory between requests.
+constexpr size_t kServerFileCacheBytes = size_t{256} << 20;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    CommandLine command;
+    if (!parse_command_line({argv + 1, argv + argc}, "", command, std::cerr)) {
         return 1;
     }
-    out.write(reinterpret_cast<const char*>(object_file.data()),
-              static_cast<std::streamsize>(object_file.size()));
-    out.close();
+    if (!command.serve_socket) {
+        IncludeCache headers(command.cache_dir);
+        return assemble_files(command, nullptr, headers, std::cout, std::cerr);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    // Answer requests from nc16x32-asc, which passes its command line.
+    if (!command.inputs.empty()) {
+        std::cerr << "--serve takes no input files.\n";
+        return 1;
+    }
+    FileCache files(kServerFileCacheBytes);
+    // Headers, by the cache directory of the requests that include them.
+    std::mutex headers_mutex;
+    std::map<std::string, IncludeCache> headers;
+    return service::serve(*command.serve_socket, [&](const std::string &cwd, std::vector<std::string> args,
+                                                    std::ostream &out, std::ostream &err) {
+        CommandLine request;
+        if (!parse_command_line(std::move(args), cwd, request, err)) {
+            return 1;
+        }
+        if (request.serve_socket) {
+            err << "--serve cannot be sent to a server.\n";
+            return 1;
+        }
+        IncludeCache *request_headers;
+        {
+            std::lock_guard lock(headers_mutex);
+            request_headers = &headers.try_emplace(request.cache_dir, request.cache_dir).first->second;
+        }
+        return assemble_files(request, &files, *request_headers, out, err);
+    });
+}
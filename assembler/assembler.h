@@ -5,7 +5,9 @@
 #ifndef MAIN_H
 #define MAIN_H
 #include "machine_description.h"
+#include <cstdint>
 #include <iomanip>
+#include <string_view>
 
 inline time_t get_compile_unix_time() {
     const char *compile_date = __DATE__; // "Mmm dd yyyy"
@@ -35,4 +37,10 @@ const char* get_encoding_for_instruction(const char* inst_name, uint8_t sp);
 
 // Retrieve length based on instruction name and specifier 'sp'.
 uint8_t get_length_for_instruction(const char* inst_name, uint8_t sp);
+
+// Parse a decimal, 0x-hexadecimal or 0-octal integer with an optional sign,
+// as std::stoll(text, nullptr, 0) would, but without throwing. Trailing
+// characters are ignored. Returns false if there are no digits or the value
+// does not fit in 64 bits.
+bool parse_integer(std::string_view text, int64_t &value);
 #endif //MAIN_H
@@ -0,0 +1,64 @@
+#ifndef CHAR_CLASS_H
+#define CHAR_CLASS_H
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+// Byte classification shared by the scanner and the macro expander. Every byte
+// of the source is classified with a single table lookup.
+namespace lex {
+
+enum CharClass : uint8_t {
+    kSpace      = 1 << 0, // ' ', \t, \n, \v, \f, \r
+    kIdentStart = 1 << 1, // [A-Za-z_]
+    kIdentCont  = 1 << 2, // [A-Za-z0-9_]
+    kDigit      = 1 << 3, // [0-9]
+    kSeparator  = 1 << 4, // whitespace or ','
+};
+
+constexpr std::array<uint8_t, 256> makeCharClassTable() {
+    std::array<uint8_t, 256> table{};
+    for (int c = 0; c < 256; ++c) {
+        uint8_t cls = 0;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r')
+            cls |= kSpace | kSeparator;
+        if (c == ',')
+            cls |= kSeparator;
+        if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_')
+            cls |= kIdentStart | kIdentCont;
+        if (c >= '0' && c <= '9')
+            cls |= kDigit | kIdentCont;
+        table[c] = cls;
+    }
+    return table;
+}
+
+inline constexpr std::array<uint8_t, 256> kCharClass = makeCharClassTable();
+
+inline bool is(char c, uint8_t cls) {
+    return (kCharClass[static_cast<unsigned char>(c)] & cls) != 0;
+}
+
+// End of the identifier-continuation run starting at 'pos'.
+inline size_t identRunEnd(std::string_view s, size_t pos) {
+    while (pos < s.size() && is(s[pos], kIdentCont)) ++pos;
+    return pos;
+}
+
+inline size_t skipSpaces(std::string_view s, size_t pos) {
+    while (pos < s.size() && is(s[pos], kSpace)) ++pos;
+    return pos;
+}
+
+inline std::string_view trimView(std::string_view s) {
+    size_t begin = skipSpaces(s, 0);
+    size_t end = s.size();
+    while (end > begin && is(s[end - 1], kSpace)) --end;
+    return s.substr(begin, end - begin);
+}
+
+} // namespace lex
+
+#endif // CHAR_CLASS_H
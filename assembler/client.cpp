@@ -0,0 +1,83 @@
+#include "file_identity.h"
+#include "service.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+nc16x32-asc: the nc16x32-as command line, run by an assembler server
+(nc16x32-as --serve) on the socket named by $NC16X32_AS_SOCKET or the
+default path. Without a server, or if the server is run by another user, it
+runs nc16x32-as from its own directory.
+*/
+
+namespace {
+
+// Run the nc16x32-as next to this program with the same arguments. Where
+// the system does not say where this program is, argv[0] does if it has a
+// directory, and otherwise it was found in $PATH, as nc16x32-as is.
+int run_locally(char *argv[], const std::string &socket_path) {
+    std::string self = executable_path();
+    if (self.empty()) {
+        self = argv[0];
+    }
+    std::string assembler = "nc16x32-as";
+    size_t slash = self.rfind('/');
+    if (slash != std::string::npos) {
+        assembler = self.substr(0, slash + 1) + assembler;
+    }
+    argv[0] = assembler.data();
+    ::execvp(assembler.c_str(), argv);
+    std::cerr << "No assembler server on " << socket_path << ", and cannot run " << assembler << ": "
+              << std::strerror(errno) << "\n";
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    const std::string socket_path = service::default_socket_path();
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        return run_locally(argv, socket_path);
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    int fd = service::stream_socket();
+    if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        return run_locally(argv, socket_path);
+    }
+    if (!service::peer_is_self(fd)) {
+        std::cerr << "The assembler server on " << socket_path << " is not run by this user; not using it.\n";
+        ::close(fd);
+        return run_locally(argv, socket_path);
+    }
+
+    char cwd[PATH_MAX];
+    if (!::getcwd(cwd, sizeof(cwd))) {
+        std::cerr << "Cannot find the working directory: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    bool sent = service::write_u32(fd, static_cast<uint32_t>(argc)) && service::write_string(fd, cwd);
+    for (int i = 1; sent && i < argc; ++i) {
+        sent = service::write_string(fd, argv[i]);
+    }
+
+    uint32_t status;
+    std::string out;
+    std::string err;
+    if (!sent || !service::read_u32(fd, status) || !service::read_string(fd, out) || !service::read_string(fd, err)) {
+        std::cerr << "Lost the connection to the assembler server on " << socket_path << ".\n";
+        return 1;
+    }
+    ::close(fd);
+    std::cout << out << std::flush;
+    std::cerr << err;
+    return static_cast<int>(status);
+}
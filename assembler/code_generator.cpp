@@ -5,98 +5,331 @@
 #include "code_generator.h"
 #include "machine_description.h"
 #include <iostream>
-#include <sstream>
 #include <cctype>
-#include <unordered_map>
+#include <cstdint>
+#include <algorithm>
 #include "assembler.h"
 
-// Remove extra spaces from a string.
-inline void trim(std::string &s) {
-    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
-        s.erase(s.begin());
-    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
-        s.pop_back();
-}
-
-// Save a number into a byte vector in big-endian order.
-inline void store_big_endian(std::vector<uint8_t> &dest, uint64_t value) {
-    int n = static_cast<int>(dest.size());
-    for (int i = 0; i < n; i++) {
-        dest[i] = static_cast<uint8_t>((value >> (8 * (n - 1 - i))) & 0xFF);
+// Append the low 'n' bytes of a number to a byte vector in big-endian order.
+inline void append_big_endian(std::vector<uint8_t> &dest, uint64_t value, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dest.push_back(static_cast<uint8_t>((value >> (8 * (n - 1 - i))) & 0xFF));
     }
 }
 
 // Break a register token into its number and suffix.
 // If no valid suffix, return the token with an empty suffix.
-std::pair<std::string, std::string> split_register_suffix(const std::string &regToken) {
+std::pair<std::string_view, std::string_view> split_register_suffix(std::string_view regToken) {
     auto dotPos = regToken.rfind('.');
-    if (dotPos == std::string::npos)
-        return {regToken, ""};
+    if (dotPos == std::string_view::npos)
+        return {regToken, {}};
 
-    std::string mainPart = regToken.substr(0, dotPos);
-    std::string suffix = regToken.substr(dotPos + 1);
+    std::string_view mainPart = regToken.substr(0, dotPos);
+    std::string_view suffix = regToken.substr(dotPos + 1);
 
     if (suffix != "L" && suffix != "H")
-        return {regToken, ""};
+        return {regToken, {}};
 
     return {mainPart, suffix};
 }
 
+// Remove surrounding whitespace.
+inline std::string_view trim_view(std::string_view s) {
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
+        s.remove_prefix(1);
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
+        s.remove_suffix(1);
+    return s;
+}
+
+// Strip an optional leading '#' and parse the rest as an integer.
+inline bool parse_hash_integer(std::string_view text, int64_t &value) {
+    if (!text.empty() && text.front() == '#')
+        text.remove_prefix(1);
+    return parse_integer(text, value);
+}
+
+namespace {
+
+// Store the low 'N' bytes of a number in big-endian order.
+template <size_t N>
+inline void store_big_endian(uint8_t *out, uint64_t value) {
+    for (size_t i = 0; i < N; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * (N - 1 - i)));
+    }
+}
+
+// parse_integer() with a fast path for the common case of a short decimal
+// number without a sign or leading zero.
+inline bool parse_operand_integer(std::string_view text, int64_t &value) {
+    if (text.empty() || text.size() > 9 || text[0] == '0')
+        return parse_integer(text, value);
+    int64_t result = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9')
+            return parse_integer(text, value);
+        result = result * 10 + (c - '0');
+    }
+    value = result;
+    return true;
+}
+
+// Operand conversions for the generated encoders (see SpecifierEncoders).
+// A conversion that fails returns false without reporting anything; the
+// caller then encodes the instruction again with the generic encoder, which
+// prints the diagnostic. Relocations and base fixups are held back until
+// commit() so that an abandoned attempt leaves no trace.
+class FieldWriter {
+public:
+    using Operand = Token;
+
+    FieldWriter(CodeGenerator &code_generator, const uint8_t *start, uint32_t address)
+        : code_generator_(code_generator), start_(start), address_(address) {}
+
+    template <size_t N, uint8_t SuffixBits>
+    bool reg(const Token &token, uint8_t *out) {
+        std::string_view number = token.data;
+        if (SuffixBits != 0)
+            number.remove_suffix(2); // ".L" or ".H", as selected by the specifier.
+        int64_t reg_num = 0;
+        if (!parse_operand_integer(number, reg_num) || reg_num < INT32_MIN || reg_num > INT32_MAX)
+            return false;
+        store_big_endian<N>(out, static_cast<uint8_t>((reg_num & 0x3F) | SuffixBits));
+        return true;
+    }
+
+    template <size_t N>
+    bool immediate(const Token &token, uint8_t *out) {
+        std::string_view text = token.data;
+        if (!text.empty() && text.front() == '#')
+            text.remove_prefix(1);
+        int64_t imm = 0;
+        if (!parse_operand_integer(text, imm))
+            return false;
+        store_big_endian<N>(out, static_cast<uint64_t>(imm));
+        return true;
+    }
+
+    // A memory placeholder takes either "[address]" or a label.
+    template <size_t N>
+    bool address(const Token &token, uint8_t *out) {
+        if (token.subtype == OperandSubtype::LabelReference)
+            return label<N>(token, out);
+        std::string_view inside = trim_view(token.data.substr(1, token.data.size() - 2));
+        if (!inside.empty() && inside[0] == '#')
+            inside.remove_prefix(1);
+        int64_t address = 0;
+        if (!parse_operand_integer(inside, address))
+            return false;
+        store_big_endian<N>(out, static_cast<uint64_t>(address));
+        return true;
+    }
+
+    template <size_t N>
+    bool label(const Token &token, uint8_t *out) {
+        const uint32_t address = address_ + static_cast<uint32_t>(out - start_);
+        auto label = code_generator_.label_table.find(token.data);
+        if (label != code_generator_.label_table.end()) {
+            store_big_endian<N>(out, label->second.address);
+            pending_[num_pending_++] = {{}, address, label->second.section};
+        } else {
+            store_big_endian<N>(out, 0);
+            pending_[num_pending_++] = {token.data, address, Section::Text};
+        }
+        return true;
+    }
+
+    // The label's address relative to the instruction; the label must be in
+    // this file's .text and within reach of the field.
+    template <size_t N, unsigned Bits>
+    bool relative_label(const Token &token, uint8_t *out) {
+        auto label = code_generator_.label_table.find(token.data);
+        if (label == code_generator_.label_table.end() || label->second.section != Section::Text)
+            return false;
+        const int64_t displacement = static_cast<int64_t>(label->second.address) - static_cast<int64_t>(address_);
+        if (!CodeGenerator::displacement_fits(displacement, Bits))
+            return false;
+        store_big_endian<N>(out, static_cast<uint64_t>(displacement));
+        return true;
+    }
+
+    template <size_t N>
+    bool base_register(const Token &token, uint8_t *out) {
+        if (!parse_offset_memory(token) || base_ < 0 || base_ > 63)
+            return false;
+        store_big_endian<N>(out, static_cast<uint8_t>(base_));
+        return true;
+    }
+
+    template <size_t N>
+    bool offset(const Token &token, uint8_t *out) {
+        if (!parse_offset_memory(token))
+            return false;
+        store_big_endian<N>(out, static_cast<uint64_t>(offset_));
+        return true;
+    }
+
+    // Record the relocations of a successful encoding.
+    void commit() {
+        for (size_t i = 0; i < num_pending_; ++i) {
+            const PendingReference &pending = pending_[i];
+            if (pending.external_label.empty()) {
+                code_generator_.base_fixups.push_back({pending.address, Section::Text, pending.target});
+            } else {
+                code_generator_.relocation_entries.emplace_back(code_generator_.intern_label(pending.external_label),
+                                                                pending.address, Section::Text);
+            }
+        }
+    }
+
+private:
+    // The base and offset fields come from the same operand; parse it once.
+    bool parse_offset_memory(const Token &token) {
+        if (&token != offset_memory_) {
+            if (!CodeGenerator::parse_offset_memory_subfields(token.data, base_, offset_))
+                return false;
+            offset_memory_ = &token;
+        }
+        return true;
+    }
+
+    CodeGenerator &code_generator_;
+    const uint8_t *start_;  // First byte of the instruction.
+    uint32_t address_;      // Output address of that byte.
+    // A label reference: a base fixup, or a relocation if the label is external.
+    struct PendingReference {
+        std::string_view external_label;
+        uint32_t address;
+        Section target; // Of a label in this file.
+    };
+    PendingReference pending_[max_fields];
+    size_t num_pending_ = 0;
+    const Token *offset_memory_ = nullptr; // Operand that base_ and offset_ were parsed from.
+    int base_ = 0;
+    int offset_ = 0;
+};
+
+using Encoders = SpecifierEncoders<FieldWriter>;
+
+} // namespace
+
+void CodeGenerator::bind_fields(const InstructionSpecifier *spec,
+                                std::span<const Token> operand_tokens,
+                                const Token *(&binding)[max_fields]) {
+    for (size_t i = 0; i < spec->num_fields; ++i) {
+        const int8_t operand = spec->fields[i].operand;
+        binding[i] = operand >= 0 && static_cast<size_t>(operand) < operand_tokens.size()
+                         ? &operand_tokens[static_cast<size_t>(operand)]
+                         : nullptr;
+    }
+}
+
+void CodeGenerator::assemble_instruction(const InstructionFormat *format,
+                                         const InstructionSpecifier *spec,
+                                         std::span<const Token> operand_tokens,
+                                         std::vector<uint8_t> &object_code) {
+    const Encoders::Encoder encoder = Encoders::table[spec->index];
+    if (encoder && operand_tokens.size() == spec->num_operands) {
+        const size_t start = object_code.size();
+        object_code.resize(start + spec->length);
+        uint8_t *out = object_code.data() + start;
+        FieldWriter fields(*this, out, code_base + static_cast<uint32_t>(start));
+        if (encoder(fields, operand_tokens.data(), out)) {
+            const size_t first_relocation = relocation_entries.size();
+            const size_t first_fixup = base_fixups.size();
+            fields.commit();
+            if (validate_encoders)
+                validate_generated_encoding(format, spec, operand_tokens, object_code,
+                                            start, first_relocation, first_fixup);
+            return;
+        }
+        object_code.resize(start);
+    }
+    assemble_instruction_generic(format, spec, operand_tokens, object_code);
+}
+
+void CodeGenerator::validate_generated_encoding(const InstructionFormat *format,
+                                                const InstructionSpecifier *spec,
+                                                std::span<const Token> operand_tokens,
+                                                std::vector<uint8_t> &object_code,
+                                                size_t start, size_t first_relocation, size_t first_fixup) {
+    // Set the generated result aside and encode the instruction again, in place.
+    const auto relocations_begin = relocation_entries.begin() + static_cast<std::ptrdiff_t>(first_relocation);
+    const auto fixups_begin = base_fixups.begin() + static_cast<std::ptrdiff_t>(first_fixup);
+    uint8_t generated_code[UINT8_MAX];
+    std::copy(object_code.begin() + static_cast<std::ptrdiff_t>(start), object_code.end(), generated_code);
+    std::vector<RelocationEntry> generated_relocations(relocations_begin, relocation_entries.end());
+    std::vector<BaseFixup> generated_fixups(fixups_begin, base_fixups.end());
+    object_code.resize(start);
+    relocation_entries.erase(relocations_begin, relocation_entries.end());
+    base_fixups.erase(fixups_begin, base_fixups.end());
+    assemble_instruction_generic(format, spec, operand_tokens, object_code);
+
+    bool same = object_code.size() - start == spec->length &&
+                std::equal(object_code.begin() + static_cast<std::ptrdiff_t>(start), object_code.end(), generated_code) &&
+                std::equal(relocation_entries.begin() + static_cast<std::ptrdiff_t>(first_relocation), relocation_entries.end(),
+                           generated_relocations.begin(), generated_relocations.end(),
+                           [](const RelocationEntry &a, const RelocationEntry &b) {
+                               return a.label == b.label && a.address == b.address;
+                           }) &&
+                std::equal(base_fixups.begin() + static_cast<std::ptrdiff_t>(first_fixup), base_fixups.end(),
+                           generated_fixups.begin(), generated_fixups.end());
+    if (!same) {
+        *diagnostics << "ERROR: Generated encoder for '" << spec->syntax
+                  << "' disagrees with the generic encoder.\n";
+    }
+}
+
 // Turn an instruction into object code.
-void CodeGenerator::assemble_instruction(const InstructionSpecifier *spec,
-                                           const std::string &inst_name,
-                                           const std::vector<Token> &operand_tokens,
+void CodeGenerator::assemble_instruction_generic(const InstructionFormat *format,
+                                           const InstructionSpecifier *spec,
+                                           std::span<const Token> operand_tokens,
                                            std::vector<uint8_t> &object_code) {
+    const uint32_t instruction_address = code_base + static_cast<uint32_t>(object_code.size());
+
     // Write the sp and opcode.
     object_code.push_back(static_cast<uint8_t>(spec->sp));
-    uint8_t opcode = get_opcode_for_instruction(inst_name.c_str());
-    object_code.push_back(opcode);
-
-    // Map placeholders from the syntax to tokens.
-    auto placeholder_map = build_placeholder_map(spec->syntax, operand_tokens);
+    object_code.push_back(format->opcode);
 
-    // Get operand fields and convert bit widths to byte widths.
-    auto operand_fields = get_operand_lengths(inst_name, spec->sp);
-    for (auto &field : operand_fields)
-        field.second = static_cast<uint8_t>((field.second + 7) / 8);
+    // Bind each field slot to the operand token that fills it.
+    const Token *binding[max_fields];
+    bind_fields(spec, operand_tokens, binding);
 
-    // Process each operand field.
-    for (const auto &[field_name, field_byte_width] : operand_fields) {
-        if (field_name == "sp" || field_name == "opcode")
+    // Process each operand field, in encoding order.
+    for (size_t field_index = 0; field_index < spec->num_fields; ++field_index) {
+        const FieldDescriptor &field = spec->fields[field_index];
+        if (field.kind == FieldKind::Sp || field.kind == FieldKind::Opcode)
             continue;
 
-        std::vector<uint8_t> field_bytes(field_byte_width, 0);
-        std::string sub_field, reg_suffix;
-        const Token *chosen_token = find_token_for_field(field_name, placeholder_map, sub_field, reg_suffix);
+        const size_t field_byte_width = (field.bit_width + 7u) / 8u;
+        const Token *chosen_token = binding[field_index];
 
         if (!chosen_token) {
-            std::cerr << "ERROR: No matching token for field '" << field_name << "'\n";
+            *diagnostics << "ERROR: No matching token for field '" << field_kind_name(field.kind) << "'\n";
+            append_big_endian(object_code, 0, field_byte_width);
             continue;
         }
 
+        // A field whose operand is in error is left zero, so that the
+        // instruction keeps the length the layout pass gave it.
         uint64_t value_to_store = 0;
 
         switch (chosen_token->subtype) {
             case OperandSubtype::Immediate: {
-                std::string imm_str = chosen_token->data;
-                if (!imm_str.empty() && imm_str[0] == '#')
-                    imm_str.erase(0, 1);
-                try {
-                    value_to_store = std::stoll(imm_str, nullptr, 0);
-                } catch (const std::invalid_argument &) {
-                    std::cerr << "ERROR: Invalid immediate value '" << imm_str << "'\n";
-                    continue;
+                int64_t imm = 0;
+                if (!parse_hash_integer(chosen_token->data, imm)) {
+                    *diagnostics << "ERROR: Invalid immediate value '" << chosen_token->data.substr(1) << "'\n";
+                    break;
                 }
+                value_to_store = static_cast<uint64_t>(imm);
                 break;
             }
             case OperandSubtype::Register: {
                 auto [mainPart, suffix] = split_register_suffix(chosen_token->data);
-                int reg_num = 0;
-                try {
-                    reg_num = std::stoi(mainPart, nullptr, 0);
-                } catch (const std::invalid_argument &) {
-                    std::cerr << "ERROR: Invalid register number '" << mainPart << "'\n";
-                    continue;
+                int64_t reg_num = 0;
+                if (!parse_integer(mainPart, reg_num) || reg_num < INT32_MIN || reg_num > INT32_MAX) {
+                    *diagnostics << "ERROR: Invalid register number '" << mainPart << "'\n";
+                    break;
                 }
 
                 uint8_t reg_field = static_cast<uint8_t>(reg_num & 0x3F);
@@ -106,252 +339,199 @@ void CodeGenerator::assemble_instruction(const InstructionSpecifier *spec,
                     else if (suffix == "L")
                         reg_field |= 0x40;
                     if ((reg_field & 0xC0) == 0xC0) {
-                        std::cerr << "ERROR: Register '" << chosen_token->data
+                        *diagnostics << "ERROR: Register '" << chosen_token->data
                                   << "' cannot have both .L and .H suffixes.\n";
-                        continue;
+                        break;
                     }
                 }
                 value_to_store = reg_field;
                 break;
             }
             case OperandSubtype::Memory: {
-                std::string inside = chosen_token->data;
+                std::string_view inside = chosen_token->data;
                 if (!inside.empty() && inside.front() == '[')
-                    inside.erase(0, 1);
+                    inside.remove_prefix(1);
                 if (!inside.empty() && inside.back() == ']')
-                    inside.pop_back();
-                trim(inside);
+                    inside.remove_suffix(1);
+                inside = trim_view(inside);
                 if (!inside.empty() && inside[0] == '#')
-                    inside.erase(0, 1);
-                try {
-                    value_to_store = std::stoll(inside, nullptr, 0);
-                } catch (const std::invalid_argument &) {
-                    std::cerr << "ERROR: Invalid memory address '" << inside << "'\n";
-                    continue;
+                    inside.remove_prefix(1);
+                int64_t address = 0;
+                if (!parse_integer(inside, address)) {
+                    *diagnostics << "ERROR: Invalid memory address '" << inside << "'\n";
+                    break;
                 }
+                value_to_store = static_cast<uint64_t>(address);
                 break;
             }
             case OperandSubtype::OffsetMemory: {
-                auto [base_val, offset_val] = parse_offset_memory_subfields(chosen_token->data);
-                if (sub_field == "baseReg") {
+                int base_val = 0;
+                int offset_val = 0;
+                if (!parse_offset_memory_subfields(chosen_token->data, base_val, offset_val)) {
+                    *diagnostics << "ERROR: Invalid offset memory operand '" << chosen_token->data << "'\n";
+                    break;
+                }
+                if (field.part == FieldPart::BaseRegister) {
                     if (base_val < 0 || base_val > 63) {
-                        std::cerr << "ERROR: Base register number '" << base_val
+                        *diagnostics << "ERROR: Base register number '" << base_val
                                   << "' out of range (0-63).\n";
-                        continue;
+                        break;
                     }
                     value_to_store = static_cast<uint8_t>(base_val & 0x3F);
-                } else if (sub_field == "offset") {
+                } else if (field.part == FieldPart::Offset) {
                     value_to_store = static_cast<uint64_t>(offset_val);
                 } else {
-                    std::cerr << "ERROR: Unknown subfield '" << sub_field
+                    *diagnostics << "ERROR: Unknown subfield '" << field_kind_name(field.kind)
                               << "' for OffsetMemory.\n";
-                    continue;
+                    break;
                 }
                 break;
             }
             case OperandSubtype::LabelReference: {
-                // Here we are processing a label reference.
-                // We write a dummy 32-bit placeholder (0) into the object code.
-                // Record a relocation entry so that the linker (or a second pass)
-                // can patch this location with the actual address.
-                // Assume we have access to a relocation_entries vector.
-                // The current position is where these bytes will be inserted.
-                value_to_store = this->label_table[chosen_token->data];
-                auto patch_position = static_cast<uint32_t>(object_code.size());
-                // Note: you may want to strip any extra punctuation from the token,
-                // so that token.data contains just the label name.
-                // Also note that the relocation entry’s address field is defined as the
-                // location in the object code to be patched.
-                // For example:
-                this->relocation_entries.emplace_back(chosen_token->data, patch_position);
+                if (field.relative) {
+                    // The distance from the instruction to a label in this file.
+                    auto label = label_table.find(chosen_token->data);
+                    if (label == label_table.end()) {
+                        *diagnostics << "ERROR: Relative reference to label '" << chosen_token->data
+                                  << "', which is not defined in this file.\n";
+                        break;
+                    }
+                    if (label->second.section != Section::Text) {
+                        *diagnostics << "ERROR: Relative reference to label '" << chosen_token->data
+                                  << "', which is not in .text.\n";
+                        break;
+                    }
+                    const int64_t displacement = static_cast<int64_t>(label->second.address) -
+                                                 static_cast<int64_t>(instruction_address);
+                    if (!displacement_fits(displacement, field.bit_width)) {
+                        *diagnostics << "ERROR: Label '" << chosen_token->data << "' is out of range of a "
+                                  << static_cast<int>(field.bit_width) << "-bit relative field.\n";
+                        break;
+                    }
+                    value_to_store = static_cast<uint64_t>(displacement);
+                    break;
+                }
+                // A label in this file is written as its address in its
+                // section, for the linker to rebase; any other label as 0,
+                // with a relocation entry so that the linker can patch in
+                // the actual address.
+                auto patch_position = code_base + static_cast<uint32_t>(object_code.size());
+                auto label = label_table.find(chosen_token->data);
+                if (label != label_table.end()) {
+                    value_to_store = label->second.address;
+                    base_fixups.push_back({patch_position, Section::Text, label->second.section});
+                } else {
+                    this->relocation_entries.emplace_back(intern_label(chosen_token->data), patch_position,
+                                                          Section::Text);
+                }
                 break;
             }
             default:
-                std::cerr << "ERROR: Unhandled operand subtype for token '"
+                *diagnostics << "ERROR: Unhandled operand subtype for token '"
                           << chosen_token->data << "'\n";
-                continue;
+                break;
         }
 
-        store_big_endian(field_bytes, value_to_store);
-        object_code.insert(object_code.end(), field_bytes.begin(), field_bytes.end());
+        append_big_endian(object_code, value_to_store, field_byte_width);
     }
 }
 
-// Get operand fields and their bit widths from the machine description.
-std::vector<std::pair<std::string, uint8_t> >
-CodeGenerator::get_operand_lengths(const std::string &inst_name, uint8_t sp) {
-    const char *encoding = get_encoding_for_instruction(inst_name.c_str(), sp);
-    if (!encoding)
-        return {};
-
-    std::string enc_str(encoding);
-    std::istringstream iss(enc_str);
-    std::string token_str;
-    std::vector<std::pair<std::string, uint8_t> > fields;
-
-    while (iss >> token_str) {
-        if (!token_str.empty() && token_str.front() == '[')
-            token_str.erase(0, 1);
-        if (!token_str.empty() && token_str.back() == ']')
-            token_str.pop_back();
-
-        auto paren_open = token_str.find('(');
-        auto paren_close = token_str.find(')');
-        if (paren_open == std::string::npos || paren_close == std::string::npos ||
-            paren_close < paren_open)
-            continue;
-
-        std::string field_name = token_str.substr(0, paren_open);
-        std::string width_str = token_str.substr(paren_open + 1, paren_close - paren_open - 1);
-        auto bit_width = static_cast<uint8_t>(std::stoi(width_str));
-
-        if (field_name == "sp" || field_name == "opcode")
-            continue;
-
-        fields.emplace_back(field_name, bit_width);
-    }
+namespace {
 
-    return fields;
+inline bool fits_unsigned(int64_t value, unsigned bit_width) {
+    return value >= 0 && (bit_width >= 63 || value < (int64_t{1} << bit_width));
 }
 
-// Build a map linking operand placeholders to their tokens.
-std::unordered_map<std::string, Token>
-CodeGenerator::build_placeholder_map(const std::string &syntax_str,
-                                       const std::vector<Token> &operand_tokens) {
-    std::unordered_map<std::string, Token> placeholder_map;
-    auto first_space = syntax_str.find(' ');
-    if (first_space == std::string::npos)
-        return placeholder_map;
-
-    std::string operand_part = syntax_str.substr(first_space + 1);
-    std::vector<std::string> placeholders;
-    std::istringstream iss(operand_part);
-    std::string tmp_str;
-    while (std::getline(iss, tmp_str, ',')) {
-        tmp_str.erase(tmp_str.begin(), std::find_if(tmp_str.begin(), tmp_str.end(),
-                                                     [](unsigned char ch) { return !std::isspace(ch); }));
-        tmp_str.erase(std::find_if(tmp_str.rbegin(), tmp_str.rend(),
-                                   [](unsigned char ch) { return !std::isspace(ch); }).base(), tmp_str.end());
-        if (!tmp_str.empty())
-            placeholders.push_back(tmp_str);
-    }
+} // namespace
 
-    if (placeholders.size() != operand_tokens.size()) {
-        std::cerr << "Mismatch between placeholder count and operand token count!\n";
-        return placeholder_map;
-    }
+bool CodeGenerator::operands_fit(const InstructionSpecifier *spec,
+                                 std::span<const Token> operand_tokens,
+                                 std::string_view &relative_label) {
+    relative_label = {};
+    const Token *binding[max_fields];
+    bind_fields(spec, operand_tokens, binding);
 
-    for (size_t i = 0; i < placeholders.size(); i++) {
-        placeholder_map[placeholders[i]] = operand_tokens[i];
+    for (size_t field_index = 0; field_index < spec->num_fields; ++field_index) {
+        const FieldDescriptor &field = spec->fields[field_index];
+        if (field.kind == FieldKind::Sp || field.kind == FieldKind::Opcode)
+            continue;
+        const Token *token = binding[field_index];
+        if (!token)
+            return false;
+
+        int64_t value = 0;
+        switch (token->subtype) {
+            case OperandSubtype::Immediate:
+                if (!parse_hash_integer(token->data, value))
+                    return false;
+                break;
+            case OperandSubtype::Register: {
+                auto [mainPart, suffix] = split_register_suffix(token->data);
+                if (!parse_integer(mainPart, value) || value < INT32_MIN || value > INT32_MAX)
+                    return false;
+                value = (value & 0x3F) | (suffix == "H" ? 0x80 : suffix == "L" ? 0x40 : 0);
+                break;
+            }
+            case OperandSubtype::Memory: {
+                std::string_view inside = trim_view(token->data.substr(1, token->data.size() - 2));
+                if (!parse_hash_integer(inside, value))
+                    return false;
+                break;
+            }
+            case OperandSubtype::OffsetMemory: {
+                int base = 0;
+                int offset = 0;
+                if (!parse_offset_memory_subfields(token->data, base, offset))
+                    return false;
+                value = field.part == FieldPart::BaseRegister ? base : offset;
+                break;
+            }
+            case OperandSubtype::LabelReference:
+                if (field.relative) {
+                    relative_label = token->data;
+                    continue;
+                }
+                // Base fixups and relocations patch 32-bit addresses.
+                if (field.bit_width < 32)
+                    return false;
+                continue;
+            default:
+                return false;
+        }
+        if (!fits_unsigned(value, field.bit_width))
+            return false;
     }
+    return true;
+}
 
-    return placeholder_map;
+std::string_view CodeGenerator::intern_label(std::string_view name) {
+    auto label = label_table.find(name);
+    if (label != label_table.end())
+        return label->first;
+    auto external = external_labels.find(name);
+    if (external == external_labels.end())
+        external = external_labels.emplace(name).first;
+    return *external;
 }
 
 // Parse offset memory operands like "[2 + #8]".
-std::pair<int, int> CodeGenerator::parse_offset_memory_subfields(const std::string &token_data) {
-    auto cache_it = offset_memory_cache.find(token_data);
-    if (cache_it != offset_memory_cache.end())
-        return cache_it->second;
-
-    std::string content = token_data.substr(1, token_data.size() - 2);
+bool CodeGenerator::parse_offset_memory_subfields(std::string_view token_data, int &base, int &offset) {
+    if (token_data.size() < 2)
+        return false;
+    std::string_view content = token_data.substr(1, token_data.size() - 2);
     auto plus_pos = content.find('+');
-    if (plus_pos == std::string::npos)
-        throw std::runtime_error("OffsetMemory operand missing '+': " + token_data);
-
-    std::string base_str = content.substr(0, plus_pos);
-    std::string offset_str = content.substr(plus_pos + 1);
-
-    auto trim = [](std::string &s) {
-        while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
-            s.erase(s.begin());
-        while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
-            s.pop_back();
-    };
-    trim(base_str);
-    trim(offset_str);
-
-    int base_val = 0;
-    if (!base_str.empty() && base_str[0] == '#')
-        base_val = std::stoi(base_str.substr(1), nullptr, 0);
-    else
-        base_val = std::stoi(base_str, nullptr, 0);
-
-    int offset_val = 0;
-    if (!offset_str.empty() && offset_str[0] == '#')
-        offset_val = std::stoi(offset_str.substr(1), nullptr, 0);
-    else
-        offset_val = std::stoi(offset_str, nullptr, 0);
-
-    offset_memory_cache[token_data] = {base_val, offset_val};
-    return {base_val, offset_val};
+    if (plus_pos == std::string_view::npos)
+        return false;
+
+    int64_t base_val = 0;
+    int64_t offset_val = 0;
+    if (!parse_hash_integer(trim_view(content.substr(0, plus_pos)), base_val) ||
+        !parse_hash_integer(trim_view(content.substr(plus_pos + 1)), offset_val))
+        return false;
+    if (base_val < INT32_MIN || base_val > INT32_MAX || offset_val < INT32_MIN || offset_val > INT32_MAX)
+        return false;
+
+    base = static_cast<int>(base_val);
+    offset = static_cast<int>(offset_val);
+    return true;
 }
-
-// Find the token for a field, handling register suffixes or offset memory.
-const Token* CodeGenerator::find_token_for_field(const std::string &field_name,
-                                                   const std::unordered_map<std::string, Token> &placeholder_map,
-                                                   std::string &subFieldOut,
-                                                   std::string &regSuffixOut) {
-    subFieldOut.clear();
-    regSuffixOut.clear();
-
-    bool is_register_field =
-        (field_name == "rd" || field_name == "rd1" ||
-         field_name == "rn" || field_name == "rn1" ||
-         field_name == "rm" || field_name == "rs");
-
-    if (is_register_field) {
-        std::string directKey = "%" + field_name;
-        auto it = placeholder_map.find(directKey);
-        if (it != placeholder_map.end())
-            return &it->second;
-
-        for (const auto &kv : placeholder_map) {
-            const std::string &ph = kv.first;
-            if (ph.find(directKey + ".") == 0) {
-                auto [mainPart, suffix] = split_register_suffix(ph.substr(1));
-                if (mainPart == field_name) {
-                    regSuffixOut = suffix;
-                    return &kv.second;
-                }
-            }
-        }
-
-        for (const auto &kv : placeholder_map) {
-            if (kv.second.subtype == OperandSubtype::OffsetMemory) {
-                subFieldOut = "baseReg";
-                return &kv.second;
-            }
-        }
-
-        return nullptr;
-    }
-    else if (field_name == "offset") {
-        for (const auto &kv : placeholder_map) {
-            if (kv.second.subtype == OperandSubtype::OffsetMemory) {
-                subFieldOut = "offset";
-                return &kv.second;
-            }
-        }
-    }
-    else if (field_name == "immediate" || field_name == "operand2") {
-        for (const auto &kv : placeholder_map) {
-            if (kv.second.subtype == OperandSubtype::Immediate  || kv.second.subtype == OperandSubtype::LabelReference)
-                return &kv.second;
-        }
-    }
-    else if (field_name == "normAddressing") {
-        for (const auto &kv : placeholder_map) {
-            if ((kv.second.subtype == OperandSubtype::Memory) || kv.second.subtype == OperandSubtype::LabelReference)
-                return &kv.second;
-        }
-    }
-    else if (field_name == "label") {
-        for (const auto &kv : placeholder_map) {
-            if (kv.second.subtype == OperandSubtype::LabelReference)
-                return &kv.second;
-        }
-    }
-
-    return nullptr;
-}
\ No newline at end of file
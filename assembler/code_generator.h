@@ -7,87 +7,182 @@
 
 #include <utility>
 #include <vector>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <iostream>
 #include <cstdint>
 #include "lexer.h"
 #include "machine_description.h"
 
+// Hash for looking up std::string keys by std::string_view without a copy.
+struct StringViewHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+};
+
+// The sections of an object file. Instructions go in Text; initialized data
+// in Text or Data; Bss has a size but no contents.
+enum class Section : uint8_t {
+    Text,
+    Data,
+    Bss
+};
+constexpr size_t kSectionCount = 3;
+
+constexpr size_t section_index(Section section) {
+    return static_cast<size_t>(section);
+}
+
+// Where a label is defined.
+struct LabelAddress {
+    uint32_t address; // Relative to the start of its section in this file.
+    Section section;
+};
+
+// Label name to address.
+using LabelTable = std::unordered_map<std::string, LabelAddress, StringViewHash, std::equal_to<>>;
+
 class CodeGenerator {
 public:
     // Constructor.
-    std::unordered_map<std::string, uint16_t> label_table;
+    LabelTable label_table;
 
-    explicit CodeGenerator(std::unordered_map<std::string, uint16_t> label_table):
+    explicit CodeGenerator(LabelTable label_table):
         label_table(std::move(label_table))
     {};
     struct RelocationEntry {
-        std::string label;
-        uint32_t address; // Address is relative to 0x0
+        std::string_view label; // Interned by intern_label(); valid for the CodeGenerator's lifetime.
+        uint32_t address; // Address is relative to the start of 'section'
+        Section section;
 
-        // Add a constructor that takes two arguments
-        RelocationEntry(std::string label, uint32_t address)
-            : label(std::move(label)), address(address) {
+        // Add a constructor that takes three arguments
+        RelocationEntry(std::string_view label, uint32_t address, Section section)
+            : label(label), address(address), section(section) {
         }
     };
+
+    // A 32-bit field that holds the address of a label in this file,
+    // relative to the start of the label's section.
+    struct BaseFixup {
+        uint32_t address; // Of the field, relative to the start of 'section'.
+        Section section;  // Holding the field.
+        Section target;   // Of the label; the linker adds its load address.
+
+        bool operator==(const BaseFixup &) const = default;
+    };
+
     /**
-     * Assemble an instruction into object code.
+     * Return a copy of a label name that lives as long as the CodeGenerator.
+     * Names from the label table are not copied; other (external) names are
+     * copied once, on first use.
      *
-     * @param spec Pointer to the instruction specifier.
-     * @param inst_name Instruction mnemonic.
-     * @param operand_tokens Tokens for the operands.
+     * @param name The label name.
+     * @return A view of the stored name.
+     */
+    std::string_view intern_label(std::string_view name);
+    /**
+     * Assemble an instruction into object code. Apart from growing
+     * 'object_code' and recording relocations, this does not allocate.
+     *
+     * Uses the specifier's generated encoder, and the generic encoder when
+     * there is none or an operand needs a diagnostic.
+     *
+     * @param format The instruction, as found by lookup_instruction().
+     * @param spec Pointer to the chosen specifier of 'format'.
+     * @param operand_tokens Tokens for the operands, matching the specifier's syntax.
      * @param object_code Vector to which the assembled bytes are appended.
      */
-    void assemble_instruction(const InstructionSpecifier* spec,
-                                const std::string& inst_name,
-                                const std::vector<Token>& operand_tokens,
+    void assemble_instruction(const InstructionFormat* format,
+                                const InstructionSpecifier* spec,
+                                std::span<const Token> operand_tokens,
                                 std::vector<uint8_t>& object_code);
 
     /**
-     * Get operand field lengths for the given instruction.
-     *
-     * @param inst_name Instruction mnemonic.
-     * @param sp Specifier value.
-     * @return Vector of (field name, bit width) pairs.
+     * Assemble an instruction by walking the specifier's field descriptors.
+     * Same contract as assemble_instruction(); this is the reference the
+     * generated encoders are checked against.
      */
-    static std::vector<std::pair<std::string, uint8_t>> get_operand_lengths(const std::string& inst_name, uint8_t sp);
+    void assemble_instruction_generic(const InstructionFormat* format,
+                                      const InstructionSpecifier* spec,
+                                      std::span<const Token> operand_tokens,
+                                      std::vector<uint8_t>& object_code);
 
     /**
-     * Build a map from operand placeholders to actual tokens.
+     * Bind each encoding field of a specifier to the operand token that fills it.
      *
-     * @param syntax_str The syntax string (e.g., "mov %rd, #%immediate").
-     * @param operand_tokens Tokens representing the operands.
-     * @return Map from placeholder to Token.
+     * @param spec The instruction specifier.
+     * @param operand_tokens Tokens for the operands.
+     * @param binding Receives, per field slot, the token or nullptr.
      */
-    static std::unordered_map<std::string, Token> build_placeholder_map(const std::string& syntax_str,
-                                                                         const std::vector<Token>& operand_tokens);
+    static void bind_fields(const InstructionSpecifier* spec,
+                            std::span<const Token> operand_tokens,
+                            const Token* (&binding)[max_fields]);
 
     /**
-     * Parse an offset memory operand like "[2 + #8]".
+     * Check that encoding the operands with 'spec' loses no bits: register,
+     * immediate, address and offset values must fit their fields as
+     * unsigned numbers, and a label must fill a field of at least 32 bits
+     * unless the field is relative. A relative field's displacement depends
+     * on the layout and is left to the caller.
      *
-     * @param token_data The operand string.
-     * @return A pair of integers: (base register, offset).
+     * @param spec The instruction specifier.
+     * @param operand_tokens Tokens for the operands, matching the specifier's syntax.
+     * @param relative_label Receives the label of the relative field, or an empty view.
+     * @return False if a value does not fit or does not parse.
      */
-    std::pair<int, int> parse_offset_memory_subfields(const std::string& token_data);
+    static bool operands_fit(const InstructionSpecifier* spec,
+                             std::span<const Token> operand_tokens,
+                             std::string_view &relative_label);
+
+    // Whether a label 'displacement' bytes away fits a relative field of 'bit_width' bits.
+    static bool displacement_fits(int64_t displacement, unsigned bit_width) {
+        return bit_width >= 64 || (displacement >= -(int64_t{1} << (bit_width - 1)) &&
+                                   displacement < (int64_t{1} << (bit_width - 1)));
+    }
 
     /**
-     * Find the token for a given field.
+     * Parse an offset memory operand like "[2 + #8]".
      *
-     * @param field_name The field name.
-     * @param placeholder_map Map of placeholders to tokens.
-     * @param subFieldOut Output for subfield if needed.
-     * @param regSuffixOut Output for register suffix if needed.
-     * @return Pointer to the matching token, or nullptr if not found.
+     * @param token_data The operand string.
+     * @param base Receives the base register.
+     * @param offset Receives the offset.
+     * @return False if the operand is malformed.
      */
-    static const Token *find_token_for_field(const std::string &field_name,
-                                              const std::unordered_map<std::string, Token> &placeholder_map,
-                                              std::string &subFieldOut, std::string &regSuffixOut);
+    static bool parse_offset_memory_subfields(std::string_view token_data, int &base, int &offset);
 
+    // References to labels not defined in this file, for the linker to resolve.
     std::vector<RelocationEntry> relocation_entries;
 
+    // Fields that hold the address of a label in this file. Relative
+    // fields need no fixup.
+    std::vector<BaseFixup> base_fixups;
+
+    // Names of referenced labels that are not in label_table.
+    std::unordered_set<std::string, StringViewHash, std::equal_to<>> external_labels;
+
+    // Bytes of .text already written out before the current buffer
+    // (streaming mode); relocation addresses are relative to the whole section.
+    uint32_t code_base = 0;
+
+    // Run the generic encoder after every generated one and report any
+    // difference in bytes or relocations (the generic result is kept).
+    bool validate_encoders = false;
+
+    // Where errors in operands are reported.
+    std::ostream *diagnostics = &std::cerr;
+
 private:
-    // Cache for offset memory operand parsing.
-    std::unordered_map<std::string, std::pair<int, int>> offset_memory_cache;
+    // Re-encode the instruction at 'start' generically and compare with the
+    // generated encoding; see validate_encoders.
+    void validate_generated_encoding(const InstructionFormat* format,
+                                     const InstructionSpecifier* spec,
+                                     std::span<const Token> operand_tokens,
+                                     std::vector<uint8_t>& object_code,
+                                     size_t start, size_t first_relocation, size_t first_fixup);
 };
 
 #endif // CODE_GENERATOR_H
\ No newline at end of file
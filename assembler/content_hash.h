@@ -0,0 +1,76 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+// A 128-bit hash, wide enough to name cache entries by: two different inputs
+// are not expected to share one.
+struct ContentDigest {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    bool operator==(const ContentDigest &) const = default;
+
+    // 32 hex digits.
+    [[nodiscard]] std::string hex() const {
+        char text[33];
+        std::snprintf(text, sizeof(text), "%016llx%016llx", static_cast<unsigned long long>(high),
+                      static_cast<unsigned long long>(low));
+        return text;
+    }
+};
+
+// 128-bit FNV-1a over a sequence of values. Strings are length-prefixed, so
+// that ("ab", "c") and ("a", "bc") hash differently.
+class ContentHash {
+public:
+    void update(std::string_view bytes) {
+        update(static_cast<uint64_t>(bytes.size()));
+        mix(bytes.data(), bytes.size());
+    }
+
+    void update(uint64_t value) {
+        unsigned char bytes[8];
+        for (int i = 0; i < 8; ++i) {
+            bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+        }
+        mix(bytes, sizeof(bytes));
+    }
+
+    void update(const ContentDigest &digest) {
+        update(digest.high);
+        update(digest.low);
+    }
+
+    [[nodiscard]] ContentDigest digest() const {
+        return {static_cast<uint64_t>(hash_ >> 64), static_cast<uint64_t>(hash_)};
+    }
+
+    // 64 bits of the hash, where a collision costs nothing but a rebuild.
+    // The high half: the low half of an FNV product depends on the low half
+    // of the state only.
+    [[nodiscard]] uint64_t value() const { return static_cast<uint64_t>(hash_ >> 64); }
+
+private:
+    __extension__ typedef unsigned __int128 uint128;
+
+    // The FNV-128 prime, 2^88 + 0x13b.
+    static constexpr unsigned shift = 88;
+    static constexpr uint64_t prime_low = 0x13b;
+
+    void mix(const void *data, size_t size) {
+        const auto *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash_ ^= bytes[i];
+            hash_ = (hash_ << shift) + hash_ * prime_low;
+        }
+    }
+
+    uint128 hash_ = (uint128{0x6c62272e07bb0142ull} << 64) | 0x62b821756295c58dull;
+};
+
+#endif // CONTENT_HASH_H
@@ -0,0 +1,63 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "lexer.h"
+
+/*
+DataflowOptimizer removes instructions whose effect is provably unused from a
+token stream before the parser lays it out (assembler -O2):
+
+- dead stores: writes to registers that are overwritten or never read again
+  on any path, by instructions that have no other effect;
+- redundant reloads: "mov r, #k" (or a copy into r) when r already holds k.
+
+The stream is split into basic blocks at labels and after b, be, bne, blt,
+bgt, bro, jsr, rts and hlt. Register liveness is solved over the control flow
+graph of those blocks, with one bit per register field value and one for the
+overflow flag, which every instruction that changes it sets or clears. The register effects of every specifier come from a table in
+dataflow.cpp that is checked against the machine description at build time.
+
+The analysis assumes nothing it cannot see. Any label may be the target of a
+branch from another file, so known register values do not flow into a label.
+Control that leaves the stream (rts, a branch to a label defined elsewhere,
+falling off the end) and instructions that run unknown code (jsr, wfi) or stop
+with the register file still observable (hlt) read every register. Loads and
+stores are never removed, as memory may be a device.
+*/
+class DataflowOptimizer {
+public:
+    /**
+     * Remove dead stores and redundant reloads from 'tokens'. May be called
+     * on consecutive chunks of a longer stream; each is analysed on its own,
+     * assuming nothing about the code before and after it.
+     *
+     * @param tokens The token stream of a source file, or of a chunk of it.
+     */
+    void run(std::vector<Token> &tokens);
+
+    // After run(), one entry per token of the rewritten stream: true at the
+    // mnemonic of each instruction after which the overflow flag is dead.
+    [[nodiscard]] const std::vector<bool> &overflow_dead() const { return dead_overflow; }
+
+    // List the removed instructions, with their reason.
+    void print_report(std::ostream &out) const;
+
+private:
+    struct Removal {
+        std::string location;    // "label+N": the Nth instruction after the label.
+        std::string instruction; // As written, operands separated by ", ".
+        const char *reason;
+    };
+    std::vector<Removal> removals;
+    std::vector<bool> dead_overflow; // See overflow_dead().
+
+    // Where the next instruction is, for locations; kept across chunks.
+    std::string last_label;
+    size_t since_label = 0;
+};
+
+#endif // DATAFLOW_H
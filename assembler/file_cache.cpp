@@ -0,0 +1,60 @@
+#include "file_cache.h"
+
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+
+std::shared_ptr<const std::string> FileCache::read(const std::string &path) {
+    struct stat st{};
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) > capacity_) {
+        return nullptr;
+    }
+    const FileVersion version = file_version(st);
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(path);
+        if (it != entries_.end() && it->second.version == version) {
+            recent_.splice(recent_.begin(), recent_, it->second.recent);
+            return it->second.text;
+        }
+    }
+
+    // Read without holding the lock; another thread may read the same file.
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return nullptr;
+    }
+    auto text = std::make_shared<std::string>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (in.bad()) {
+        return nullptr;
+    }
+    // The file may have changed while it was read; it is then read again next time.
+    if (text->size() != version.size) {
+        return text;
+    }
+
+    std::lock_guard lock(mutex_);
+    auto [it, inserted] = entries_.try_emplace(path);
+    Entry &entry = it->second;
+    if (inserted) {
+        recent_.push_front(path);
+        entry.recent = recent_.begin();
+    } else {
+        bytes_ -= entry.text->size();
+        recent_.splice(recent_.begin(), recent_, entry.recent);
+    }
+    entry.version = version;
+    entry.text = text;
+    bytes_ += text->size();
+    evict();
+    return text;
+}
+
+void FileCache::evict() {
+    while (bytes_ > capacity_) {
+        auto it = entries_.find(recent_.back());
+        bytes_ -= it->second.text->size();
+        entries_.erase(it);
+        recent_.pop_back();
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "file_identity.h"
+
+/*
+FileCache keeps the contents of recently read source files in memory, for
+the assembler server (nc16x32-as --serve), which sees the same files request
+after request. A cached file is used as long as its device, inode, size,
+modification and change times are those it had when it was read; otherwise
+it is read again. The least recently used files are dropped once the cache
+holds more than its capacity.
+
+Contents are copied rather than mapped, so that a file truncated while a
+request uses it cannot fault the server. Safe to use from several threads.
+*/
+class FileCache {
+public:
+    explicit FileCache(size_t capacity_bytes) : capacity_(capacity_bytes) {}
+
+    /**
+     * The contents of the regular file at 'path'.
+     *
+     * @return Null if 'path' is not a regular file, is larger than the
+     * capacity, or cannot be read; the caller then reads it itself.
+     */
+    std::shared_ptr<const std::string> read(const std::string &path);
+
+private:
+    struct Entry {
+        FileVersion version;
+        std::shared_ptr<const std::string> text;
+        std::list<std::string>::iterator recent; // Position in 'recent_'.
+    };
+
+    void evict();
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::list<std::string> recent_; // Paths, most recently used first.
+    size_t bytes_ = 0;
+    size_t capacity_;
+};
+
+#endif // FILE_CACHE_H
@@ -1,180 +1,309 @@
 #include "lexer.h"
 
+#include "char_class.h"
+
+#include <algorithm>
+
+using namespace lex;
+
 // -----------------------------------------------
-// Expand Macros in a single line
+// Expansion storage
 // -----------------------------------------------
-std::string Lexer::expandMacros(const std::string& line) {
-    static std::regex macroTokenRegex(R"((#?)([A-Za-z_]\w*))");
-
-    std::string expanded = line;
-    std::smatch match;
-    size_t offset = 0;
-
-    while (std::regex_search(expanded.cbegin() + offset, expanded.cend(), match, macroTokenRegex)) {
-        std::string maybeHash = match[1];
-        std::string found     = match[2];
-
-        if (macroTable.find(found) != macroTable.end()) {
-            auto matchPos = match.position(2) + offset;
-            auto matchLen = match.length(2);
-            expanded.replace(matchPos, matchLen, macroTable[found]);
-            offset = matchPos + macroTable[found].size();
-        } else {
-            offset += match.position(0) + match.length(0);
-        }
+std::string_view Lexer::storeExpansion(std::string_view text) {
+    constexpr size_t blockSize = 64 * 1024;
+    if (expansionBlocks.empty() || expansionBlockSize - expansionBlockUsed < text.size()) {
+        expansionBlockSize = std::max(blockSize, text.size());
+        expansionBlocks.push_back(std::make_unique<char[]>(expansionBlockSize));
+        expansionBlockUsed = 0;
     }
-    return expanded;
+    char *dest = expansionBlocks.back().get() + expansionBlockUsed;
+    std::copy(text.begin(), text.end(), dest);
+    expansionBlockUsed += text.size();
+    return {dest, text.size()};
 }
 
 // -----------------------------------------------
 // Operand Parsing Logic
 // -----------------------------------------------
-OperandSubtype Lexer::parseOperandSubtype(const std::string &operandText) {
+OperandSubtype Lexer::parseOperandSubtype(std::string_view operandText) {
+    if (operandText.empty()) {
+        return OperandSubtype::Unknown;
+    }
     if (operandText.size() >= 2 && operandText.front() == '[' && operandText.back() == ']') {
-        std::string inside = operandText.substr(1, operandText.size() - 2);
-        std::string insideTrimmed = inside;
-        trim(insideTrimmed);
-        if (insideTrimmed.find('+') != std::string::npos) {
+        if (operandText.find('+') != std::string_view::npos) {
             return OperandSubtype::OffsetMemory;
         }
         return OperandSubtype::Memory;
     }
-    if (!operandText.empty() && operandText[0] == '#') {
+    if (operandText[0] == '#') {
         return OperandSubtype::Immediate;
     }
-    {
-        bool allDigits = !operandText.empty() &&
-                         std::all_of(operandText.begin(), operandText.end(), ::isdigit);
-        if (allDigits) {
-            return OperandSubtype::Register;
-        }
-        static std::regex regRegex(R"(^(?:r)?\d+(?:\.[HL])?$)");
-        if (std::regex_match(operandText, regRegex)) {
+
+    // Register: (r)?\d+(\.[HL])?
+    size_t pos = operandText[0] == 'r' ? 1 : 0;
+    size_t digitsEnd = pos;
+    while (digitsEnd < operandText.size() && is(operandText[digitsEnd], kDigit)) ++digitsEnd;
+    if (digitsEnd > pos) {
+        std::string_view rest = operandText.substr(digitsEnd);
+        if (rest.empty() || rest == ".H" || rest == ".L") {
             return OperandSubtype::Register;
         }
     }
-    if (!operandText.empty() && (std::isalpha(operandText[0]) || operandText[0] == '_')) {
+
+    if (is(operandText[0], kIdentStart)) {
         return OperandSubtype::LabelReference;
     }
     return OperandSubtype::Unknown;
 }
 
 // -----------------------------------------------
-// First Pass: Collect Macros and Labels
+// Definition matchers
 // -----------------------------------------------
-void Lexer::firstPass(const std::vector<std::string>& lines) {
-    std::regex macroRegex(R"(^\s*\$(?:MACRO\s+)?([A-Za-z_]\w+)\s+(.+)$)");
-    std::regex labelRegex(R"(^\s*([A-Za-z_]\w*):)");
+bool Lexer::matchMacroDefinition(std::string_view line, MacroTable::Definition &definition) {
+    if (line.empty() || line[0] != '$') {
+        return false;
+    }
 
-    for (size_t i = 0; i < lines.size(); ++i) {
-        std::string line = lines[i];
+    // NAME must be at least two identifier characters. It is followed either by
+    // whitespace or by a parenthesised parameter list and whitespace, and then
+    // by a non-empty body.
+    auto matchFrom = [&](size_t pos) {
+        if (pos >= line.size() || !is(line[pos], kIdentStart)) return false;
+        size_t nameEnd = identRunEnd(line, pos + 1);
+        if (nameEnd == pos + 1 || nameEnd >= line.size()) return false;
 
-        // Remove comments
-        auto commentPos = line.find(';');
-        if (commentPos != std::string::npos) {
-            line.erase(commentPos);
+        definition.params.clear();
+        definition.is_function = line[nameEnd] == '(';
+        size_t bodyStart = nameEnd;
+        if (definition.is_function) {
+            size_t p = skipSpaces(line, nameEnd + 1);
+            if (p < line.size() && line[p] == ')') {
+                bodyStart = p + 1;
+            } else {
+                while (true) {
+                    if (p >= line.size() || !is(line[p], kIdentStart)) return false;
+                    size_t paramEnd = identRunEnd(line, p);
+                    std::string_view param = line.substr(p, paramEnd - p);
+                    if (std::find(definition.params.begin(), definition.params.end(), param) !=
+                        definition.params.end()) {
+                        return false;
+                    }
+                    definition.params.push_back(param);
+                    p = skipSpaces(line, paramEnd);
+                    if (p >= line.size()) return false;
+                    if (line[p] == ')') break;
+                    if (line[p] != ',') return false;
+                    p = skipSpaces(line, p + 1);
+                }
+                bodyStart = p + 1;
+            }
         }
-        trim(line);
-        if (line.empty()) continue;
 
-        std::smatch m;
-        if (std::regex_match(line, m, macroRegex)) {
-            std::string macroName  = m[1];
-            std::string macroValue = m[2];
-            trim(macroName);
-            trim(macroValue);
-            macroTable[macroName] = macroValue;
-            continue;
-        }
+        if (bodyStart >= line.size() || !is(line[bodyStart], kSpace)) return false;
+        size_t valueBegin = skipSpaces(line, bodyStart);
+        if (valueBegin >= line.size()) return false;
+        std::string_view body = line.substr(valueBegin);
+        if (body.find_first_of("\r\n") != std::string_view::npos) return false;
+        definition.name = line.substr(pos, nameEnd - pos);
+        definition.body = body;
+        return true;
+    };
 
-        if (std::regex_match(line, m, labelRegex)) {
-            std::string labelName = m[1];
-            trim(labelName);
-            labelTable[labelName] = i;
-        }
+    constexpr std::string_view keyword = "MACRO";
+    if (line.substr(1, keyword.size()) == keyword &&
+        line.size() > 1 + keyword.size() && is(line[1 + keyword.size()], kSpace) &&
+        matchFrom(skipSpaces(line, 1 + keyword.size()))) {
+        return true;
     }
+    return matchFrom(1);
+}
+
+std::string_view Lexer::matchLabelDefinition(std::string_view line) {
+    if (line.size() < 2 || line.back() != ':' || !is(line[0], kIdentStart)) {
+        return {};
+    }
+    if (identRunEnd(line, 1) != line.size() - 1) {
+        return {};
+    }
+    return line.substr(0, line.size() - 1);
+}
+
+std::string_view Lexer::matchIncludeDirective(std::string_view line) {
+    constexpr std::string_view keyword = ".include";
+    if (!line.starts_with(keyword) || line.size() < keyword.size() + 3 || !is(line[keyword.size()], kSpace)) {
+        return {};
+    }
+    std::string_view quoted = trimView(line.substr(keyword.size()));
+    if (quoted.size() < 3 || quoted.front() != '"' || quoted.back() != '"' ||
+        quoted.find_first_of("\"\r\n", 1) != quoted.size() - 1) {
+        return {};
+    }
+    return quoted.substr(1, quoted.size() - 2);
+}
+
+bool Lexer::isDirectiveName(std::string_view text) {
+    return text == ".text" || text == ".data" || text == ".bss" || text == ".space" || text == ".include";
 }
 
 // -----------------------------------------------
-// Second Pass: Tokenize
+// Tokenizer
 // -----------------------------------------------
-std::vector<Token> Lexer::secondPass(const std::vector<std::string>& lines) {
-    std::vector<Token> tokens;
-    std::regex labelDef(R"(^\s*([A-Za-z_]\w*):\s*$)");
-    std::regex instructionDef(R"(^[A-Za-z_]\w*$)");
-    std::regex tokenRegex(R"((\"[^\"]*\")|(\'.*?\')|(\[.*?\])|([^,\s]+))");
-
-    for (auto rawLine : lines) {
-        auto commentPos = rawLine.find(';');
-        if (commentPos != std::string::npos) {
-            rawLine.erase(commentPos);
-        }
-        trim(rawLine);
-        if (rawLine.empty()) continue;
-        if (!rawLine.empty() && rawLine[0] == '$') continue;
-
-        std::string expanded = expandMacros(rawLine);
-        trim(expanded);
-        if (expanded.empty()) continue;
-
-        std::smatch lm;
-        if (std::regex_match(expanded, lm, labelDef)) {
-            Token t;
-            t.lexeme  = lm[1];
-            t.type    = TokenType::Label;
-            t.subtype = OperandSubtype::Unknown;
-            t.data    = lm[1];
-            tokens.push_back(t);
+// A token is one of, tried in this order at each non-separator position:
+//   "..."   double-quoted string (no escapes)
+//   '...'   single-quoted string, shortest match
+//   [...]   bracketed operand, shortest match
+//   a maximal run of characters other than ',' and whitespace
+// An opening quote or bracket without its closing character falls through to
+// the last rule.
+void Lexer::tokenizeLine(std::string_view line, std::vector<Token> &tokens) {
+    bool firstTokenOfLine = true;
+    size_t pos = 0;
+
+    while (pos < line.size()) {
+        if (is(line[pos], kSeparator)) {
+            ++pos;
             continue;
         }
 
-        std::sregex_iterator iter(expanded.begin(), expanded.end(), tokenRegex);
-        std::sregex_iterator end;
-
-        bool firstTokenOfLine = true;
-        while (iter != end) {
-            std::string thisToken;
-            if ((*iter)[1].matched) {
-                thisToken = (*iter)[1].str(); // Double-quoted string literal.
-            } else if ((*iter)[2].matched) {
-                thisToken = (*iter)[2].str(); // Single-quoted string literal.
-            } else if ((*iter)[3].matched) {
-                thisToken = (*iter)[3].str(); // Bracketed operand.
-            } else if ((*iter)[4].matched) {
-                thisToken = (*iter)[4].str(); // Regular token.
+        size_t end = std::string_view::npos;
+        char open = line[pos];
+        if (open == '"' || open == '\'' || open == '[') {
+            char close = open == '[' ? ']' : open;
+            size_t closePos = line.find(close, pos + 1);
+            if (closePos != std::string_view::npos) {
+                // '.' in the old patterns stopped at line terminators.
+                bool crossesLineEnd = open != '"' &&
+                    line.substr(pos + 1, closePos - pos - 1).find_first_of("\r\n") != std::string_view::npos;
+                if (!crossesLineEnd) end = closePos + 1;
             }
+        }
+        if (end == std::string_view::npos) {
+            end = pos;
+            while (end < line.size() && !is(line[end], kSeparator)) ++end;
+        }
 
-            trim(thisToken);  // Trim leading/trailing whitespace
-
-            // Process the token as before:
-            if (firstTokenOfLine) {
-                if (std::regex_match(thisToken, instructionDef)) {
-                    Token t;
-                    t.lexeme  = thisToken;
-                    t.type    = TokenType::Instruction;
-                    t.subtype = OperandSubtype::Unknown;
-                    t.data    = thisToken;
-                    tokens.push_back(t);
-                    firstTokenOfLine = false;
-                } else {
-                    Token t;
-                    t.lexeme  = thisToken;
-                    t.type    = TokenType::Operand;
-                    t.subtype = parseOperandSubtype(thisToken);
-                    t.data    = thisToken;
-                    tokens.push_back(t);
-                    firstTokenOfLine = false;
+        std::string_view text = line.substr(pos, end - pos);
+        pos = end;
+
+        Token t;
+        t.lexeme = text;
+        // An identifier first on the line is an instruction, as is the name
+        // of a directive. Any other ".name" is an operand, as it always was.
+        if (firstTokenOfLine &&
+            ((is(text[0], kIdentStart) && identRunEnd(text, 1) == text.size()) || isDirectiveName(text))) {
+            t.type    = TokenType::Instruction;
+            t.subtype = OperandSubtype::Unknown;
+        } else {
+            t.type    = TokenType::Operand;
+            t.subtype = parseOperandSubtype(text);
+        }
+        t.data = t.lexeme;
+        tokens.push_back(t);
+        firstTokenOfLine = false;
+    }
+}
+
+// -----------------------------------------------
+// First Pass: Collect Macros
+// -----------------------------------------------
+void Lexer::firstPass(const StructuralIndex &index) {
+    MacroTable::Definition definition;
+    for (size_t i = 0; i < index.size(); ++i) {
+        // Definitions start with '$'; of the other lines, only include
+        // directives matter.
+        if ((index.line(i).flags & StructuralIndex::kDollar) == 0) {
+            std::string_view code = index.code(i);
+            size_t start = skipSpaces(code, 0);
+            if (start < code.size() && code[start] == '.') {
+                std::string_view name = matchIncludeDirective(trimView(code));
+                if (!name.empty() && std::find(includeNames.begin(), includeNames.end(), name) == includeNames.end()) {
+                    includeNames.emplace_back(name);
                 }
-            } else {
-                Token t;
-                t.lexeme  = thisToken;
-                t.type    = TokenType::Operand;
-                t.subtype = parseOperandSubtype(thisToken);
-                t.data    = thisToken;
-                tokens.push_back(t);
             }
-            ++iter;
+            continue;
+        }
+        std::string_view line = trimView(index.code(i));
+        if (line.empty()) continue;
+
+        if (matchMacroDefinition(line, definition)) {
+            macroTable.define(definition);
+        }
+    }
+}
+
+// -----------------------------------------------
+// Second Pass: Tokenize
+// -----------------------------------------------
+void Lexer::tokenizeSourceLine(std::string_view code, std::vector<Token> &tokens, std::string &expanded) {
+    std::string_view line = trimView(code);
+    if (line.empty()) return;
+    if (line[0] == '$') return;
+
+    if (line[0] == '.') {
+        std::string_view name = matchIncludeDirective(line);
+        if (!name.empty()) {
+            tokens.push_back({line, TokenType::Include, OperandSubtype::Unknown, name});
+            return;
+        }
+    }
+
+    std::string_view text = line;
+    if (macroTable.expand(line, expanded)) {
+        // Keep the expanded text alive for as long as the tokens that view it.
+        text = trimView(storeExpansion(expanded));
+        if (text.empty()) return;
+    }
+
+    std::string_view labelName = matchLabelDefinition(text);
+    if (!labelName.empty()) {
+        Token t;
+        t.lexeme  = labelName;
+        t.type    = TokenType::Label;
+        t.subtype = OperandSubtype::Unknown;
+        t.data    = t.lexeme;
+        tokens.push_back(t);
+        return;
+    }
+
+    tokenizeLine(text, tokens);
+}
+
+Lexer::ChunkResult Lexer::tokenizeChunk(const StructuralIndex &index, std::vector<Token> &tokens) {
+    macroTable.compile();
+    std::string expanded;
+    ChunkResult result{0, 0};
+    size_t firstToken = tokens.size();
+
+    for (size_t i = 0; i < index.size(); ++i) {
+        size_t lineStart = tokens.size();
+        tokenizeSourceLine(index.code(i), tokens, expanded);
+        if (tokens.size() > lineStart && lineStart > firstToken &&
+            (tokens[lineStart].type == TokenType::Instruction || tokens[lineStart].type == TokenType::Label)) {
+            result.cutLine = i;
+            result.cutTokens = lineStart - firstToken;
         }
     }
+    return result;
+}
+
+std::vector<Token> Lexer::secondPass(const StructuralIndex &index) {
+    std::vector<Token> tokens;
+    // Typical sources average a little over eight bytes per token; reserving
+    // up front avoids repeatedly copying the token vector as it grows.
+    tokens.reserve(index.text().size() / 8);
+    tokenizeChunk(index, tokens);
     return tokens;
-}
\ No newline at end of file
+}
+
+void Lexer::importMacros(const std::vector<MacroTable::Macro> &macros) {
+    for (const MacroTable::Macro &macro : macros) {
+        macroTable.import(macro);
+    }
+}
+
+void Lexer::releaseExpansions() {
+    if (expansionBlocks.size() > 1) {
+        expansionBlocks.erase(expansionBlocks.begin(), expansionBlocks.end() - 1);
+    }
+    expansionBlockUsed = 0;
+}
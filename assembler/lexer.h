@@ -2,16 +2,19 @@
 #define LEXER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_map>
-#include <regex>
-#include <cctype>
+#include <memory>
+#include "macro_table.h"
+#include "structural_index.h"
 
 // Token types for classification.
 enum class TokenType {
     Label,
-    Instruction,
+    Instruction,   // Also directives such as ".data" and "db".
     Operand,
+    Include,       // '.include "name"'; data is the name. Replaced by the
+                   // header's tokens before the stream is parsed.
     EndOfLine,
     Unknown
 };
@@ -27,60 +30,147 @@ enum class OperandSubtype {
 };
 
 // Structure representing a single token.
+// The text fields are views into the source buffer, or into the Lexer's own
+// storage for macro-expanded lines; both must outlive the token.
 struct Token {
-    std::string lexeme;      // The raw text.
+    std::string_view lexeme; // The raw text.
     TokenType type;          // General token type.
     OperandSubtype subtype;  // More detailed classification.
-    std::string data;        // Numeric value, label name, etc.
+    std::string_view data;   // Numeric value, label name, etc.
 };
 
 class Lexer {
 public:
-    // First pass: collects macros and labels.
-    void firstPass(const std::vector<std::string>& lines);
+    // Where the token stream of a chunk can safely be cut.
+    struct ChunkResult {
+        size_t cutLine;    // Index of the last line that starts a new statement.
+        size_t cutTokens;  // Number of tokens before that line (0 if there is none).
+    };
 
-    // Second pass: tokenizes the input lines.
-    std::vector<Token> secondPass(const std::vector<std::string>& lines);
+    /**
+     * @brief First pass: collects macros and the names of included headers.
+     * Labels are placed by the parser's layout pass, which sees
+     * macro-expanded lines.
+     *
+     * @param index Structural index of the source, or of a slice of it that
+     * starts at a line boundary.
+     */
+    void firstPass(const StructuralIndex &index);
+
+    // Second pass: tokenizes the indexed source text.
+    std::vector<Token> secondPass(const StructuralIndex &index);
+
+    /**
+     * @brief Tokenize every line of an indexed slice of the source.
+     *
+     * A statement never spans a line that starts with an instruction or a
+     * label, so the token stream can be cut at ChunkResult::cutTokens and the
+     * lines from ChunkResult::cutLine on tokenized again with the next chunk.
+     *
+     * @param index Structural index of the slice.
+     * @param tokens Vector to which the tokens are appended.
+     */
+    ChunkResult tokenizeChunk(const StructuralIndex &index, std::vector<Token> &tokens);
+
+    /**
+     * @brief Drop the text backing macro-expanded tokens. Only valid once no
+     * token from an earlier chunk is in use.
+     */
+    void releaseExpansions();
 
     /**
      * @brief Retrieve the macro table.
      *
-     * @return A reference to the map storing macros.
+     * @return A reference to the table storing macros.
      */
-    [[nodiscard]] const std::unordered_map<std::string, std::string>& getMacroTable() const { return macroTable; }
+    [[nodiscard]] const MacroTable& getMacroTable() const { return macroTable; }
+
+    // The names in the '.include "name"' directives seen by firstPass(), each
+    // once, in the order of their first directive.
+    [[nodiscard]] const std::vector<std::string>& includes() const { return includeNames; }
 
     /**
-     * @brief Retrieve the label table.
+     * @brief Add the macros of an included header. A macro the source defines
+     * itself, or that an earlier header defined, is kept.
      *
-     * @return A reference to the map storing label positions.
+     * @param macros The header's macro table, including those it includes.
      */
-    [[nodiscard]] const std::unordered_map<std::string, size_t>& getLabelTable() const { return labelTable; }
+    void importMacros(const std::vector<MacroTable::Macro> &macros);
+
+    /**
+     * @brief Report errors found while lexing to 'out' instead of std::cerr.
+     *
+     * @param out Stream that outlives the Lexer's use.
+     */
+    void setDiagnostics(std::ostream &out) { macroTable.diagnostics = &out; }
 
 private:
-    std::unordered_map<std::string, std::string> macroTable; // Stores macros.
-    std::unordered_map<std::string, size_t> labelTable;      // Maps labels to line numbers.
+    MacroTable macroTable;                                   // Stores macros.
+    std::vector<std::string> includeNames;                   // See includes().
+
+    // Backing text for macro-expanded lines, allocated in large blocks so that
+    // the views held by tokens stay valid and expansion does not allocate per line.
+    std::vector<std::unique_ptr<char[]>> expansionBlocks;
+    size_t expansionBlockUsed = 0;
+    size_t expansionBlockSize = 0;
+
+    /**
+     * @brief Copy text into the expansion storage.
+     *
+     * @param text The text to keep.
+     * @return A view of the stored copy, valid for the lifetime of the Lexer.
+     */
+    std::string_view storeExpansion(std::string_view text);
+
+    /**
+     * @brief Match a "$NAME value" or "$MACRO NAME value" definition, where
+     * NAME may carry a parameter list: "$MACRO NAME(a, b) value".
+     *
+     * @param line A stripped line starting with '$'.
+     * @param definition Receives the name, parameters and body on success.
+     * @return True if the line is a macro definition.
+     */
+    static bool matchMacroDefinition(std::string_view line, MacroTable::Definition &definition);
+
+    /**
+     * @brief Match an '.include "name"' directive. Directives are matched
+     * before macro expansion, so a macro cannot produce one.
+     *
+     * @param line A stripped line.
+     * @return The name, or an empty view if the line is not an include directive.
+     */
+    static std::string_view matchIncludeDirective(std::string_view line);
+
+    /**
+     * @brief Whether 'text' names a directive: ".text", ".data", ".bss",
+     * ".space" or ".include". Only these lex as Instruction tokens.
+     */
+    static bool isDirectiveName(std::string_view text);
+
+    /**
+     * @brief Match a line consisting solely of "label:".
+     *
+     * @param line A stripped line.
+     * @return The label name, or an empty view if the line is not a label definition.
+     */
+    static std::string_view matchLabelDefinition(std::string_view line);
 
     /**
-     * @brief Trim leading and trailing whitespace from a string.
+     * @brief Expand and tokenize one source line.
      *
-     * @param s The string to trim.
+     * @param code The line up to its comment, untrimmed.
+     * @param tokens Vector to which the tokens are appended.
+     * @param expanded Scratch buffer for macro expansion.
      */
-    static inline void trim(std::string &s) {
-        s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-            return !std::isspace(ch);
-        }));
-        s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
-            return !std::isspace(ch);
-        }).base(), s.end());
-    }
+    void tokenizeSourceLine(std::string_view code, std::vector<Token> &tokens, std::string &expanded);
 
     /**
-     * @brief Expand macros in a given line.
+     * @brief Split a stripped, macro-expanded line into tokens.
      *
-     * @param line The line to process.
-     * @return The expanded line.
+     * @param line The line to scan.
+     * @param tokens Vector to which the tokens are appended.
      */
-    std::string expandMacros(const std::string& line);
+    static void tokenizeLine(std::string_view line, std::vector<Token> &tokens);
 
     /**
      * @brief Determine the operand subtype.
@@ -88,7 +178,7 @@ private:
      * @param operandText The operand string.
      * @return The corresponding operand subtype.
      */
-    OperandSubtype parseOperandSubtype(const std::string &operandText);
+    static OperandSubtype parseOperandSubtype(std::string_view operandText);
 };
 
-#endif // LEXER_H
\ No newline at end of file
+#endif // LEXER_H
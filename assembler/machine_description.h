@@ -4,12 +4,92 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <string_view>
+
+// Kind of an operand, as written in a syntax placeholder or as found in the
+// source. A Memory placeholder also accepts a Label operand.
+enum class OperandKind : uint8_t {
+    None,
+    Register,
+    RegisterLow,
+    RegisterHigh,
+    Immediate,
+    Memory,
+    OffsetMemory,
+    Label,
+};
+
+inline constexpr size_t max_operands = 3;
+
+// Kind of an encoding field, named after the field in the description.
+enum class FieldKind : uint8_t {
+    Sp,
+    Opcode,
+    Rd,
+    Rd1,
+    Rn,
+    Rn1,
+    Rm,
+    Rs,
+    Immediate,
+    Operand2,
+    NormAddressing,
+    Offset,
+    Label,
+};
+
+inline constexpr const char* field_kind_names[] = {
+    "sp",
+    "opcode",
+    "rd",
+    "rd1",
+    "rn",
+    "rn1",
+    "rm",
+    "rs",
+    "immediate",
+    "operand2",
+    "normAddressing",
+    "offset",
+    "label",
+};
+
+constexpr const char* field_kind_name(FieldKind kind) {
+    return field_kind_names[static_cast<size_t>(kind)];
+}
+
+// Part of an operand that fills a field: an offset-memory operand
+// "[rn + #offset]" fills a register field and an offset field.
+enum class FieldPart : uint8_t {
+    Whole,
+    BaseRegister,
+    Offset,
+};
+
+// One field of an instruction encoding; offsets count from the first bit
+// of the instruction. 'operand' is the index of the syntax placeholder
+// whose operand fills the field, or -1 if none does.
+struct FieldDescriptor {
+    FieldKind kind;
+    uint8_t bit_offset;
+    uint8_t bit_width;
+    int8_t operand;
+    FieldPart part;
+    bool relative; // Holds a label's address minus the instruction's.
+};
+
+inline constexpr size_t max_fields = 6;
 
 struct InstructionSpecifier {
     uint8_t sp;
     const char* syntax;
     const char* encoding;
     uint8_t length;
+    uint8_t num_operands;
+    OperandKind operands[max_operands]; // Placeholder kinds, in syntax order.
+    uint8_t num_fields;
+    FieldDescriptor fields[max_fields]; // Encoding fields, in order.
+    uint16_t index; // Position among all specifiers, for per-specifier tables.
 };
 
 struct InstructionFormat {
@@ -19,137 +99,195 @@ struct InstructionFormat {
     const InstructionSpecifier* specifiers;
 };
 
-static const InstructionSpecifier nop_specs[] = {
-    {0, "nop", "[sp(8)] [opcode(8)]", 2},
+inline constexpr InstructionSpecifier nop_specs[] = {
+    {0, "nop", "[sp(8)] [opcode(8)]", 2, 0, {},
+        2, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}}, 0},
 };
 
-static const InstructionSpecifier add_specs[] = {
-    {0, "add %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5},
-    {1, "add %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {2, "add %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
+inline constexpr InstructionSpecifier add_specs[] = {
+    {0, "add %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Operand2, 24, 16, 1, FieldPart::Whole, false}}, 1},
+    {1, "add %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 2},
+    {2, "add %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 3},
 };
 
-static const InstructionSpecifier sub_specs[] = {
-    {0, "sub %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5},
-    {1, "sub %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {2, "sub %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
+inline constexpr InstructionSpecifier sub_specs[] = {
+    {0, "sub %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Operand2, 24, 16, 1, FieldPart::Whole, false}}, 4},
+    {1, "sub %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 5},
+    {2, "sub %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 6},
 };
 
-static const InstructionSpecifier mul_specs[] = {
-    {0, "mul %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5},
-    {1, "mul %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {2, "mul %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
+inline constexpr InstructionSpecifier mul_specs[] = {
+    {0, "mul %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Operand2, 24, 16, 1, FieldPart::Whole, false}}, 7},
+    {1, "mul %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 8},
+    {2, "mul %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 9},
 };
 
-static const InstructionSpecifier and_specs[] = {
-    {0, "and %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5},
-    {1, "and %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {2, "and %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
+inline constexpr InstructionSpecifier and_specs[] = {
+    {0, "and %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Operand2, 24, 16, 1, FieldPart::Whole, false}}, 10},
+    {1, "and %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 11},
+    {2, "and %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 12},
 };
 
-static const InstructionSpecifier or_specs[] = {
-    {0, "or %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5},
-    {1, "or %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {2, "or %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
+inline constexpr InstructionSpecifier or_specs[] = {
+    {0, "or %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Operand2, 24, 16, 1, FieldPart::Whole, false}}, 13},
+    {1, "or %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 14},
+    {2, "or %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 15},
 };
 
-static const InstructionSpecifier xor_specs[] = {
-    {0, "xor %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5},
-    {1, "xor %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {2, "xor %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
+inline constexpr InstructionSpecifier xor_specs[] = {
+    {0, "xor %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Operand2, 24, 16, 1, FieldPart::Whole, false}}, 16},
+    {1, "xor %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 17},
+    {2, "xor %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 18},
 };
 
-static const InstructionSpecifier lsh_specs[] = {
-    {0, "lsh %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5},
-    {1, "lsh %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {2, "lsh %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
+inline constexpr InstructionSpecifier lsh_specs[] = {
+    {0, "lsh %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Operand2, 24, 16, 1, FieldPart::Whole, false}}, 19},
+    {1, "lsh %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 20},
+    {2, "lsh %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 21},
 };
 
-static const InstructionSpecifier rsh_specs[] = {
-    {0, "rsh %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5},
-    {1, "rsh %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {2, "rsh %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
+inline constexpr InstructionSpecifier rsh_specs[] = {
+    {0, "rsh %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [operand2(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Operand2, 24, 16, 1, FieldPart::Whole, false}}, 22},
+    {1, "rsh %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 23},
+    {2, "rsh %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 24},
 };
 
-static const InstructionSpecifier mov_specs[] = {
-    {0, "mov %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [immediate(16)]", 5},
-    {1, "mov %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8},
-    {2, "mov %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4},
-    {3, "mov %rd.L, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
-    {4, "mov %rd.H, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
-    {5, "mov %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
-    {6, "mov %rd, %rn1, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [rn1(8)] [normAddressing(32)]", 8},
-    {7, "mov [%normAddressing], %rd.L", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
-    {8, "mov [%normAddressing], %rd.H", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
-    {9, "mov [%normAddressing], %rd", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7},
-    {10, "mov [%normAddressing], %rd, %rn1", "[sp(8)] [opcode(8)] [rd(8)] [rn1(8)] [normAddressing(32)]", 8},
-    {11, "mov %rd.L, [%rn + #%offset]", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8},
-    {12, "mov %rd.H, [%rn + #%offset]", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8},
-    {13, "mov %rd, [%rn + #%offset]", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8},
-    {14, "mov %rd, %rd1, [%rn + #%offset]", "[sp(8)] [opcode(8)] [rd(8)] [rd1(8)] [rn(8)] [offset(32)]", 9},
-    {15, "mov [%rn + #%offset], %rd.L", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8},
-    {16, "mov [%rn + #%offset], %rd.H", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8},
-    {17, "mov [%rn + #%offset], %rd", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8},
-    {18, "mov [%rn + #%offset], %rd, %rn1", "[sp(8)] [opcode(8)] [rd(8)] [rn1(8)] [rn(8)] [offset(32)]", 9},
+inline constexpr InstructionSpecifier mov_specs[] = {
+    {0, "mov %rd, #%immediate", "[sp(8)] [opcode(8)] [rd(8)] [immediate(16)]", 5, 2, {OperandKind::Register, OperandKind::Immediate},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Immediate, 24, 16, 1, FieldPart::Whole, false}}, 25},
+    {1, "mov %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8, 3, {OperandKind::Register, OperandKind::Register, OperandKind::Label},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::Label, 32, 32, 2, FieldPart::Whole, false}}, 26},
+    {2, "mov %rd, %rn", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)]", 4, 2, {OperandKind::Register, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}}, 27},
+    {3, "mov %rd.L, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::RegisterLow, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 28},
+    {4, "mov %rd.H, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::RegisterHigh, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 29},
+    {5, "mov %rd, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Register, OperandKind::Memory},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 1, FieldPart::Whole, false}}, 30},
+    {6, "mov %rd, %rn1, [%normAddressing]", "[sp(8)] [opcode(8)] [rd(8)] [rn1(8)] [normAddressing(32)]", 8, 3, {OperandKind::Register, OperandKind::Register, OperandKind::Memory},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn1, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::NormAddressing, 32, 32, 2, FieldPart::Whole, false}}, 31},
+    {7, "mov [%normAddressing], %rd.L", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Memory, OperandKind::RegisterLow},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 1, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 0, FieldPart::Whole, false}}, 32},
+    {8, "mov [%normAddressing], %rd.H", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Memory, OperandKind::RegisterHigh},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 1, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 0, FieldPart::Whole, false}}, 33},
+    {9, "mov [%normAddressing], %rd", "[sp(8)] [opcode(8)] [rd(8)] [normAddressing(32)]", 7, 2, {OperandKind::Memory, OperandKind::Register},
+        4, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 1, FieldPart::Whole, false}, {FieldKind::NormAddressing, 24, 32, 0, FieldPart::Whole, false}}, 34},
+    {10, "mov [%normAddressing], %rd, %rn1", "[sp(8)] [opcode(8)] [rd(8)] [rn1(8)] [normAddressing(32)]", 8, 3, {OperandKind::Memory, OperandKind::Register, OperandKind::Register},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 1, FieldPart::Whole, false}, {FieldKind::Rn1, 24, 8, 2, FieldPart::Whole, false}, {FieldKind::NormAddressing, 32, 32, 0, FieldPart::Whole, false}}, 35},
+    {11, "mov %rd.L, [%rn + #%offset]", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8, 2, {OperandKind::RegisterLow, OperandKind::OffsetMemory},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::BaseRegister, false}, {FieldKind::Offset, 32, 32, 1, FieldPart::Offset, false}}, 36},
+    {12, "mov %rd.H, [%rn + #%offset]", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8, 2, {OperandKind::RegisterHigh, OperandKind::OffsetMemory},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::BaseRegister, false}, {FieldKind::Offset, 32, 32, 1, FieldPart::Offset, false}}, 37},
+    {13, "mov %rd, [%rn + #%offset]", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8, 2, {OperandKind::Register, OperandKind::OffsetMemory},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::BaseRegister, false}, {FieldKind::Offset, 32, 32, 1, FieldPart::Offset, false}}, 38},
+    {14, "mov %rd, %rd1, [%rn + #%offset]", "[sp(8)] [opcode(8)] [rd(8)] [rd1(8)] [rn(8)] [offset(32)]", 9, 3, {OperandKind::Register, OperandKind::Register, OperandKind::OffsetMemory},
+        6, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rd1, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::Rn, 32, 8, 2, FieldPart::BaseRegister, false}, {FieldKind::Offset, 40, 32, 2, FieldPart::Offset, false}}, 39},
+    {15, "mov [%rn + #%offset], %rd.L", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8, 2, {OperandKind::OffsetMemory, OperandKind::RegisterLow},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 1, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 0, FieldPart::BaseRegister, false}, {FieldKind::Offset, 32, 32, 0, FieldPart::Offset, false}}, 40},
+    {16, "mov [%rn + #%offset], %rd.H", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8, 2, {OperandKind::OffsetMemory, OperandKind::RegisterHigh},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 1, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 0, FieldPart::BaseRegister, false}, {FieldKind::Offset, 32, 32, 0, FieldPart::Offset, false}}, 41},
+    {17, "mov [%rn + #%offset], %rd", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [offset(32)]", 8, 2, {OperandKind::OffsetMemory, OperandKind::Register},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 1, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 0, FieldPart::BaseRegister, false}, {FieldKind::Offset, 32, 32, 0, FieldPart::Offset, false}}, 42},
+    {18, "mov [%rn + #%offset], %rd, %rn1", "[sp(8)] [opcode(8)] [rd(8)] [rn1(8)] [rn(8)] [offset(32)]", 9, 3, {OperandKind::OffsetMemory, OperandKind::Register, OperandKind::Register},
+        6, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 1, FieldPart::Whole, false}, {FieldKind::Rn1, 24, 8, 2, FieldPart::Whole, false}, {FieldKind::Rn, 32, 8, 0, FieldPart::BaseRegister, false}, {FieldKind::Offset, 40, 32, 0, FieldPart::Offset, false}}, 43},
 };
 
-static const InstructionSpecifier b_specs[] = {
-    {0, "b %label", "[sp(8)] [opcode(8)] [label(32)]", 6},
+inline constexpr InstructionSpecifier b_specs[] = {
+    {0, "b %label", "[sp(8)] [opcode(8)] [label(32)]", 6, 1, {OperandKind::Label},
+        3, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Label, 16, 32, 0, FieldPart::Whole, false}}, 44},
 };
 
-static const InstructionSpecifier be_specs[] = {
-    {0, "be %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8},
+inline constexpr InstructionSpecifier be_specs[] = {
+    {0, "be %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8, 3, {OperandKind::Register, OperandKind::Register, OperandKind::Label},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::Label, 32, 32, 2, FieldPart::Whole, false}}, 45},
 };
 
-static const InstructionSpecifier bne_specs[] = {
-    {0, "bne %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8},
+inline constexpr InstructionSpecifier bne_specs[] = {
+    {0, "bne %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8, 3, {OperandKind::Register, OperandKind::Register, OperandKind::Label},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::Label, 32, 32, 2, FieldPart::Whole, false}}, 46},
 };
 
-static const InstructionSpecifier blt_specs[] = {
-    {0, "blt %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8},
+inline constexpr InstructionSpecifier blt_specs[] = {
+    {0, "blt %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8, 3, {OperandKind::Register, OperandKind::Register, OperandKind::Label},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::Label, 32, 32, 2, FieldPart::Whole, false}}, 47},
 };
 
-static const InstructionSpecifier bgt_specs[] = {
-    {0, "bgt %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8},
+inline constexpr InstructionSpecifier bgt_specs[] = {
+    {0, "bgt %rd, %rn, %label", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [label(32)]", 8, 3, {OperandKind::Register, OperandKind::Register, OperandKind::Label},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::Label, 32, 32, 2, FieldPart::Whole, false}}, 48},
 };
 
-static const InstructionSpecifier bro_specs[] = {
-    {0, "bro %label", "[sp(8)] [opcode(8)] [label(32)]", 6},
+inline constexpr InstructionSpecifier bro_specs[] = {
+    {0, "bro %label", "[sp(8)] [opcode(8)] [label(32)]", 6, 1, {OperandKind::Label},
+        3, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Label, 16, 32, 0, FieldPart::Whole, false}}, 49},
 };
 
-static const InstructionSpecifier umull_specs[] = {
-    {0, "umull %rd, %rn, %rn1", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [rn1(8)]", 5},
+inline constexpr InstructionSpecifier umull_specs[] = {
+    {0, "umull %rd, %rn, %rn1", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [rn1(8)]", 5, 3, {OperandKind::Register, OperandKind::Register, OperandKind::Register},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::Rn1, 32, 8, 2, FieldPart::Whole, false}}, 50},
 };
 
-static const InstructionSpecifier smull_specs[] = {
-    {0, "smull %rd, %rn, %rn1", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [rn1(8)]", 5},
+inline constexpr InstructionSpecifier smull_specs[] = {
+    {0, "smull %rd, %rn, %rn1", "[sp(8)] [opcode(8)] [rd(8)] [rn(8)] [rn1(8)]", 5, 3, {OperandKind::Register, OperandKind::Register, OperandKind::Register},
+        5, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}, {FieldKind::Rn, 24, 8, 1, FieldPart::Whole, false}, {FieldKind::Rn1, 32, 8, 2, FieldPart::Whole, false}}, 51},
 };
 
-static const InstructionSpecifier hlt_specs[] = {
-    {0, "hlt", "[sp(8)] [opcode(8)]", 2},
+inline constexpr InstructionSpecifier hlt_specs[] = {
+    {0, "hlt", "[sp(8)] [opcode(8)]", 2, 0, {},
+        2, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}}, 52},
 };
 
-static const InstructionSpecifier psh_specs[] = {
-    {0, "psh %rd", "[sp(8)] [opcode(8)] [rd(8)]", 3},
+inline constexpr InstructionSpecifier psh_specs[] = {
+    {0, "psh %rd", "[sp(8)] [opcode(8)] [rd(8)]", 3, 1, {OperandKind::Register},
+        3, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}}, 53},
 };
 
-static const InstructionSpecifier pop_specs[] = {
-    {0, "pop %rd", "[sp(8)] [opcode(8)] [rd(8)]", 3},
+inline constexpr InstructionSpecifier pop_specs[] = {
+    {0, "pop %rd", "[sp(8)] [opcode(8)] [rd(8)]", 3, 1, {OperandKind::Register},
+        3, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Rd, 16, 8, 0, FieldPart::Whole, false}}, 54},
 };
 
-static const InstructionSpecifier jsr_specs[] = {
-    {0, "jsr %label", "[sp(8)] [opcode(8)] [label(32)]", 6},
+inline constexpr InstructionSpecifier jsr_specs[] = {
+    {0, "jsr %label", "[sp(8)] [opcode(8)] [label(32)]", 6, 1, {OperandKind::Label},
+        3, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}, {FieldKind::Label, 16, 32, 0, FieldPart::Whole, false}}, 55},
 };
 
-static const InstructionSpecifier rts_specs[] = {
-    {0, "rts", "[sp(8)] [opcode(8)]", 2},
+inline constexpr InstructionSpecifier rts_specs[] = {
+    {0, "rts", "[sp(8)] [opcode(8)]", 2, 0, {},
+        2, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}}, 56},
 };
 
-static const InstructionSpecifier wfi_specs[] = {
-    {0, "wfi", "[sp(8)] [opcode(8)]", 2},
+inline constexpr InstructionSpecifier wfi_specs[] = {
+    {0, "wfi", "[sp(8)] [opcode(8)]", 2, 0, {},
+        2, {{FieldKind::Sp, 0, 8, -1, FieldPart::Whole, false}, {FieldKind::Opcode, 8, 8, -1, FieldPart::Whole, false}}, 57},
 };
 
-static const InstructionFormat instructions[] = {
+inline constexpr InstructionFormat instructions[] = {
     {"nop", 0x00, 1, nop_specs},
     {"add", 0x01, 3, add_specs},
     {"sub", 0x02, 3, sub_specs},
@@ -176,4 +314,650 @@ static const InstructionFormat instructions[] = {
     {"wfi", 0x17, 1, wfi_specs},
 };
 
+inline constexpr size_t num_instructions = 24;
+
+inline constexpr size_t num_specifiers = 58;
+
+// Perfect hash over the mnemonics: 32-bit FNV-1a from a seed chosen by
+// parse_md.py so that no two mnemonics share a slot. mnemonic_table maps
+// a slot to an index into instructions[] plus one; 0 marks an empty slot.
+inline constexpr uint32_t mnemonic_hash_seed = 2166136267u;
+inline constexpr size_t mnemonic_table_size = 128;
+inline constexpr uint8_t mnemonic_table[mnemonic_table_size] = {
+    1, 0, 0, 14, 0, 0, 0, 0, 0, 0, 0, 11, 0, 0, 21, 0,
+    9, 0, 0, 0, 0, 0, 0, 0, 17, 0, 20, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 12, 4, 0, 24, 18, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 0, 2, 3,
+    7, 0, 0, 10, 0, 0, 0, 0, 0, 0, 23, 0, 0, 0, 13, 0,
+    0, 0, 0, 0, 0, 0, 22, 0, 0, 0, 6, 0, 16, 0, 8, 0,
+};
+
+// Find the instruction with the given mnemonic, or nullptr. Usable in
+// constant expressions.
+constexpr const InstructionFormat* lookup_instruction(std::string_view name) {
+    uint32_t hash = mnemonic_hash_seed;
+    for (char c : name) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    uint8_t entry = mnemonic_table[hash & (mnemonic_table_size - 1)];
+    if (entry == 0) return nullptr;
+    const InstructionFormat* format = &instructions[entry - 1];
+    return std::string_view(format->name) == name ? format : nullptr;
+}
+
+constexpr bool mnemonic_table_is_perfect() {
+    for (size_t i = 0; i < num_instructions; ++i) {
+        if (lookup_instruction(instructions[i].name) != &instructions[i]) return false;
+    }
+    return true;
+}
+static_assert(mnemonic_table_is_perfect(), "mnemonic hash has a collision");
+
+// Operand-kind signature of an operand list: the operand count in the low
+// 4 bits, then 3 bits per operand kind.
+constexpr uint32_t operand_signature(const OperandKind* kinds, size_t count) {
+    uint32_t signature = static_cast<uint32_t>(count);
+    for (size_t i = 0; i < count; ++i) {
+        signature |= static_cast<uint32_t>(kinds[i]) << (4 + 3 * i);
+    }
+    return signature;
+}
+
+struct SpecifierDispatchEntry {
+    uint32_t key;             // (instruction index + 1) << 16 | operand signature; 0 if empty.
+    uint8_t specifier;        // Index into the instruction's specifiers.
+    uint8_t num_candidates;   // Specifiers to relax to; 0 if none is shorter.
+    uint16_t first_candidate; // Index into relaxation_candidates.
+};
+
+// Specifiers that also accept the operands of a dispatch entry and are
+// shorter than its specifier: indices into the instruction's specifiers,
+// shortest first, each run ending with the entry's own specifier.
+inline constexpr uint8_t relaxation_candidates[1] = {0};
+
+inline constexpr size_t max_relaxation_candidates = 8;
+
+// The specifiers relaxation may choose from for an instruction.
+struct RelaxationCandidates {
+    const uint8_t* indices = nullptr; // Into the instruction's specifiers.
+    uint8_t count = 0;
+};
+
+// Perfect hash from (instruction, operand signature) to the first specifier
+// that accepts those operands: slot = (key * multiplier) >> (32 - bits).
+inline constexpr uint32_t specifier_dispatch_multiplier = 2654622381u;
+inline constexpr unsigned specifier_dispatch_bits = 8;
+inline constexpr SpecifierDispatchEntry specifier_dispatch[size_t{1} << specifier_dispatch_bits] = {
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x100071, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0A00D2, 9, 0, 0}, {0x0A0162, 15, 0, 0},
+    {0x0A01F2, 8, 0, 0}, {0x0A0312, 13, 0, 0}, {0x0A03A2, 3, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0F1C93, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0C1C93, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x130000, 0, 0, 0}, {0x0A0152, 7, 0, 0}, {0x0A01E2, 16, 0, 0}, {0x090092, 1, 0, 0}, {0x0A0392, 5, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x080212, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x060092, 1, 0, 0}, {0x070392, 2, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x050212, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x030092, 1, 0, 0}, {0x040392, 2, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x020212, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x0A01D2, 8, 0, 0}, {0x000000, 0, 0, 0}, {0x110493, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x080292, 2, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x150011, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x050292, 2, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x010000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0A04F3, 10, 0, 0}, {0x000000, 0, 0, 0}, {0x020292, 2, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0B0071, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x170000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0D1C93, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x0A04E3, 18, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0A1C93, 1, 0, 0},
+    {0x0A0092, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x090212, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x070092, 1, 0, 0},
+    {0x000000, 0, 0, 0}, {0x080392, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x060212, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x040092, 1, 0, 0},
+    {0x000000, 0, 0, 0}, {0x050392, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x030212, 0, 0, 0}, {0x0A1893, 14, 0, 0}, {0x0A04D3, 10, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x020392, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x120493, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x090292, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x060292, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0A1493, 6, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x030292, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0A02B2, 4, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x180000, 0, 0, 0}, {0x0E1C93, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0A00F2, 9, 0, 0}, {0x000000, 0, 0, 0}, {0x0A0212, 0, 0, 0},
+    {0x0A02A2, 3, 0, 0}, {0x0A0332, 12, 0, 0}, {0x080092, 1, 0, 0}, {0x000000, 0, 0, 0}, {0x090392, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x070212, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x050092, 1, 0, 0}, {0x000000, 0, 0, 0}, {0x060392, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x040212, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x020092, 1, 0, 0}, {0x000000, 0, 0, 0}, {0x030392, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x0A00E2, 17, 0, 0}, {0x0A0172, 7, 0, 0}, {0x0A0292, 5, 0, 0}, {0x0A0322, 11, 0, 0}, {0x0A03B2, 4, 0, 0}, {0x000000, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x160071, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x070292, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x140011, 0, 0, 0},
+    {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x040292, 2, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0}, {0x000000, 0, 0, 0},
+};
+
+// Find the specifier of 'format' that takes operands with the given
+// signature, or nullptr if none does. If 'candidates' is given, it also
+// receives the shorter specifiers that take the same operands.
+constexpr const InstructionSpecifier* lookup_specifier(const InstructionFormat* format, uint32_t signature,
+                                                      RelaxationCandidates* candidates = nullptr) {
+    uint32_t key = (static_cast<uint32_t>(format - instructions) + 1) << 16 | signature;
+    const SpecifierDispatchEntry& entry = specifier_dispatch[(key * specifier_dispatch_multiplier) >> (32 - specifier_dispatch_bits)];
+    if (entry.key != key) return nullptr;
+    if (candidates) {
+        candidates->indices = &relaxation_candidates[entry.first_candidate];
+        candidates->count = entry.num_candidates;
+    }
+    return &format->specifiers[entry.specifier];
+}
+
+constexpr bool specifier_dispatch_is_complete() {
+    for (size_t i = 0; i < num_instructions; ++i) {
+        for (size_t j = 0; j < instructions[i].num_specifiers; ++j) {
+            const InstructionSpecifier& spec = instructions[i].specifiers[j];
+            bool valid = true;
+            for (size_t k = 0; k < spec.num_operands; ++k) {
+                valid = valid && spec.operands[k] != OperandKind::None;
+            }
+            if (valid && !lookup_specifier(&instructions[i], operand_signature(spec.operands, spec.num_operands))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+static_assert(specifier_dispatch_is_complete(), "specifier missing from the dispatch table");
+
+// Specialized encoders, one per specifier, with the field layout baked in.
+// Each writes exactly 'length' bytes to 'out' and returns false if an
+// operand does not convert; the caller then falls back to the generic
+// encoder, which reports the error. 'Fields' supplies the operand type and
+// the conversions (reg, immediate, address, label, relative_label,
+// base_register, offset), each templated on the field's width in bytes
+// (relative_label also on its width in bits). The table is indexed by
+// InstructionSpecifier::index; a null entry means "use the generic encoder".
+template <typename Fields>
+struct SpecifierEncoders {
+    using Operand = typename Fields::Operand;
+    using Encoder = bool (*)(Fields&, const Operand*, uint8_t*);
+
+    // nop
+    static bool nop_0(Fields&, const Operand*, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x00;
+        return true;
+    }
+
+    // add %rd, #%immediate
+    static bool add_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x01;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // add %rd, %rn
+    static bool add_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x01;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // add %rd, [%normAddressing]
+    static bool add_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x01;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // sub %rd, #%immediate
+    static bool sub_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x02;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // sub %rd, %rn
+    static bool sub_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x02;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // sub %rd, [%normAddressing]
+    static bool sub_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x02;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // mul %rd, #%immediate
+    static bool mul_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x03;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // mul %rd, %rn
+    static bool mul_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x03;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // mul %rd, [%normAddressing]
+    static bool mul_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x03;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // and %rd, #%immediate
+    static bool and_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x04;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // and %rd, %rn
+    static bool and_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x04;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // and %rd, [%normAddressing]
+    static bool and_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x04;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // or %rd, #%immediate
+    static bool or_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x05;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // or %rd, %rn
+    static bool or_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x05;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // or %rd, [%normAddressing]
+    static bool or_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x05;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // xor %rd, #%immediate
+    static bool xor_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x06;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // xor %rd, %rn
+    static bool xor_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x06;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // xor %rd, [%normAddressing]
+    static bool xor_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x06;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // lsh %rd, #%immediate
+    static bool lsh_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x07;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // lsh %rd, %rn
+    static bool lsh_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x07;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // lsh %rd, [%normAddressing]
+    static bool lsh_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x07;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // rsh %rd, #%immediate
+    static bool rsh_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x08;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // rsh %rd, %rn
+    static bool rsh_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x08;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // rsh %rd, [%normAddressing]
+    static bool rsh_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x08;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // mov %rd, #%immediate
+    static bool mov_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template immediate<2>(ops[1], out + 3);
+    }
+
+    // mov %rd, %rn, %label
+    static bool mov_1(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x01;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template label<4>(ops[2], out + 4);
+    }
+
+    // mov %rd, %rn
+    static bool mov_2(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x02;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3);
+    }
+
+    // mov %rd.L, [%normAddressing]
+    static bool mov_3(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x03;
+        out[1] = 0x09;
+        return f.template reg<1, 0x40>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // mov %rd.H, [%normAddressing]
+    static bool mov_4(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x04;
+        out[1] = 0x09;
+        return f.template reg<1, 0x80>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // mov %rd, [%normAddressing]
+    static bool mov_5(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x05;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template address<4>(ops[1], out + 3);
+    }
+
+    // mov %rd, %rn1, [%normAddressing]
+    static bool mov_6(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x06;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template address<4>(ops[2], out + 4);
+    }
+
+    // mov [%normAddressing], %rd.L
+    static bool mov_7(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x07;
+        out[1] = 0x09;
+        return f.template reg<1, 0x40>(ops[1], out + 2)
+            && f.template address<4>(ops[0], out + 3);
+    }
+
+    // mov [%normAddressing], %rd.H
+    static bool mov_8(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x08;
+        out[1] = 0x09;
+        return f.template reg<1, 0x80>(ops[1], out + 2)
+            && f.template address<4>(ops[0], out + 3);
+    }
+
+    // mov [%normAddressing], %rd
+    static bool mov_9(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x09;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[1], out + 2)
+            && f.template address<4>(ops[0], out + 3);
+    }
+
+    // mov [%normAddressing], %rd, %rn1
+    static bool mov_10(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x0A;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[1], out + 2)
+            && f.template reg<1, 0x00>(ops[2], out + 3)
+            && f.template address<4>(ops[0], out + 4);
+    }
+
+    // mov %rd.L, [%rn + #%offset]
+    static bool mov_11(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x0B;
+        out[1] = 0x09;
+        return f.template reg<1, 0x40>(ops[0], out + 2)
+            && f.template base_register<1>(ops[1], out + 3)
+            && f.template offset<4>(ops[1], out + 4);
+    }
+
+    // mov %rd.H, [%rn + #%offset]
+    static bool mov_12(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x0C;
+        out[1] = 0x09;
+        return f.template reg<1, 0x80>(ops[0], out + 2)
+            && f.template base_register<1>(ops[1], out + 3)
+            && f.template offset<4>(ops[1], out + 4);
+    }
+
+    // mov %rd, [%rn + #%offset]
+    static bool mov_13(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x0D;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template base_register<1>(ops[1], out + 3)
+            && f.template offset<4>(ops[1], out + 4);
+    }
+
+    // mov %rd, %rd1, [%rn + #%offset]
+    static bool mov_14(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x0E;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template base_register<1>(ops[2], out + 4)
+            && f.template offset<4>(ops[2], out + 5);
+    }
+
+    // mov [%rn + #%offset], %rd.L
+    static bool mov_15(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x0F;
+        out[1] = 0x09;
+        return f.template reg<1, 0x40>(ops[1], out + 2)
+            && f.template base_register<1>(ops[0], out + 3)
+            && f.template offset<4>(ops[0], out + 4);
+    }
+
+    // mov [%rn + #%offset], %rd.H
+    static bool mov_16(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x10;
+        out[1] = 0x09;
+        return f.template reg<1, 0x80>(ops[1], out + 2)
+            && f.template base_register<1>(ops[0], out + 3)
+            && f.template offset<4>(ops[0], out + 4);
+    }
+
+    // mov [%rn + #%offset], %rd
+    static bool mov_17(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x11;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[1], out + 2)
+            && f.template base_register<1>(ops[0], out + 3)
+            && f.template offset<4>(ops[0], out + 4);
+    }
+
+    // mov [%rn + #%offset], %rd, %rn1
+    static bool mov_18(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x12;
+        out[1] = 0x09;
+        return f.template reg<1, 0x00>(ops[1], out + 2)
+            && f.template reg<1, 0x00>(ops[2], out + 3)
+            && f.template base_register<1>(ops[0], out + 4)
+            && f.template offset<4>(ops[0], out + 5);
+    }
+
+    // b %label
+    static bool b_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x0A;
+        return f.template label<4>(ops[0], out + 2);
+    }
+
+    // be %rd, %rn, %label
+    static bool be_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x0B;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template label<4>(ops[2], out + 4);
+    }
+
+    // bne %rd, %rn, %label
+    static bool bne_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x0C;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template label<4>(ops[2], out + 4);
+    }
+
+    // blt %rd, %rn, %label
+    static bool blt_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x0D;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template label<4>(ops[2], out + 4);
+    }
+
+    // bgt %rd, %rn, %label
+    static bool bgt_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x0E;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template label<4>(ops[2], out + 4);
+    }
+
+    // bro %label
+    static bool bro_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x0F;
+        return f.template label<4>(ops[0], out + 2);
+    }
+
+    // umull %rd, %rn, %rn1
+    static bool umull_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x10;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template reg<1, 0x00>(ops[2], out + 4);
+    }
+
+    // smull %rd, %rn, %rn1
+    static bool smull_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x11;
+        return f.template reg<1, 0x00>(ops[0], out + 2)
+            && f.template reg<1, 0x00>(ops[1], out + 3)
+            && f.template reg<1, 0x00>(ops[2], out + 4);
+    }
+
+    // hlt
+    static bool hlt_0(Fields&, const Operand*, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x12;
+        return true;
+    }
+
+    // psh %rd
+    static bool psh_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x13;
+        return f.template reg<1, 0x00>(ops[0], out + 2);
+    }
+
+    // pop %rd
+    static bool pop_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x14;
+        return f.template reg<1, 0x00>(ops[0], out + 2);
+    }
+
+    // jsr %label
+    static bool jsr_0(Fields& f, const Operand* ops, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x15;
+        return f.template label<4>(ops[0], out + 2);
+    }
+
+    // rts
+    static bool rts_0(Fields&, const Operand*, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x16;
+        return true;
+    }
+
+    // wfi
+    static bool wfi_0(Fields&, const Operand*, uint8_t* out) {
+        out[0] = 0x00;
+        out[1] = 0x17;
+        return true;
+    }
+
+    static constexpr Encoder table[num_specifiers] = {
+        nop_0, add_0, add_1, add_2, sub_0, sub_1,
+        sub_2, mul_0, mul_1, mul_2, and_0, and_1,
+        and_2, or_0, or_1, or_2, xor_0, xor_1,
+        xor_2, lsh_0, lsh_1, lsh_2, rsh_0, rsh_1,
+        rsh_2, mov_0, mov_1, mov_2, mov_3, mov_4,
+        mov_5, mov_6, mov_7, mov_8, mov_9, mov_10,
+        mov_11, mov_12, mov_13, mov_14, mov_15, mov_16,
+        mov_17, mov_18, b_0, be_0, bne_0, blt_0,
+        bgt_0, bro_0, umull_0, smull_0, hlt_0, psh_0,
+        pop_0, jsr_0, rts_0, wfi_0,
+    };
+};
+
+// Hash of everything above; changes whenever the generated tables do.
+inline constexpr uint64_t machine_description_hash = 0x30db1dd88461f02full;
+
 #endif // INSTRUCTIONS_H
@@ -0,0 +1,91 @@
+#ifndef NC16X32ASM_H
+#define NC16X32ASM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "content_hash.h"
+#include "source_buffer.h"
+
+class IncludeCache;
+class Stats;
+
+/*
+libnc16x32asm: the assembler as a library, for programs that assemble many
+sources without a process and a file per source. nc16x32-as is a command
+line around it.
+
+The library has no global or static mutable state: every call works on its
+own lexer, parser and code generator, and reports through its result. Any
+number of threads may assemble at once.
+*/
+
+struct AssemblyOptions {
+    // 1 runs the peephole optimizer (-O); 2 removes dead stores and
+    // redundant reloads first (-O2).
+    int optimization_level = 0;
+    // Put a hash of the inputs in the object header instead of the time, so
+    // that the same inputs give the same bytes.
+    bool deterministic = false;
+    // assemble_file() only: if not 0, assemble and write .text in chunks of
+    // about this many bytes of source, with bounded memory (--stream). -O2
+    // then analyses each chunk on its own.
+    size_t stream_chunk_bytes = 0;
+    // '.include "name"' looks for name in the source's directory (the
+    // current directory if empty), then in each of 'include_dirs' (-I).
+    std::string source_directory;
+    std::vector<std::string> include_dirs;
+    // Headers lexed before, shared between assemblies; if null, each call
+    // lexes the headers it includes.
+    IncludeCache *include_cache = nullptr;
+    // If not null, the time and heap use of each phase of the assembly, and
+    // counts of what went through them, are added to it (--stats). One
+    // Stats per assembly running at a time.
+    Stats *stats = nullptr;
+};
+
+struct AssemblyResult {
+    // False if no object was produced. Errors in single statements are
+    // reported in 'diagnostics' and the statement is skipped.
+    bool ok = false;
+    std::vector<uint8_t> object;         // The LF02 object file; assemble() only.
+    std::string diagnostics;             // Errors, one per line.
+    std::string report;                  // What relaxation and the optimizers did.
+    std::optional<ContentDigest> content_hash; // If deterministic; the header holds its high half.
+    std::vector<std::string> includes;   // Canonical paths of the headers included, directly or not.
+};
+
+/**
+ * Assemble a source text into an object file in memory.
+ *
+ * @param source The text of one source file.
+ * @param options stream_chunk_bytes is ignored.
+ */
+AssemblyResult assemble(std::string_view source, const AssemblyOptions &options = {});
+
+/**
+ * Assemble a source file into the object file at 'output'. The pages of a
+ * mapped source are dropped as they are consumed.
+ *
+ * @param source The source file; read once more if deterministic.
+ * @param content_hash The hash of the inputs, if already computed by
+ * assembly_hash(); computed here if missing and deterministic.
+ */
+AssemblyResult assemble_file(SourceBuffer &source, const std::string &output, const AssemblyOptions &options,
+                             std::optional<ContentDigest> content_hash = std::nullopt);
+
+/**
+ * Hash of everything an object file depends on: the source, the macros it
+ * defines, the headers it includes, the machine description, the object
+ * format and the options that change the code. assemble_file() puts its high
+ * half in a deterministic header.
+ *
+ * @param includes If not null, receives AssemblyResult::includes.
+ */
+ContentDigest assembly_hash(SourceBuffer &source, const AssemblyOptions &options,
+                            std::vector<std::string> *includes = nullptr);
+
+#endif // NC16X32ASM_H
@@ -0,0 +1,95 @@
+#include "object_cache.h"
+#include "file_identity.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Copy the file at 'from' to 'to', replacing its contents.
+bool copy_file(const std::string &from, const std::string &to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    if (!in || !out) {
+        return false;
+    }
+    out << in.rdbuf();
+    out.close();
+    return static_cast<bool>(out);
+}
+
+} // namespace
+
+ObjectCache::ObjectCache(std::string directory, std::ostream &diagnostics) : directory_(std::move(directory)) {
+    if (::mkdir(directory_.c_str(), 0777) != 0 && errno != EEXIST) {
+        diagnostics << "Cannot create cache directory " << directory_ << ": " << std::strerror(errno) << "\n";
+    }
+    assembler_identity_ = executable_identity();
+    if (!assembler_identity_) {
+        diagnostics << "Cannot find the assembler executable; not using the cache in " << directory_ << ".\n";
+    }
+}
+
+std::string ObjectCache::entry_path(const ContentDigest &content_hash) const {
+    ContentHash key;
+    key.update(content_hash);
+    key.update(*assembler_identity_);
+    return directory_ + "/" + key.digest().hex() + ".o";
+}
+
+bool ObjectCache::fetch(const ContentDigest &content_hash, const std::string &output) const {
+    if (!assembler_identity_) {
+        return false;
+    }
+    const std::string entry = entry_path(content_hash);
+    if (::access(entry.c_str(), R_OK) != 0) {
+        return false;
+    }
+    // Replace a regular output by a link to the entry; write anything else
+    // (a device, a pipe) through.
+    struct stat st{};
+    bool regular = ::stat(output.c_str(), &st) != 0 || S_ISREG(st.st_mode);
+    if (!regular) {
+        return copy_file(entry, output);
+    }
+    ::unlink(output.c_str());
+    if (::link(entry.c_str(), output.c_str()) != 0 && !copy_file(entry, output)) {
+        return false;
+    }
+    // The output is as new as if it had been assembled now, or make would
+    // find it older than its source. A link shares the entry's time, so
+    // this renews the entry as well.
+    ::utimensat(AT_FDCWD, output.c_str(), nullptr, 0);
+    return true;
+}
+
+void ObjectCache::store(const ContentDigest &content_hash, const std::string &object, std::ostream &diagnostics) const {
+    if (!assembler_identity_) {
+        return;
+    }
+    const std::string entry = entry_path(content_hash);
+    // Unique to this thread, as several may assemble the same source at once.
+    const std::string temporary = entry + ".tmp" + std::to_string(::getpid()) + "." +
+                                  std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    ::unlink(temporary.c_str());
+    if ((::link(object.c_str(), temporary.c_str()) != 0 && !copy_file(object, temporary)) ||
+        ::rename(temporary.c_str(), entry.c_str()) != 0) {
+        diagnostics << "Cannot add " << object << " to the cache: " << std::strerror(errno) << "\n";
+        ::unlink(temporary.c_str());
+    }
+}
+
+void ObjectCache::detach(const std::string &path) {
+    struct stat st{};
+    if (::lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink > 1) {
+        ::unlink(path.c_str());
+    }
+}
@@ -1,9 +1,16 @@
 #ifndef OBJECT_FILE_GENERATOR_H
 #define OBJECT_FILE_GENERATOR_H
 
-#include <algorithm> // For std::reverse
+#include <algorithm> // For std::ranges::sort
 #include "code_generator.h"
+#include "object_format.h"
+#include <cerrno>
 #include <chrono>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <sys/uio.h>
+#include <unordered_map>
 
 //
 // Created by Dulat S on 2/13/24.
@@ -11,238 +18,251 @@
 
 
 /*
-ObjectFileGenerator builds an object file in our custom “LF” format (big-endian) without a metadata block.
-The file layout is as follows:
-
-    +-----------------------------+
-    | 1. Header (32 bytes)        |
-    +-----------------------------+
-    | 2. Machine Code Blob        |
-    +-----------------------------+
-    | 3. Label Table Block        |
-    +-----------------------------+
-    | 4. Relocation Table Block   |
-    +-----------------------------+
-
-The header layout (32 bytes):
-  - Bytes 0-3:   Magic ("LF01")
-  - Bytes 4-5:   Version (0x0001)
-  - Bytes 6-7:   Flags (0x0000)
-  - Bytes 8-15:  Timestamp (current time in microseconds)
-  - Bytes 16-19: Machine Code Length
-  - Bytes 20-23: Label Table Offset
-  - Bytes 24-27: Relocation Table Offset
-  - Bytes 28-31: Metadata Offset (set to 0, as no metadata block is generated)
-
-Label strings are stored as a length field (which includes the terminating zero) followed by the
-UTF‑8 characters and a trailing 0x00 byte.
+ObjectFileGenerator builds an object file in the LF02 format described in object_format.h:
+the header, the machine code as the code section, the data section, then the symbol,
+relocation and string sections and the section header table. The code, data and bss sections
+are always present, in that order, so a Section value is also its index in the table.
+
+Every label becomes a symbol record in its section, in name order. References to labels
+defined in the same file hold the label's address relative to the start of its section, and
+get a base relocation so that the linker can add the address at which it places that section;
+references to labels defined elsewhere get an external relocation that names the label. Each
+distinct name is stored once in the string section.
 */
 class ObjectFileGenerator {
 public:
-    // Constructor accepts the relocation table, label-to-address mapping, and machine code.
+    // Constructor accepts the relocation table, label-to-address mapping, machine code, and the
+    // contents of .data and size of .bss.
     ObjectFileGenerator(const std::vector<CodeGenerator::RelocationEntry>& relocationEntries,
-                        const std::unordered_map<std::string, uint32_t>& labelTable,
-                        const std::vector<uint8_t>& machineCode)
+                        const std::vector<CodeGenerator::BaseFixup>& baseFixups,
+                        const LabelTable& labelTable,
+                        const std::vector<uint8_t>& machineCode,
+                        const std::vector<uint8_t>& data,
+                        uint32_t bssSize)
         : relocationEntries_(relocationEntries),
+          baseFixups_(baseFixups),
           labelTable_(labelTable),
-          machineCode_(machineCode)
+          machineCode_(machineCode),
+          data_(data),
+          bssSize_(bssSize)
     {
     }
 
+    // Stamp the header with 'hash', a hash of everything the object file was
+    // built from, instead of the current time, making the file reproducible.
+    void setContentHash(uint64_t hash) {
+        contentHash_ = hash;
+    }
+
     // Builds and returns the complete object file as a vector of bytes.
     [[nodiscard]] std::vector<uint8_t> build() const {
+        auto machineCodeLength = static_cast<uint32_t>(machineCode_.size());
         std::vector<uint8_t> buffer;
-        // Reserve space for the fixed header (32 bytes).
-        buffer.resize(32, 0);
+        std::vector<uint8_t> tables = buildTrailer(machineCodeLength, buffer);
 
-        // --- Append the Machine Code Blob ---
+        // --- Append the code section, then the rest ---
+        buffer.reserve(buffer.size() + machineCode_.size() + tables.size());
         buffer.insert(buffer.end(), machineCode_.begin(), machineCode_.end());
-        auto machineCodeLength = static_cast<uint32_t>(machineCode_.size());
+        buffer.insert(buffer.end(), tables.begin(), tables.end());
+        return buffer;
+    }
+
+    // Writes the complete object file to 'fd' without assembling it in memory:
+    // the header, the machine code straight from the caller's buffer and the
+    // sections that follow it go out in one writev(). Returns false, with
+    // errno set, if a write fails.
+    [[nodiscard]] bool write(int fd) const {
+        std::vector<uint8_t> header;
+        std::vector<uint8_t> tables = buildTrailer(static_cast<uint32_t>(machineCode_.size()), header);
+        iovec parts[3] = {
+            {header.data(), header.size()},
+            {const_cast<uint8_t*>(machineCode_.data()), machineCode_.size()},
+            {tables.data(), tables.size()},
+        };
+        return writeFully(fd, parts, 3);
+    }
+
+    // Builds everything that follows a code section of the given length, in
+    // one buffer, and fills 'header' with the header describing it. Streaming
+    // writers use this directly: the machine code is written separately and
+    // never passed to the generator.
+    [[nodiscard]] std::vector<uint8_t> buildTrailer(uint32_t machineCodeLength, std::vector<uint8_t>& header) const {
+        const SymbolTable symbols = buildSymbolTable();
+
+        // --- Lay out the sections, then fill them in place ---
+        const size_t codeEnd = lf::kHeaderSize + machineCodeLength;
+        const size_t dataOffset = lf::align(codeEnd);
+        const size_t symbolsOffset = lf::align(dataOffset + data_.size());
+        const size_t symbolsSize = sizeof(lf::Symbol) * symbols.symbols.size();
+        const size_t relocationsOffset = symbolsOffset + symbolsSize;
+        const size_t relocationsSize = sizeof(lf::Relocation) * (baseFixups_.size() + relocationEntries_.size());
+        const size_t stringsOffset = relocationsOffset + relocationsSize;
+        const size_t sectionTableOffset = lf::align(stringsOffset + symbols.strings.size());
+        std::vector<uint8_t> tables(sectionTableOffset + sizeof(lf::SectionHeader) * kSectionCount - codeEnd);
+        auto at = [&](size_t fileOffset) { return tables.data() + (fileOffset - codeEnd); };
+
+        std::ranges::copy(data_, at(dataOffset));
+        writeSymbolSection(at(symbolsOffset), symbols);
+        writeRelocationSection(at(relocationsOffset), symbols);
+        std::ranges::copy(symbols.strings, at(stringsOffset));
 
-        // --- Build the Label Table Block ---
-        std::vector<uint8_t> labelTableBlock = buildLabelTableBlock();
-        auto labelTableOffset = static_cast<uint32_t>(buffer.size());
-        buffer.insert(buffer.end(), labelTableBlock.begin(), labelTableBlock.end());
-
-        // --- Build the Relocation Table Block ---
-        std::vector<uint8_t> relocationTableBlock = buildRelocationTableBlock();
-        auto relocationTableOffset = static_cast<uint32_t>(buffer.size());
-        buffer.insert(buffer.end(), relocationTableBlock.begin(), relocationTableBlock.end());
-
-        // --- Now fill in the header fields ---
-        // Header layout (32 bytes):
-        //  0-3:   Magic ("LF01")
-        //  4-5:   Version (0x0001)
-        //  6-7:   Flags (0x0000)
-        //  8-15:  Timestamp (current time in microseconds)
-        // 16-19:  Machine Code Length
-        // 20-23:  Label Table Offset
-        // 24-27:  Relocation Table Offset
-        // 28-31:  Metadata Offset (0, since metadata is not included)
-
-        // Magic "LF01"
-        writeBytes(buffer, 0, { 'L', 'F', '0', '1' });
-        // Version: 0x0001
-        writeUint16(buffer, 4, 0x0001);
-        // Flags: 0x0000
-        writeUint16(buffer, 6, 0x0000);
-        // Timestamp: use system_clock now in microseconds.
+        const lf::SectionHeader sections[kSectionCount] = {
+            sectionHeader(lf::kSectionCode, lf::kHeaderSize, machineCodeLength, 0),
+            sectionHeader(lf::kSectionData, dataOffset, data_.size(), 0),
+            sectionHeader(lf::kSectionBss, 0, bssSize_, 0),
+            sectionHeader(lf::kSectionSymbols, symbolsOffset, symbolsSize, sizeof(lf::Symbol)),
+            sectionHeader(lf::kSectionRelocations, relocationsOffset, relocationsSize, sizeof(lf::Relocation)),
+            sectionHeader(lf::kSectionStrings, stringsOffset, symbols.strings.size(), 0),
+        };
+        std::memcpy(at(sectionTableOffset), sections, sizeof(sections));
+
+        // --- Now fill in the header ---
+        lf::Header fields{};
+        std::ranges::copy(lf::kMagic, fields.magic);
+        fields.version[0] = static_cast<uint8_t>(lf::kVersion >> 8);
+        fields.version[1] = static_cast<uint8_t>(lf::kVersion);
+        // Timestamp: the content hash, or system_clock now in microseconds.
         uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
             std::chrono::system_clock::now().time_since_epoch()).count());
-        writeUint64(buffer, 8, timestamp);
-        // Machine Code Length.
-        writeUint32(buffer, 16, machineCodeLength);
-        // Label Table Offset.
-        writeUint32(buffer, 20, labelTableOffset);
-        // Relocation Table Offset.
-        writeUint32(buffer, 24, relocationTableOffset);
-        // Metadata Offset (set to 0, since metadata is not included).
-        writeUint32(buffer, 28, 0);
+        if (contentHash_) {
+            fields.flags[1] = static_cast<uint8_t>(lf::kFlagContentHash);
+            timestamp = *contentHash_;
+        }
+        for (int i = 0; i < 8; ++i) {
+            fields.timestamp[i] = static_cast<uint8_t>(timestamp >> (56 - 8 * i));
+        }
+        fields.section_table_offset.set(static_cast<uint32_t>(sectionTableOffset));
+        fields.section_count.set(kSectionCount);
+        fields.section_header_size.set(sizeof(lf::SectionHeader));
+        header.resize(lf::kHeaderSize);
+        std::memcpy(header.data(), &fields, sizeof(fields));
 
-        return buffer;
+        return tables;
     }
 
 private:
     const std::vector<CodeGenerator::RelocationEntry>& relocationEntries_;
-    const std::unordered_map<std::string, uint32_t>& labelTable_;
+    const std::vector<CodeGenerator::BaseFixup>& baseFixups_;
+    const LabelTable& labelTable_;
     const std::vector<uint8_t>& machineCode_;
+    const std::vector<uint8_t>& data_;
+    uint32_t bssSize_;
+    std::optional<uint64_t> contentHash_;
 
-    // --- Helper Functions for Writing Data in Big-Endian Format ---
-
-    // Write a list of bytes at the given offset (assumes offset is valid).
-    static void writeBytes(std::vector<uint8_t>& buffer, size_t offset, const std::initializer_list<uint8_t>& bytes) {
-        size_t i = 0;
-        for (auto b : bytes) {
-            if (offset + i < buffer.size())
-                buffer[offset + i] = b;
-            else
-                buffer.push_back(b);
-            ++i;
+    // Entries of the section header table: the three of Section, then the tables.
+    static constexpr uint32_t kSectionCount = ::kSectionCount + 3;
+
+    struct Symbol {
+        std::string_view name;
+        LabelAddress label;
+        uint32_t nameOffset; // In the string table.
+    };
+
+    // The labels sorted by name, and the string table that all the sections
+    // refer to. Built once per object file.
+    struct SymbolTable {
+        std::vector<Symbol> symbols;
+        std::vector<uint32_t> relocationNameOffsets; // In the order of relocationEntries_.
+        std::vector<uint8_t> strings;
+    };
+
+    // Sort the labels once, and store each distinct name once: a hash index
+    // from name to string table offset finds the names already stored, so
+    // that a relocation to a label shares the label's name.
+    [[nodiscard]] SymbolTable buildSymbolTable() const {
+        SymbolTable table;
+        table.symbols.reserve(labelTable_.size());
+        for (const auto& [name, label] : labelTable_) {
+            table.symbols.push_back({name, label, 0});
         }
-    }
+        std::ranges::sort(table.symbols, {}, &Symbol::name);
 
-    // Write a 16-bit unsigned integer (big-endian) into buffer at offset.
-    static void writeUint16(std::vector<uint8_t>& buffer, size_t offset, uint16_t value) {
-        if (offset + 1 >= buffer.size())
-            throw std::out_of_range("Offset out of range in writeUint16");
-        buffer[offset]   = static_cast<uint8_t>((value >> 8) & 0xFF);
-        buffer[offset+1] = static_cast<uint8_t>(value & 0xFF);
+        std::unordered_map<std::string_view, uint32_t> nameOffsets;
+        nameOffsets.reserve(table.symbols.size() + relocationEntries_.size());
+        auto intern = [&](std::string_view name) {
+            auto [it, inserted] = nameOffsets.try_emplace(name, static_cast<uint32_t>(table.strings.size()));
+            if (inserted) {
+                table.strings.insert(table.strings.end(), name.begin(), name.end());
+                table.strings.push_back(0x00);
+            }
+            return it->second;
+        };
+        for (Symbol& symbol : table.symbols) {
+            symbol.nameOffset = intern(symbol.name);
+        }
+        table.relocationNameOffsets.reserve(relocationEntries_.size());
+        for (const auto& reloc : relocationEntries_) {
+            table.relocationNameOffsets.push_back(intern(reloc.label));
+        }
+        return table;
     }
 
-    // Write a 32-bit unsigned integer (big-endian) into buffer at offset.
-    static void writeUint32(std::vector<uint8_t>& buffer, size_t offset, uint32_t value) {
-        if (offset + 3 >= buffer.size())
-            throw std::out_of_range("Offset out of range in writeUint32");
-        buffer[offset]   = static_cast<uint8_t>((value >> 24) & 0xFF);
-        buffer[offset+1] = static_cast<uint8_t>((value >> 16) & 0xFF);
-        buffer[offset+2] = static_cast<uint8_t>((value >> 8) & 0xFF);
-        buffer[offset+3] = static_cast<uint8_t>(value & 0xFF);
+    static lf::SectionHeader sectionHeader(lf::SectionType type, size_t offset, size_t size, size_t entrySize) {
+        lf::SectionHeader section{};
+        section.type.set(type);
+        section.offset.set(static_cast<uint32_t>(offset));
+        section.size.set(static_cast<uint32_t>(size));
+        section.entry_size.set(static_cast<uint32_t>(entrySize));
+        return section;
     }
 
-    // Write a 64-bit unsigned integer (big-endian) into buffer at offset.
-    static void writeUint64(std::vector<uint8_t>& buffer, size_t offset, uint64_t value) {
-        if (offset + 7 >= buffer.size())
-            throw std::out_of_range("Offset out of range in writeUint64");
-        buffer[offset]   = static_cast<uint8_t>((value >> 56) & 0xFF);
-        buffer[offset+1] = static_cast<uint8_t>((value >> 48) & 0xFF);
-        buffer[offset+2] = static_cast<uint8_t>((value >> 40) & 0xFF);
-        buffer[offset+3] = static_cast<uint8_t>((value >> 32) & 0xFF);
-        buffer[offset+4] = static_cast<uint8_t>((value >> 24) & 0xFF);
-        buffer[offset+5] = static_cast<uint8_t>((value >> 16) & 0xFF);
-        buffer[offset+6] = static_cast<uint8_t>((value >> 8) & 0xFF);
-        buffer[offset+7] = static_cast<uint8_t>(value & 0xFF);
+    // writev() all of 'parts', resuming after partial writes and interruptions.
+    static bool writeFully(int fd, iovec* parts, int count) {
+        while (count > 0) {
+            ssize_t written = ::writev(fd, parts, count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            auto remaining = static_cast<size_t>(written);
+            while (count > 0 && remaining >= parts->iov_len) {
+                remaining -= parts->iov_len;
+                ++parts;
+                --count;
+            }
+            if (count > 0) {
+                parts->iov_base = static_cast<uint8_t*>(parts->iov_base) + remaining;
+                parts->iov_len -= remaining;
+            }
+        }
+        return true;
     }
 
-    // --- Build the Label Table Block ---
-    // Label table block layout:
-    //   [Label Count (4 bytes)]
-    //   For each label:
-    //     [Code Offset (4 bytes)] [Name Length (2 bytes)] [Name (bytes including trailing 0x00)]
-    // In this version, strings are stored as zero-terminated.
-    [[nodiscard]] std::vector<uint8_t> buildLabelTableBlock() const {
-        std::vector<uint8_t> block;
-        // Convert unordered_map to a vector of pairs sorted by label name for stable ordering.
-        std::vector<std::pair<std::string, uint32_t>> labels(labelTable_.begin(), labelTable_.end());
-        std::ranges::sort(labels, [](const auto& a, const auto& b) {
-            return a.first < b.first;
-        });
-
-        // Write label count.
-        auto labelCount = static_cast<uint32_t>(labels.size());
-        block.push_back(static_cast<uint8_t>((labelCount >> 24) & 0xFF));
-        block.push_back(static_cast<uint8_t>((labelCount >> 16) & 0xFF));
-        block.push_back(static_cast<uint8_t>((labelCount >> 8) & 0xFF));
-        block.push_back(static_cast<uint8_t>(labelCount & 0xFF));
-
-        // Write each label entry.
-        for (const auto& entry : labels) {
-            // Code offset (4 bytes).
-            uint32_t offset = entry.second;
-            block.push_back(static_cast<uint8_t>((offset >> 24) & 0xFF));
-            block.push_back(static_cast<uint8_t>((offset >> 16) & 0xFF));
-            block.push_back(static_cast<uint8_t>((offset >> 8) & 0xFF));
-            block.push_back(static_cast<uint8_t>(offset & 0xFF));
-
-            // Insert the string characters.
-            block.insert(block.end(), entry.first.begin(), entry.first.end());
-            // Append the zero terminator.
-            block.push_back(0x00);
+    // --- Symbol Section ---
+    // One lf::Symbol per label, in name order.
+    static void writeSymbolSection(uint8_t* out, const SymbolTable& table) {
+        for (const Symbol& symbol : table.symbols) {
+            lf::Symbol record{};
+            record.value.set(symbol.label.address);
+            record.name.set(symbol.nameOffset);
+            record.kind = lf::kSymbolLabel;
+            record.section = static_cast<uint8_t>(section_index(symbol.label.section));
+            std::memcpy(out, &record, sizeof(record));
+            out += sizeof(record);
         }
-        return block;
     }
 
-    // --- Build the Relocation Table Block ---
-    // Relocation table block layout:
-    //   [Relocation Entry Count (4 bytes)]
-    //   For each relocation:
-    //     [Code Offset (4 bytes)] [Reloc Type (1 byte)] [Reserved (1 byte)] [Label Index (2 bytes)]
-    // In this example, we use a default relocation type of 0.
-    // The label index is determined by finding the relocation entry's label in the sorted label table.
-    [[nodiscard]] std::vector<uint8_t> buildRelocationTableBlock() const {
-        std::vector<uint8_t> block;
-        // First, obtain the sorted labels as in the label table.
-        std::vector<std::pair<std::string, uint32_t>> labels(labelTable_.begin(), labelTable_.end());
-        std::ranges::sort(labels, [](const auto& a, const auto& b) {
-            return a.first < b.first;
-        });
-
-        // Write relocation entry count.
-        auto relocCount = static_cast<uint32_t>(relocationEntries_.size());
-        block.push_back(static_cast<uint8_t>((relocCount >> 24) & 0xFF));
-        block.push_back(static_cast<uint8_t>((relocCount >> 16) & 0xFF));
-        block.push_back(static_cast<uint8_t>((relocCount >> 8) & 0xFF));
-        block.push_back(static_cast<uint8_t>(relocCount & 0xFF));
-
-        // Write each relocation entry.
-        for (const auto& reloc : relocationEntries_) {
-            // Write code offset (4 bytes).
-            uint32_t codeOffset = reloc.address;
-            block.push_back(static_cast<uint8_t>((codeOffset >> 24) & 0xFF));
-            block.push_back(static_cast<uint8_t>((codeOffset >> 16) & 0xFF));
-            block.push_back(static_cast<uint8_t>((codeOffset >> 8) & 0xFF));
-            block.push_back(static_cast<uint8_t>(codeOffset & 0xFF));
-
-            // Determine label index from sortedLabels.
-            auto it = std::ranges::find_if(labels,
-                                           [&reloc](const std::pair<std::string, uint32_t>& pair) {
-                                               return pair.first == reloc.label;
-                                           });
-            if (it != labels.end()) {
-                // Label found: write 2-byte index.
-                auto labelIndex = static_cast<uint16_t>(std::distance(labels.begin(), it));
-                block.push_back(static_cast<uint8_t>((labelIndex >> 8) & 0xFF));
-                block.push_back(static_cast<uint8_t>(labelIndex & 0xFF));
-            } else {
-                // Label not found: external relocation.
-                // Write the external label as a null-terminated string.
-                for (char c : reloc.label) {
-                    block.push_back(static_cast<uint8_t>(c));
-                }
-                block.push_back(0); // Null terminator.
-            }
+    // --- Relocation Section ---
+    // One lf::Relocation per base fixup, then one per external reference.
+    void writeRelocationSection(uint8_t* out, const SymbolTable& table) const {
+        for (const CodeGenerator::BaseFixup& fixup : baseFixups_) {
+            lf::Relocation record{};
+            record.offset.set(fixup.address);
+            record.target.set(static_cast<uint32_t>(section_index(fixup.target)));
+            record.kind = lf::kRelocationBase;
+            record.section = static_cast<uint8_t>(section_index(fixup.section));
+            std::memcpy(out, &record, sizeof(record));
+            out += sizeof(record);
+        }
+        for (size_t i = 0; i < relocationEntries_.size(); ++i) {
+            lf::Relocation record{};
+            record.offset.set(relocationEntries_[i].address);
+            record.target.set(table.relocationNameOffsets[i]);
+            record.kind = lf::kRelocationExternal;
+            record.section = static_cast<uint8_t>(section_index(relocationEntries_[i].section));
+            std::memcpy(out, &record, sizeof(record));
+            out += sizeof(record);
         }
-
-        return block;
     }
 };
 
@@ -0,0 +1,132 @@
+#ifndef OBJECT_FORMAT_H
+#define OBJECT_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+The records of the LF02 object file format, shared by the assembler, which
+writes them, and the linker, which uses them in place from a memory map.
+
+    +-----------------------------+  offset 0
+    | Header (32 bytes)           |
+    +-----------------------------+  offset 32
+    | Code section (.text)        |
+    +-----------------------------+  each following part starts 4-byte aligned
+    | Data section (.data)        |
+    +-----------------------------+
+    | Symbol section              |
+    +-----------------------------+
+    | Relocation section          |
+    +-----------------------------+
+    | String section              |
+    +-----------------------------+
+    | Section header table        |
+    +-----------------------------+
+
+The section header table is last so that a streaming writer can emit the code
+before it knows its length. Readers find every section through the table,
+and skip section types they do not know. The bss section has a size but no
+bytes in the file, and offset 0.
+
+All multi-byte fields are big-endian and every record is made of byte arrays,
+so a record can be read through a pointer into the file at any address. Names
+are offsets of zero-terminated strings in the string section, which ends with
+a zero byte.
+*/
+namespace lf {
+
+constexpr char kMagic[4] = {'L', 'F', '0', '2'};
+constexpr uint16_t kVersion = 0x0002;
+constexpr size_t kHeaderSize = 32;
+constexpr size_t kAlignment = 4;
+
+// Header flag: 'timestamp' holds a hash of the assembler's inputs instead of
+// the time, so that assembling the same inputs gives the same file.
+constexpr uint16_t kFlagContentHash = 0x0001;
+
+enum SectionType : uint32_t {
+    kSectionCode = 1,
+    kSectionSymbols = 2,     // Symbol records.
+    kSectionRelocations = 3, // Relocation records.
+    kSectionStrings = 4,
+    kSectionData = 5,
+    kSectionBss = 6,
+};
+
+enum SymbolKind : uint8_t {
+    kSymbolLabel = 1, // An address in the symbol's section.
+};
+
+enum RelocationKind : uint8_t {
+    // Add the address at which the linker places section 'target' to the
+    // 32-bit field, which holds an address relative to that section.
+    kRelocationBase = 1,
+    // Store the address of symbol record 'target' of the same file.
+    kRelocationSymbol = 2,
+    // Store the address of the symbol named at string offset 'target',
+    // defined in another file.
+    kRelocationExternal = 3,
+};
+
+// A big-endian 32-bit field.
+struct Be32 {
+    uint8_t bytes[4];
+
+    [[nodiscard]] constexpr uint32_t get() const {
+        return (uint32_t{bytes[0]} << 24) | (uint32_t{bytes[1]} << 16) | (uint32_t{bytes[2]} << 8) | bytes[3];
+    }
+    constexpr void set(uint32_t value) {
+        bytes[0] = static_cast<uint8_t>(value >> 24);
+        bytes[1] = static_cast<uint8_t>(value >> 16);
+        bytes[2] = static_cast<uint8_t>(value >> 8);
+        bytes[3] = static_cast<uint8_t>(value);
+    }
+};
+
+struct Header {
+    char magic[4];                // kMagic
+    uint8_t version[2];           // kVersion
+    uint8_t flags[2];             // kFlagContentHash, or 0.
+    uint8_t timestamp[8];         // Microseconds since the epoch, or the content hash.
+    Be32 section_table_offset;
+    Be32 section_count;
+    Be32 section_header_size;     // sizeof(SectionHeader)
+    Be32 reserved;
+};
+
+struct SectionHeader {
+    Be32 type;       // SectionType
+    Be32 offset;     // From the start of the file; a multiple of kAlignment.
+    Be32 size;       // In bytes, without padding.
+    Be32 entry_size; // Of the records in the section, or 0.
+};
+
+struct Symbol {
+    Be32 value;      // Address relative to the start of 'section'.
+    Be32 name;       // String offset.
+    uint8_t kind;    // SymbolKind
+    uint8_t section; // Index in the section header table.
+    uint8_t reserved[2];
+};
+
+struct Relocation {
+    Be32 offset;     // Of the 32-bit field, from the start of 'section'.
+    Be32 target;     // Meaning depends on 'kind'.
+    uint8_t kind;    // RelocationKind
+    uint8_t section; // Index in the section header table of the section patched.
+    uint8_t reserved[2];
+};
+
+static_assert(sizeof(Header) == kHeaderSize && alignof(Header) == 1);
+static_assert(sizeof(SectionHeader) == 16 && alignof(SectionHeader) == 1);
+static_assert(sizeof(Symbol) == 12 && alignof(Symbol) == 1);
+static_assert(sizeof(Relocation) == 12 && alignof(Relocation) == 1);
+
+constexpr size_t align(size_t offset) {
+    return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+} // namespace lf
+
+#endif // OBJECT_FORMAT_H
@@ -6,12 +6,14 @@
 #define CPU_ASSEMBLER_PARSER_H
 
 #include <vector>
+#include <span>
 #include <cstdint>
 #include <string>
 #include <iostream>
 #include "lexer.h"
+#include "code_generator.h"
+#include "machine_description.h"
 
-class CodeGenerator;
 class Parser {
 public:
     struct Metadata {
@@ -22,6 +24,10 @@ public:
 
 private:
     size_t currentTokenIndex = 0;
+    size_t tokenIndexBase = 0; // Tokens consumed by earlier chunks (streaming mode).
+    Section section = Section::Text; // Selected by the last .text, .data or .bss.
+    uint32_t laidOutBytes[kSectionCount] = {}; // Size of each section covered by layout() so far.
+    size_t nextRelaxed = 0;    // Next entry of relaxed_specifiers for parse().
     std::vector<Token> tokens;
     Metadata metadata;
     void addObjectCodeByte(uint8_t byte) {
@@ -31,23 +37,149 @@ private:
     CodeGenerator& code_generator;
 
 public:
-    Parser(const std::vector<Token> &tokens, Metadata metadata, CodeGenerator& code_generator):
-          tokens(tokens),
+    Parser(std::vector<Token> tokens, Metadata metadata, CodeGenerator& code_generator):
+          tokens(std::move(tokens)),
           metadata(std::move(metadata)),
           code_generator(code_generator) {
     }
 
+    /**
+     * Replace the token stream with the next chunk of the same source.
+     * Object code produced so far is kept; hand it off with
+     * take_object_code() to keep memory bounded.
+     *
+     * @param next_tokens Tokens of the next chunk.
+     */
+    void set_tokens(std::vector<Token> next_tokens) {
+        // Error recovery may have stepped past the end of the previous chunk;
+        // carry that over so chunked parsing matches parsing the whole stream.
+        currentTokenIndex = currentTokenIndex > tokens.size() ? currentTokenIndex - tokens.size() : 0;
+        tokenIndexBase += tokens.size();
+        tokens = std::move(next_tokens);
+    }
+
+    /**
+     * Hand off the .text produced so far. Later labels and relocations keep
+     * counting addresses from the start of the section.
+     *
+     * @param out Receives the object code; its previous contents are discarded.
+     */
+    void take_object_code(std::vector<uint8_t> &out);
+
+    // Address of the next byte in the current section, counting code already handed off.
+    [[nodiscard]] uint32_t current_address() const;
+
     void parse_data_definition();
 
+    /**
+     * Handle the directive at the current token and its operands: ".text",
+     * ".data" and ".bss" select the section that follows, ".space n" reserves
+     * n zero bytes (in .bss, only its size); an ".include" left to the parser
+     * is malformed and reported. With 'laying_out', only label
+     * addresses are tracked and no errors are reported, as in layout().
+     */
+    void parse_directive(bool laying_out);
+
     void parse();
     void parse_instruction();
 
-    static bool match_operands_against_syntax(const std::vector<Token> &operand_tokens, const std::string &syntax_str);
+    /**
+     * Sizing pass: walk the tokens as parse() does, without generating code
+     * or reporting errors, and record the address of every label in
+     * label_address_table. Instructions are sized with the length of the
+     * specifier select_specifier() picks; those that have shorter forms are
+     * noted for relax(). Like parse(), this continues across set_tokens()
+     * chunks.
+     */
+    void layout();
+
+    struct RelaxationResult {
+        uint32_t bytes_saved;
+        size_t instructions; // Instructions given a shorter specifier.
+    };
+
+    /**
+     * After layout() has seen the whole source, give every instruction that
+     * has shorter forms the shortest specifier whose fields hold its
+     * operands, and move the labels in label_address_table accordingly.
+     * Relative label fields are checked against the final layout: the pass
+     * starts from the shortest forms and lengthens instructions whose labels
+     * are out of reach until nothing changes. The choices are stored in
+     * relaxed_specifiers.
+     */
+    RelaxationResult relax();
+
+    /**
+     * Go back to the first token so that parse() can follow layout() over
+     * the same token stream. Only for a parser that holds the whole stream.
+     */
+    void rewind() {
+        currentTokenIndex = 0;
+        tokenIndexBase = 0;
+        nextRelaxed = 0;
+        section = Section::Text;
+    }
+
+    // Operand kind of a lexed operand token (OperandKind::None if it fits no placeholder).
+    static OperandKind operand_kind(const Token &token);
 
-    static bool placeholder_matches_token(const std::string &placeholder, const Token &token);
+    /**
+     * Choose the specifier of 'format' whose placeholders accept the operands:
+     * the first one in description order, found with a single lookup in the
+     * generated dispatch table.
+     *
+     * @param format The instruction.
+     * @param operand_tokens The operand tokens.
+     * @param candidates If given, receives the shorter specifiers that accept the operands.
+     * @return The specifier, or nullptr if no specifier matches.
+     */
+    static const InstructionSpecifier *select_specifier(const InstructionFormat *format,
+                                                        std::span<const Token> operand_tokens,
+                                                        RelaxationCandidates *candidates = nullptr);
+
+    std::vector<uint8_t> object_code; // The resultant .text in big endian format
+    std::vector<uint8_t> data;        // The .data section; never handed off.
+    uint32_t bss_size = 0;
+    LabelTable label_address_table;
+
+    // Where errors in statements and directives are reported.
+    std::ostream *diagnostics = &std::cerr;
+
+    // Specifier chosen by relax() for each instruction that has shorter
+    // forms, in source order; parse() takes them in turn. Hand them to the
+    // parser that generates the code if it is not the one that laid it out.
+    std::vector<const InstructionSpecifier *> relaxed_specifiers;
+
+    // Left empty, or sized to num_specifiers for parse() to count the
+    // instructions it encodes with each specifier, by its index (--stats).
+    std::vector<uint64_t> specifier_counts;
+
+private:
+    // Step past the operands of the instruction before currentTokenIndex:
+    // the tokens up to the next instruction or label.
+    std::span<const Token> take_operands();
+
+    // Number of bytes parse_data_definition() emits for one operand.
+    static uint32_t data_operand_size(const Token &operand);
+
+    // Where db and .space put their bytes: .text or .data.
+    std::vector<uint8_t> &section_bytes() {
+        return section == Section::Data ? data : object_code;
+    }
+
+    // An instruction noted by layout() for relax().
+    struct RelaxableInstruction {
+        uint32_t address;                  // With every instruction at its default length.
+        const InstructionFormat *format;
+        RelaxationCandidates candidates;   // The last is the default specifier.
+        uint8_t usable;                    // Bit i: candidate i holds the operands.
+        uint8_t chosen;                    // Index into candidates.
+        std::string target;                // Label of a relative field, if a candidate has one.
+    };
+    std::vector<RelaxableInstruction> relaxable;
 
-    std::vector<uint8_t> object_code; // The resultant object code in big endian format
-    std::unordered_map<std::string, uint32_t> label_address_table;
+    void note_relaxable(const InstructionFormat *format, const RelaxationCandidates &candidates,
+                        std::span<const Token> operand_tokens);
 };
 
 #endif //CPU_ASSEMBLER_PARSER_H
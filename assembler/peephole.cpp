@@ -0,0 +1,488 @@
+#include "peephole.h"
+
+#include "assembler.h"
+#include "machine_description.h"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <iomanip>
+#include <string_view>
+
+namespace {
+
+// -----------------------------------------------
+// Rule table
+// -----------------------------------------------
+// Instructions are separated by ';'. In a pattern, %x matches a register
+// without a .L/.H suffix, #%x any immediate, and #N exactly that value; a
+// variable that occurs twice must match the same value both times. A
+// replacement may use the pattern's variables and #log2(%x), which is only
+// defined for powers of two. An empty replacement deletes the sequence.
+//
+// Note that "mov %a, %b" copies register a into b.
+//
+// Rewrites keep registers and memory the same. Those marked as changing
+// flags may set the overflow flag differently, so they are only applied
+// where the flag is dead: see overflow_dead_after().
+struct RuleText {
+    std::string_view name;
+    std::string_view pattern;
+    std::string_view replacement;
+    bool changes_flags;
+};
+
+constexpr RuleText rule_text[] = {
+    {"mov-self",      "mov %a, %a",     "",                   false},
+    {"push-pop-same", "psh %a; pop %a", "",                   false},
+    {"push-pop",      "psh %a; pop %b", "mov %a, %b",         false},
+    {"add-zero",      "add %a, #0",     "",                   true},
+    {"sub-zero",      "sub %a, #0",     "",                   true},
+    {"mul-one",       "mul %a, #1",     "",                   true},
+    {"mul-pow2",      "mul %a, #%k",    "lsh %a, #log2(%k)",  true},
+    {"zero-by-xor",   "mov %a, #0",     "xor %a, %a",         true},
+};
+
+constexpr size_t num_rules = std::size(rule_text);
+constexpr size_t max_rule_instructions = 2;
+
+// Instructions that set or clear the overflow flag, and those after which it
+// may be read: bro tests it, and the others continue elsewhere.
+constexpr std::string_view sets_overflow = "add sub mul and or xor lsh rsh umull smull";
+constexpr std::string_view may_read_overflow = "b be bne blt bgt bro jsr rts hlt wfi";
+
+// -----------------------------------------------
+// Rule compilation (at build time)
+// -----------------------------------------------
+enum class PatternKind : uint8_t {
+    Register,  // %x
+    Immediate, // #%x
+    Value,     // #N
+    Log2,      // #log2(%x), replacements only
+};
+
+struct OperandPattern {
+    PatternKind kind;
+    char variable; // 'a'..'z', or 0 for Value.
+    int64_t value; // For Value.
+};
+
+struct InstructionPattern {
+    const InstructionFormat *format;
+    uint8_t num_operands;
+    OperandPattern operands[max_operands];
+};
+
+struct Sequence {
+    uint8_t count;
+    InstructionPattern instructions[max_rule_instructions];
+    uint32_t length; // Bytes, with the specifiers the operands select.
+};
+
+struct Rule {
+    std::string_view name;
+    Sequence pattern;
+    Sequence replacement;
+    bool changes_flags;
+    bool valid; // Parses and agrees with the machine description.
+};
+
+constexpr std::string_view trim(std::string_view s) {
+    while (!s.empty() && s.front() == ' ') s.remove_prefix(1);
+    while (!s.empty() && s.back() == ' ') s.remove_suffix(1);
+    return s;
+}
+
+constexpr bool is_variable(char c) {
+    return c >= 'a' && c <= 'z';
+}
+
+constexpr bool compile_operand(std::string_view text, bool in_replacement, OperandPattern &operand) {
+    operand = {PatternKind::Register, 0, 0};
+    if (text.size() == 2 && text[0] == '%' && is_variable(text[1])) {
+        operand.variable = text[1];
+        return true;
+    }
+    if (text.size() == 3 && text.substr(0, 2) == "#%" && is_variable(text[2])) {
+        operand.kind = PatternKind::Immediate;
+        operand.variable = text[2];
+        return true;
+    }
+    if (in_replacement && text.size() == 9 && text.substr(0, 7) == "#log2(%" && is_variable(text[7]) &&
+        text[8] == ')') {
+        operand.kind = PatternKind::Log2;
+        operand.variable = text[7];
+        return true;
+    }
+    if (!in_replacement && text.size() >= 2 && text[0] == '#') {
+        operand.kind = PatternKind::Value;
+        for (char c : text.substr(1)) {
+            if (c < '0' || c > '9') return false;
+            operand.value = operand.value * 10 + (c - '0');
+        }
+        return true;
+    }
+    return false;
+}
+
+constexpr bool compile_instruction(std::string_view text, bool in_replacement, InstructionPattern &instruction,
+                                   uint32_t &length) {
+    text = trim(text);
+    size_t space = text.find(' ');
+    instruction.format = lookup_instruction(text.substr(0, space));
+    instruction.num_operands = 0;
+    if (!instruction.format) return false;
+
+    OperandKind kinds[max_operands] = {};
+    std::string_view rest = space == std::string_view::npos ? std::string_view() : text.substr(space + 1);
+    while (!trim(rest).empty()) {
+        if (instruction.num_operands == max_operands) return false;
+        size_t comma = rest.find(',');
+        OperandPattern &operand = instruction.operands[instruction.num_operands];
+        if (!compile_operand(trim(rest.substr(0, comma)), in_replacement, operand)) return false;
+        kinds[instruction.num_operands++] =
+            operand.kind == PatternKind::Register ? OperandKind::Register : OperandKind::Immediate;
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+    }
+    const InstructionSpecifier *spec =
+        lookup_specifier(instruction.format, operand_signature(kinds, instruction.num_operands));
+    if (!spec) return false;
+    length += spec->length;
+    return true;
+}
+
+constexpr bool compile_sequence(std::string_view text, bool in_replacement, Sequence &sequence) {
+    sequence.count = 0;
+    sequence.length = 0;
+    while (!trim(text).empty()) {
+        if (sequence.count == max_rule_instructions) return false;
+        size_t semicolon = text.find(';');
+        if (!compile_instruction(text.substr(0, semicolon), in_replacement,
+                                 sequence.instructions[sequence.count++], sequence.length)) {
+            return false;
+        }
+        text = semicolon == std::string_view::npos ? std::string_view() : text.substr(semicolon + 1);
+    }
+    return true;
+}
+
+constexpr Rule compile_rule(const RuleText &text) {
+    Rule rule{text.name, {}, {}, text.changes_flags, false};
+    if (!compile_sequence(text.pattern, false, rule.pattern) || rule.pattern.count == 0 ||
+        !compile_sequence(text.replacement, true, rule.replacement)) {
+        return rule;
+    }
+    // Every variable of the replacement must be bound by the pattern, to a
+    // register if it is used as one and to an immediate otherwise.
+    for (size_t i = 0; i < rule.replacement.count; ++i) {
+        const InstructionPattern &instruction = rule.replacement.instructions[i];
+        for (size_t j = 0; j < instruction.num_operands; ++j) {
+            const OperandPattern &operand = instruction.operands[j];
+            const PatternKind wanted =
+                operand.kind == PatternKind::Register ? PatternKind::Register : PatternKind::Immediate;
+            bool bound = false;
+            for (size_t m = 0; m < rule.pattern.count; ++m) {
+                const InstructionPattern &matched = rule.pattern.instructions[m];
+                for (size_t n = 0; n < matched.num_operands; ++n) {
+                    bound = bound || (matched.operands[n].variable == operand.variable &&
+                                      matched.operands[n].kind == wanted);
+                }
+            }
+            if (!bound) return rule;
+        }
+    }
+    rule.valid = true;
+    return rule;
+}
+
+constexpr std::array<Rule, num_rules> compile_rules() {
+    std::array<Rule, num_rules> rules{};
+    for (size_t i = 0; i < num_rules; ++i) {
+        rules[i] = compile_rule(rule_text[i]);
+    }
+    return rules;
+}
+
+constexpr std::array<Rule, num_rules> rules = compile_rules();
+
+constexpr bool rules_are_valid() {
+    for (const Rule &rule : rules) {
+        if (!rule.valid) return false;
+    }
+    return true;
+}
+static_assert(rules_are_valid(), "a peephole rule does not parse or does not match the machine description");
+
+// -----------------------------------------------
+// Matching
+// -----------------------------------------------
+// Text of the immediates log2() produces. A power of two is only taken
+// from a 16-bit immediate field, so shifts stay below 16.
+constexpr std::string_view shift_text[] = {
+    "#0", "#1", "#2", "#3", "#4", "#5", "#6", "#7",
+    "#8", "#9", "#10", "#11", "#12", "#13", "#14", "#15",
+};
+
+struct Bindings {
+    uint32_t bound = 0; // Bit v: variable 'a' + v is bound.
+    int64_t value[26];
+    const Token *token[26];
+};
+
+bool operand_value(const Token &token, PatternKind kind, int64_t &value) {
+    std::string_view text = token.data;
+    if (kind == PatternKind::Register) {
+        // Plain registers only: a .L/.H half is not the whole register.
+        if (token.subtype != OperandSubtype::Register || text.find('.') != std::string_view::npos) return false;
+    } else {
+        if (token.subtype != OperandSubtype::Immediate) return false;
+        text.remove_prefix(1);
+    }
+    return parse_integer(text, value);
+}
+
+bool match_operand(const OperandPattern &pattern, const Token &token, Bindings &bindings) {
+    int64_t value = 0;
+    if (!operand_value(token, pattern.kind, value)) return false;
+    if (pattern.kind == PatternKind::Value) return value == pattern.value;
+
+    const uint32_t bit = 1u << (pattern.variable - 'a');
+    const size_t v = static_cast<size_t>(pattern.variable - 'a');
+    if (bindings.bound & bit) return bindings.value[v] == value;
+    bindings.bound |= bit;
+    bindings.value[v] = value;
+    bindings.token[v] = &token;
+    return true;
+}
+
+constexpr bool in_list(std::string_view list, std::string_view name) {
+    while (!list.empty()) {
+        size_t space = list.find(' ');
+        if (list.substr(0, space) == name) return true;
+        list = space == std::string_view::npos ? std::string_view() : list.substr(space + 1);
+    }
+    return false;
+}
+
+enum class FlagScan {
+    Passes, // Leaves the overflow flag alone and continues with the next instruction.
+    Sets,
+    Stops,  // May read the flag, or is not a known instruction.
+};
+
+FlagScan scan_overflow(const Token &token) {
+    if (token.type != TokenType::Instruction) return FlagScan::Stops;
+    if (in_list(sets_overflow, token.data)) return FlagScan::Sets;
+    if (in_list(may_read_overflow, token.data) || !lookup_instruction(token.data)) return FlagScan::Stops;
+    return FlagScan::Passes;
+}
+
+// Whether the overflow flag is dead after the instruction at tokens[last],
+// whose operands end before tokens[next]. It is if the dataflow analysis
+// found it dead there, or if a later instruction sets it before a label, a
+// branch or the end of the tokens.
+bool overflow_dead_after(const std::vector<Token> &tokens, size_t last, size_t next,
+                         const std::vector<bool> &overflow_dead) {
+    if (!overflow_dead.empty() && overflow_dead[last]) return true;
+    for (size_t pos = next; pos < tokens.size(); ++pos) {
+        if (tokens[pos].type == TokenType::Operand) continue;
+        switch (scan_overflow(tokens[pos])) {
+        case FlagScan::Passes: continue;
+        case FlagScan::Sets: return true;
+        case FlagScan::Stops: return false;
+        }
+    }
+    return false;
+}
+
+// Match 'rule' against the instructions starting at tokens[begin]; on
+// success, 'end' is the index of the first token after the sequence and
+// 'last' that of its last mnemonic. 'overflow_dead' is the dataflow
+// optimizer's, or empty.
+bool match_rule(const Rule &rule, const std::vector<Token> &tokens, size_t begin,
+                const std::vector<bool> &overflow_dead, Bindings &bindings, size_t &end, size_t &last) {
+    size_t pos = begin;
+    for (size_t i = 0; i < rule.pattern.count; ++i) {
+        const InstructionPattern &instruction = rule.pattern.instructions[i];
+        if (pos >= tokens.size() || tokens[pos].type != TokenType::Instruction ||
+            tokens[pos].data != instruction.format->name) {
+            return false;
+        }
+        last = pos;
+        size_t operands = ++pos;
+        while (pos < tokens.size() && tokens[pos].type == TokenType::Operand) ++pos;
+        if (pos - operands != instruction.num_operands) return false;
+        for (size_t j = 0; j < instruction.num_operands; ++j) {
+            if (!match_operand(instruction.operands[j], tokens[operands + j], bindings)) return false;
+        }
+    }
+    if (rule.changes_flags && !overflow_dead_after(tokens, last, pos, overflow_dead)) return false;
+    end = pos;
+    return true;
+}
+
+// The replacement text for an operand, or an empty view if it is undefined.
+std::string_view replacement_text(const OperandPattern &operand, const Bindings &bindings) {
+    const size_t v = static_cast<size_t>(operand.variable - 'a');
+    if (operand.kind != PatternKind::Log2) return bindings.token[v]->data;
+    const int64_t value = bindings.value[v];
+    if (value <= 0 || value > 0xFFFF || (value & (value - 1)) != 0) return {};
+    return shift_text[std::countr_zero(static_cast<uint64_t>(value))];
+}
+
+// Append the replacement of a matched rule, or return false if log2() of a
+// bound value is undefined.
+bool emit_replacement(const Rule &rule, const Bindings &bindings, std::vector<Token> &out) {
+    for (size_t i = 0; i < rule.replacement.count; ++i) {
+        const InstructionPattern &instruction = rule.replacement.instructions[i];
+        for (size_t j = 0; j < instruction.num_operands; ++j) {
+            if (replacement_text(instruction.operands[j], bindings).empty()) return false;
+        }
+    }
+    for (size_t i = 0; i < rule.replacement.count; ++i) {
+        const InstructionPattern &instruction = rule.replacement.instructions[i];
+        const std::string_view name = instruction.format->name;
+        out.push_back({name, TokenType::Instruction, OperandSubtype::Unknown, name});
+        for (size_t j = 0; j < instruction.num_operands; ++j) {
+            const OperandPattern &operand = instruction.operands[j];
+            const std::string_view text = replacement_text(operand, bindings);
+            const OperandSubtype subtype =
+                operand.kind == PatternKind::Register ? OperandSubtype::Register : OperandSubtype::Immediate;
+            out.push_back({text, TokenType::Operand, subtype, text});
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+PeepholeOptimizer::PeepholeOptimizer() : hits(num_rules, 0) {}
+
+void PeepholeOptimizer::run(std::vector<Token> &tokens, const std::vector<bool> *overflow_dead) {
+    std::vector<bool> dead = overflow_dead ? *overflow_dead : std::vector<bool>();
+    rewrite(tokens, dead);
+}
+
+void PeepholeOptimizer::rewrite(std::vector<Token> &tokens, std::vector<bool> &overflow_dead) {
+    // A rewrite can bring two instructions together (psh 1; psh 2; pop 2;
+    // pop 1), so repeat until a pass changes nothing. Where the flag was dead
+    // after a sequence, it is dead after its replacement.
+    std::vector<Token> out;
+    std::vector<bool> out_dead;
+    const bool tracked = !overflow_dead.empty();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        out.clear();
+        out.reserve(tokens.size());
+        out_dead.clear();
+        size_t i = 0;
+        while (i < tokens.size()) {
+            if (tokens[i].type == TokenType::Instruction) {
+                size_t end = 0;
+                size_t last = 0;
+                size_t r = 0;
+                for (; r < num_rules; ++r) {
+                    Bindings bindings;
+                    if (match_rule(rules[r], tokens, i, overflow_dead, bindings, end, last) &&
+                        emit_replacement(rules[r], bindings, out)) {
+                        break;
+                    }
+                }
+                if (r < num_rules) {
+                    ++hits[r];
+                    if (tracked) {
+                        for (size_t t = out_dead.size(); t < out.size(); ++t) {
+                            out_dead.push_back(out[t].type == TokenType::Instruction && overflow_dead[last]);
+                        }
+                    }
+                    i = end;
+                    changed = true;
+                    continue;
+                }
+            }
+            out.push_back(tokens[i]);
+            if (tracked) out_dead.push_back(overflow_dead[i]);
+            ++i;
+        }
+        tokens.swap(out);
+        overflow_dead.swap(out_dead);
+    }
+}
+
+void PeepholeOptimizer::run_chunk(std::vector<Token> &tokens, const std::vector<bool> *overflow_dead) {
+    // Facts the dataflow optimizer found about the held statements stay true.
+    std::vector<bool> dead;
+    if (overflow_dead) {
+        dead = held_dead.empty() ? std::vector<bool>(held.size(), false) : held_dead;
+        dead.insert(dead.end(), overflow_dead->begin(), overflow_dead->end());
+    }
+    held_dead.clear();
+    if (!held.empty()) {
+        tokens.insert(tokens.begin(), held.begin(), held.end());
+        held.clear();
+    }
+    rewrite(tokens, dead);
+
+    // Whether a rule that looks past its first instruction starts with this
+    // mnemonic: a longer pattern, or one that needs the overflow flag dead.
+    auto looks_ahead = [](std::string_view mnemonic) {
+        for (const Rule &rule : rules) {
+            if ((rule.pattern.count > 1 || rule.changes_flags) && mnemonic == rule.pattern.instructions[0].format->name) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Hold back the trailing statements that such rules start, and those a
+    // search for the next instruction that sets the flag passes. A rewrite in
+    // the next chunk may bring any of them next to a later instruction, but
+    // none of the statements before them.
+    size_t keep = tokens.size();
+    for (size_t statement = tokens.size(); statement > 0;) {
+        --statement;
+        if (tokens[statement].type == TokenType::Operand) continue;
+        if (tokens[statement].type != TokenType::Instruction ||
+            (!looks_ahead(tokens[statement].data) && scan_overflow(tokens[statement]) != FlagScan::Passes)) {
+            break;
+        }
+        keep = statement;
+    }
+    if (keep == tokens.size()) return;
+
+    held_buffer ^= 1;
+    std::string &text = held_text[held_buffer];
+    text.clear();
+    size_t bytes = 0;
+    for (size_t i = keep; i < tokens.size(); ++i) bytes += tokens[i].lexeme.size() + tokens[i].data.size();
+    text.reserve(bytes); // No reallocation below, so the views stay valid.
+    for (size_t i = keep; i < tokens.size(); ++i) {
+        Token token = tokens[i];
+        text.append(token.lexeme);
+        token.lexeme = std::string_view(text).substr(text.size() - token.lexeme.size());
+        text.append(token.data);
+        token.data = std::string_view(text).substr(text.size() - token.data.size());
+        held.push_back(token);
+    }
+    if (!dead.empty()) held_dead.assign(dead.begin() + static_cast<std::ptrdiff_t>(keep), dead.end());
+    tokens.resize(keep);
+}
+
+std::vector<Token> PeepholeOptimizer::finish() {
+    std::vector<Token> tokens = std::move(held);
+    std::vector<bool> dead = std::move(held_dead);
+    held.clear();
+    held_dead.clear();
+    rewrite(tokens, dead);
+    return tokens;
+}
+
+void PeepholeOptimizer::print_statistics(std::ostream &out) const {
+    out << "Peephole rule         hits  bytes saved\n";
+    for (size_t r = 0; r < num_rules; ++r) {
+        const long saved = static_cast<long>(rules[r].pattern.length) - static_cast<long>(rules[r].replacement.length);
+        out << "  " << std::left << std::setw(16) << rules[r].name << std::right
+            << std::setw(8) << hits[r] << std::setw(13) << saved * static_cast<long>(hits[r]) << "\n";
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "lexer.h"
+
+/*
+PeepholeOptimizer rewrites short instruction sequences in a token stream into
+cheaper equivalents before the parser lays out and encodes it (assembler -O).
+
+The rewrites come from a declarative rule table in peephole.cpp. A rule is a
+pattern of one or two instructions, written in assembler syntax with
+variables for registers (%a) and immediates (#%k), and a replacement that may
+use the pattern's variables and log2(). The table is compiled and checked
+against the machine description at build time: every instruction of a
+pattern or replacement must have a specifier that takes its operands.
+
+A pattern matches consecutive instructions only; a label between them ends
+the sequence, since it may be a branch target. A rule that may change the
+overflow flag only applies where the flag is dead: where the dataflow
+optimizer found it so, or where a later instruction sets it before a label,
+a branch or the end of the tokens.
+*/
+class PeepholeOptimizer {
+public:
+    PeepholeOptimizer();
+
+    /**
+     * Rewrite the instructions in 'tokens' until no rule applies. The new
+     * tokens view the old ones' text or static storage, so they live as
+     * long as the source and the rule table.
+     *
+     * @param tokens The token stream of a source file, or of a chunk of it.
+     * @param overflow_dead DataflowOptimizer::overflow_dead() for 'tokens',
+     * or null if it was not run.
+     */
+    void run(std::vector<Token> &tokens, const std::vector<bool> *overflow_dead = nullptr);
+
+    /**
+     * Like run(), for one chunk of a longer token stream. An instruction at
+     * the end of the chunk that may start a longer pattern is held back and
+     * put in front of the next chunk, so that the result does not depend on
+     * where the stream is cut. Call finish() after the last chunk.
+     *
+     * @param tokens The tokens of the chunk.
+     * @param overflow_dead As for run().
+     */
+    void run_chunk(std::vector<Token> &tokens, const std::vector<bool> *overflow_dead = nullptr);
+
+    // The tokens run_chunk() held back from the last chunk, rewritten; parse
+    // them last. They stay valid until the next run_chunk().
+    std::vector<Token> finish();
+
+    // Print how often each rule applied and the bytes it saved.
+    void print_statistics(std::ostream &out) const;
+
+private:
+    // run(), with 'overflow_dead' empty or kept in step with 'tokens'.
+    void rewrite(std::vector<Token> &tokens, std::vector<bool> &overflow_dead);
+
+    std::vector<size_t> hits; // Per rule, in table order.
+
+    // Held back by run_chunk(). Their text is copied, because the lexer
+    // reuses its storage from one chunk to the next; the two buffers take
+    // turns so that a held statement can be held again.
+    std::vector<Token> held;
+    std::vector<bool> held_dead; // Their overflow_dead entries, if any.
+    std::string held_text[2];
+    size_t held_buffer = 0;
+};
+
+#endif // PEEPHOLE_H
@@ -0,0 +1,228 @@
+#include "service.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <semaphore>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace service {
+
+namespace {
+
+// Where send() cannot be told not to raise SIGPIPE, configure() sets
+// SO_NOSIGPIPE on the socket instead.
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+// Set up 'fd', from socket() or accept(), as stream_socket() describes.
+int configure(int fd) {
+    if (fd >= 0) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#if defined(SO_NOSIGPIPE)
+        const int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    }
+    return fd;
+}
+
+bool write_all(int fd, const void *data, size_t size) {
+    const auto *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t n = ::send(fd, bytes, size, kSendFlags);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool read_all(int fd, void *data, size_t size) {
+    auto *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t n = ::recv(fd, bytes, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Path of the socket being served, removed when the server is stopped.
+char served_path[sizeof(sockaddr_un::sun_path)];
+
+extern "C" void stop_serving(int signal) {
+    ::unlink(served_path);
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+// Free places for connections being answered.
+std::counting_semaphore<kMaxConnections> connection_slots(kMaxConnections);
+
+void answer(int fd, const Handler &handle) {
+    uint32_t count;
+    std::vector<std::string> strings;
+    bool ok = peer_is_self(fd) && read_u32(fd, count) && count >= 1 && count <= kMaxStrings;
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        ok = read_string(fd, strings.emplace_back());
+    }
+    if (ok) {
+        std::string cwd = std::move(strings.front());
+        strings.erase(strings.begin());
+        std::ostringstream out;
+        std::ostringstream err;
+        int status;
+        try {
+            status = handle(cwd, std::move(strings), out, err);
+        } catch (const std::exception &e) {
+            err << e.what() << "\n";
+            status = 1;
+        }
+        // The client may have gone; there is no one to tell.
+        (void)(write_u32(fd, static_cast<uint32_t>(status)) && write_string(fd, out.view()) &&
+               write_string(fd, err.view()));
+    }
+    ::close(fd);
+}
+
+} // namespace
+
+std::string default_socket_path() {
+    if (const char *path = std::getenv(kSocketVariable); path && *path) {
+        return path;
+    }
+    if (const char *runtime = std::getenv("XDG_RUNTIME_DIR"); runtime && *runtime) {
+        return std::string(runtime) + "/nc16x32-as.sock";
+    }
+    return "/tmp/nc16x32-as-" + std::to_string(::getuid()) + ".sock";
+}
+
+int stream_socket() {
+    return configure(::socket(AF_UNIX, SOCK_STREAM, 0));
+}
+
+bool write_u32(int fd, uint32_t value) {
+    return write_all(fd, &value, sizeof(value));
+}
+
+bool write_string(int fd, std::string_view text) {
+    return text.size() <= kMaxStringBytes && write_u32(fd, static_cast<uint32_t>(text.size())) &&
+           write_all(fd, text.data(), text.size());
+}
+
+bool read_u32(int fd, uint32_t &value) {
+    return read_all(fd, &value, sizeof(value));
+}
+
+bool read_string(int fd, std::string &text) {
+    uint32_t size;
+    if (!read_u32(fd, size) || size > kMaxStringBytes) {
+        return false;
+    }
+    text.resize(size);
+    return read_all(fd, text.data(), size);
+}
+
+bool peer_is_self(int fd) {
+#if defined(__linux__)
+    ucred credentials{};
+    socklen_t size = sizeof(credentials);
+    return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && size == sizeof(credentials) &&
+           credentials.uid == ::getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return ::getpeereid(fd, &uid, &gid) == 0 && uid == ::getuid();
+#endif
+}
+
+int serve(const std::string &socket_path, const Handler &handle) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socket_path << "\n";
+        return 1;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int fd = stream_socket();
+    if (fd < 0) {
+        std::cerr << "Cannot create socket: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    // A socket file nobody answers on is left over from a server that was killed.
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0) {
+        std::cerr << "A server is already listening on " << socket_path << ".\n";
+        ::close(fd);
+        return 1;
+    }
+    ::unlink(socket_path.c_str());
+    ::close(fd);
+    // Create the socket file with mode 0600, not chmod() it afterwards, so
+    // that no other user can connect in between. No other thread runs yet.
+    fd = stream_socket();
+    const mode_t mask = ::umask(0177);
+    const bool bound = fd >= 0 && ::bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+    const int bind_error = errno;
+    ::umask(mask);
+    errno = bind_error;
+    if (!bound || ::listen(fd, SOMAXCONN) != 0) {
+        std::cerr << "Cannot listen on " << socket_path << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    std::memcpy(served_path, address.sun_path, sizeof(served_path));
+    std::signal(SIGINT, stop_serving);
+    std::signal(SIGTERM, stop_serving);
+    std::cerr << "Serving on " << socket_path << ".\n";
+
+    for (;;) {
+        connection_slots.acquire();
+        int client = configure(::accept(fd, nullptr, nullptr));
+        if (client < 0) {
+            connection_slots.release();
+            if (errno != EINTR && errno != ECONNABORTED) {
+                std::cerr << "Cannot accept a connection: " << std::strerror(errno) << "\n";
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+        try {
+            std::thread([client, &handle] {
+                answer(client, handle);
+                connection_slots.release();
+            }).detach();
+        } catch (const std::system_error &e) {
+            std::cerr << "Cannot answer a connection: " << e.what() << "\n";
+            ::close(client);
+            connection_slots.release();
+        }
+    }
+}
+
+} // namespace service
@@ -0,0 +1,71 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+The assembler server (nc16x32-as --serve) and its client (nc16x32-asc) talk
+over a Unix domain stream socket, one request per connection:
+
+    request:  u32 count, then 'count' strings: the client's working
+              directory, then its arguments (without the program name)
+    response: u32 exit status, then two strings: what the request printed
+              to standard output and to standard error
+
+A u32 is in host byte order, as both ends run on one machine; a string is a
+u32 byte count followed by the bytes.
+
+The socket is only usable by its owner, but its directory may not be: in /tmp,
+another user could be listening on the path first. So each end checks that
+the other runs as the same user (SO_PEERCRED on Linux, getpeereid()
+elsewhere) before it trusts it.
+*/
+namespace service {
+
+constexpr uint32_t kMaxStrings = 1 << 20;
+constexpr uint32_t kMaxStringBytes = 1 << 30;
+
+// Requests answered at once; more connections wait to be accepted.
+constexpr unsigned kMaxConnections = 16;
+
+// Environment variable that overrides default_socket_path().
+constexpr const char *kSocketVariable = "NC16X32_AS_SOCKET";
+
+// $NC16X32_AS_SOCKET, else nc16x32-as.sock in $XDG_RUNTIME_DIR, else
+// /tmp/nc16x32-as-<uid>.sock.
+std::string default_socket_path();
+
+bool write_u32(int fd, uint32_t value);
+bool write_string(int fd, std::string_view text);
+bool read_u32(int fd, uint32_t &value);
+bool read_string(int fd, std::string &text);
+
+// A Unix domain stream socket, closed on exec, whose writes fail with EPIPE
+// rather than raise SIGPIPE; -1 with errno set if it cannot be created.
+int stream_socket();
+
+// Whether the other end of the connected socket 'fd' runs as this user.
+bool peer_is_self(int fd);
+
+// Runs one request: its arguments, relative to 'cwd', printing to 'out' and 'err'.
+using Handler = std::function<int(const std::string &cwd, std::vector<std::string> args,
+                                  std::ostream &out, std::ostream &err)>;
+
+/**
+ * Listen on 'socket_path' and answer every request with 'handle', each
+ * connection on a thread of its own and at most kMaxConnections at once,
+ * until the process is stopped. The socket is created with mode 0600 and
+ * removed on SIGINT and SIGTERM.
+ *
+ * @return 1 if the socket cannot be set up; does not return otherwise.
+ */
+int serve(const std::string &socket_path, const Handler &handle);
+
+} // namespace service
+
+#endif // SERVICE_H
@@ -0,0 +1,168 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+namespace {
+
+uint64_t clock_ns(clockid_t clock) {
+    timespec now{};
+    clock_gettime(clock, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + static_cast<uint64_t>(now.tv_nsec);
+}
+
+// 'text' as a JSON string.
+std::string json_string(std::string_view text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + '"';
+}
+
+// Nanoseconds as milliseconds with three decimals.
+std::string milliseconds(uint64_t ns) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", static_cast<double>(ns) / 1e6);
+    return text;
+}
+
+// 'text' padded with spaces to 'width', on the left if 'right'.
+std::string pad(const std::string &text, size_t width, bool right = true) {
+    std::string padding(width > text.size() ? width - text.size() : 0, ' ');
+    return right ? padding + text : text + padding;
+}
+
+} // namespace
+
+PhaseStats &Stats::phase(std::string_view name) {
+    auto it = std::find_if(phases.begin(), phases.end(), [&](const PhaseStats &p) { return p.name == name; });
+    if (it != phases.end()) {
+        return *it;
+    }
+    phases.push_back({std::string(name)});
+    return phases.back();
+}
+
+void Stats::add(std::string_view name, uint64_t n) {
+    auto it = std::find_if(counts.begin(), counts.end(), [&](const auto &count) { return count.first == name; });
+    if (it != counts.end()) {
+        it->second += n;
+    } else {
+        counts.emplace_back(name, n);
+    }
+}
+
+void Stats::add_instructions(std::string_view syntax, uint64_t n) {
+    instructions[std::string(syntax)] += n;
+}
+
+void Stats::merge(const Stats &other) {
+    for (const PhaseStats &p : other.phases) {
+        PhaseStats &into = phase(p.name);
+        into.wall_ns += p.wall_ns;
+        into.cpu_ns += p.cpu_ns;
+        into.allocations += p.allocations;
+        into.allocated_bytes += p.allocated_bytes;
+    }
+    for (const auto &[name, n] : other.counts) {
+        add(name, n);
+    }
+    for (const auto &[syntax, n] : other.instructions) {
+        instructions[syntax] += n;
+    }
+}
+
+void Stats::print(std::ostream &out, std::string_view tool, uint64_t elapsed_ns, bool json) const {
+    const bool allocations = heap_usage::hooked;
+    if (json) {
+        out << "{\"tool\": " << json_string(tool) << ", \"elapsed_ns\": " << elapsed_ns << ",\n \"phases\": [";
+        for (size_t i = 0; i < phases.size(); ++i) {
+            const PhaseStats &p = phases[i];
+            out << (i == 0 ? "\n" : ",\n") << "  {\"name\": " << json_string(p.name) << ", \"wall_ns\": " << p.wall_ns
+                << ", \"cpu_ns\": " << p.cpu_ns;
+            if (allocations) {
+                out << ", \"allocations\": " << p.allocations << ", \"allocated_bytes\": " << p.allocated_bytes;
+            }
+            out << "}";
+        }
+        out << "],\n \"counts\": {";
+        for (size_t i = 0; i < counts.size(); ++i) {
+            out << (i == 0 ? "" : ", ") << json_string(counts[i].first) << ": " << counts[i].second;
+        }
+        out << "}";
+        if (!instructions.empty()) {
+            out << ",\n \"instructions\": {";
+            bool first = true;
+            for (const auto &[syntax, n] : instructions) {
+                out << (first ? "\n" : ",\n") << "  " << json_string(syntax) << ": " << n;
+                first = false;
+            }
+            out << "}";
+        }
+        out << "}\n";
+        return;
+    }
+
+    out << tool << " statistics, " << milliseconds(elapsed_ns) << " ms elapsed:\n";
+    out << "  " << pad("phase", 12, false) << pad("wall ms", 12) << pad("cpu ms", 12);
+    if (allocations) {
+        out << pad("allocations", 14) << pad("bytes", 14);
+    }
+    out << "\n";
+    for (const PhaseStats &p : phases) {
+        out << "  " << pad(p.name, 12, false) << pad(milliseconds(p.wall_ns), 12) << pad(milliseconds(p.cpu_ns), 12);
+        if (allocations) {
+            out << pad(std::to_string(p.allocations), 14) << pad(std::to_string(p.allocated_bytes), 14);
+        }
+        out << "\n";
+    }
+    for (const auto &[name, n] : counts) {
+        out << "  " << pad(name, 24, false) << pad(std::to_string(n), 12) << "\n";
+    }
+    if (!instructions.empty()) {
+        out << "  instructions by specifier:\n";
+        for (const auto &[syntax, n] : instructions) {
+            out << "    " << pad(syntax, 40, false) << pad(std::to_string(n), 12) << "\n";
+        }
+    }
+}
+
+uint64_t wall_clock_ns() {
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+void PhaseTimer::start(std::string_view name) {
+    // Look the phase up before taking the counts, so that adding it is not counted.
+    PhaseStats &p = stats_->phase(name);
+    phase_ = static_cast<size_t>(&p - stats_->phases.data());
+    heap_usage::Counters &heap = heap_usage::counters;
+    was_counting_ = heap.counting;
+    heap.counting = true;
+    allocations_ = heap.allocations;
+    allocated_bytes_ = heap.bytes;
+    cpu_ns_ = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    wall_ns_ = wall_clock_ns();
+}
+
+void PhaseTimer::stop() {
+    const uint64_t wall_ns = wall_clock_ns();
+    const uint64_t cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    heap_usage::Counters &heap = heap_usage::counters;
+    heap.counting = was_counting_;
+    PhaseStats &p = stats_->phases[phase_];
+    p.wall_ns += wall_ns - wall_ns_;
+    p.cpu_ns += cpu_ns - cpu_ns_;
+    p.allocations += heap.allocations - allocations_;
+    p.allocated_bytes += heap.bytes - allocated_bytes_;
+}
@@ -0,0 +1,110 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+What a run of nc16x32-as or nc16x32-ld did, for --stats: the wall time, CPU
+time and heap use of each phase, and counts of what went through them. Code
+collects into a Stats only through a pointer that is null without --stats,
+so that a run without it does no more than test the pointer.
+
+Heap use is counted by the operator new of stats_new.cpp, which the tools
+link in: it counts the allocations of a thread while the thread is inside a
+PhaseTimer, and only then. Programs without it, such as other users of
+libnc16x32asm, get no allocation counts. CPU time is that of the thread, so
+phases timed on several threads at once add up to more than the wall time
+of the run.
+*/
+namespace heap_usage {
+
+struct Counters {
+    bool counting = false; // Inside a PhaseTimer.
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+// This thread's allocations.
+inline thread_local Counters counters;
+
+// Whether operator new counts them; set before main() by stats_new.cpp.
+inline bool hooked = false;
+
+} // namespace heap_usage
+
+struct PhaseStats {
+    std::string name;
+    uint64_t wall_ns = 0;
+    uint64_t cpu_ns = 0;
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+};
+
+class Stats {
+public:
+    // The phase 'name', added after the others if it is new.
+    PhaseStats &phase(std::string_view name);
+
+    // Add 'n' to the count 'name'.
+    void add(std::string_view name, uint64_t n);
+
+    // Add 'n' to the instructions encoded with the specifier whose syntax is 'syntax'.
+    void add_instructions(std::string_view syntax, uint64_t n);
+
+    // Add the phases and counts of 'other', keeping the order of this one's.
+    void merge(const Stats &other);
+
+    /**
+     * Print the phases and counts to 'out' as a table, or as a JSON object.
+     *
+     * @param tool The program, first in the output.
+     * @param elapsed_ns The wall time of the whole run.
+     */
+    void print(std::ostream &out, std::string_view tool, uint64_t elapsed_ns, bool json) const;
+
+    std::vector<PhaseStats> phases;                       // In the order they first ran.
+    std::vector<std::pair<std::string, uint64_t>> counts; // In the order first counted.
+    std::map<std::string, uint64_t> instructions;         // By specifier syntax.
+};
+
+// Nanoseconds on the monotonic clock.
+uint64_t wall_clock_ns();
+
+// Time and count the allocations of a phase, from construction to
+// destruction, into 'stats' if it is not null. Phases may nest; each counts
+// the time and allocations of those inside it.
+class PhaseTimer {
+public:
+    PhaseTimer(Stats *stats, std::string_view name) : stats_(stats) {
+        if (stats_) {
+            start(name);
+        }
+    }
+    ~PhaseTimer() {
+        if (stats_) {
+            stop();
+        }
+    }
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+    void start(std::string_view name);
+    void stop();
+
+    Stats *stats_;
+    size_t phase_ = 0;
+    uint64_t wall_ns_ = 0;
+    uint64_t cpu_ns_ = 0;
+    uint64_t allocations_ = 0;
+    uint64_t allocated_bytes_ = 0;
+    bool was_counting_ = false;
+};
+
+#endif // STATS_H
@@ -0,0 +1,57 @@
+// The global allocation functions of nc16x32-as and nc16x32-ld: malloc and
+// free, as the default ones, and counting into heap_usage::counters while
+// the thread is inside a PhaseTimer (see stats.h). Outside of --stats that
+// is one test of a thread-local flag per allocation.
+
+#include "stats.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+void *allocate(std::size_t size, std::size_t alignment) {
+    heap_usage::Counters &heap = heap_usage::counters;
+    if (heap.counting) {
+        ++heap.allocations;
+        heap.bytes += size;
+    }
+    if (size == 0) size = 1;
+    void *p = nullptr;
+    if (alignment > alignof(std::max_align_t)) {
+        // aligned_alloc requires the size to be a multiple of the alignment.
+        p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    } else {
+        p = std::malloc(size);
+    }
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+const bool hooked = (heap_usage::hooked = true);
+
+} // namespace
+
+void *operator new(std::size_t size) { return allocate(size, 0); }
+void *operator new[](std::size_t size) { return allocate(size, 0); }
+void *operator new(std::size_t size, std::align_val_t al) { return allocate(size, static_cast<std::size_t>(al)); }
+void *operator new[](std::size_t size, std::align_val_t al) { return allocate(size, static_cast<std::size_t>(al)); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    try { return allocate(size, 0); } catch (...) { return nullptr; }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    try { return allocate(size, 0); } catch (...) { return nullptr; }
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
@@ -0,0 +1,64 @@
+#ifndef STRUCTURAL_INDEX_H
+#define STRUCTURAL_INDEX_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+StructuralIndex records where the lines of a piece of source text begin, where
+their comments start, and whether the code part of a line contains a '$'
+(macro directive).
+
+The index is built in two stages, after simdjson's structural indexing:
+stage 1 classifies the text 64 bytes at a time into one bitmask per
+interesting character (with AVX2 or SSE2 when available, otherwise a scalar
+loop); stage 2 walks the newline bits and turns them into line records. Both
+lexer passes then iterate the records instead of searching the text again, and
+the first pass only looks at lines that have a '$' at all.
+
+Offsets are relative to the indexed text, which must be shorter than 4 GiB.
+*/
+class StructuralIndex {
+public:
+    enum LineFlags : uint8_t {
+        kComment = 1 << 0, // The line has a ';' comment.
+        kDollar  = 1 << 1, // A '$' occurs before the comment.
+    };
+
+    struct Line {
+        uint32_t begin;  // Offset of the first byte of the line.
+        uint32_t length; // Bytes up to the comment or the line terminator.
+        uint8_t flags;
+    };
+
+    /**
+     * Index 'text', replacing any previous contents. The text must outlive
+     * the index. A final line without a terminator is included; a trailing
+     * '\n' does not start an extra empty line.
+     *
+     * @param text Source text, or a slice of it that starts at a line boundary.
+     */
+    void build(std::string_view text);
+
+    [[nodiscard]] std::string_view text() const { return text_; }
+    [[nodiscard]] size_t size() const { return lines_.size(); }
+    [[nodiscard]] const Line &line(size_t i) const { return lines_[i]; }
+
+    // The part of line 'i' before its comment, untrimmed.
+    [[nodiscard]] std::string_view code(size_t i) const {
+        return {text_.data() + lines_[i].begin, lines_[i].length};
+    }
+
+    // Offset of line 'i'; size() is accepted and gives the end of the text.
+    [[nodiscard]] size_t lineBegin(size_t i) const {
+        return i < lines_.size() ? lines_[i].begin : text_.size();
+    }
+
+private:
+    std::string_view text_;
+    std::vector<Line> lines_;
+};
+
+#endif // STRUCTURAL_INDEX_H
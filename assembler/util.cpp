@@ -1,30 +1,21 @@
 //
 // Created by Dulat S on 1/20/25.
 //
-#include <cstring>    // For strcmp
 #include "machine_description.h"
+#include "assembler.h"
+#include <cctype>
+#include <charconv>
 
 // Retrieve opcode for a given instruction name.
 uint8_t get_opcode_for_instruction(const char* inst_name) {
-    size_t num_instructions = sizeof(instructions) / sizeof(instructions[0]);
-    for (size_t i = 0; i < num_instructions; ++i) {
-        if (strcmp(instructions[i].name, inst_name) == 0) {
-            return instructions[i].opcode;
-        }
-    }
+    const InstructionFormat* format = lookup_instruction(inst_name);
     // Not found: return a special value or handle error
-    return 0xFF;
+    return format ? format->opcode : 0xFF;
 }
 
 // Helper to find the InstructionFormat for a given instruction name.
 const InstructionFormat* find_instruction_format(const char* inst_name) {
-    size_t num_instructions = sizeof(instructions) / sizeof(instructions[0]);
-    for (size_t i = 0; i < num_instructions; ++i) {
-        if (strcmp(instructions[i].name, inst_name) == 0) {
-            return &instructions[i];
-        }
-    }
-    return nullptr;
+    return lookup_instruction(inst_name);
 }
 
 // Retrieve syntax based on instruction name and specifier 'sp'.
@@ -61,4 +52,40 @@ uint8_t get_length_for_instruction(const char* inst_name, uint8_t sp) {
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+
+// Parse an integer the way strtoll does with base 0, without exceptions.
+bool parse_integer(std::string_view text, int64_t &value) {
+    size_t pos = 0;
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+        ++pos;
+    bool negative = false;
+    if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+        negative = text[pos] == '-';
+        ++pos;
+    }
+
+    int base = 10;
+    if (pos < text.size() && text[pos] == '0') {
+        if (pos + 2 < text.size() && (text[pos + 1] == 'x' || text[pos + 1] == 'X') &&
+            std::isxdigit(static_cast<unsigned char>(text[pos + 2]))) {
+            base = 16;
+            pos += 2;
+        } else {
+            base = 8;
+        }
+    }
+
+    uint64_t magnitude = 0;
+    const char *begin = text.data() + pos;
+    auto [end, ec] = std::from_chars(begin, text.data() + text.size(), magnitude, base);
+    if (ec != std::errc() || end == begin)
+        return false;
+
+    // The range of long long, as for strtoll.
+    const uint64_t limit = negative ? uint64_t{1} << 63 : (uint64_t{1} << 63) - 1;
+    if (magnitude > limit)
+        return false;
+    value = negative ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+    return true;
+}
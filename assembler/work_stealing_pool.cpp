@@ -0,0 +1,76 @@
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class JobDeque {
+public:
+    void push(size_t job) { jobs.push_back(job); }
+
+    std::optional<size_t> take_front() {
+        std::lock_guard lock(mutex);
+        if (jobs.empty()) {
+            return std::nullopt;
+        }
+        size_t job = jobs.front();
+        jobs.pop_front();
+        return job;
+    }
+
+    std::optional<size_t> steal_back() {
+        std::lock_guard lock(mutex);
+        if (jobs.empty()) {
+            return std::nullopt;
+        }
+        size_t job = jobs.back();
+        jobs.pop_back();
+        return job;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+};
+
+} // namespace
+
+void run_work_stealing(size_t threads, std::span<const size_t> order, const std::function<void(size_t)> &job) {
+    threads = std::clamp<size_t>(threads, 1, std::max<size_t>(order.size(), 1));
+    if (threads == 1) {
+        for (size_t i : order) {
+            job(i);
+        }
+        return;
+    }
+
+    std::vector<JobDeque> deques(threads);
+    for (size_t k = 0; k < order.size(); ++k) {
+        deques[k % threads].push(order[k]);
+    }
+
+    // No job adds work, so a thread that finds every deque empty is done.
+    auto work = [&](size_t self) {
+        for (;;) {
+            std::optional<size_t> next = deques[self].take_front();
+            for (size_t step = 1; !next && step < threads; ++step) {
+                next = deques[(self + step) % threads].steal_back();
+            }
+            if (!next) {
+                return;
+            }
+            job(*next);
+        }
+    };
+    std::vector<std::jthread> workers;
+    workers.reserve(threads - 1);
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(work, t);
+    }
+    work(0);
+}
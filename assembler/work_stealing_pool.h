@@ -0,0 +1,20 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <cstddef>
+#include <functional>
+#include <span>
+
+/**
+ * Call job(i) once for every i in 'order', on up to 'threads' threads
+ * including the caller, and return when all calls have returned.
+ *
+ * The jobs are dealt round-robin, in 'order', to one deque per thread. A
+ * thread runs the jobs at the front of its own deque, and when that is empty
+ * steals from the back of another's, so a thread that drew short jobs helps
+ * with the rest. Putting the longest jobs first in 'order' keeps one long
+ * job from finishing last. 'job' must not throw.
+ */
+void run_work_stealing(size_t threads, std::span<const size_t> order, const std::function<void(size_t)> &job);
+
+#endif // WORK_STEALING_POOL_H
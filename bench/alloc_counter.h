@@ -0,0 +1,23 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdint>
+
+/*
+Counts heap allocations made through the global operator new. Linking
+alloc_counter.cpp into a program replaces the global allocation functions
+with counting wrappers around malloc; nothing else needs to change.
+*/
+namespace alloc_counter {
+
+struct Snapshot {
+    uint64_t allocations; // Calls to operator new (any form).
+    uint64_t bytes;       // Bytes requested by those calls.
+};
+
+// Totals since program start.
+Snapshot snapshot();
+
+} // namespace alloc_counter
+
+#endif // ALLOC_COUNTER_H
@@ -0,0 +1,183 @@
+// Measures instruction encoding on the instructions of a set of source files:
+// time and heap allocations per encoded instruction, for the generic encoder
+// and for the generated per-specifier encoders, after checking that both
+// produce the same code and relocations. Lexing, mnemonic lookup and
+// specifier selection happen once, outside the timed loop.
+
+#include "alloc_counter.h"
+
+#include "assembler/code_generator.h"
+#include "assembler/lexer.h"
+#include "assembler/parser.h"
+#include "assembler/source_buffer.h"
+#include "assembler/structural_index.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+struct EncodeJob {
+    const InstructionFormat *format;
+    const InstructionSpecifier *spec;
+    std::span<const Token> operands;
+};
+
+// One source file, lexed, with its instructions resolved to specifiers.
+struct Unit {
+    SourceBuffer source;
+    Lexer lexer;
+    std::vector<Token> tokens;
+    std::unique_ptr<CodeGenerator> code_generator;
+    std::vector<EncodeJob> jobs;
+};
+
+std::unique_ptr<Unit> load_unit(const std::string &path) {
+    auto unit = std::make_unique<Unit>();
+    if (!unit->source.open(path)) {
+        std::fprintf(stderr, "Cannot open %s\n", path.c_str());
+        return nullptr;
+    }
+    StructuralIndex index;
+    index.build(unit->source.text());
+    unit->lexer.firstPass(index);
+    unit->tokens = unit->lexer.secondPass(index);
+
+    unit->code_generator = std::make_unique<CodeGenerator>(LabelTable{});
+    Parser layout_parser(unit->tokens, Parser::Metadata(), *unit->code_generator);
+    layout_parser.layout();
+    layout_parser.relax();
+    unit->code_generator->label_table = std::move(layout_parser.label_address_table);
+    size_t next_relaxed = 0;
+
+    // Group operands and choose specifiers the way Parser::parse_instruction does.
+    const std::vector<Token> &tokens = unit->tokens;
+    for (size_t i = 0; i < tokens.size();) {
+        if (tokens[i].type != TokenType::Instruction) {
+            ++i;
+            continue;
+        }
+        const InstructionFormat *format = lookup_instruction(tokens[i].data);
+        size_t begin = ++i;
+        while (i < tokens.size() && tokens[i].type != TokenType::Instruction && tokens[i].type != TokenType::Label) {
+            ++i;
+        }
+        std::span<const Token> operands(tokens.data() + begin, i - begin);
+        if (!format) continue;
+        RelaxationCandidates candidates;
+        const InstructionSpecifier *spec = Parser::select_specifier(format, operands, &candidates);
+        if (spec && candidates.count != 0) spec = layout_parser.relaxed_specifiers[next_relaxed++];
+        if (spec) unit->jobs.push_back({format, spec, operands});
+    }
+    return unit;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    long rounds = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            rounds = std::strtol(optarg, nullptr, 10);
+        } else {
+            std::fprintf(stderr, "Usage: %s [-n rounds] file.s...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || rounds <= 0) {
+        std::fprintf(stderr, "Usage: %s [-n rounds] file.s...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Unit>> units;
+    size_t instructions = 0;
+    for (int i = optind; i < argc; ++i) {
+        auto unit = load_unit(argv[i]);
+        if (!unit) return 1;
+        instructions += unit->jobs.size();
+        units.push_back(std::move(unit));
+    }
+    if (instructions == 0) {
+        std::fprintf(stderr, "No instructions to encode.\n");
+        return 1;
+    }
+
+    using EncodeFn = void (CodeGenerator::*)(const InstructionFormat *, const InstructionSpecifier *,
+                                             std::span<const Token>, std::vector<uint8_t> &);
+    std::vector<uint8_t> object_code;
+    auto run_round = [&](EncodeFn encode) {
+        for (auto &unit : units) {
+            object_code.clear();
+            unit->code_generator->relocation_entries.clear();
+            unit->code_generator->base_fixups.clear();
+            for (const EncodeJob &job : unit->jobs) {
+                ((*unit->code_generator).*encode)(job.format, job.spec, job.operands, object_code);
+            }
+        }
+    };
+
+    // The generated encoders must produce what the generic one does.
+    size_t mismatches = 0;
+    std::vector<uint8_t> generic_code;
+    for (auto &unit : units) {
+        CodeGenerator &code_generator = *unit->code_generator;
+        object_code.clear();
+        generic_code.clear();
+        code_generator.relocation_entries.clear();
+        code_generator.base_fixups.clear();
+        for (const EncodeJob &job : unit->jobs) {
+            code_generator.assemble_instruction(job.format, job.spec, job.operands, object_code);
+        }
+        auto generated_relocations = std::move(code_generator.relocation_entries);
+        auto generated_fixups = std::move(code_generator.base_fixups);
+        code_generator.relocation_entries.clear();
+        code_generator.base_fixups.clear();
+        for (const EncodeJob &job : unit->jobs) {
+            code_generator.assemble_instruction_generic(job.format, job.spec, job.operands, generic_code);
+        }
+        bool same = object_code == generic_code && generated_fixups == code_generator.base_fixups &&
+                    std::equal(generated_relocations.begin(), generated_relocations.end(),
+                               code_generator.relocation_entries.begin(), code_generator.relocation_entries.end(),
+                               [](const auto &a, const auto &b) { return a.label == b.label && a.address == b.address; });
+        if (!same) ++mismatches;
+    }
+
+    std::printf("%zu files, %zu instructions, %ld rounds\n", units.size(), instructions, rounds);
+    const double encoded = static_cast<double>(instructions) * static_cast<double>(rounds);
+    double ns_per_instruction[2];
+    const EncodeFn paths[2] = {&CodeGenerator::assemble_instruction_generic, &CodeGenerator::assemble_instruction};
+    const char *names[2] = {"generic", "generated"};
+    for (int path = 0; path < 2; ++path) {
+        // Warm up, which also grows the output buffers to their final size.
+        run_round(paths[path]);
+
+        const alloc_counter::Snapshot before = alloc_counter::snapshot();
+        const auto start = std::chrono::steady_clock::now();
+        for (long r = 0; r < rounds; ++r) {
+            run_round(paths[path]);
+        }
+        const auto stop = std::chrono::steady_clock::now();
+        const alloc_counter::Snapshot after = alloc_counter::snapshot();
+
+        ns_per_instruction[path] = std::chrono::duration<double, std::nano>(stop - start).count() / encoded;
+        std::printf("  %-9s %8.1f ns/instruction  %.3f allocations/instruction  %.1f bytes/instruction\n",
+                    names[path],
+                    ns_per_instruction[path],
+                    static_cast<double>(after.allocations - before.allocations) / encoded,
+                    static_cast<double>(after.bytes - before.bytes) / encoded);
+    }
+    std::printf("  speedup   %8.2fx\n", ns_per_instruction[0] / ns_per_instruction[1]);
+    if (mismatches != 0) {
+        std::fprintf(stderr, "%zu files encode differently with the generated encoders.\n", mismatches);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,372 @@
+// Measures the assembler and the linker end to end on generated programs
+// (see program_generator.h): wall time, heap allocations and throughput of
+// each phase, and the peak resident set size of each program, which runs in
+// a process of its own, as JSON on standard output. The phases are those of nc16x32-as and nc16x32-ld:
+//
+//   lexer                  structural index and both lexer passes
+//   parser                 layout and relaxation: specifier selection and
+//                          label addresses
+//   code_generator         encoding, through Parser::parse()
+//   object_file_generator  writing the object file to disk with
+//                          ObjectFileGenerator::write(), as nc16x32-as does
+//   linker_read            mapping the object files
+//   linker_parse           reading and checking their tables
+//   linker_layout          placing the sections and rebasing references
+//   linker_relocate        patching references to other files' labels
+//
+// What the linker prints goes to /dev/null. Each program is measured -r
+// times; a phase reports its fastest run, and the allocations of the last.
+// If a program fails to assemble or link, the error goes to standard error
+// and the JSON ends with the programs measured before it.
+
+#include "alloc_counter.h"
+#include "program_generator.h"
+
+#include "assembler/code_generator.h"
+#include "assembler/lexer.h"
+#include "assembler/object_file_generator.h"
+#include "assembler/parser.h"
+#include "assembler/structural_index.h"
+#include "linker/memory_layout.h"
+#include "linker/object_files_parser.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+enum Phase {
+    kLexer,
+    kParser,
+    kCodeGenerator,
+    kObjectFileGenerator,
+    kLinkerRead,
+    kLinkerParse,
+    kLinkerLayout,
+    kLinkerRelocate,
+    kPhaseCount,
+};
+
+constexpr const char *kPhaseNames[kPhaseCount] = {
+    "lexer", "parser", "code_generator", "object_file_generator",
+    "linker_read", "linker_parse", "linker_layout", "linker_relocate",
+};
+
+struct PhaseResult {
+    uint64_t ns = 0;
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+};
+
+using PhaseResults = std::array<PhaseResult, kPhaseCount>;
+
+// Run 'work', adding its time and allocations to 'result'.
+template <typename Work>
+void measure(PhaseResult &result, Work work) {
+    const alloc_counter::Snapshot before = alloc_counter::snapshot();
+    const auto start = std::chrono::steady_clock::now();
+    work();
+    const auto stop = std::chrono::steady_clock::now();
+    const alloc_counter::Snapshot after = alloc_counter::snapshot();
+    result.ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+    result.allocations += after.allocations - before.allocations;
+    result.allocated_bytes += after.bytes - before.bytes;
+}
+
+// Peak resident set size of this process, in bytes.
+uint64_t peak_rss() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss); // In bytes on macOS,
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // in KiB elsewhere.
+#endif
+}
+
+// Files removed when it goes out of scope, then its directory if it has one.
+struct TemporaryFiles {
+    TemporaryFiles() = default;
+    TemporaryFiles(const TemporaryFiles &) = delete;
+    TemporaryFiles &operator=(const TemporaryFiles &) = delete;
+    ~TemporaryFiles() {
+        for (const std::string &path : paths) {
+            ::unlink(path.c_str());
+        }
+        if (!directory.empty()) {
+            ::rmdir(directory.c_str());
+        }
+    }
+
+    std::vector<std::string> paths;
+    std::string directory;
+};
+
+// Sizes of one generated program and what it assembled and linked into.
+struct ProgramSizes {
+    size_t lines = 0;
+    size_t source_bytes = 0;
+    size_t instructions = 0;
+    size_t label_references = 0;
+    size_t object_bytes = 0;
+    size_t image_bytes = 0;
+};
+
+/**
+ * Assemble and link 'program' once, in the directory 'work_dir'.
+ *
+ * @return False after reporting to std::cerr if it does not assemble
+ * without a diagnostic, or does not link.
+ */
+bool run_once(const std::vector<GeneratedFile> &program, const std::string &work_dir, PhaseResults &results,
+              ProgramSizes &sizes) {
+    sizes.object_bytes = 0;
+    TemporaryFiles objects_written;
+    std::vector<std::string> &object_paths = objects_written.paths;
+    for (const GeneratedFile &file : program) {
+        std::ostringstream diagnostics;
+        StructuralIndex index;
+        Lexer lexer;
+        lexer.setDiagnostics(diagnostics);
+        std::vector<Token> tokens;
+        measure(results[kLexer], [&] {
+            index.build(file.text);
+            lexer.firstPass(index);
+            tokens = lexer.secondPass(index);
+        });
+
+        CodeGenerator code_generator(LabelTable{});
+        code_generator.diagnostics = &diagnostics;
+        Parser parser(std::move(tokens), Parser::Metadata(), code_generator);
+        parser.diagnostics = &diagnostics;
+        measure(results[kParser], [&] {
+            parser.layout();
+            parser.relax();
+        });
+        measure(results[kCodeGenerator], [&] {
+            code_generator.label_table = parser.label_address_table;
+            parser.rewind();
+            parser.parse();
+        });
+
+        if (!diagnostics.str().empty()) {
+            std::cerr << file.name << " does not assemble:\n" << diagnostics.str().substr(0, 2000);
+            return false;
+        }
+
+        object_paths.push_back(work_dir + "/" + file.name + ".o");
+        bool written = false;
+        measure(results[kObjectFileGenerator], [&] {
+            ObjectFileGenerator generator(code_generator.relocation_entries, code_generator.base_fixups,
+                                          parser.label_address_table, parser.object_code, parser.data,
+                                          parser.bss_size);
+            int fd = ::open(object_paths.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd >= 0) {
+                written = generator.write(fd);
+                written = ::close(fd) == 0 && written;
+            }
+        });
+        struct stat object{};
+        if (!written || ::stat(object_paths.back().c_str(), &object) != 0) {
+            std::cerr << "Cannot write " << object_paths.back() << "\n";
+            return false;
+        }
+        sizes.object_bytes += static_cast<size_t>(object.st_size);
+    }
+
+    std::ofstream null_output("/dev/null");
+    std::streambuf *saved_output = std::cout.rdbuf(null_output.rdbuf());
+    bool linked = false;
+    {
+        std::optional<object_files_parser> objects;
+        measure(results[kLinkerRead], [&] { objects.emplace(object_paths); });
+        measure(results[kLinkerParse], [&] { linked = objects->validate_all_files(); });
+        if (linked) {
+            std::optional<memory_layout> layout;
+            measure(results[kLinkerLayout], [&] {
+                layout.emplace(objects->sections_per_file, objects->label_info_per_file,
+                               objects->relocation_info_per_file, objects->base_fixups_per_file);
+                layout->extract_object_codes();
+            });
+            measure(results[kLinkerRelocate], [&] { layout->relocate_memory_layout(); });
+            sizes.image_bytes = layout->memory.size();
+        }
+    }
+    std::cout.rdbuf(saved_output);
+    if (!linked) {
+        std::cerr << "The generated program does not link.\n";
+    }
+    return linked;
+}
+
+void print_phase(const char *name, const PhaseResult &phase, double input_bytes, double lines, bool last) {
+    const double seconds = static_cast<double>(std::max<uint64_t>(phase.ns, 1)) / 1e9;
+    std::printf("        {\"name\": \"%s\", \"ns\": %llu, \"allocations\": %llu, \"allocated_bytes\": %llu, "
+                "\"mb_per_second\": %.2f",
+                name,
+                static_cast<unsigned long long>(phase.ns),
+                static_cast<unsigned long long>(phase.allocations),
+                static_cast<unsigned long long>(phase.allocated_bytes),
+                input_bytes / 1e6 / seconds);
+    if (lines > 0) {
+        std::printf(", \"lines_per_second\": %.0f", lines / seconds);
+    }
+    std::printf("}%s\n", last ? "" : ",");
+}
+
+/**
+ * Measure the program 'shape' describes 'repetitions' times, in 'work_dir',
+ * and print its entry in the JSON, after a comma unless it is the 'first'.
+ *
+ * @return False after reporting to std::cerr, printing nothing, if it does
+ * not assemble or link.
+ */
+bool measure_program(const ProgramShape &shape, long repetitions, const std::string &work_dir, bool first) {
+    const std::vector<GeneratedFile> program = generate_program(shape);
+    ProgramSizes sizes;
+    for (const GeneratedFile &file : program) {
+        sizes.lines += file.lines;
+        sizes.source_bytes += file.text.size();
+        sizes.instructions += file.instructions;
+        sizes.label_references += file.label_references;
+    }
+
+    PhaseResults best;
+    for (PhaseResult &phase : best) phase.ns = std::numeric_limits<uint64_t>::max();
+    bool ok = true;
+    for (long r = 0; r < repetitions && ok; ++r) {
+        PhaseResults run{};
+        ok = run_once(program, work_dir, run, sizes);
+        for (size_t p = 0; p < kPhaseCount; ++p) {
+            best[p] = {std::min(best[p].ns, run[p].ns), run[p].allocations, run[p].allocated_bytes};
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+
+    std::printf("%s    {\n", first ? "" : ",\n");
+    std::printf("      \"lines\": %zu, \"files\": %zu, \"label_density\": %g, \"relocation_density\": %g, "
+                "\"data_share\": %g, \"seed\": %llu,\n",
+                sizes.lines, program.size(), shape.label_density, shape.relocation_density, shape.data_share,
+                static_cast<unsigned long long>(shape.seed));
+    std::printf("      \"source_bytes\": %zu, \"instructions\": %zu, \"label_references\": %zu, "
+                "\"object_bytes\": %zu, \"image_bytes\": %zu,\n",
+                sizes.source_bytes, sizes.instructions, sizes.label_references, sizes.object_bytes,
+                sizes.image_bytes);
+    std::printf("      \"peak_rss_bytes\": %llu,\n", static_cast<unsigned long long>(peak_rss()));
+    std::printf("      \"phases\": [\n");
+    for (size_t p = 0; p < kPhaseCount; ++p) {
+        const bool assembling = p <= kObjectFileGenerator;
+        print_phase(kPhaseNames[p], best[p],
+                    static_cast<double>(assembling ? sizes.source_bytes : sizes.object_bytes),
+                    assembling ? static_cast<double>(sizes.lines) : 0, p + 1 == kPhaseCount);
+    }
+    std::printf("      ]\n    }");
+    return true;
+}
+
+void print_usage(const char *program) {
+    std::fprintf(stderr,
+                 "Usage: %s [-l lines[,lines...]] [-f files] [-L label_density] [-R relocation_density]\n"
+                 "          [-d data_share] [-s seed] [-r repetitions] [-w directory]\n"
+                 "  -w writes the generated sources of the first size to the directory instead.\n",
+                 program);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    ProgramShape shape;
+    std::vector<size_t> line_counts;
+    long repetitions = 3;
+    std::string write_dir;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:f:L:R:d:s:r:w:")) != -1) {
+        switch (opt) {
+            case 'l': {
+                std::stringstream list(optarg);
+                for (std::string count; std::getline(list, count, ',');) {
+                    line_counts.push_back(std::strtoull(count.c_str(), nullptr, 10));
+                }
+                break;
+            }
+            case 'f': shape.files = std::strtoull(optarg, nullptr, 10); break;
+            case 'L': shape.label_density = std::strtod(optarg, nullptr); break;
+            case 'R': shape.relocation_density = std::strtod(optarg, nullptr); break;
+            case 'd': shape.data_share = std::strtod(optarg, nullptr); break;
+            case 's': shape.seed = std::strtoull(optarg, nullptr, 10); break;
+            case 'r': repetitions = std::strtol(optarg, nullptr, 10); break;
+            case 'w': write_dir = optarg; break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (line_counts.empty()) {
+        line_counts = {1000, 10000, 100000};
+    }
+    if (optind != argc || repetitions <= 0 || shape.files == 0 ||
+        std::find(line_counts.begin(), line_counts.end(), 0) != line_counts.end()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!write_dir.empty()) {
+        shape.lines = line_counts.front();
+        for (const GeneratedFile &file : generate_program(shape)) {
+            std::ofstream out(write_dir + "/" + file.name, std::ios::binary | std::ios::trunc);
+            out << file.text;
+            if (!out.flush()) {
+                std::cerr << "Cannot write " << write_dir << "/" << file.name << "\n";
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    char work_dir[] = "/tmp/nc16x32-bench-XXXXXX";
+    if (!::mkdtemp(work_dir)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    TemporaryFiles work;
+    work.directory = work_dir;
+
+    std::printf("{\n  \"benchmark\": \"pipeline\",\n  \"repetitions\": %ld,\n  \"programs\": [\n", repetitions);
+    bool ok = true;
+    for (size_t n = 0; n < line_counts.size() && ok; ++n) {
+        shape.lines = line_counts[n];
+        // Each program is measured in a process of its own, so that the
+        // peak resident set size is its own.
+        std::fflush(stdout);
+        const pid_t child = ::fork();
+        if (child == 0) {
+            const bool measured = measure_program(shape, repetitions, work_dir, n == 0);
+            std::fflush(stdout);
+            ::_exit(measured ? 0 : 1);
+        }
+        if (child < 0) {
+            std::perror("fork");
+        }
+        int status = 0;
+        ok = child > 0 && ::waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    std::printf("\n  ]\n}\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include "program_generator.h"
+
+#include "assembler/machine_description.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace {
+
+// Registers the generated code uses; every register field holds them.
+constexpr unsigned kRegisters = 16;
+
+class FileWriter {
+public:
+    FileWriter(const ProgramShape &shape, size_t files, size_t file_index, size_t labels_per_file,
+               std::mt19937_64 &random)
+        : shape_(shape), files_(files), file_index_(file_index), labels_per_file_(labels_per_file), random_(random) {}
+
+    void write(GeneratedFile &file, size_t lines) {
+        file.text.reserve(lines * 24);
+        size_t next_label = 0;
+        for (size_t line = 0; line < lines; ++line) {
+            // Labels are spread evenly, the first on the first line.
+            if (next_label < labels_per_file_ && line == next_label * lines / labels_per_file_) {
+                append_label(file.text, file_index_, next_label++);
+                file.text += ":\n";
+            } else if (chance(shape_.data_share)) {
+                write_data(file);
+            } else {
+                write_instruction(file);
+            }
+        }
+        file.lines = lines;
+    }
+
+private:
+    bool chance(double p) { return std::uniform_real_distribution<double>(0.0, 1.0)(random_) < p; }
+    uint64_t below(uint64_t n) { return std::uniform_int_distribution<uint64_t>(0, n - 1)(random_); }
+
+    static void append_label(std::string &out, size_t file_index, size_t label_index) {
+        char name[48];
+        std::snprintf(name, sizeof(name), "f%zu_l%zu", file_index, label_index);
+        out += name;
+    }
+
+    static void append_hex(std::string &out, uint64_t value) {
+        char text[24];
+        std::snprintf(text, sizeof(text), "0x%llX", static_cast<unsigned long long>(value));
+        out += text;
+    }
+
+    void append_label_reference(GeneratedFile &file) {
+        size_t target = file_index_;
+        if (files_ > 1 && chance(shape_.relocation_density)) {
+            target = (file_index_ + 1 + below(files_ - 1)) % files_;
+        }
+        append_label(file.text, target, below(labels_per_file_));
+        ++file.label_references;
+    }
+
+    void write_data(GeneratedFile &file) {
+        file.text += "    db ";
+        const uint64_t count = 1 + below(8);
+        for (uint64_t i = 0; i < count; ++i) {
+            if (i != 0) file.text += ", ";
+            // Now and then a 4-byte label address.
+            if (below(8) == 0) {
+                append_label_reference(file);
+            } else {
+                append_hex(file.text, below(256));
+            }
+        }
+        file.text += '\n';
+    }
+
+    void write_instruction(GeneratedFile &file) {
+        const InstructionFormat &format = instructions[below(num_instructions)];
+        const InstructionSpecifier &spec = format.specifiers[below(format.num_specifiers)];
+        std::string &out = file.text;
+        out += "    ";
+        out += format.name;
+        for (size_t i = 0; i < spec.num_operands; ++i) {
+            out += i == 0 ? " " : ", ";
+            switch (spec.operands[i]) {
+                case OperandKind::Register:
+                    out += std::to_string(below(kRegisters));
+                    break;
+                case OperandKind::RegisterLow:
+                    out += std::to_string(below(kRegisters)) + ".L";
+                    break;
+                case OperandKind::RegisterHigh:
+                    out += std::to_string(below(kRegisters)) + ".H";
+                    break;
+                case OperandKind::Immediate:
+                    out += '#';
+                    append_hex(out, below(0x10000));
+                    break;
+                case OperandKind::Memory:
+                    out += '[';
+                    append_hex(out, below(0x10000));
+                    out += ']';
+                    break;
+                case OperandKind::OffsetMemory:
+                    out += '[' + std::to_string(below(kRegisters)) + " + #";
+                    append_hex(out, below(0x100));
+                    out += ']';
+                    break;
+                case OperandKind::Label:
+                    append_label_reference(file);
+                    break;
+                case OperandKind::None:
+                    break;
+            }
+        }
+        out += '\n';
+        ++file.instructions;
+    }
+
+    const ProgramShape &shape_;
+    size_t files_;
+    size_t file_index_;
+    size_t labels_per_file_;
+    std::mt19937_64 &random_;
+};
+
+} // namespace
+
+std::vector<GeneratedFile> generate_program(const ProgramShape &shape) {
+    const size_t files = std::max<size_t>(shape.files, 1);
+    const size_t lines_per_file = std::max<size_t>(shape.lines / files, 1);
+    const auto labels_per_file = std::clamp<size_t>(
+        static_cast<size_t>(static_cast<double>(lines_per_file) * shape.label_density), 1, lines_per_file);
+
+    std::mt19937_64 random(shape.seed);
+    std::vector<GeneratedFile> program(files);
+    for (size_t i = 0; i < files; ++i) {
+        program[i].name = "gen" + std::to_string(i) + ".s";
+        FileWriter(shape, files, i, labels_per_file, random).write(program[i], lines_per_file);
+    }
+    return program;
+}
@@ -0,0 +1,36 @@
+#ifndef PROGRAM_GENERATOR_H
+#define PROGRAM_GENERATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Generates random assembly programs for the benchmarks. Every instruction is
+drawn from the instructions[] table of the machine description: a uniformly
+chosen mnemonic, then one of its specifiers, with operands of the kinds the
+specifier's syntax takes. The programs assemble without a diagnostic and
+link: a label reference names a label of the same file, or of another file
+of the program (an external reference, which the linker relocates).
+*/
+struct ProgramShape {
+    size_t lines = 1000;             // In all the files together.
+    size_t files = 4;
+    double label_density = 0.05;     // Share of lines that define a label.
+    double relocation_density = 0.3; // Share of label references to another file.
+    double data_share = 0.1;         // Share of lines that are "db" directives.
+    uint64_t seed = 1;
+};
+
+struct GeneratedFile {
+    std::string name; // "gen<N>.s"
+    std::string text;
+    size_t lines = 0;
+    size_t instructions = 0;
+    size_t label_references = 0;
+};
+
+std::vector<GeneratedFile> generate_program(const ProgramShape &shape);
+
+#endif // PROGRAM_GENERATOR_H
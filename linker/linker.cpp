@@ -15,6 +15,7 @@
 
 #include "memory_layout.h"
 #include "object_files_parser.h"
+#include "assembler/stats.h"
 
 void print_hex_dump(const std::vector<uint8_t>& object_file) {
     if (object_file.empty()) return; // Early return if the input vector is empty
@@ -78,9 +79,12 @@ void print_hex_dump(const std::vector<uint8_t>& object_file) {
 int main(const int argc, char* argv[]) {
     std::vector<std::string> inputFiles;
     std::string outputFile = "a.out";
+    // --stats: print the time and heap use of each phase to std::cerr, as JSON with --stats=json.
+    bool print_stats = false;
+    bool stats_json = false;
 
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <input_files> [-o <output_file>]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <input_files> [-o <output_file>] [--stats[=json]]" << std::endl;
         return 1;
     }
 
@@ -94,6 +98,12 @@ int main(const int argc, char* argv[]) {
                 std::cerr << "Error: Missing output file name after -o" << std::endl;
                 return 1;
             }
+        } else if (arg == "--stats" || arg == "--stats=text" || arg == "--stats=json") {
+            print_stats = true;
+            stats_json = arg == "--stats=json";
+        } else if (arg.starts_with("--stats=")) {
+            std::cerr << "Error: Unknown statistics format: " << arg.substr(8) << std::endl;
+            return 1;
         } else {
             inputFiles.push_back(arg);
         }
@@ -110,21 +120,66 @@ int main(const int argc, char* argv[]) {
     }
     std::cout << "Output file: " << outputFile << std::endl;
 
+    const uint64_t start_ns = wall_clock_ns();
+    Stats collected;
+    Stats *stats = print_stats ? &collected : nullptr;
+
     // Actual linking logic would go here
-    auto o_files_parser = new object_files_parser(inputFiles);
+    object_files_parser *o_files_parser;
+    {
+        PhaseTimer timer(stats, "read");
+        o_files_parser = new object_files_parser(inputFiles);
+    }
 
-    o_files_parser->validate_all_files();
+    {
+        PhaseTimer timer(stats, "parse");
+        o_files_parser->validate_all_files();
+
+        o_files_parser->log_label_info();
+    }
+
+    memory_layout *memory_class;
+    {
+        PhaseTimer timer(stats, "layout");
+        memory_class = new memory_layout(o_files_parser->sections_per_file, o_files_parser->label_info_per_file,
+                                         o_files_parser->relocation_info_per_file, o_files_parser->base_fixups_per_file);
+        memory_class->extract_object_codes();
+    }
+    {
+        PhaseTimer timer(stats, "relocate");
+        memory_class->relocate_memory_layout();
+    }
 
-    o_files_parser->log_label_info();
+    {
+        PhaseTimer timer(stats, "write");
+        print_hex_dump(memory_class->memory);
 
-    auto memory_class = new memory_layout(o_files_parser->object_file_vectors, o_files_parser->label_info_per_file, o_files_parser->relocation_info_per_file);
+        std::ofstream output_file(outputFile, std::ios::binary);
+        if (output_file.is_open()) {
+            output_file.write(reinterpret_cast<const char*>(memory_class->memory.data()), static_cast<std::streamsize>(memory_class->memory.size()));
+            output_file.close();
+        } else {
+            std::cerr << "Failed to open file: " << outputFile << std::endl;
+        }
+    }
 
-    std::ofstream output_file(outputFile, std::ios::binary);
-    if (output_file.is_open()) {
-        output_file.write(reinterpret_cast<const char*>(memory_class->memory.data()), static_cast<std::streamsize>(memory_class->memory.size()));
-        output_file.close();
-    } else {
-        std::cerr << "Failed to open file: " << outputFile << std::endl;
+    if (stats) {
+        stats->add("objects", o_files_parser->mapped_files.size());
+        for (const mapped_file &file : o_files_parser->mapped_files) {
+            stats->add("object_bytes", file.size());
+        }
+        for (const auto &labels : o_files_parser->label_info_per_file) {
+            stats->add("labels", labels.size());
+        }
+        for (const auto &relocations : o_files_parser->relocation_info_per_file) {
+            stats->add("relocations", relocations.size());
+        }
+        for (const auto &fixups : o_files_parser->base_fixups_per_file) {
+            stats->add("base_fixups", fixups.size());
+        }
+        stats->add("image_bytes", memory_class->memory.size());
+        std::cout << std::flush;
+        stats->print(std::cerr, "nc16x32-ld", wall_clock_ns() - start_ns, stats_json);
     }
 
 
@@ -8,21 +8,48 @@
 
 #include <vector>
 #include <cstdint>
+#include <span>
+#include <string_view>
+
+// The sections of an object file; the linker places each kind together.
+enum class SectionKind : std::uint8_t {
+    Text,
+    Data,
+    Bss
+};
+
+// The contents of one object file's sections, in its mapping.
+struct ObjectSections {
+    std::span<const std::uint8_t> text;
+    std::span<const std::uint8_t> data;
+    std::uint32_t bss_size = 0; // Bss has no contents.
+};
 
+// Names point into the mapped object files.
 struct LabelInfo {
-    std::string name;
-    uint32_t address;
+    std::string_view name;
+    uint32_t address; // Relative to its section, until memory_layout places it.
+    SectionKind section = SectionKind::Text;
+};
+
+// A 32-bit field holding an address in the same file, relative to the start
+// of section 'target'.
+struct BaseFixup {
+    std::uint32_t address; // Of the field, relative to the start of 'section'.
+    SectionKind section;
+    SectionKind target;
 };
 
 struct RelocationInfo {
     std::uint32_t address;
+    SectionKind section;       // Holding the field; address is relative to it.
     bool is_external;          // true if the relocation refers to an external label.
-    std::uint16_t local_index; // valid if is_external == false.
-    std::string external_label; // valid if is_external == true.
+    std::uint32_t local_index; // valid if is_external == false.
+    std::string_view external_label; // valid if is_external == true.
     // Instead of a global absolute index, we now store a pair:
     // first: file index (i.e., which file’s label table),
     // second: label index within that file.
-    std::pair<size_t, std::uint16_t> label_location;
+    std::pair<size_t, std::uint32_t> label_location;
 };
 
 
@@ -0,0 +1,82 @@
+//
+// Maps object files into memory for the linker.
+//
+
+#include "mapped_file.h"
+
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_file::~mapped_file() {
+    release();
+}
+
+mapped_file::mapped_file(mapped_file &&other) noexcept {
+    *this = std::move(other);
+}
+
+mapped_file &mapped_file::operator=(mapped_file &&other) noexcept {
+    if (this != &other) {
+        release();
+        mapped_ = other.mapped_;
+        owned_ = std::move(other.owned_);
+        size_ = other.size_;
+        data_ = mapped_ ? other.data_ : owned_.data();
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.mapped_ = false;
+    }
+    return *this;
+}
+
+void mapped_file::release() {
+    if (mapped_ && data_) {
+        munmap(const_cast<uint8_t *>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    owned_.clear();
+}
+
+bool mapped_file::open(const std::string &path) {
+    release();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) {
+            ::close(fd);
+            return true;
+        }
+        void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            ::close(fd);
+            data_ = static_cast<const uint8_t *>(addr);
+            mapped_ = true;
+            return true;
+        }
+        size_ = 0;
+    }
+    ::close(fd);
+
+    // Fall back to reading the whole stream.
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    owned_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data_ = owned_.data();
+    size_ = owned_.size();
+    return true;
+}
@@ -0,0 +1,52 @@
+//
+// Maps object files into memory for the linker.
+//
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+mapped_file owns the bytes of one object file for the whole link.
+
+Regular files are mapped read-only with mmap, so that the linker can use the
+records of an LF02 file where they lie, without copying or decoding them;
+anything that cannot be mapped (pipes, character devices) is read into an
+owned buffer instead. Names and code taken from the file point into these
+bytes, so the mapped_file must outlive them.
+*/
+class mapped_file {
+public:
+    mapped_file() = default;
+    ~mapped_file();
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+    mapped_file(mapped_file &&other) noexcept;
+    mapped_file &operator=(mapped_file &&other) noexcept;
+
+    /**
+     * Map (or read) the file at 'path', replacing any previous contents.
+     *
+     * @param path Path of the object file.
+     * @return False if the file could not be opened or read.
+     */
+    bool open(const std::string &path);
+
+    [[nodiscard]] const uint8_t *data() const { return data_; }
+    [[nodiscard]] size_t size() const { return size_; }
+
+private:
+    void release();
+
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<uint8_t> owned_; // Used when the file cannot be mapped.
+};
+
+#endif // MAPPED_FILE_H
@@ -7,8 +7,10 @@
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <array>
 #include <limits>
 #include <map>
+#include <unordered_map>
 
 #include "linker.h"
 #include <cstdint>
@@ -19,82 +21,69 @@
 #include <arpa/inet.h>  // for ntohl()
 
 void memory_layout::extract_object_codes() {
-    // For each object file with its index.
-    for (size_t file_index = 0; file_index < object_files.size(); ++file_index) {
-        const auto &file = object_files[file_index];
-        // Create a binary input stream from the raw file data.
-        std::istringstream file_stream(
-            std::string(file.begin(), file.end()),
-            std::ios::binary
-        );
-
-        // --- Header Layout ---
-        // Bytes  0-3: Magic ("LF01")
-        // Bytes  4-5: Version (0x0001)
-        // Bytes  6-7: Flags.
-        // Bytes  8-15: Timestamp.
-        // Bytes 16-19: Machine Code Length.
-        // Bytes 20-23: Label Table Offset.
-        // Bytes 24-27: Relocation Table Offset.
-        // Bytes 28-31: Metadata Offset.
-        //
-        // We only need the machine code length (offset 16).
-
-        // Seek to byte offset 16.
-        file_stream.seekg(16, std::ios::beg);
-        if (!file_stream) {
-            std::cerr << "Error: Could not seek to machine code length field in file index " << file_index << std::endl;
-            continue;
-        }
-
-        // Read the 4-byte machine code length.
-        std::uint32_t machine_code_length;
-        file_stream.read(reinterpret_cast<char *>(&machine_code_length), sizeof(machine_code_length));
-        if (!file_stream) {
-            std::cerr << "Error: Could not read machine code length in file index " << file_index << std::endl;
-            continue;
-        }
-        // Convert from network byte order to host order.
-        machine_code_length = ntohl(machine_code_length);
-
-        // The machine code itself starts at offset 32.
-        file_stream.seekg(32, std::ios::beg);
-        if (!file_stream) {
-            std::cerr << "Error: Could not seek to machine code section in file index " << file_index << std::endl;
-            continue;
-        }
-
-        // Read the machine code bytes into a temporary vector.
-        std::vector<uint8_t> temp_code(machine_code_length);
-        file_stream.read(reinterpret_cast<char *>(temp_code.data()), machine_code_length);
-        if (!file_stream) {
-            std::cerr << "Error: Incomplete machine code read in file index " << file_index << std::endl;
-            continue;
-        }
-
-        // Get the base offset where this file's code will be placed in the final memory buffer.
-        size_t base_offset = memory.size();
-
-        // Append the temporary machine code directly into the unified memory buffer.
-        memory.insert(memory.end(), temp_code.begin(), temp_code.end());
+    // Each kind of section is placed together, in file order: all .text,
+    // then all .data, then all .bss. The image stores .text and .data; .bss
+    // only takes the addresses after its end.
+    const size_t file_count = sections_per_file.size();
+    std::vector<std::array<uint32_t, 3>> section_base(file_count);
+    auto base_of = [&](size_t file_index, SectionKind section) {
+        return section_base[file_index][static_cast<size_t>(section)];
+    };
+    for (size_t file_index = 0; file_index < file_count; ++file_index) {
+        std::span<const uint8_t> text = sections_per_file[file_index].text;
+        section_base[file_index][static_cast<size_t>(SectionKind::Text)] = static_cast<uint32_t>(memory.size());
+        memory.insert(memory.end(), text.begin(), text.end());
+    }
+    for (size_t file_index = 0; file_index < file_count; ++file_index) {
+        std::span<const uint8_t> data = sections_per_file[file_index].data;
+        section_base[file_index][static_cast<size_t>(SectionKind::Data)] = static_cast<uint32_t>(memory.size());
+        memory.insert(memory.end(), data.begin(), data.end());
+    }
+    auto bss_end = static_cast<uint32_t>(memory.size());
+    for (size_t file_index = 0; file_index < file_count; ++file_index) {
+        section_base[file_index][static_cast<size_t>(SectionKind::Bss)] = bss_end;
+        bss_end += sections_per_file[file_index].bss_size;
+    }
+    if (bss_end != memory.size()) {
+        std::cout << "Bss: " << bss_end - memory.size() << " bytes at " << memory.size()
+                  << ", not stored in the image" << std::endl;
+    }
 
+    for (size_t file_index = 0; file_index < file_count; ++file_index) {
         // Fix-up label addresses for this file:
-        // Each label's original file-relative address is updated by adding the base offset.
+        // Each label's section-relative address is updated by adding the section's base.
         for (auto &label : label_info_per_file[file_index]) {
-            label.address += static_cast<int>(base_offset);
+            label.address += base_of(file_index, label.section);
+        }
+
+        // Rebase the file's references to its own labels, which the
+        // assembler wrote as section-relative addresses.
+        if (file_index < base_fixups_per_file.size()) {
+            for (const BaseFixup &fixup : base_fixups_per_file[file_index]) {
+                const uint32_t target_base = base_of(file_index, fixup.target);
+                if (target_base == 0) continue;
+                uint8_t *field = memory.data() + base_of(file_index, fixup.section) + fixup.address;
+                uint32_t address = (uint32_t{field[0]} << 24) | (uint32_t{field[1]} << 16) |
+                                   (uint32_t{field[2]} << 8) | uint32_t{field[3]};
+                address += target_base;
+                field[0] = (address >> 24) & 0xFF;
+                field[1] = (address >> 16) & 0xFF;
+                field[2] = (address >> 8) & 0xFF;
+                field[3] = address & 0xFF;
+            }
         }
 
         // Fix-up relocation reference addresses for this file:
-        // Each relocation's original file-relative ref_address is updated by adding the base offset.
+        // Each relocation's section-relative address is updated by adding the section's base.
         for (auto &reloc : relocation_info_per_file[file_index]) {
-            reloc.address += static_cast<int>(base_offset);
+            reloc.address += base_of(file_index, reloc.section);
         }
     }
 }
 
 void memory_layout::relocate_memory_layout() {
     // Build a mapping from label name to unified address.
-    std::map<std::string, uint32_t> unified_label_map;
+    std::unordered_map<std::string_view, uint32_t> unified_label_map;
     for (const auto &labels_in_file : label_info_per_file) {
         for (const auto &label : labels_in_file) {
             unified_label_map[label.name] = label.address;
@@ -117,7 +106,7 @@ void memory_layout::relocate_memory_layout() {
                           << ") in relocation entry for file " << file_index << ".\n";
                 continue;
             }
-            std::string symbol = label_info_per_file[file_index][label_index].name;
+            std::string_view symbol = label_info_per_file[file_index][label_index].name;
             auto it = unified_label_map.find(symbol);
             if (it == unified_label_map.end()) {
                 std::cerr << "Error: Symbol '" << symbol
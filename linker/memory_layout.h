@@ -15,27 +15,30 @@
 #include "linker.h"  // Assuming this defines LabelInfo and RelocationInfo
 
 class memory_layout {
-    std::vector<std::vector<uint8_t>> object_files;
+    std::vector<ObjectSections> sections_per_file;
     std::map<std::string, std::tuple<int, int, int>> label_ranges;
     std::vector<std::vector<LabelInfo>> label_info_per_file;
     std::vector<std::vector<RelocationInfo>> relocation_info_per_file;
+    std::vector<std::vector<BaseFixup>> base_fixups_per_file;
 public:
     std::vector<uint8_t> memory;
 
-    // Updated constructor that accepts both the object files and the parsed label/relocation info.
-    memory_layout(const std::vector<std::vector<uint8_t>>& object_files,
+    // Takes the files' sections and the parsed label/relocation info; linking
+    // them is extract_object_codes() and then relocate_memory_layout().
+    memory_layout(const std::vector<ObjectSections>& sections_per_file,
                   const std::vector<std::vector<LabelInfo>>& label_info,
-                  const std::vector<std::vector<RelocationInfo>>& relocation_info)
-        : object_files(object_files),
+                  const std::vector<std::vector<RelocationInfo>>& relocation_info,
+                  const std::vector<std::vector<BaseFixup>>& base_fixups)
+        : sections_per_file(sections_per_file),
           label_info_per_file(label_info),
-          relocation_info_per_file(relocation_info)
+          relocation_info_per_file(relocation_info),
+          base_fixups_per_file(base_fixups)
     {
-        extract_object_codes();
-        relocate_memory_layout();
-        print_hex_dump(memory);
     }
-private:
+
+    // Place the sections in memory and rebase the files' own references.
     void extract_object_codes();
+    // Patch the references to labels of other files.
     void relocate_memory_layout();
 };
 
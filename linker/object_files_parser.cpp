@@ -3,13 +3,16 @@
 //
 
 #include "object_files_parser.h"
+#include "assembler/object_format.h"
 #include <arpa/inet.h>
+#include <cstdio>
 #include <ctime>
 #include <sstream>
 #include <iostream>
 #include <map>
 #include <cstring>
 #include <algorithm>
+#include <unordered_map>
 
 #if defined(__linux__) && !defined(__APPLE__)
 #include <cstdint>
@@ -28,14 +31,26 @@ bool object_files_parser::validate_all_files() {
     // Clear any existing data.
     label_info_per_file.clear();
     relocation_info_per_file.clear();
+    base_fixups_per_file.clear();
+    sections_per_file.clear();
 
     // Process each object file.
-    for (size_t i = 0; i < object_file_vectors.size(); ++i) {
-        // Create an input stream from the file vector data.
-        std::istringstream file_stream(
-            std::string(object_file_vectors[i].begin(), object_file_vectors[i].end()),
-            std::ios::binary
-        );
+    for (size_t i = 0; i < mapped_files.size(); ++i) {
+        const uint8_t *data = mapped_files[i].data();
+        const size_t size = mapped_files[i].size();
+        if (size >= lf::kHeaderSize && std::equal(std::begin(lf::kMagic), std::end(lf::kMagic), data)) {
+            if (!read_lf02_file(i)) {
+                return false;
+            }
+            continue;
+        }
+
+        // An LF01 file from an older assembler: read it through a stream.
+        // Names are taken as views of the mapping, at the stream's position.
+        std::istringstream file_stream(std::string(reinterpret_cast<const char *>(data), size), std::ios::binary);
+        auto name_at_position = [data](std::streampos position, size_t length) {
+            return std::string_view(reinterpret_cast<const char *>(data) + position, length);
+        };
 
         // --- Read the 32-byte header ---
         // Bytes 0-3: Magic ("LF01")
@@ -118,8 +133,7 @@ bool object_files_parser::validate_all_files() {
         log_info("Metadata offset: " + std::to_string(metadata_offset), i);
 
         // --- Validate the Machine Code Section ---
-        file_stream.seekg(32 + machine_code_length, std::ios::beg);
-        if (!file_stream) {
+        if (size - 32 < machine_code_length) {
             log_error("Machine code section is incomplete", i);
             return false;
         }
@@ -141,6 +155,9 @@ bool object_files_parser::validate_all_files() {
         }
         log_info("Label count: " + std::to_string(label_count), i);
 
+        // With a string table, names are offsets into it, resolved once it has been read.
+        const bool has_string_table = flags & 0x0002;
+        std::vector<std::uint32_t> label_name_offsets;
         std::vector<LabelInfo> labels_in_file;
         for (std::uint32_t j = 0; j < label_count; ++j) {
             LabelInfo label_info;
@@ -151,16 +168,29 @@ bool object_files_parser::validate_all_files() {
                 log_error("Could not read label address", i);
                 return false;
             }
+            if (has_string_table) {
+                std::uint32_t name_offset;
+                file_stream.read(reinterpret_cast<char *>(&name_offset), sizeof(name_offset));
+                if (!file_stream) {
+                    log_error("Could not read label name offset", i);
+                    return false;
+                }
+                label_name_offsets.push_back(ntohl(name_offset));
+                labels_in_file.push_back(std::move(label_info));
+                continue;
+            }
             // Read a null-terminated label name.
-            std::getline(file_stream, label_info.name, '\0');
-            if (label_info.name.empty()) {
+            std::streampos name_position = file_stream.tellg();
+            std::string name;
+            std::getline(file_stream, name, '\0');
+            if (name.empty()) {
                 log_error("Missing label name in label table", i);
                 return false;
             }
-            log_info("Label: " + label_info.name + ", Address: " + std::to_string(label_info.address), i);
+            label_info.name = name_at_position(name_position, name.size());
+            log_info("Label: " + name + ", Address: " + std::to_string(label_info.address), i);
             labels_in_file.push_back(std::move(label_info));
         }
-        label_info_per_file.push_back(std::move(labels_in_file));
 
         // --- Read the Relocation Table ---
         file_stream.seekg(relocation_table_offset, std::ios::beg);
@@ -174,6 +204,7 @@ bool object_files_parser::validate_all_files() {
         relocation_count = ntohl(relocation_count);
         log_info("Relocation count: " + std::to_string(relocation_count), i);
 
+        std::vector<std::uint32_t> relocation_name_offsets;
         std::vector<RelocationInfo> relocations_in_file;
         for (std::uint32_t j = 0; j < relocation_count; ++j) {
             RelocationInfo reloc_info{};
@@ -184,6 +215,17 @@ bool object_files_parser::validate_all_files() {
                 log_error("Could not read relocation address", i);
                 return false;
             }
+            if (has_string_table) {
+                std::uint32_t name_offset;
+                file_stream.read(reinterpret_cast<char *>(&name_offset), sizeof(name_offset));
+                if (!file_stream) {
+                    log_error("Could not read relocation name offset", i);
+                    return false;
+                }
+                relocation_name_offsets.push_back(ntohl(name_offset));
+                relocations_in_file.push_back(std::move(reloc_info));
+                continue;
+            }
 
             // Save the current position.
             std::streampos pos = file_stream.tellg();
@@ -205,55 +247,141 @@ bool object_files_parser::validate_all_files() {
             if (candidateIsExternal) {
                 // External relocation: store the label string.
                 reloc_info.is_external = true;
-                reloc_info.external_label = candidate;
+                reloc_info.external_label = name_at_position(pos, candidate.size());
                 // The label_location will be resolved later.
             } else {
                 // Not external: roll back and read exactly 2 bytes as the file-local index.
                 file_stream.clear(); // Clear any eof/fail flags.
                 file_stream.seekg(pos);
-                file_stream.read(reinterpret_cast<char *>(&reloc_info.local_index),
-                                 sizeof(reloc_info.local_index));
-                reloc_info.local_index = ntohs(reloc_info.local_index);
+                std::uint16_t local_index;
+                file_stream.read(reinterpret_cast<char *>(&local_index), sizeof(local_index));
+                reloc_info.local_index = ntohs(local_index);
                 reloc_info.is_external = false;
                 // The label_location will be set later.
             }
 
             if (reloc_info.is_external) {
                 log_info("Relocation: Address = " + std::to_string(reloc_info.address) +
-                         ", External Label = " + reloc_info.external_label, i);
+                         ", External Label = " + candidate, i);
             } else {
                 log_info("Relocation: Address = " + std::to_string(reloc_info.address) +
                          ", File-local Label Index = " + std::to_string(reloc_info.local_index), i);
             }
             relocations_in_file.push_back(std::move(reloc_info));
         }
+
+        // --- Read the Base Fixup Table, which follows the relocations ---
+        // LF01 files have a single section: all addresses are in .text.
+        std::vector<BaseFixup> fixups_in_file;
+        if (flags & 0x0001) {
+            std::uint32_t fixup_count;
+            file_stream.read(reinterpret_cast<char *>(&fixup_count), sizeof(fixup_count));
+            fixup_count = ntohl(fixup_count);
+            if (!file_stream) {
+                log_error("Could not read base fixup count", i);
+                return false;
+            }
+            log_info("Base fixup count: " + std::to_string(fixup_count), i);
+            std::vector<std::uint32_t> fixups(fixup_count);
+            file_stream.read(reinterpret_cast<char *>(fixups.data()),
+                             static_cast<std::streamsize>(fixup_count * sizeof(std::uint32_t)));
+            if (!file_stream) {
+                log_error("Base fixup table is incomplete", i);
+                return false;
+            }
+            fixups_in_file.reserve(fixup_count);
+            for (std::uint32_t fixup : fixups) {
+                fixup = ntohl(fixup);
+                if (fixup > machine_code_length || machine_code_length - fixup < 4) {
+                    log_error("Base fixup out of bounds", i);
+                    return false;
+                }
+                fixups_in_file.push_back({fixup, SectionKind::Text, SectionKind::Text});
+            }
+        }
+        base_fixups_per_file.push_back(std::move(fixups_in_file));
+
+        // --- Read the String Table, which comes last, and resolve the names ---
+        if (has_string_table) {
+            std::uint32_t string_table_size;
+            file_stream.read(reinterpret_cast<char *>(&string_table_size), sizeof(string_table_size));
+            string_table_size = ntohl(string_table_size);
+            std::streampos strings_position = file_stream.tellg();
+            if (!file_stream || size - static_cast<size_t>(strings_position) < string_table_size) {
+                log_error("String table is incomplete", i);
+                return false;
+            }
+            std::string_view strings = name_at_position(strings_position, string_table_size);
+            auto name_at = [strings](std::uint32_t offset) -> std::string_view {
+                if (offset >= strings.size()) return {};
+                size_t end = strings.find('\0', offset);
+                if (end == std::string_view::npos) return {};
+                return strings.substr(offset, end - offset);
+            };
+
+            // A relocation that names a label of this file refers to that label.
+            std::unordered_map<std::uint32_t, std::uint32_t> label_by_offset;
+            for (size_t j = 0; j < labels_in_file.size(); ++j) {
+                std::string_view name = name_at(label_name_offsets[j]);
+                if (name.empty()) {
+                    log_error("Missing label name in label table", i);
+                    return false;
+                }
+                labels_in_file[j].name = name;
+                label_by_offset.emplace(label_name_offsets[j], static_cast<std::uint32_t>(j));
+                log_info("Label: " + std::string(name) + ", Address: " +
+                         std::to_string(labels_in_file[j].address), i);
+            }
+            for (size_t j = 0; j < relocations_in_file.size(); ++j) {
+                RelocationInfo &reloc_info = relocations_in_file[j];
+                auto local = label_by_offset.find(relocation_name_offsets[j]);
+                if (local != label_by_offset.end()) {
+                    reloc_info.is_external = false;
+                    reloc_info.local_index = local->second;
+                    log_info("Relocation: Address = " + std::to_string(reloc_info.address) +
+                             ", File-local Label Index = " + std::to_string(reloc_info.local_index), i);
+                    continue;
+                }
+                std::string_view name = name_at(relocation_name_offsets[j]);
+                if (name.empty()) {
+                    log_error("Missing relocation name in relocation table", i);
+                    return false;
+                }
+                reloc_info.is_external = true;
+                reloc_info.external_label = name;
+                log_info("Relocation: Address = " + std::to_string(reloc_info.address) +
+                         ", External Label = " + std::string(name), i);
+            }
+        }
+        sections_per_file.push_back({{data + 32, machine_code_length}, {}, 0});
+        label_info_per_file.push_back(std::move(labels_in_file));
         relocation_info_per_file.push_back(std::move(relocations_in_file));
     } // End processing all files
 
     // --- Post-process relocations ---
+    // Index every label by name once; the first file to define a name wins.
+    std::unordered_map<std::string_view, std::pair<size_t, std::uint32_t>> label_locations;
+    for (size_t file_index = 0; file_index < label_info_per_file.size(); ++file_index) {
+        const auto &labels = label_info_per_file[file_index];
+        for (std::uint32_t j = 0; j < labels.size(); ++j) {
+            label_locations.try_emplace(labels[j].name, file_index, j);
+        }
+    }
+
     // For each relocation, assign its location in the 2D label table.
     for (size_t file_index = 0; file_index < relocation_info_per_file.size(); ++file_index) {
         for (auto &reloc : relocation_info_per_file[file_index]) {
             if (reloc.is_external) {
-                // For external relocations, search all files’ label tables.
-                bool found = false;
-                for (size_t otherFileIndex = 0; otherFileIndex < label_info_per_file.size(); ++otherFileIndex) {
-                    const auto &labels = label_info_per_file[otherFileIndex];
-                    for (std::uint16_t j = 0; j < labels.size(); ++j) {
-                        if (labels[j].name == reloc.external_label) {
-                            reloc.label_location = {otherFileIndex, j};
-                            found = true;
-                            break;
-                        }
-                    }
-                    if (found) break;
-                }
-                if (!found) {
-                    log_error("Could not match external label: " + reloc.external_label, file_index);
+                // For external relocations, look the name up in all files' labels.
+                auto location = label_locations.find(reloc.external_label);
+                if (location != label_locations.end()) {
+                    reloc.label_location = location->second;
+                } else {
+                    log_error("Could not match external label: " + std::string(reloc.external_label), file_index);
                     // Depending on your error policy you may wish to return false here.
                 }
                 // Optionally clear the temporary external label.
-                reloc.external_label.clear();
+                reloc.external_label = {};
             } else {
                 // For internal relocations, the label is in the same file.
                 // Simply record the current file index and the local label index.
@@ -271,6 +399,208 @@ bool object_files_parser::validate_all_files() {
     return true;
 }
 
+bool object_files_parser::read_lf02_file(size_t i) {
+    // The records are byte arrays, so they are used where they lie in the
+    // mapping. Every offset, size and index is checked here, once.
+    const uint8_t *data = mapped_files[i].data();
+    const size_t size = mapped_files[i].size();
+    const auto *header = reinterpret_cast<const lf::Header *>(data);
+
+    if (((header->version[0] << 8) | header->version[1]) != lf::kVersion) {
+        log_error("Unsupported or missing version", i);
+        return false;
+    }
+    std::uint64_t timestamp = 0;
+    for (std::uint8_t byte : header->timestamp) {
+        timestamp = (timestamp << 8) | byte;
+    }
+    const std::uint16_t flags = static_cast<std::uint16_t>((header->flags[0] << 8) | header->flags[1]);
+    if (flags & lf::kFlagContentHash) {
+        char hash_buffer[17];
+        std::snprintf(hash_buffer, sizeof(hash_buffer), "%016llx", static_cast<unsigned long long>(timestamp));
+        log_info("Content hash: " + std::string(hash_buffer), i);
+    } else {
+        time_t time_sec = static_cast<time_t>(timestamp) / 1000000;
+        char time_buffer[80];
+        std::strftime(time_buffer, sizeof(time_buffer), "%Y-%m-%d %I:%M:%S %p", std::localtime(&time_sec));
+        log_info("Timestamp: " + std::string(time_buffer), i);
+    }
+
+    // --- Find the sections through the section header table ---
+    const std::uint64_t table_offset = header->section_table_offset.get();
+    const std::uint64_t section_count = header->section_count.get();
+    if (header->section_header_size.get() != sizeof(lf::SectionHeader) || table_offset % lf::kAlignment != 0 ||
+        table_offset + section_count * sizeof(lf::SectionHeader) > size) {
+        log_error("Invalid section header table", i);
+        return false;
+    }
+    const auto *sections = reinterpret_cast<const lf::SectionHeader *>(data + table_offset);
+
+    // Index of each known section type in the table; unknown types are skipped.
+    constexpr std::uint32_t kNone = UINT32_MAX;
+    std::uint32_t code = kNone, data_section = kNone, bss_section = kNone;
+    std::uint32_t symbol_section = kNone, relocation_section = kNone, string_section = kNone;
+    for (std::uint32_t s = 0; s < section_count; ++s) {
+        const lf::SectionHeader &section = sections[s];
+        const std::uint64_t offset = section.offset.get();
+        const std::uint32_t section_size = section.size.get();
+        const bool in_file = section.type.get() != lf::kSectionBss;
+        if (offset % lf::kAlignment != 0 || (in_file && offset + section_size > size)) {
+            log_error("Section " + std::to_string(s) + " out of bounds", i);
+            return false;
+        }
+        std::uint32_t *index = nullptr;
+        std::uint32_t entry_size = 0;
+        switch (section.type.get()) {
+            case lf::kSectionCode: index = &code; break;
+            case lf::kSectionData: index = &data_section; break;
+            case lf::kSectionBss: index = &bss_section; break;
+            case lf::kSectionSymbols: index = &symbol_section; entry_size = sizeof(lf::Symbol); break;
+            case lf::kSectionRelocations: index = &relocation_section; entry_size = sizeof(lf::Relocation); break;
+            case lf::kSectionStrings: index = &string_section; break;
+            default: continue;
+        }
+        if (*index != kNone || section.entry_size.get() != entry_size ||
+            (entry_size != 0 && section_size % entry_size != 0)) {
+            log_error("Invalid section " + std::to_string(s), i);
+            return false;
+        }
+        *index = s;
+    }
+    if (code == kNone) {
+        log_error("Missing code section", i);
+        return false;
+    }
+    auto section_data = [&](std::uint32_t s) { return data + sections[s].offset.get(); };
+    auto record_count = [&](std::uint32_t s, size_t record_size) {
+        return s == kNone ? 0 : sections[s].size.get() / record_size;
+    };
+
+    const std::uint32_t machine_code_length = sections[code].size.get();
+    log_info("Machine code length: " + std::to_string(machine_code_length), i);
+
+    // The kind and size of the section at each index symbols and relocations may name.
+    auto section_kind = [&](std::uint32_t s, SectionKind &kind, std::uint32_t &section_size) {
+        if (s == kNone || (s != code && s != data_section && s != bss_section)) return false;
+        kind = s == code ? SectionKind::Text : s == data_section ? SectionKind::Data : SectionKind::Bss;
+        section_size = sections[s].size.get();
+        return true;
+    };
+    ObjectSections contents{{section_data(code), machine_code_length}, {}, 0};
+    if (data_section != kNone) {
+        contents.data = {section_data(data_section), sections[data_section].size.get()};
+        log_info("Data length: " + std::to_string(contents.data.size()), i);
+    }
+    if (bss_section != kNone) {
+        contents.bss_size = sections[bss_section].size.get();
+        log_info("Bss size: " + std::to_string(contents.bss_size), i);
+    }
+
+    // The string section ends with a zero byte, so every name in it is terminated.
+    std::string_view strings;
+    if (string_section != kNone && sections[string_section].size.get() != 0) {
+        strings = std::string_view(reinterpret_cast<const char *>(section_data(string_section)),
+                                   sections[string_section].size.get());
+        if (strings.back() != '\0') {
+            log_error("String table is not terminated", i);
+            return false;
+        }
+    }
+    auto name_at = [strings](std::uint32_t offset) -> std::string_view {
+        if (offset >= strings.size()) return {};
+        return strings.data() + offset;
+    };
+
+    // --- Symbols ---
+    const size_t symbol_count = record_count(symbol_section, sizeof(lf::Symbol));
+    const auto *symbols = symbol_count ? reinterpret_cast<const lf::Symbol *>(section_data(symbol_section)) : nullptr;
+    log_info("Label count: " + std::to_string(symbol_count), i);
+    std::vector<LabelInfo> labels_in_file;
+    labels_in_file.reserve(symbol_count);
+    for (size_t j = 0; j < symbol_count; ++j) {
+        const lf::Symbol &symbol = symbols[j];
+        SectionKind kind;
+        std::uint32_t section_size;
+        if (symbol.kind != lf::kSymbolLabel || !section_kind(symbol.section, kind, section_size) ||
+            symbol.value.get() > section_size) {
+            log_error("Invalid symbol " + std::to_string(j), i);
+            return false;
+        }
+        std::string_view name = name_at(symbol.name.get());
+        if (name.empty()) {
+            log_error("Missing label name in label table", i);
+            return false;
+        }
+        labels_in_file.push_back({name, symbol.value.get(), kind});
+        log_info("Label: " + std::string(name) + ", Address: " + std::to_string(symbol.value.get()), i);
+    }
+
+    // --- Relocations, by kind ---
+    const size_t relocation_count = record_count(relocation_section, sizeof(lf::Relocation));
+    const auto *relocations =
+        relocation_count ? reinterpret_cast<const lf::Relocation *>(section_data(relocation_section)) : nullptr;
+    log_info("Relocation count: " + std::to_string(relocation_count), i);
+    std::vector<RelocationInfo> relocations_in_file;
+    std::vector<BaseFixup> fixups_in_file;
+    for (size_t j = 0; j < relocation_count; ++j) {
+        const lf::Relocation &relocation = relocations[j];
+        const std::uint32_t address = relocation.offset.get();
+        const std::uint32_t target = relocation.target.get();
+        SectionKind section;
+        std::uint32_t section_size;
+        if (!section_kind(relocation.section, section, section_size) || section == SectionKind::Bss ||
+            address > section_size || section_size - address < 4) {
+            log_error("Relocation out of bounds", i);
+            return false;
+        }
+        RelocationInfo reloc_info{};
+        reloc_info.address = address;
+        reloc_info.section = section;
+        switch (relocation.kind) {
+            case lf::kRelocationBase: {
+                SectionKind target_kind;
+                if (!section_kind(target, target_kind, section_size)) {
+                    log_error("Base relocation to an unknown section", i);
+                    return false;
+                }
+                fixups_in_file.push_back({address, section, target_kind});
+                continue;
+            }
+            case lf::kRelocationSymbol:
+                if (target >= symbol_count) {
+                    log_error("Internal relocation index out of bounds", i);
+                    return false;
+                }
+                reloc_info.is_external = false;
+                reloc_info.local_index = target;
+                log_info("Relocation: Address = " + std::to_string(address) +
+                         ", File-local Label Index = " + std::to_string(target), i);
+                break;
+            case lf::kRelocationExternal:
+                reloc_info.is_external = true;
+                reloc_info.external_label = name_at(target);
+                if (reloc_info.external_label.empty()) {
+                    log_error("Missing relocation name in relocation table", i);
+                    return false;
+                }
+                log_info("Relocation: Address = " + std::to_string(address) +
+                         ", External Label = " + std::string(reloc_info.external_label), i);
+                break;
+            default:
+                log_error("Unknown relocation kind " + std::to_string(relocation.kind), i);
+                return false;
+        }
+        relocations_in_file.push_back(std::move(reloc_info));
+    }
+    log_info("Base fixup count: " + std::to_string(fixups_in_file.size()), i);
+
+    sections_per_file.push_back(contents);
+    label_info_per_file.push_back(std::move(labels_in_file));
+    relocation_info_per_file.push_back(std::move(relocations_in_file));
+    base_fixups_per_file.push_back(std::move(fixups_in_file));
+    return true;
+}
+
 void object_files_parser::log_label_info() const {
     // Log each file's labels and then its relocation entries.
     for (size_t file_index = 0; file_index < object_files.size(); ++file_index) {
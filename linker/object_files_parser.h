@@ -4,26 +4,29 @@
 
 #ifndef OBJECT_FILE_PARSER_H
 #define OBJECT_FILE_PARSER_H
+#include <span>
 #include <string>
 #include <vector>
-#include <fstream>
 #include <iostream>
 
 #include "linker.h"
+#include "mapped_file.h"
 
 class object_files_parser {
 public:
-    std::vector<std::vector<uint8_t>> object_file_vectors;
+    std::vector<mapped_file> mapped_files;
     std::vector<std::string> object_files;
+    // The contents of each file's sections, in its mapping.
+    std::vector<ObjectSections> sections_per_file;
     std::vector<std::vector<LabelInfo>> label_info_per_file;
     std::vector<std::vector<RelocationInfo>> relocation_info_per_file;
+    // 32-bit section-relative addresses to rebase, per file.
+    std::vector<std::vector<BaseFixup>> base_fixups_per_file;
 
     explicit object_files_parser(const std::vector<std::string>& object_files) : object_files(object_files) {
         for (const auto& file_path : object_files) {
-            if (std::ifstream file_stream(file_path, std::ios::binary | std::ios::in); file_stream.is_open()) {
-                // Read the contents of the file into a vector
-                std::vector<uint8_t> file_content((std::istreambuf_iterator<char>(file_stream)), std::istreambuf_iterator<char>());
-                object_file_vectors.push_back(std::move(file_content));
+            if (mapped_file file; file.open(file_path)) {
+                mapped_files.push_back(std::move(file));
             } else {
                 // Handle the case when the file couldn't be opened
                 std::cerr << "Error: Unable to open file " << file_path << std::endl;
@@ -39,6 +42,9 @@ public:
     void log_label_info() const;
 
 private:
+    // Read an LF02 file; false if it is malformed.
+    bool read_lf02_file(size_t file_index);
+
     void log_error(const std::string& message, size_t file_index) const {
         std::cerr << "Validation failed: " << message << " in file " << object_files[file_index] << std::endl;
     }
@@ -7,6 +7,7 @@ class Specifier:
         self.syntax = syntax
         self.encoding = encoding
         self.length = length
+        self.relative = []  # Label fields that hold a displacement from the instruction.
 
 class Instruction:
     def __init__(self, name, opcode):
@@ -61,21 +62,324 @@ def parse_md_file(filename):
                 elif stripped.startswith("length") and current_specifier:
                     _, length_val = stripped.split()
                     current_specifier.length = int(length_val)
+                elif stripped.startswith("relative") and current_specifier:
+                    # "relative label": the field holds the label's address
+                    # minus the address of the instruction.
+                    current_specifier.relative.extend(stripped.split()[1:])
 
     return instructions
 
+# Operand kinds, numbered as in the generated OperandKind enum.
+OPERAND_KINDS = ["None", "Register", "RegisterLow", "RegisterHigh", "Immediate", "Memory", "OffsetMemory", "Label"]
+KIND = {name: i for i, name in enumerate(OPERAND_KINDS)}
+
+def placeholder_kind(placeholder):
+    # The operand kind a syntax placeholder accepts, e.g. "%rd.L" -> RegisterLow.
+    if "[%rn + #%offset]" in placeholder:
+        return KIND["OffsetMemory"]
+    if "%rd" in placeholder or "%rn" in placeholder:
+        if ".H" in placeholder:
+            return KIND["RegisterHigh"]
+        if ".L" in placeholder:
+            return KIND["RegisterLow"]
+        return KIND["Register"]
+    if "#%immediate" in placeholder:
+        return KIND["Immediate"]
+    if "[%normAddressing]" in placeholder:
+        return KIND["Memory"]
+    if "%label" in placeholder:
+        return KIND["Label"]
+    return KIND["None"]  # Matches nothing.
+
+def placeholders(syntax):
+    # Placeholders follow the mnemonic and are separated by commas.
+    syntax = syntax or ""
+    if " " not in syntax:
+        return []
+    return [p.strip() for p in syntax.split(" ", 1)[1].split(",")]
+
+def operand_kinds(syntax):
+    return [placeholder_kind(p) for p in placeholders(syntax)]
+
+def accepted_token_kinds(kind):
+    # A memory placeholder also takes a label, which is resolved to an address.
+    if kind == KIND["Memory"]:
+        return [KIND["Memory"], KIND["Label"]]
+    return [kind]
+
+def operand_signature(kinds):
+    # Must match operand_signature() in the generated header.
+    signature = len(kinds)
+    for i, kind in enumerate(kinds):
+        signature |= kind << (SIGNATURE_COUNT_BITS + SIGNATURE_KIND_BITS * i)
+    return signature
+
+SIGNATURE_COUNT_BITS = 4
+SIGNATURE_KIND_BITS = 3
+
+def build_dispatch(instructions):
+    # Map (instruction, operand-kind signature of the tokens) to every
+    # specifier whose placeholders accept those tokens, in description order.
+    # The first is the one chosen when the operands' values are not known.
+    dispatch = {}
+    for index, inst in enumerate(instructions):
+        for spec_index, spec in enumerate(inst.specifiers):
+            kinds = operand_kinds(spec.syntax)
+            if KIND["None"] in kinds:
+                continue
+            choices = [[]]
+            for kind in kinds:
+                choices = [c + [k] for c in choices for k in accepted_token_kinds(kind)]
+            for choice in choices:
+                key = ((index + 1) << 16) | operand_signature(choice)
+                dispatch.setdefault(key, []).append(spec_index)
+    return dispatch
+
+MAX_RELAXATION_CANDIDATES = 8
+
+def relaxation_candidates(inst, spec_indices):
+    # The specifiers relaxation chooses from: those no longer than the
+    # default (first) one, shortest first, ending with the default. Empty if
+    # none is shorter than the default.
+    default = spec_indices[0]
+    ordered = sorted(spec_indices, key=lambda i: (inst.specifiers[i].length, i))
+    if ordered[0] == default:
+        return []
+    candidates = ordered[:ordered.index(default) + 1]
+    if len(candidates) > MAX_RELAXATION_CANDIDATES:
+        raise RuntimeError(f"too many short forms of '{inst.specifiers[default].syntax}'")
+    return candidates
+
+def check_relative_fields(spec):
+    # A relative field must be filled by a %label operand, and a specifier
+    # may have only one.
+    if len(spec.relative) > 1:
+        raise RuntimeError(f"'{spec.syntax}' has more than one relative field")
+    kinds = operand_kinds(spec.syntax)
+    for name in spec.relative:
+        if name not in [n for n, _ in encoding_fields(spec.encoding)]:
+            raise RuntimeError(f"relative field '{name}' is not in the encoding of '{spec.syntax}'")
+        operand, part = bind_field(name, spec.syntax)
+        if operand < 0 or kinds[operand] != KIND["Label"] or part != "Whole":
+            raise RuntimeError(f"relative field '{name}' of '{spec.syntax}' is not filled by a %label")
+
+def find_dispatch_hash(keys):
+    # Search for a multiplier that sends every key to its own slot of a
+    # power-of-two table: slot = (key * multiplier) >> (32 - bits).
+    bits = 1
+    while (1 << bits) < 2 * len(keys):
+        bits += 1
+    while bits <= 16:
+        for multiplier in range(0x9E3779B1, 0x9E3779B1 + 2 * 100000, 2):
+            slots = {((k * multiplier) & 0xFFFFFFFF) >> (32 - bits) for k in keys}
+            if len(slots) == len(keys):
+                return multiplier, bits
+        bits += 1
+    raise RuntimeError("no perfect hash found for the specifier dispatch table")
+
+# Encoding fields the code generator knows how to fill, followed in the
+# generated FieldKind enum by any other field named in the description.
+KNOWN_FIELDS = ["sp", "opcode", "rd", "rd1", "rn", "rn1", "rm", "rs",
+                "immediate", "operand2", "normAddressing", "offset", "label"]
+
+def encoding_fields(encoding):
+    # "[sp(8)] [opcode(8)] [rd(8)]" -> [("sp", 8), ("opcode", 8), ("rd", 8)]
+    fields = []
+    for part in (encoding or "").split():
+        match = re.fullmatch(r'\[?(\w+)\((\d+)\)\]?', part)
+        if match:
+            fields.append((match.group(1), int(match.group(2))))
+    return fields
+
+REGISTER_FIELDS = ["rd", "rd1", "rn", "rn1", "rm", "rs"]
+
+def bind_field(name, syntax):
+    # Which operand fills field 'name', and which part of it: returns
+    # (operand index or -1, part), where part is one of FIELD_PARTS.
+    phs = placeholders(syntax)
+    kinds = [placeholder_kind(p) for p in phs]
+    if name in REGISTER_FIELDS:
+        for i, p in enumerate(phs):
+            if p == "%" + name:
+                return i, "Whole"
+        for i, p in enumerate(phs):
+            if p in ("%" + name + ".L", "%" + name + ".H"):
+                return i, "Whole"
+        # A register field with no register placeholder is the base of an
+        # offset-memory operand.
+        for i, kind in enumerate(kinds):
+            if kind == KIND["OffsetMemory"]:
+                return i, "BaseRegister"
+    elif name == "offset":
+        for i, kind in enumerate(kinds):
+            if kind == KIND["OffsetMemory"]:
+                return i, "Offset"
+    else:
+        accepted = {
+            "immediate": (KIND["Immediate"], KIND["Label"]),
+            "operand2": (KIND["Immediate"], KIND["Label"]),
+            "normAddressing": (KIND["Memory"], KIND["Label"]),
+            "label": (KIND["Label"],),
+        }.get(name, ())
+        for i, kind in enumerate(kinds):
+            if kind in accepted:
+                return i, "Whole"
+    return -1, "Whole"
+
+FIELD_PARTS = ["Whole", "BaseRegister", "Offset"]
+
+def field_kind_names(instructions):
+    names = list(KNOWN_FIELDS)
+    for inst in instructions:
+        for spec in inst.specifiers:
+            for name, _ in encoding_fields(spec.encoding):
+                if name not in names:
+                    names.append(name)
+    return names
+
+def field_enumerator(name):
+    return name[0].upper() + name[1:]
+
+# Fields member that converts an operand of a given placeholder kind.
+FIELD_WRITERS = {
+    KIND["Register"]: "reg<{n}, 0x00>",
+    KIND["RegisterLow"]: "reg<{n}, 0x40>",
+    KIND["RegisterHigh"]: "reg<{n}, 0x80>",
+    KIND["Immediate"]: "immediate<{n}>",
+    KIND["Memory"]: "address<{n}>",
+    KIND["Label"]: "label<{n}>",
+}
+
+def encoder_body(inst, spec):
+    # Statements of the specialized encoder for 'spec', or None if the
+    # generic encoder has to handle it. The layout mirrors
+    # CodeGenerator::assemble_instruction: sp, opcode, then every other field
+    # in encoding order, each rounded up to whole bytes.
+    kinds = operand_kinds(spec.syntax)
+    calls = []
+    offset = 2
+    for name, width in encoding_fields(spec.encoding):
+        if name in ("sp", "opcode"):
+            continue
+        n = (width + 7) // 8
+        operand, part = bind_field(name, spec.syntax)
+        if operand < 0:
+            return None
+        if part == "BaseRegister":
+            writer = f"base_register<{n}>"
+        elif part == "Offset":
+            writer = f"offset<{n}>"
+        elif name in spec.relative:
+            writer = f"relative_label<{n}, {width}>"
+        elif kinds[operand] in FIELD_WRITERS:
+            writer = FIELD_WRITERS[kinds[operand]].format(n=n)
+        else:
+            return None
+        calls.append(f"f.template {writer}(ops[{operand}], out + {offset})")
+        offset += n
+    if offset != spec.length:
+        return None
+    lines = [f"out[0] = 0x{spec.sp:02X};", f"out[1] = 0x{inst.opcode:02X};"]
+    if calls:
+        lines.append("return " + "\n            && ".join(calls) + ";")
+    else:
+        lines.append("return true;")
+    return lines
+
+def mnemonic_hash(name, seed):
+    # 32-bit FNV-1a, starting from 'seed' instead of the usual offset basis.
+    h = seed
+    for c in name.encode():
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return h
+
+def description_hash(text):
+    # 64-bit FNV-1a of the generated tables, so that object caches can tell
+    # when the instruction set they were built with has changed.
+    h = 14695981039346656037
+    for c in text.encode():
+        h = ((h ^ c) * 1099511628211) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+def find_perfect_hash(instructions):
+    # Search for a seed that sends every mnemonic to its own slot, trying the
+    # smallest power-of-two table first.
+    names = [inst.name for inst in instructions]
+    size = 1
+    while size < len(names):
+        size *= 2
+    while size <= 4096:
+        for seed in range(2166136261, 2166136261 + 100000):
+            slots = {mnemonic_hash(n, seed) & (size - 1) for n in names}
+            if len(slots) == len(names):
+                return seed, size
+        size *= 2
+    raise RuntimeError("no perfect hash found for the instruction mnemonics")
+
 def generate_header(instructions, output_filename):
     with open(output_filename, 'w') as f:
         f.write("// Auto-generated instructions header\n")
         f.write("#ifndef INSTRUCTIONS_H\n#define INSTRUCTIONS_H\n\n")
         f.write("#include <cstdint>\n")
-        f.write("#include <cstddef>\n\n")
+        f.write("#include <cstddef>\n")
+        f.write("#include <string_view>\n\n")
+
+        max_operands = max(len(operand_kinds(spec.syntax)) for inst in instructions for spec in inst.specifiers)
+        if max_operands >= (1 << SIGNATURE_COUNT_BITS) or \
+                SIGNATURE_COUNT_BITS + SIGNATURE_KIND_BITS * max_operands > 16:
+            raise RuntimeError("too many operands for a 16-bit operand signature")
+
+        f.write("// Kind of an operand, as written in a syntax placeholder or as found in the\n")
+        f.write("// source. A Memory placeholder also accepts a Label operand.\n")
+        f.write("enum class OperandKind : uint8_t {\n")
+        for kind in OPERAND_KINDS:
+            f.write(f"    {kind},\n")
+        f.write("};\n\n")
+        f.write(f"inline constexpr size_t max_operands = {max_operands};\n\n")
+
+        field_names = field_kind_names(instructions)
+        max_fields = max(len(encoding_fields(spec.encoding)) for inst in instructions for spec in inst.specifiers)
+        f.write("// Kind of an encoding field, named after the field in the description.\n")
+        f.write("enum class FieldKind : uint8_t {\n")
+        for name in field_names:
+            f.write(f"    {field_enumerator(name)},\n")
+        f.write("};\n\n")
+        f.write("inline constexpr const char* field_kind_names[] = {\n")
+        for name in field_names:
+            f.write(f"    \"{name}\",\n")
+        f.write("};\n\n")
+        f.write("constexpr const char* field_kind_name(FieldKind kind) {\n")
+        f.write("    return field_kind_names[static_cast<size_t>(kind)];\n")
+        f.write("}\n\n")
+        f.write("// Part of an operand that fills a field: an offset-memory operand\n")
+        f.write("// \"[rn + #offset]\" fills a register field and an offset field.\n")
+        f.write("enum class FieldPart : uint8_t {\n")
+        for part in FIELD_PARTS:
+            f.write(f"    {part},\n")
+        f.write("};\n\n")
+        f.write("// One field of an instruction encoding; offsets count from the first bit\n")
+        f.write("// of the instruction. 'operand' is the index of the syntax placeholder\n")
+        f.write("// whose operand fills the field, or -1 if none does.\n")
+        f.write("struct FieldDescriptor {\n")
+        f.write("    FieldKind kind;\n")
+        f.write("    uint8_t bit_offset;\n")
+        f.write("    uint8_t bit_width;\n")
+        f.write("    int8_t operand;\n")
+        f.write("    FieldPart part;\n")
+        f.write("    bool relative; // Holds a label's address minus the instruction's.\n")
+        f.write("};\n\n")
+        f.write(f"inline constexpr size_t max_fields = {max_fields};\n\n")
 
         f.write("struct InstructionSpecifier {\n")
         f.write("    uint8_t sp;\n")
         f.write("    const char* syntax;\n")
         f.write("    const char* encoding;\n")
         f.write("    uint8_t length;\n")
+        f.write("    uint8_t num_operands;\n")
+        f.write("    OperandKind operands[max_operands]; // Placeholder kinds, in syntax order.\n")
+        f.write("    uint8_t num_fields;\n")
+        f.write("    FieldDescriptor fields[max_fields]; // Encoding fields, in order.\n")
+        f.write("    uint16_t index; // Position among all specifiers, for per-specifier tables.\n")
         f.write("};\n\n")
 
         f.write("struct InstructionFormat {\n")
@@ -86,27 +390,209 @@ def generate_header(instructions, output_filename):
         f.write("};\n\n")
 
         # Generate specifier arrays for each instruction
+        spec_count = 0
         for inst in instructions:
-            f.write(f"static const InstructionSpecifier {inst.name}_specs[] = {{\n")
+            f.write(f"inline constexpr InstructionSpecifier {inst.name}_specs[] = {{\n")
             for spec in inst.specifiers:
+                check_relative_fields(spec)
                 syntax = spec.syntax.replace('"', '\\"') if spec.syntax else ""
                 encoding = spec.encoding.replace('"', '\\"') if spec.encoding else ""
-                f.write(f"    {{{spec.sp}, \"{syntax}\", \"{encoding}\", {spec.length}}},\n")
+                kinds = operand_kinds(spec.syntax)
+                kind_list = ", ".join(f"OperandKind::{OPERAND_KINDS[k]}" for k in kinds)
+                fields = []
+                offset = 0
+                for name, width in encoding_fields(spec.encoding):
+                    operand, part = bind_field(name, spec.syntax) if name not in ("sp", "opcode") else (-1, "Whole")
+                    fields.append(f"{{FieldKind::{field_enumerator(name)}, {offset}, {width}, {operand}, FieldPart::{part}, {'true' if name in spec.relative else 'false'}}}")
+                    offset += width
+                if offset > 255:
+                    raise RuntimeError(f"encoding of '{spec.syntax}' is too long")
+                f.write(f"    {{{spec.sp}, \"{syntax}\", \"{encoding}\", {spec.length}, {len(kinds)}, {{{kind_list}}},\n")
+                f.write(f"        {len(fields)}, {{{', '.join(fields)}}}, {spec_count}}},\n")
+                spec_count += 1
             f.write("};\n\n")
 
         # Generate instructions array
-        f.write("static const InstructionFormat instructions[] = {\n")
+        f.write("inline constexpr InstructionFormat instructions[] = {\n")
         for inst in instructions:
             f.write(f"    {{\"{inst.name}\", 0x{inst.opcode:02X}, {len(inst.specifiers)}, {inst.name}_specs}},\n")
         f.write("};\n\n")
+        f.write(f"inline constexpr size_t num_instructions = {len(instructions)};\n\n")
+        f.write(f"inline constexpr size_t num_specifiers = {spec_count};\n\n")
+
+        # Generate the perfect hash over mnemonics
+        seed, size = find_perfect_hash(instructions)
+        table = [0] * size
+        for i, inst in enumerate(instructions):
+            table[mnemonic_hash(inst.name, seed) & (size - 1)] = i + 1
+
+        f.write("// Perfect hash over the mnemonics: 32-bit FNV-1a from a seed chosen by\n")
+        f.write("// parse_md.py so that no two mnemonics share a slot. mnemonic_table maps\n")
+        f.write("// a slot to an index into instructions[] plus one; 0 marks an empty slot.\n")
+        f.write(f"inline constexpr uint32_t mnemonic_hash_seed = {seed}u;\n")
+        f.write(f"inline constexpr size_t mnemonic_table_size = {size};\n")
+        f.write("inline constexpr uint8_t mnemonic_table[mnemonic_table_size] = {")
+        for i, entry in enumerate(table):
+            if i % 16 == 0:
+                f.write("\n    ")
+            else:
+                f.write(" ")
+            f.write(f"{entry},")
+        f.write("\n};\n\n")
+
+        f.write("// Find the instruction with the given mnemonic, or nullptr. Usable in\n")
+        f.write("// constant expressions.\n")
+        f.write("constexpr const InstructionFormat* lookup_instruction(std::string_view name) {\n")
+        f.write("    uint32_t hash = mnemonic_hash_seed;\n")
+        f.write("    for (char c : name) {\n")
+        f.write("        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;\n")
+        f.write("    }\n")
+        f.write("    uint8_t entry = mnemonic_table[hash & (mnemonic_table_size - 1)];\n")
+        f.write("    if (entry == 0) return nullptr;\n")
+        f.write("    const InstructionFormat* format = &instructions[entry - 1];\n")
+        f.write("    return std::string_view(format->name) == name ? format : nullptr;\n")
+        f.write("}\n\n")
+
+        f.write("constexpr bool mnemonic_table_is_perfect() {\n")
+        f.write("    for (size_t i = 0; i < num_instructions; ++i) {\n")
+        f.write("        if (lookup_instruction(instructions[i].name) != &instructions[i]) return false;\n")
+        f.write("    }\n")
+        f.write("    return true;\n")
+        f.write("}\n")
+        f.write("static_assert(mnemonic_table_is_perfect(), \"mnemonic hash has a collision\");\n\n")
+
+        # Generate the specifier dispatch index
+        dispatch = build_dispatch(instructions)
+        multiplier, bits = find_dispatch_hash(list(dispatch))
+        slots = [None] * (1 << bits)
+        candidate_list = []
+        for key, spec_indices in dispatch.items():
+            inst = instructions[(key >> 16) - 1]
+            candidates = relaxation_candidates(inst, spec_indices)
+            slots[((key * multiplier) & 0xFFFFFFFF) >> (32 - bits)] = \
+                (key, spec_indices[0], len(candidate_list), len(candidates))
+            candidate_list.extend(candidates)
+
+        f.write("// Operand-kind signature of an operand list: the operand count in the low\n")
+        f.write(f"// {SIGNATURE_COUNT_BITS} bits, then {SIGNATURE_KIND_BITS} bits per operand kind.\n")
+        f.write("constexpr uint32_t operand_signature(const OperandKind* kinds, size_t count) {\n")
+        f.write("    uint32_t signature = static_cast<uint32_t>(count);\n")
+        f.write("    for (size_t i = 0; i < count; ++i) {\n")
+        f.write(f"        signature |= static_cast<uint32_t>(kinds[i]) << ({SIGNATURE_COUNT_BITS} + {SIGNATURE_KIND_BITS} * i);\n")
+        f.write("    }\n")
+        f.write("    return signature;\n")
+        f.write("}\n\n")
+
+        f.write("struct SpecifierDispatchEntry {\n")
+        f.write("    uint32_t key;             // (instruction index + 1) << 16 | operand signature; 0 if empty.\n")
+        f.write("    uint8_t specifier;        // Index into the instruction's specifiers.\n")
+        f.write("    uint8_t num_candidates;   // Specifiers to relax to; 0 if none is shorter.\n")
+        f.write("    uint16_t first_candidate; // Index into relaxation_candidates.\n")
+        f.write("};\n\n")
+        f.write("// Specifiers that also accept the operands of a dispatch entry and are\n")
+        f.write("// shorter than its specifier: indices into the instruction's specifiers,\n")
+        f.write("// shortest first, each run ending with the entry's own specifier.\n")
+        f.write(f"inline constexpr uint8_t relaxation_candidates[{max(len(candidate_list), 1)}] = {{")
+        f.write(", ".join(str(c) for c in candidate_list) if candidate_list else "0")
+        f.write("};\n\n")
+        f.write(f"inline constexpr size_t max_relaxation_candidates = {MAX_RELAXATION_CANDIDATES};\n\n")
+        f.write("// The specifiers relaxation may choose from for an instruction.\n")
+        f.write("struct RelaxationCandidates {\n")
+        f.write("    const uint8_t* indices = nullptr; // Into the instruction's specifiers.\n")
+        f.write("    uint8_t count = 0;\n")
+        f.write("};\n\n")
+        f.write("// Perfect hash from (instruction, operand signature) to the first specifier\n")
+        f.write("// that accepts those operands: slot = (key * multiplier) >> (32 - bits).\n")
+        f.write(f"inline constexpr uint32_t specifier_dispatch_multiplier = {multiplier}u;\n")
+        f.write(f"inline constexpr unsigned specifier_dispatch_bits = {bits};\n")
+        f.write("inline constexpr SpecifierDispatchEntry specifier_dispatch[size_t{1} << specifier_dispatch_bits] = {")
+        for i, slot in enumerate(slots):
+            f.write("\n    " if i % 8 == 0 else " ")
+            key, spec_index, first, count = slot if slot else (0, 0, 0, 0)
+            f.write(f"{{0x{key:06X}, {spec_index}, {count}, {first}}},")
+        f.write("\n};\n\n")
+
+        f.write("// Find the specifier of 'format' that takes operands with the given\n")
+        f.write("// signature, or nullptr if none does. If 'candidates' is given, it also\n")
+        f.write("// receives the shorter specifiers that take the same operands.\n")
+        f.write("constexpr const InstructionSpecifier* lookup_specifier(const InstructionFormat* format, uint32_t signature,\n")
+        f.write("                                                      RelaxationCandidates* candidates = nullptr) {\n")
+        f.write("    uint32_t key = (static_cast<uint32_t>(format - instructions) + 1) << 16 | signature;\n")
+        f.write("    const SpecifierDispatchEntry& entry = specifier_dispatch[(key * specifier_dispatch_multiplier) >> (32 - specifier_dispatch_bits)];\n")
+        f.write("    if (entry.key != key) return nullptr;\n")
+        f.write("    if (candidates) {\n")
+        f.write("        candidates->indices = &relaxation_candidates[entry.first_candidate];\n")
+        f.write("        candidates->count = entry.num_candidates;\n")
+        f.write("    }\n")
+        f.write("    return &format->specifiers[entry.specifier];\n")
+        f.write("}\n\n")
+
+        f.write("constexpr bool specifier_dispatch_is_complete() {\n")
+        f.write("    for (size_t i = 0; i < num_instructions; ++i) {\n")
+        f.write("        for (size_t j = 0; j < instructions[i].num_specifiers; ++j) {\n")
+        f.write("            const InstructionSpecifier& spec = instructions[i].specifiers[j];\n")
+        f.write("            bool valid = true;\n")
+        f.write("            for (size_t k = 0; k < spec.num_operands; ++k) {\n")
+        f.write("                valid = valid && spec.operands[k] != OperandKind::None;\n")
+        f.write("            }\n")
+        f.write("            if (valid && !lookup_specifier(&instructions[i], operand_signature(spec.operands, spec.num_operands))) {\n")
+        f.write("                return false;\n")
+        f.write("            }\n")
+        f.write("        }\n")
+        f.write("    }\n")
+        f.write("    return true;\n")
+        f.write("}\n")
+        f.write("static_assert(specifier_dispatch_is_complete(), \"specifier missing from the dispatch table\");\n\n")
+
+        # Generate the specialized encoders
+        f.write("// Specialized encoders, one per specifier, with the field layout baked in.\n")
+        f.write("// Each writes exactly 'length' bytes to 'out' and returns false if an\n")
+        f.write("// operand does not convert; the caller then falls back to the generic\n")
+        f.write("// encoder, which reports the error. 'Fields' supplies the operand type and\n")
+        f.write("// the conversions (reg, immediate, address, label, relative_label,\n")
+        f.write("// base_register, offset), each templated on the field's width in bytes\n")
+        f.write("// (relative_label also on its width in bits). The table is indexed by\n")
+        f.write("// InstructionSpecifier::index; a null entry means \"use the generic encoder\".\n")
+        f.write("template <typename Fields>\n")
+        f.write("struct SpecifierEncoders {\n")
+        f.write("    using Operand = typename Fields::Operand;\n")
+        f.write("    using Encoder = bool (*)(Fields&, const Operand*, uint8_t*);\n\n")
+        entries = []
+        for inst in instructions:
+            for spec_index, spec in enumerate(inst.specifiers):
+                body = encoder_body(inst, spec)
+                if body is None:
+                    entries.append("nullptr")
+                    continue
+                fn = f"{inst.name}_{spec_index}"
+                entries.append(fn)
+                uses_operands = not body[-1].startswith("return true")
+                params = "Fields& f, const Operand* ops, uint8_t* out" if uses_operands else "Fields&, const Operand*, uint8_t* out"
+                f.write(f"    // {spec.syntax}\n")
+                f.write(f"    static bool {fn}({params}) {{\n")
+                for line in body:
+                    f.write(f"        {line}\n")
+                f.write("    }\n\n")
+        f.write("    static constexpr Encoder table[num_specifiers] = {")
+        for i, entry in enumerate(entries):
+            f.write("\n        " if i % 6 == 0 else " ")
+            f.write(f"{entry},")
+        f.write("\n    };\n")
+        f.write("};\n\n")
 
+    with open(output_filename, 'r') as f:
+        generated = f.read()
+    with open(output_filename, 'a') as f:
+        f.write("// Hash of everything above; changes whenever the generated tables do.\n")
+        f.write(f"inline constexpr uint64_t machine_description_hash = 0x{description_hash(generated):016x}ull;\n\n")
         f.write("#endif // INSTRUCTIONS_H\n")
 
 def main():
     import sys
     # Use command-line argument for MD file if provided
     md_file = sys.argv[1] if len(sys.argv) > 1 else "config/neocore16x32.mdesc"
-    output_header = "assembler/machine_description.h"
+    # and for the header to generate, which tests put elsewhere
+    output_header = sys.argv[2] if len(sys.argv) > 2 else "assembler/machine_description.h"
 
     instructions = parse_md_file(md_file)
     generate_header(instructions, output_header)
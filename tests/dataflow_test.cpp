@@ -0,0 +1,109 @@
+// Behavior of the dataflow optimizer (-O2): dead stores and redundant
+// reloads, across labels and branches.
+
+#include "test_util.h"
+
+#include "assembler/dataflow.h"
+
+#include <sstream>
+
+namespace {
+
+std::string optimize(std::string_view source) {
+    Lexer lexer;
+    std::vector<Token> tokens = test::lex(source, lexer);
+    DataflowOptimizer dataflow;
+    dataflow.run(tokens);
+    return test::render(tokens);
+}
+
+void test_dead_stores() {
+    CHECK_EQUAL(optimize("mov 1, #5\nmov 1, #6\nhlt\n"), "mov 1, #6; hlt");
+    CHECK_EQUAL(optimize("mov 1, #5\nadd 2, 1\nmov 1, #6\nhlt\n"), "mov 1, #5; add 2, 1; mov 1, #6; hlt");
+    // A write to a half register keeps the other half.
+    CHECK_EQUAL(optimize("mov 1, #5\nmov 1.L, [0x10]\nhlt\n"), "mov 1, #5; mov 1.L, [0x10]; hlt");
+    // Loads and stores stay, as memory may be a device.
+    CHECK_EQUAL(optimize("mov 1, [0x10]\nmov 1, #2\nhlt\n"), "mov 1, [0x10]; mov 1, #2; hlt");
+    // Unknown code runs at jsr and wfi, and reads every register.
+    CHECK_EQUAL(optimize("mov 1, #5\njsr f\nmov 1, #6\nhlt\n"), "mov 1, #5; jsr f; mov 1, #6; hlt");
+    CHECK_EQUAL(optimize("mov 1, #5\nwfi\nmov 1, #6\nhlt\n"), "mov 1, #5; wfi; mov 1, #6; hlt");
+    // The overflow flag an ALU instruction sets is live until set again.
+    CHECK_EQUAL(optimize("add 1, #3\nmov 1, #4\nhlt\n"), "add 1, #3; mov 1, #4; hlt");
+    CHECK_EQUAL(optimize("add 1, #3\nsub 2, #1\nmov 1, #4\nhlt\n"), "sub 2, #1; mov 1, #4; hlt");
+}
+
+void test_dead_stores_across_control_flow() {
+    // Liveness flows backwards through a label.
+    CHECK_EQUAL(optimize("mov 1, #5\nhere:\nmov 1, #6\nhlt\n"), "here:; mov 1, #6; hlt");
+    // Dead on the path a jump takes, though read on the one it skips.
+    CHECK_EQUAL(optimize("mov 1, #5\nb next\nadd 2, 1\nhlt\nnext:\nmov 1, #6\nhlt\n"),
+                "b next; add 2, 1; hlt; next:; mov 1, #6; hlt");
+    // Read where a conditional branch goes.
+    CHECK_EQUAL(optimize("mov 1, #5\nbe 2, 3, next\nmov 1, #6\nnext:\nhlt\n"),
+                "mov 1, #5; be 2, 3, next; mov 1, #6; next:; hlt");
+    // Read in a loop, through the branch back.
+    CHECK_EQUAL(optimize("mov 1, #5\nloop:\nadd 2, 1\nmov 1, #6\nbne 2, 3, loop\nmov 1, #7\nhlt\n"),
+                "mov 1, #5; loop:; add 2, 1; mov 1, #6; bne 2, 3, loop; mov 1, #7; hlt");
+    // A branch out of the stream, or falling off its end, may read anything.
+    CHECK_EQUAL(optimize("mov 1, #5\nb elsewhere\n"), "mov 1, #5; b elsewhere");
+    CHECK_EQUAL(optimize("mov 1, #5\n"), "mov 1, #5");
+}
+
+void test_redundant_reloads() {
+    CHECK_EQUAL(optimize("mov 1, #5\nadd 2, 1\nmov 1, #5\nadd 3, 1\nhlt\n"), "mov 1, #5; add 2, 1; add 3, 1; hlt");
+    // "mov 1, 2" copies 1 into 2, which then holds 5 as well.
+    CHECK_EQUAL(optimize("mov 1, #5\nmov 1, 2\nmov 2, #5\nadd 3, 2\nadd 4, 1\nhlt\n"),
+                "mov 1, #5; mov 1, 2; add 3, 2; add 4, 1; hlt");
+    // Known values flow along the fall-through of a conditional branch,
+    CHECK_EQUAL(optimize("mov 1, #5\nadd 2, 1\nbe 2, 3, x\nmov 1, #5\nadd 3, 1\nx:\nhlt\n"),
+                "mov 1, #5; add 2, 1; be 2, 3, x; add 3, 1; x:; hlt");
+    // but not into a label, which may be entered from anywhere,
+    CHECK_EQUAL(optimize("mov 1, #5\nadd 2, 1\nhere:\nmov 1, #5\nadd 3, 1\nhlt\n"),
+                "mov 1, #5; add 2, 1; here:; mov 1, #5; add 3, 1; hlt");
+    // nor past an instruction that may change the register.
+    CHECK_EQUAL(optimize("mov 1, #5\nadd 1, 1\nadd 2, 1\nmov 1, #5\nadd 3, 1\nhlt\n"),
+                "mov 1, #5; add 1, 1; add 2, 1; mov 1, #5; add 3, 1; hlt");
+    CHECK_EQUAL(optimize("mov 1, #5\nadd 2, 1\njsr f\nmov 1, #5\nadd 3, 1\nhlt\n"),
+                "mov 1, #5; add 2, 1; jsr f; mov 1, #5; add 3, 1; hlt");
+}
+
+void test_overflow_liveness() {
+    Lexer lexer;
+    std::vector<Token> tokens = test::lex("start:\nadd 1, #0\nmov 2, 3\nbro start\nadd 4, #0\nsub 5, #1\nhlt\n", lexer);
+    DataflowOptimizer dataflow;
+    dataflow.run(tokens);
+    CHECK_EQUAL(test::render(tokens), "start:; add 1, #0; mov 2, 3; bro start; add 4, #0; sub 5, #1; hlt");
+    const std::vector<bool> &dead = dataflow.overflow_dead();
+    CHECK(dead.size() == tokens.size());
+    std::string flags;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].type == TokenType::Instruction) flags += dead[i] ? 'd' : 'l';
+    }
+    // Live up to the bro; dead after it and "add 4", as the next ALU
+    // instruction sets it; live before hlt, which reads everything.
+    CHECK_EQUAL(flags, "llddld");
+}
+
+void test_report() {
+    Lexer lexer;
+    std::vector<Token> tokens = test::lex("mov 1, #5\nmov 1, #6\nloop:\nmov 2, #1\nadd 3, 2\nmov 2, #1\nhlt\n", lexer);
+    DataflowOptimizer dataflow;
+    dataflow.run(tokens);
+    std::ostringstream report;
+    dataflow.print_report(report);
+    CHECK_EQUAL(report.str(),
+                "Dataflow removed 2 instructions:\n"
+                "  (start)+0               mov 1, #5                   dead store\n"
+                "  loop+2                  mov 2, #1                   redundant reload\n");
+}
+
+} // namespace
+
+int main() {
+    test_dead_stores();
+    test_dead_stores_across_control_flow();
+    test_redundant_reloads();
+    test_overflow_liveness();
+    test_report();
+    return test::result("dataflow_test");
+}
@@ -0,0 +1,120 @@
+// Behavior of the peephole optimizer (-O) and of its use of the dataflow
+// optimizer's overflow liveness (-O2).
+
+#include "test_util.h"
+
+#include "assembler/dataflow.h"
+#include "assembler/peephole.h"
+
+#include <sstream>
+
+namespace {
+
+// 'source' after -O, or -O2 if 'dataflow'.
+std::string optimize(std::string_view source, bool dataflow = false) {
+    Lexer lexer;
+    std::vector<Token> tokens = test::lex(source, lexer);
+    DataflowOptimizer dataflow_optimizer;
+    if (dataflow) dataflow_optimizer.run(tokens);
+    PeepholeOptimizer peephole;
+    peephole.run(tokens, dataflow ? &dataflow_optimizer.overflow_dead() : nullptr);
+    return test::render(tokens);
+}
+
+// Each rule, where it applies and where it must not. The flag-changing rules
+// are followed by an instruction that sets the flag again.
+void test_rules() {
+    CHECK_EQUAL(optimize("mov 1, 1\nmov 1, 2\n"), "mov 1, 2");
+    CHECK_EQUAL(optimize("mov 1.L, 1.L\n"), "mov 1.L, 1.L");
+
+    CHECK_EQUAL(optimize("psh 3\npop 3\nhlt\n"), "hlt");
+    // psh a; pop b copies a into b, which "mov a, b" does.
+    CHECK_EQUAL(optimize("psh 3\npop 4\n"), "mov 3, 4");
+    // Nested pairs come together once the inner one is gone.
+    CHECK_EQUAL(optimize("psh 1\npsh 2\npop 2\npop 1\n"), "");
+    // A label between them may be a branch target.
+    CHECK_EQUAL(optimize("psh 3\nhere:\npop 4\n"), "psh 3; here:; pop 4");
+
+    CHECK_EQUAL(optimize("add 1, #0\nsub 2, #0\nmul 3, #1\nand 4, 4\n"), "and 4, 4");
+    CHECK_EQUAL(optimize("add 1, #1\nsub 2, #2\nmul 3, #3\nand 4, 4\n"),
+                "add 1, #1; sub 2, #2; mul 3, #3; and 4, 4");
+    CHECK_EQUAL(optimize("mul 1, #0x100\nand 4, 4\n"), "lsh 1, #8; and 4, 4");
+    CHECK_EQUAL(optimize("mul 1, #6\nand 4, 4\n"), "mul 1, #6; and 4, 4");
+    CHECK_EQUAL(optimize("mov 5, #0\nand 4, 4\n"), "xor 5, 5; and 4, 4");
+    // A half register is not the whole register.
+    CHECK_EQUAL(optimize("add 1.L, #0\nand 4, 4\n"), "add 1.L, #0; and 4, 4");
+
+    // One count per rewrite, and the bytes it saved.
+    Lexer lexer;
+    std::vector<Token> tokens = test::lex("add 1, #0\nadd 2, #0\nmul 3, #2\nand 4, 4\n", lexer);
+    PeepholeOptimizer peephole;
+    peephole.run(tokens);
+    std::ostringstream statistics;
+    peephole.print_statistics(statistics);
+    CHECK(statistics.str().find("add-zero               2           10") != std::string::npos);
+    CHECK(statistics.str().find("mul-pow2               1            0") != std::string::npos);
+}
+
+// A rule that changes the overflow flag must not apply while a later bro
+// may still test it.
+void test_overflow_flag() {
+    const std::string_view source =
+        "start:\n"
+        "    add 1, #0\n"
+        "    mov 2, 3\n"
+        "    bro start\n";
+    CHECK_EQUAL(optimize(source), "start:; add 1, #0; mov 2, 3; bro start");
+    CHECK_EQUAL(optimize(source, true), "start:; add 1, #0; mov 2, 3; bro start");
+
+    // Set again before anything reads it.
+    CHECK_EQUAL(optimize("add 1, #0\nmov 2, 3\nsub 4, #1\nbro start\n"), "mov 2, 3; sub 4, #1; bro start");
+
+    // Possibly read at a label, after a branch or outside the tokens.
+    CHECK_EQUAL(optimize("add 1, #0\nnext:\nsub 4, #1\n"), "add 1, #0; next:; sub 4, #1");
+    CHECK_EQUAL(optimize("add 1, #0\njsr f\nsub 4, #1\n"), "add 1, #0; jsr f; sub 4, #1");
+    CHECK_EQUAL(optimize("mul 1, #4\nmov 2, 3\n"), "mul 1, #4; mov 2, 3");
+
+    // -O2 follows the flag through labels and branches in the stream.
+    CHECK_EQUAL(optimize("add 1, #0\nb next\nnext:\nsub 4, #1\nbro next\n", true),
+                "b next; next:; sub 4, #1; bro next");
+    CHECK_EQUAL(optimize("add 1, #0\nb next\nnext:\nbro next\n", true), "add 1, #0; b next; next:; bro next");
+}
+
+// Chunks must give the same result wherever the stream is cut.
+void test_chunks() {
+    const std::string_view source =
+        "mov 1, #0\n"
+        "psh 2\n"
+        "pop 3\n"
+        "mov 4, 5\n"
+        "add 1, #0\n"
+        "pop 6\n"
+        "nop\n"
+        "sub 7, #1\n"
+        "bro start\n";
+    const std::string expected = optimize(source);
+    Lexer lexer;
+    const std::vector<Token> tokens = test::lex(source, lexer);
+    for (size_t cut = 0; cut <= tokens.size(); ++cut) {
+        if (cut < tokens.size() && tokens[cut].type == TokenType::Operand) continue;
+        PeepholeOptimizer peephole;
+        std::vector<Token> first(tokens.begin(), tokens.begin() + static_cast<std::ptrdiff_t>(cut));
+        std::vector<Token> second(tokens.begin() + static_cast<std::ptrdiff_t>(cut), tokens.end());
+        peephole.run_chunk(first);
+        peephole.run_chunk(second);
+        std::vector<Token> result = first;
+        result.insert(result.end(), second.begin(), second.end());
+        const std::vector<Token> held = peephole.finish();
+        result.insert(result.end(), held.begin(), held.end());
+        CHECK_EQUAL(test::render(result), expected);
+    }
+}
+
+} // namespace
+
+int main() {
+    test_rules();
+    test_overflow_flag();
+    test_chunks();
+    return test::result("peephole_test");
+}
@@ -0,0 +1,165 @@
+// Behavior of Parser::relax(). Built against tests/short_forms.mdesc, whose
+// short forms the shipped description does not have: an 8-bit "add" and
+// "mov" immediate (4 bytes, against 5), 8- and 16-bit relative "b" (3 and 4
+// bytes, against 6) and an 8-bit relative "be" (5 bytes, against 8).
+
+#include "test_util.h"
+
+#include "assembler/code_generator.h"
+#include "assembler/parser.h"
+
+#include <memory>
+#include <sstream>
+
+namespace {
+
+// 'source', laid out, relaxed and encoded.
+struct Assembly {
+    explicit Assembly(std::string_view source) : tokens(test::lex(source, lexer)) {
+        code_generator.diagnostics = &diagnostics;
+        parser = std::make_unique<Parser>(tokens, Parser::Metadata(), code_generator);
+        parser->diagnostics = &diagnostics;
+        parser->layout();
+        result = parser->relax();
+        code_generator.label_table = parser->label_address_table;
+        parser->rewind();
+        parser->parse();
+    }
+
+    uint32_t address(const std::string &label) const {
+        auto it = parser->label_address_table.find(label);
+        return it == parser->label_address_table.end() ? UINT32_MAX : it->second.address;
+    }
+
+    // The lengths of the instructions that have short forms, in source order.
+    std::string lengths() const {
+        std::string text;
+        for (const InstructionSpecifier *spec : parser->relaxed_specifiers) {
+            if (!text.empty()) text += " ";
+            text += std::to_string(spec->length);
+        }
+        return text;
+    }
+
+    // 'count' bytes of .text from 'offset', in hex.
+    std::string code(size_t offset, size_t count) const {
+        std::string text;
+        for (size_t i = offset; i < offset + count && i < parser->object_code.size(); ++i) {
+            char byte[4];
+            std::snprintf(byte, sizeof(byte), "%s%02x", text.empty() ? "" : " ", parser->object_code[i]);
+            text += byte;
+        }
+        return text;
+    }
+
+    Lexer lexer;
+    std::vector<Token> tokens;
+    std::ostringstream diagnostics;
+    CodeGenerator code_generator{LabelTable{}};
+    std::unique_ptr<Parser> parser;
+    Parser::RelaxationResult result{};
+};
+
+// Shorter instructions move the labels after them, and a backward branch
+// reaches its label with the displacement from itself.
+void test_labels_move() {
+    const Assembly assembly(
+        "start:\n"
+        "    add 1, #5\n"
+        "    add 2, #300\n"
+        "middle:\n"
+        "    mov 3, #7\n"
+        "end:\n"
+        "    b start\n"
+        "    hlt\n"
+        "after:\n");
+    CHECK_EQUAL(assembly.diagnostics.str(), "");
+    CHECK_EQUAL(assembly.lengths(), "4 5 4 3");
+    CHECK(assembly.result.bytes_saved == 5);
+    CHECK(assembly.result.instructions == 3);
+    CHECK(assembly.address("start") == 0);
+    CHECK(assembly.address("middle") == 9);
+    CHECK(assembly.address("end") == 13);
+    CHECK(assembly.address("after") == 18);
+    CHECK(assembly.parser->object_code.size() == 18);
+    // sp 01, opcode 0x0A, displacement -13.
+    CHECK_EQUAL(assembly.code(13, 3), "01 0a f3");
+}
+
+// A relative field too narrow for its label's distance takes the next
+// wider form, down to the default 32-bit absolute one.
+void test_out_of_reach() {
+    const Assembly assembly(
+        "    b near\n"
+        "    b middle\n"
+        "    b far\n"
+        "near:\n"
+        "    .space 100\n"
+        "middle:\n"
+        "    .space 40000\n"
+        "far:\n"
+        "    hlt\n");
+    CHECK_EQUAL(assembly.diagnostics.str(), "");
+    CHECK_EQUAL(assembly.lengths(), "3 3 6");
+    CHECK(assembly.address("near") == 12);
+    CHECK(assembly.address("middle") == 112);
+    CHECK(assembly.address("far") == 40112);
+    CHECK_EQUAL(assembly.code(0, 3), "01 0a 0c");
+    CHECK_EQUAL(assembly.code(3, 3), "01 0a 6d");
+}
+
+// Lengthening one branch can push another's label out of reach: "b target"
+// reaches it with 8 bits (127 bytes) only while "b far" is short, which it
+// cannot be.
+void test_growth_pushes_out_of_reach() {
+    const Assembly assembly(
+        "    b target\n"
+        "    b far\n"
+        "    .space 121\n"
+        "target:\n"
+        "    hlt\n"
+        "    .space 40000\n"
+        "far:\n"
+        "    hlt\n");
+    CHECK_EQUAL(assembly.diagnostics.str(), "");
+    CHECK_EQUAL(assembly.lengths(), "4 6");
+    CHECK(assembly.address("target") == 131);
+    CHECK(assembly.address("far") == 40133);
+    // sp 02, opcode 0x0A, displacement 131 in 16 bits.
+    CHECK_EQUAL(assembly.code(0, 4), "02 0a 00 83");
+
+    // At exactly 127 bytes, the 8-bit form still reaches.
+    const Assembly edge(
+        "    b target\n"
+        "    .space 124\n"
+        "target:\n"
+        "    hlt\n");
+    CHECK_EQUAL(edge.lengths(), "3");
+    CHECK(edge.address("target") == 127);
+}
+
+// Relative fields only hold labels of this file's .text; anything else
+// keeps the default form, with a relocation.
+void test_other_labels() {
+    const Assembly assembly(
+        "loop:\n"
+        "    be 1, 2, loop\n"
+        "    b elsewhere\n"
+        "    b in_data\n"
+        ".data\n"
+        "in_data:\n"
+        "    .space 4\n");
+    CHECK_EQUAL(assembly.diagnostics.str(), "");
+    CHECK_EQUAL(assembly.lengths(), "5 6 6");
+    CHECK_EQUAL(assembly.code(0, 5), "01 0b 01 02 00");
+}
+
+} // namespace
+
+int main() {
+    test_labels_move();
+    test_out_of_reach();
+    test_growth_pushes_out_of_reach();
+    test_other_labels();
+    return test::result("relaxation_test");
+}
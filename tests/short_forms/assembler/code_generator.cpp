@@ -0,0 +1,537 @@
+//
+// Created by Dulat S on 1/27/25.
+//
+
+#include "code_generator.h"
+#include "machine_description.h"
+#include <iostream>
+#include <cctype>
+#include <cstdint>
+#include <algorithm>
+#include "assembler.h"
+
+// Append the low 'n' bytes of a number to a byte vector in big-endian order.
+inline void append_big_endian(std::vector<uint8_t> &dest, uint64_t value, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dest.push_back(static_cast<uint8_t>((value >> (8 * (n - 1 - i))) & 0xFF));
+    }
+}
+
+// Break a register token into its number and suffix.
+// If no valid suffix, return the token with an empty suffix.
+std::pair<std::string_view, std::string_view> split_register_suffix(std::string_view regToken) {
+    auto dotPos = regToken.rfind('.');
+    if (dotPos == std::string_view::npos)
+        return {regToken, {}};
+
+    std::string_view mainPart = regToken.substr(0, dotPos);
+    std::string_view suffix = regToken.substr(dotPos + 1);
+
+    if (suffix != "L" && suffix != "H")
+        return {regToken, {}};
+
+    return {mainPart, suffix};
+}
+
+// Remove surrounding whitespace.
+inline std::string_view trim_view(std::string_view s) {
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
+        s.remove_prefix(1);
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
+        s.remove_suffix(1);
+    return s;
+}
+
+// Strip an optional leading '#' and parse the rest as an integer.
+inline bool parse_hash_integer(std::string_view text, int64_t &value) {
+    if (!text.empty() && text.front() == '#')
+        text.remove_prefix(1);
+    return parse_integer(text, value);
+}
+
+namespace {
+
+// Store the low 'N' bytes of a number in big-endian order.
+template <size_t N>
+inline void store_big_endian(uint8_t *out, uint64_t value) {
+    for (size_t i = 0; i < N; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * (N - 1 - i)));
+    }
+}
+
+// parse_integer() with a fast path for the common case of a short decimal
+// number without a sign or leading zero.
+inline bool parse_operand_integer(std::string_view text, int64_t &value) {
+    if (text.empty() || text.size() > 9 || text[0] == '0')
+        return parse_integer(text, value);
+    int64_t result = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9')
+            return parse_integer(text, value);
+        result = result * 10 + (c - '0');
+    }
+    value = result;
+    return true;
+}
+
+// Operand conversions for the generated encoders (see SpecifierEncoders).
+// A conversion that fails returns false without reporting anything; the
+// caller then encodes the instruction again with the generic encoder, which
+// prints the diagnostic. Relocations and base fixups are held back until
+// commit() so that an abandoned attempt leaves no trace.
+class FieldWriter {
+public:
+    using Operand = Token;
+
+    FieldWriter(CodeGenerator &code_generator, const uint8_t *start, uint32_t address)
+        : code_generator_(code_generator), start_(start), address_(address) {}
+
+    template <size_t N, uint8_t SuffixBits>
+    bool reg(const Token &token, uint8_t *out) {
+        std::string_view number = token.data;
+        if (SuffixBits != 0)
+            number.remove_suffix(2); // ".L" or ".H", as selected by the specifier.
+        int64_t reg_num = 0;
+        if (!parse_operand_integer(number, reg_num) || reg_num < INT32_MIN || reg_num > INT32_MAX)
+            return false;
+        store_big_endian<N>(out, static_cast<uint8_t>((reg_num & 0x3F) | SuffixBits));
+        return true;
+    }
+
+    template <size_t N>
+    bool immediate(const Token &token, uint8_t *out) {
+        std::string_view text = token.data;
+        if (!text.empty() && text.front() == '#')
+            text.remove_prefix(1);
+        int64_t imm = 0;
+        if (!parse_operand_integer(text, imm))
+            return false;
+        store_big_endian<N>(out, static_cast<uint64_t>(imm));
+        return true;
+    }
+
+    // A memory placeholder takes either "[address]" or a label.
+    template <size_t N>
+    bool address(const Token &token, uint8_t *out) {
+        if (token.subtype == OperandSubtype::LabelReference)
+            return label<N>(token, out);
+        std::string_view inside = trim_view(token.data.substr(1, token.data.size() - 2));
+        if (!inside.empty() && inside[0] == '#')
+            inside.remove_prefix(1);
+        int64_t address = 0;
+        if (!parse_operand_integer(inside, address))
+            return false;
+        store_big_endian<N>(out, static_cast<uint64_t>(address));
+        return true;
+    }
+
+    template <size_t N>
+    bool label(const Token &token, uint8_t *out) {
+        const uint32_t address = address_ + static_cast<uint32_t>(out - start_);
+        auto label = code_generator_.label_table.find(token.data);
+        if (label != code_generator_.label_table.end()) {
+            store_big_endian<N>(out, label->second.address);
+            pending_[num_pending_++] = {{}, address, label->second.section};
+        } else {
+            store_big_endian<N>(out, 0);
+            pending_[num_pending_++] = {token.data, address, Section::Text};
+        }
+        return true;
+    }
+
+    // The label's address relative to the instruction; the label must be in
+    // this file's .text and within reach of the field.
+    template <size_t N, unsigned Bits>
+    bool relative_label(const Token &token, uint8_t *out) {
+        auto label = code_generator_.label_table.find(token.data);
+        if (label == code_generator_.label_table.end() || label->second.section != Section::Text)
+            return false;
+        const int64_t displacement = static_cast<int64_t>(label->second.address) - static_cast<int64_t>(address_);
+        if (!CodeGenerator::displacement_fits(displacement, Bits))
+            return false;
+        store_big_endian<N>(out, static_cast<uint64_t>(displacement));
+        return true;
+    }
+
+    template <size_t N>
+    bool base_register(const Token &token, uint8_t *out) {
+        if (!parse_offset_memory(token) || base_ < 0 || base_ > 63)
+            return false;
+        store_big_endian<N>(out, static_cast<uint8_t>(base_));
+        return true;
+    }
+
+    template <size_t N>
+    bool offset(const Token &token, uint8_t *out) {
+        if (!parse_offset_memory(token))
+            return false;
+        store_big_endian<N>(out, static_cast<uint64_t>(offset_));
+        return true;
+    }
+
+    // Record the relocations of a successful encoding.
+    void commit() {
+        for (size_t i = 0; i < num_pending_; ++i) {
+            const PendingReference &pending = pending_[i];
+            if (pending.external_label.empty()) {
+                code_generator_.base_fixups.push_back({pending.address, Section::Text, pending.target});
+            } else {
+                code_generator_.relocation_entries.emplace_back(code_generator_.intern_label(pending.external_label),
+                                                                pending.address, Section::Text);
+            }
+        }
+    }
+
+private:
+    // The base and offset fields come from the same operand; parse it once.
+    bool parse_offset_memory(const Token &token) {
+        if (&token != offset_memory_) {
+            if (!CodeGenerator::parse_offset_memory_subfields(token.data, base_, offset_))
+                return false;
+            offset_memory_ = &token;
+        }
+        return true;
+    }
+
+    CodeGenerator &code_generator_;
+    const uint8_t *start_;  // First byte of the instruction.
+    uint32_t address_;      // Output address of that byte.
+    // A label reference: a base fixup, or a relocation if the label is external.
+    struct PendingReference {
+        std::string_view external_label;
+        uint32_t address;
+        Section target; // Of a label in this file.
+    };
+    PendingReference pending_[max_fields];
+    size_t num_pending_ = 0;
+    const Token *offset_memory_ = nullptr; // Operand that base_ and offset_ were parsed from.
+    int base_ = 0;
+    int offset_ = 0;
+};
+
+using Encoders = SpecifierEncoders<FieldWriter>;
+
+} // namespace
+
+void CodeGenerator::bind_fields(const InstructionSpecifier *spec,
+                                std::span<const Token> operand_tokens,
+                                const Token *(&binding)[max_fields]) {
+    for (size_t i = 0; i < spec->num_fields; ++i) {
+        const int8_t operand = spec->fields[i].operand;
+        binding[i] = operand >= 0 && static_cast<size_t>(operand) < operand_tokens.size()
+                         ? &operand_tokens[static_cast<size_t>(operand)]
+                         : nullptr;
+    }
+}
+
+void CodeGenerator::assemble_instruction(const InstructionFormat *format,
+                                         const InstructionSpecifier *spec,
+                                         std::span<const Token> operand_tokens,
+                                         std::vector<uint8_t> &object_code) {
+    const Encoders::Encoder encoder = Encoders::table[spec->index];
+    if (encoder && operand_tokens.size() == spec->num_operands) {
+        const size_t start = object_code.size();
+        object_code.resize(start + spec->length);
+        uint8_t *out = object_code.data() + start;
+        FieldWriter fields(*this, out, code_base + static_cast<uint32_t>(start));
+        if (encoder(fields, operand_tokens.data(), out)) {
+            const size_t first_relocation = relocation_entries.size();
+            const size_t first_fixup = base_fixups.size();
+            fields.commit();
+            if (validate_encoders)
+                validate_generated_encoding(format, spec, operand_tokens, object_code,
+                                            start, first_relocation, first_fixup);
+            return;
+        }
+        object_code.resize(start);
+    }
+    assemble_instruction_generic(format, spec, operand_tokens, object_code);
+}
+
+void CodeGenerator::validate_generated_encoding(const InstructionFormat *format,
+                                                const InstructionSpecifier *spec,
+                                                std::span<const Token> operand_tokens,
+                                                std::vector<uint8_t> &object_code,
+                                                size_t start, size_t first_relocation, size_t first_fixup) {
+    // Set the generated result aside and encode the instruction again, in place.
+    const auto relocations_begin = relocation_entries.begin() + static_cast<std::ptrdiff_t>(first_relocation);
+    const auto fixups_begin = base_fixups.begin() + static_cast<std::ptrdiff_t>(first_fixup);
+    uint8_t generated_code[UINT8_MAX];
+    std::copy(object_code.begin() + static_cast<std::ptrdiff_t>(start), object_code.end(), generated_code);
+    std::vector<RelocationEntry> generated_relocations(relocations_begin, relocation_entries.end());
+    std::vector<BaseFixup> generated_fixups(fixups_begin, base_fixups.end());
+    object_code.resize(start);
+    relocation_entries.erase(relocations_begin, relocation_entries.end());
+    base_fixups.erase(fixups_begin, base_fixups.end());
+    assemble_instruction_generic(format, spec, operand_tokens, object_code);
+
+    bool same = object_code.size() - start == spec->length &&
+                std::equal(object_code.begin() + static_cast<std::ptrdiff_t>(start), object_code.end(), generated_code) &&
+                std::equal(relocation_entries.begin() + static_cast<std::ptrdiff_t>(first_relocation), relocation_entries.end(),
+                           generated_relocations.begin(), generated_relocations.end(),
+                           [](const RelocationEntry &a, const RelocationEntry &b) {
+                               return a.label == b.label && a.address == b.address;
+                           }) &&
+                std::equal(base_fixups.begin() + static_cast<std::ptrdiff_t>(first_fixup), base_fixups.end(),
+                           generated_fixups.begin(), generated_fixups.end());
+    if (!same) {
+        *diagnostics << "ERROR: Generated encoder for '" << spec->syntax
+                  << "' disagrees with the generic encoder.\n";
+    }
+}
+
+// Turn an instruction into object code.
+void CodeGenerator::assemble_instruction_generic(const InstructionFormat *format,
+                                           const InstructionSpecifier *spec,
+                                           std::span<const Token> operand_tokens,
+                                           std::vector<uint8_t> &object_code) {
+    const uint32_t instruction_address = code_base + static_cast<uint32_t>(object_code.size());
+
+    // Write the sp and opcode.
+    object_code.push_back(static_cast<uint8_t>(spec->sp));
+    object_code.push_back(format->opcode);
+
+    // Bind each field slot to the operand token that fills it.
+    const Token *binding[max_fields];
+    bind_fields(spec, operand_tokens, binding);
+
+    // Process each operand field, in encoding order.
+    for (size_t field_index = 0; field_index < spec->num_fields; ++field_index) {
+        const FieldDescriptor &field = spec->fields[field_index];
+        if (field.kind == FieldKind::Sp || field.kind == FieldKind::Opcode)
+            continue;
+
+        const size_t field_byte_width = (field.bit_width + 7u) / 8u;
+        const Token *chosen_token = binding[field_index];
+
+        if (!chosen_token) {
+            *diagnostics << "ERROR: No matching token for field '" << field_kind_name(field.kind) << "'\n";
+            append_big_endian(object_code, 0, field_byte_width);
+            continue;
+        }
+
+        // A field whose operand is in error is left zero, so that the
+        // instruction keeps the length the layout pass gave it.
+        uint64_t value_to_store = 0;
+
+        switch (chosen_token->subtype) {
+            case OperandSubtype::Immediate: {
+                int64_t imm = 0;
+                if (!parse_hash_integer(chosen_token->data, imm)) {
+                    *diagnostics << "ERROR: Invalid immediate value '" << chosen_token->data.substr(1) << "'\n";
+                    break;
+                }
+                value_to_store = static_cast<uint64_t>(imm);
+                break;
+            }
+            case OperandSubtype::Register: {
+                auto [mainPart, suffix] = split_register_suffix(chosen_token->data);
+                int64_t reg_num = 0;
+                if (!parse_integer(mainPart, reg_num) || reg_num < INT32_MIN || reg_num > INT32_MAX) {
+                    *diagnostics << "ERROR: Invalid register number '" << mainPart << "'\n";
+                    break;
+                }
+
+                uint8_t reg_field = static_cast<uint8_t>(reg_num & 0x3F);
+                if (!suffix.empty()) {
+                    if (suffix == "H")
+                        reg_field |= 0x80;
+                    else if (suffix == "L")
+                        reg_field |= 0x40;
+                    if ((reg_field & 0xC0) == 0xC0) {
+                        *diagnostics << "ERROR: Register '" << chosen_token->data
+                                  << "' cannot have both .L and .H suffixes.\n";
+                        break;
+                    }
+                }
+                value_to_store = reg_field;
+                break;
+            }
+            case OperandSubtype::Memory: {
+                std::string_view inside = chosen_token->data;
+                if (!inside.empty() && inside.front() == '[')
+                    inside.remove_prefix(1);
+                if (!inside.empty() && inside.back() == ']')
+                    inside.remove_suffix(1);
+                inside = trim_view(inside);
+                if (!inside.empty() && inside[0] == '#')
+                    inside.remove_prefix(1);
+                int64_t address = 0;
+                if (!parse_integer(inside, address)) {
+                    *diagnostics << "ERROR: Invalid memory address '" << inside << "'\n";
+                    break;
+                }
+                value_to_store = static_cast<uint64_t>(address);
+                break;
+            }
+            case OperandSubtype::OffsetMemory: {
+                int base_val = 0;
+                int offset_val = 0;
+                if (!parse_offset_memory_subfields(chosen_token->data, base_val, offset_val)) {
+                    *diagnostics << "ERROR: Invalid offset memory operand '" << chosen_token->data << "'\n";
+                    break;
+                }
+                if (field.part == FieldPart::BaseRegister) {
+                    if (base_val < 0 || base_val > 63) {
+                        *diagnostics << "ERROR: Base register number '" << base_val
+                                  << "' out of range (0-63).\n";
+                        break;
+                    }
+                    value_to_store = static_cast<uint8_t>(base_val & 0x3F);
+                } else if (field.part == FieldPart::Offset) {
+                    value_to_store = static_cast<uint64_t>(offset_val);
+                } else {
+                    *diagnostics << "ERROR: Unknown subfield '" << field_kind_name(field.kind)
+                              << "' for OffsetMemory.\n";
+                    break;
+                }
+                break;
+            }
+            case OperandSubtype::LabelReference: {
+                if (field.relative) {
+                    // The distance from the instruction to a label in this file.
+                    auto label = label_table.find(chosen_token->data);
+                    if (label == label_table.end()) {
+                        *diagnostics << "ERROR: Relative reference to label '" << chosen_token->data
+                                  << "', which is not defined in this file.\n";
+                        break;
+                    }
+                    if (label->second.section != Section::Text) {
+                        *diagnostics << "ERROR: Relative reference to label '" << chosen_token->data
+                                  << "', which is not in .text.\n";
+                        break;
+                    }
+                    const int64_t displacement = static_cast<int64_t>(label->second.address) -
+                                                 static_cast<int64_t>(instruction_address);
+                    if (!displacement_fits(displacement, field.bit_width)) {
+                        *diagnostics << "ERROR: Label '" << chosen_token->data << "' is out of range of a "
+                                  << static_cast<int>(field.bit_width) << "-bit relative field.\n";
+                        break;
+                    }
+                    value_to_store = static_cast<uint64_t>(displacement);
+                    break;
+                }
+                // A label in this file is written as its address in its
+                // section, for the linker to rebase; any other label as 0,
+                // with a relocation entry so that the linker can patch in
+                // the actual address.
+                auto patch_position = code_base + static_cast<uint32_t>(object_code.size());
+                auto label = label_table.find(chosen_token->data);
+                if (label != label_table.end()) {
+                    value_to_store = label->second.address;
+                    base_fixups.push_back({patch_position, Section::Text, label->second.section});
+                } else {
+                    this->relocation_entries.emplace_back(intern_label(chosen_token->data), patch_position,
+                                                          Section::Text);
+                }
+                break;
+            }
+            default:
+                *diagnostics << "ERROR: Unhandled operand subtype for token '"
+                          << chosen_token->data << "'\n";
+                break;
+        }
+
+        append_big_endian(object_code, value_to_store, field_byte_width);
+    }
+}
+
+namespace {
+
+inline bool fits_unsigned(int64_t value, unsigned bit_width) {
+    return value >= 0 && (bit_width >= 63 || value < (int64_t{1} << bit_width));
+}
+
+} // namespace
+
+bool CodeGenerator::operands_fit(const InstructionSpecifier *spec,
+                                 std::span<const Token> operand_tokens,
+                                 std::string_view &relative_label) {
+    relative_label = {};
+    const Token *binding[max_fields];
+    bind_fields(spec, operand_tokens, binding);
+
+    for (size_t field_index = 0; field_index < spec->num_fields; ++field_index) {
+        const FieldDescriptor &field = spec->fields[field_index];
+        if (field.kind == FieldKind::Sp || field.kind == FieldKind::Opcode)
+            continue;
+        const Token *token = binding[field_index];
+        if (!token)
+            return false;
+
+        int64_t value = 0;
+        switch (token->subtype) {
+            case OperandSubtype::Immediate:
+                if (!parse_hash_integer(token->data, value))
+                    return false;
+                break;
+            case OperandSubtype::Register: {
+                auto [mainPart, suffix] = split_register_suffix(token->data);
+                if (!parse_integer(mainPart, value) || value < INT32_MIN || value > INT32_MAX)
+                    return false;
+                value = (value & 0x3F) | (suffix == "H" ? 0x80 : suffix == "L" ? 0x40 : 0);
+                break;
+            }
+            case OperandSubtype::Memory: {
+                std::string_view inside = trim_view(token->data.substr(1, token->data.size() - 2));
+                if (!parse_hash_integer(inside, value))
+                    return false;
+                break;
+            }
+            case OperandSubtype::OffsetMemory: {
+                int base = 0;
+                int offset = 0;
+                if (!parse_offset_memory_subfields(token->data, base, offset))
+                    return false;
+                value = field.part == FieldPart::BaseRegister ? base : offset;
+                break;
+            }
+            case OperandSubtype::LabelReference:
+                if (field.relative) {
+                    relative_label = token->data;
+                    continue;
+                }
+                // Base fixups and relocations patch 32-bit addresses.
+                if (field.bit_width < 32)
+                    return false;
+                continue;
+            default:
+                return false;
+        }
+        if (!fits_unsigned(value, field.bit_width))
+            return false;
+    }
+    return true;
+}
+
+std::string_view CodeGenerator::intern_label(std::string_view name) {
+    auto label = label_table.find(name);
+    if (label != label_table.end())
+        return label->first;
+    auto external = external_labels.find(name);
+    if (external == external_labels.end())
+        external = external_labels.emplace(name).first;
+    return *external;
+}
+
+// Parse offset memory operands like "[2 + #8]".
+bool CodeGenerator::parse_offset_memory_subfields(std::string_view token_data, int &base, int &offset) {
+    if (token_data.size() < 2)
+        return false;
+    std::string_view content = token_data.substr(1, token_data.size() - 2);
+    auto plus_pos = content.find('+');
+    if (plus_pos == std::string_view::npos)
+        return false;
+
+    int64_t base_val = 0;
+    int64_t offset_val = 0;
+    if (!parse_hash_integer(trim_view(content.substr(0, plus_pos)), base_val) ||
+        !parse_hash_integer(trim_view(content.substr(plus_pos + 1)), offset_val))
+        return false;
+    if (base_val < INT32_MIN || base_val > INT32_MAX || offset_val < INT32_MIN || offset_val > INT32_MAX)
+        return false;
+
+    base = static_cast<int>(base_val);
+    offset = static_cast<int>(offset_val);
+    return true;
+}
@@ -0,0 +1,515 @@
+#include "dataflow.h"
+
+#include "assembler.h"
+#include "code_generator.h"
+#include "machine_description.h"
+#include "parser.h"
+
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+// -----------------------------------------------
+// Effect table
+// -----------------------------------------------
+enum EffectFlags : uint16_t {
+    kMemory        = 1 << 0, // Reads or writes memory or the stack.
+    kSetsOverflow  = 1 << 1, // Sets or clears the overflow flag.
+    kReadsOverflow = 1 << 2,
+    kJump          = 1 << 3, // Continues at its label.
+    kBranch        = 1 << 4, // Continues at its label or at the next instruction.
+    kCall          = 1 << 5, // Runs unknown code, then the next instruction.
+    kReturn        = 1 << 6,
+    kHalt          = 1 << 7,
+    kWait          = 1 << 8, // Interrupt handlers run, then the next instruction.
+    kMoveImmediate = 1 << 9, // Operand 0 receives the immediate operand 1.
+    kCopy          = 1 << 10, // Operand 1 receives a copy of operand 0.
+};
+
+constexpr uint16_t ends_block = kJump | kBranch | kCall | kReturn | kHalt;
+constexpr uint16_t reads_everything = kCall | kReturn | kHalt | kWait;
+constexpr uint16_t writes_everything = kCall | kWait;
+constexpr uint16_t not_removable = kMemory | kReadsOverflow | ends_block | kWait;
+
+// The register effects of each specifier, named by its mnemonics and the
+// syntax after the mnemonic. Bit i of 'reads' and 'writes' stands for the
+// register of operand i; the base register of a "[rn + #offset]" operand is
+// always read, and a write to a .L/.H half also reads the rest. Every
+// specifier of the machine description must be described exactly once.
+struct EffectText {
+    std::string_view mnemonics; // Separated by spaces.
+    std::string_view operands;
+    uint8_t reads;
+    uint8_t writes;
+    uint16_t flags;
+};
+
+constexpr uint8_t op0 = 1 << 0;
+constexpr uint8_t op1 = 1 << 1;
+constexpr uint8_t op2 = 1 << 2;
+constexpr std::string_view alu = "add sub mul and or xor lsh rsh";
+constexpr std::string_view compare = "be bne blt bgt";
+
+constexpr EffectText effect_text[] = {
+    {"nop",         "",                                0,           0,           0},
+    {alu,           "%rd, #%immediate",                op0,         op0,         kSetsOverflow},
+    {alu,           "%rd, %rn",                        op0 | op1,   op0,         kSetsOverflow},
+    {alu,           "%rd, [%normAddressing]",          op0,         op0,         kSetsOverflow | kMemory},
+    // "mov %rd, %rn" copies rd into rn.
+    {"mov",         "%rd, #%immediate",                0,           op0,         kMoveImmediate},
+    {"mov",         "%rd, %rn, %label",                0,           op0 | op1,   0},
+    {"mov",         "%rd, %rn",                        op0,         op1,         kCopy},
+    {"mov",         "%rd.L, [%normAddressing]",        0,           op0,         kMemory},
+    {"mov",         "%rd.H, [%normAddressing]",        0,           op0,         kMemory},
+    {"mov",         "%rd, [%normAddressing]",          0,           op0,         kMemory},
+    {"mov",         "%rd, %rn1, [%normAddressing]",    0,           op0 | op1,   kMemory},
+    {"mov",         "[%normAddressing], %rd.L",        op1,         0,           kMemory},
+    {"mov",         "[%normAddressing], %rd.H",        op1,         0,           kMemory},
+    {"mov",         "[%normAddressing], %rd",          op1,         0,           kMemory},
+    {"mov",         "[%normAddressing], %rd, %rn1",    op1 | op2,   0,           kMemory},
+    {"mov",         "%rd.L, [%rn + #%offset]",         0,           op0,         kMemory},
+    {"mov",         "%rd.H, [%rn + #%offset]",         0,           op0,         kMemory},
+    {"mov",         "%rd, [%rn + #%offset]",           0,           op0,         kMemory},
+    {"mov",         "%rd, %rd1, [%rn + #%offset]",     0,           op0 | op1,   kMemory},
+    {"mov",         "[%rn + #%offset], %rd.L",         op1,         0,           kMemory},
+    {"mov",         "[%rn + #%offset], %rd.H",         op1,         0,           kMemory},
+    {"mov",         "[%rn + #%offset], %rd",           op1,         0,           kMemory},
+    {"mov",         "[%rn + #%offset], %rd, %rn1",     op1 | op2,   0,           kMemory},
+    {"b",           "%label",                          0,           0,           kJump},
+    {compare,       "%rd, %rn, %label",                op0 | op1,   0,           kBranch},
+    {"bro",         "%label",                          0,           0,           kBranch | kReadsOverflow},
+    {"umull smull", "%rd, %rn, %rn1",                  op0 | op1,   op0 | op2,   kSetsOverflow},
+    {"hlt",         "",                                0,           0,           kHalt},
+    {"psh",         "%rd",                             op0,         0,           kMemory},
+    {"pop",         "%rd",                             0,           op0,         kMemory},
+    {"jsr",         "%label",                          0,           0,           kCall},
+    {"rts",         "",                                0,           0,           kReturn},
+    {"wfi",         "",                                0,           0,           kWait},
+};
+
+// -----------------------------------------------
+// Effect compilation (at build time)
+// -----------------------------------------------
+struct Effect {
+    uint8_t reads;
+    uint8_t writes;
+    uint16_t flags;
+    uint8_t described; // How many table entries describe the specifier.
+    bool valid;        // Its bits name register operands only.
+};
+
+constexpr bool in_list(std::string_view list, std::string_view name) {
+    while (!list.empty()) {
+        size_t space = list.find(' ');
+        if (list.substr(0, space) == name) return true;
+        list = space == std::string_view::npos ? std::string_view() : list.substr(space + 1);
+    }
+    return false;
+}
+
+constexpr std::string_view operand_syntax(const InstructionSpecifier &spec) {
+    std::string_view syntax = spec.syntax;
+    size_t space = syntax.find(' ');
+    return space == std::string_view::npos ? std::string_view() : syntax.substr(space + 1);
+}
+
+constexpr bool is_register(OperandKind kind) {
+    return kind == OperandKind::Register || kind == OperandKind::RegisterLow || kind == OperandKind::RegisterHigh;
+}
+
+// Effects indexed by InstructionSpecifier::index, and whether every table
+// entry describes at least one specifier.
+struct EffectTable {
+    std::array<Effect, num_specifiers> effects;
+    bool entries_used;
+};
+
+constexpr EffectTable compile_effects() {
+    EffectTable table{};
+    table.entries_used = true;
+    for (const EffectText &text : effect_text) {
+        bool used = false;
+        for (const InstructionFormat &format : instructions) {
+            if (!in_list(text.mnemonics, format.name)) continue;
+            for (size_t j = 0; j < format.num_specifiers; ++j) {
+                const InstructionSpecifier &spec = format.specifiers[j];
+                if (operand_syntax(spec) != text.operands) continue;
+                uint8_t register_operands = 0;
+                for (size_t k = 0; k < spec.num_operands; ++k) {
+                    if (is_register(spec.operands[k])) register_operands |= static_cast<uint8_t>(1u << k);
+                }
+                Effect &effect = table.effects[spec.index];
+                effect = {text.reads, text.writes, text.flags, static_cast<uint8_t>(effect.described + 1),
+                          ((text.reads | text.writes) & ~register_operands) == 0};
+                used = true;
+            }
+        }
+        table.entries_used = table.entries_used && used;
+    }
+    return table;
+}
+
+constexpr EffectTable effect_table = compile_effects();
+
+constexpr bool effects_are_valid() {
+    if (!effect_table.entries_used) return false;
+    for (const Effect &effect : effect_table.effects) {
+        if (effect.described != 1 || !effect.valid) return false;
+    }
+    return true;
+}
+static_assert(effects_are_valid(), "the dataflow effect table does not match the machine description");
+
+// -----------------------------------------------
+// Instructions and blocks
+// -----------------------------------------------
+constexpr size_t num_registers = 64; // Register fields hold 6-bit numbers.
+
+// One bit per register, and one for the overflow flag.
+struct RegisterSet {
+    uint64_t registers = 0;
+    bool overflow = false;
+
+    static RegisterSet all() { return {~uint64_t{0}, true}; }
+    bool any() const { return registers != 0 || overflow; }
+    RegisterSet operator|(RegisterSet other) const { return {registers | other.registers, overflow || other.overflow}; }
+    RegisterSet operator&(RegisterSet other) const { return {registers & other.registers, overflow && other.overflow}; }
+    RegisterSet without(RegisterSet other) const { return {registers & ~other.registers, overflow && !other.overflow}; }
+    bool operator==(const RegisterSet &) const = default;
+};
+
+struct Instruction {
+    size_t begin; // The mnemonic token.
+    size_t end;   // The token after the operands.
+    uint16_t flags;
+    RegisterSet reads;
+    RegisterSet writes; // In part or in whole.
+    RegisterSet kills;  // Written in whole.
+    uint8_t source;      // kCopy.
+    uint8_t destination; // kMoveImmediate, kCopy.
+    int64_t value;       // kMoveImmediate.
+    std::string_view target; // Label of a kJump or kBranch, if it names one.
+    std::string_view label;  // For the report: the label before it,
+    size_t since_label;      // and how many instructions lie in between.
+    const char *removed;     // Why it was removed, or nullptr.
+    bool overflow_dead;      // The overflow flag is dead after it.
+};
+
+struct Block {
+    size_t first; // Index of the first instruction.
+    size_t last;  // One past the last instruction.
+    bool labelled;
+    bool leaves;  // Control may leave the stream after the block.
+    uint8_t num_successors;
+    size_t successors[2];
+    RegisterSet use; // Read before written in the block.
+    RegisterSet def; // Written in whole in the block.
+    RegisterSet live_in;
+    RegisterSet live_out;
+};
+
+// The register a register operand names, or -1 if it is not one.
+int register_number(std::string_view data) {
+    int64_t value = 0;
+    if (!parse_integer(data.substr(0, data.find('.')), value) || value < 0 ||
+        value >= static_cast<int64_t>(num_registers)) {
+        return -1;
+    }
+    return static_cast<int>(value);
+}
+
+// Describe an instruction. Returns false if its effects are unknown: it does
+// not assemble, or names a register the analysis cannot follow.
+bool decode(const InstructionFormat *format, std::span<const Token> operands, Instruction &instruction) {
+    const InstructionSpecifier *spec = format ? Parser::select_specifier(format, operands) : nullptr;
+    if (!spec) return false;
+    const Effect &effect = effect_table.effects[spec->index];
+    instruction.flags = effect.flags;
+    uint8_t numbers[max_operands] = {};
+    for (size_t k = 0; k < spec->num_operands; ++k) {
+        const Token &token = operands[k];
+        if (spec->operands[k] == OperandKind::OffsetMemory) {
+            int base = 0;
+            int offset = 0;
+            if (!CodeGenerator::parse_offset_memory_subfields(token.data, base, offset) || base < 0 ||
+                base >= static_cast<int>(num_registers)) {
+                return false;
+            }
+            instruction.reads.registers |= uint64_t{1} << base;
+        }
+        if (!is_register(spec->operands[k])) continue;
+        const int number = register_number(token.data);
+        if (number < 0) return false;
+        numbers[k] = static_cast<uint8_t>(number);
+        const uint64_t bit = uint64_t{1} << number;
+        const bool whole = Parser::operand_kind(token) == OperandKind::Register;
+        if ((effect.reads >> k & 1) || (!whole && (effect.writes >> k & 1))) instruction.reads.registers |= bit;
+        if (effect.writes >> k & 1) {
+            instruction.writes.registers |= bit;
+            if (whole) instruction.kills.registers |= bit;
+        }
+    }
+    if (effect.flags & reads_everything) instruction.reads = RegisterSet::all();
+    if (effect.flags & writes_everything) instruction.writes = RegisterSet::all();
+    instruction.reads.overflow = instruction.reads.overflow || (effect.flags & kReadsOverflow);
+    instruction.writes.overflow = instruction.writes.overflow || (effect.flags & kSetsOverflow);
+    instruction.kills.overflow = (effect.flags & kSetsOverflow) != 0;
+
+    if (effect.flags & kMoveImmediate) {
+        // Only a whole register with a numeric value is followed.
+        instruction.destination = numbers[0];
+        if (instruction.kills.registers == 0 || !parse_integer(operands[1].data.substr(1), instruction.value)) {
+            instruction.flags &= ~kMoveImmediate;
+        }
+    }
+    if (effect.flags & kCopy) {
+        instruction.source = numbers[0];
+        instruction.destination = numbers[1];
+        if (instruction.kills.registers == 0) instruction.flags &= ~kCopy;
+    }
+    if ((effect.flags & (kJump | kBranch)) && spec->num_operands > 0) {
+        const Token &last = operands[spec->num_operands - 1];
+        if (last.subtype == OperandSubtype::LabelReference) instruction.target = last.data;
+    }
+    return true;
+}
+
+// Unknown effects: reads and may change everything, and stays.
+void make_opaque(Instruction &instruction) {
+    instruction.flags = kMemory;
+    instruction.reads = RegisterSet::all();
+    instruction.writes = RegisterSet::all();
+    instruction.kills = {};
+}
+
+// Remove "mov r, #k" and copies into r when r is known to hold the value.
+// Known values only enter a block from the block before it, since any label
+// may be branched to from elsewhere; so one pass in stream order finds them.
+bool remove_redundant_reloads(std::vector<Instruction> &code, const std::vector<Block> &blocks) {
+    bool changed = false;
+    uint64_t known = 0;
+    int64_t value[num_registers] = {};
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        if (blocks[b].labelled || b == 0 ||
+            (code[blocks[b - 1].last - 1].flags & (kJump | kReturn | kHalt))) {
+            known = 0;
+        }
+        for (size_t i = blocks[b].first; i < blocks[b].last; ++i) {
+            Instruction &instruction = code[i];
+            if (instruction.removed) continue;
+            const uint64_t destination = uint64_t{1} << instruction.destination;
+            const uint64_t source = uint64_t{1} << instruction.source;
+            bool has_value = false;
+            int64_t loaded = 0;
+            if (instruction.flags & kMoveImmediate) {
+                has_value = true;
+                loaded = instruction.value;
+            } else if ((instruction.flags & kCopy) && (known & source)) {
+                has_value = true;
+                loaded = value[instruction.source];
+            }
+            if (has_value && (known & destination) && value[instruction.destination] == loaded) {
+                instruction.removed = "redundant reload";
+                changed = true;
+                continue;
+            }
+            known &= ~instruction.writes.registers;
+            if (has_value) {
+                known |= destination;
+                value[instruction.destination] = loaded;
+            }
+        }
+    }
+    return changed;
+}
+
+// Solve liveness over the blocks, then remove instructions whose only
+// effect is to write registers (and the overflow flag) that are dead.
+bool remove_dead_stores(std::vector<Instruction> &code, std::vector<Block> &blocks) {
+    for (Block &block : blocks) {
+        block.use = {};
+        block.def = {};
+        for (size_t i = block.first; i < block.last; ++i) {
+            if (code[i].removed) continue;
+            block.use = block.use | code[i].reads.without(block.def);
+            block.def = block.def | code[i].kills;
+        }
+        block.live_in = block.use;
+        block.live_out = {};
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = blocks.size(); b-- > 0;) {
+            Block &block = blocks[b];
+            RegisterSet out = block.leaves ? RegisterSet::all() : RegisterSet{};
+            for (size_t s = 0; s < block.num_successors; ++s) out = out | blocks[block.successors[s]].live_in;
+            const RegisterSet in = block.use | out.without(block.def);
+            if (!(out == block.live_out) || !(in == block.live_in)) {
+                block.live_out = out;
+                block.live_in = in;
+                changed = true;
+            }
+        }
+    }
+
+    bool removed = false;
+    for (const Block &block : blocks) {
+        RegisterSet live = block.live_out;
+        for (size_t i = block.last; i-- > block.first;) {
+            Instruction &instruction = code[i];
+            if (instruction.removed) continue;
+            if (!(instruction.flags & not_removable) && instruction.writes.any() &&
+                !(instruction.writes & live).any()) {
+                instruction.removed = "dead store";
+                removed = true;
+                continue;
+            }
+            live = live.without(instruction.kills) | instruction.reads;
+        }
+    }
+    return removed;
+}
+
+// Record after which instructions the overflow flag is dead, from the block
+// liveness that the last remove_dead_stores() computed.
+void mark_dead_overflow(std::vector<Instruction> &code, const std::vector<Block> &blocks) {
+    for (const Block &block : blocks) {
+        bool live = block.live_out.overflow;
+        for (size_t i = block.last; i-- > block.first;) {
+            Instruction &instruction = code[i];
+            if (instruction.removed) continue;
+            instruction.overflow_dead = !live;
+            live = (live && !instruction.kills.overflow) || instruction.reads.overflow;
+        }
+    }
+}
+
+} // namespace
+
+void DataflowOptimizer::run(std::vector<Token> &tokens) {
+    // Split the instructions into blocks.
+    const std::string carried_label = last_label;
+    std::string_view label = carried_label;
+    std::vector<Instruction> code;
+    std::vector<Block> blocks;
+    std::unordered_map<std::string_view, size_t> label_blocks;
+    std::vector<std::string_view> pending_labels;
+    bool new_block = true;
+    for (size_t i = 0; i < tokens.size();) {
+        if (tokens[i].type == TokenType::Label) {
+            pending_labels.push_back(tokens[i].data);
+            label = tokens[i].data;
+            since_label = 0;
+            new_block = true;
+            ++i;
+            continue;
+        }
+        if (tokens[i].type != TokenType::Instruction) {
+            ++i;
+            continue;
+        }
+        Instruction instruction{};
+        instruction.begin = i;
+        const InstructionFormat *format = lookup_instruction(tokens[i].data);
+        while (++i < tokens.size() && tokens[i].type == TokenType::Operand) {}
+        instruction.end = i;
+        std::span<const Token> operands(tokens.data() + instruction.begin + 1, instruction.end - instruction.begin - 1);
+        if (!decode(format, operands, instruction)) make_opaque(instruction);
+        instruction.label = label;
+        instruction.since_label = since_label++;
+
+        if (new_block) {
+            blocks.push_back({code.size(), code.size(), !pending_labels.empty(), false, 0, {}, {}, {}, {}, {}});
+            for (std::string_view name : pending_labels) label_blocks.emplace(name, blocks.size() - 1);
+            pending_labels.clear();
+            new_block = false;
+        }
+        new_block = (instruction.flags & ends_block) != 0;
+        code.push_back(instruction);
+        blocks.back().last = code.size();
+    }
+    last_label = label;
+    if (code.empty()) {
+        dead_overflow.assign(tokens.size(), false);
+        return;
+    }
+
+    // Connect them. A label after the last instruction, or in another file,
+    // is outside the stream.
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        Block &block = blocks[b];
+        const Instruction &last = code[block.last - 1];
+        auto add_successor = [&](std::string_view target) {
+            auto it = target.empty() ? label_blocks.end() : label_blocks.find(target);
+            if (it == label_blocks.end()) {
+                block.leaves = true;
+            } else {
+                block.successors[block.num_successors++] = it->second;
+            }
+        };
+        if (last.flags & (kJump | kBranch)) add_successor(last.target);
+        if (!(last.flags & (kJump | kReturn | kHalt))) {
+            if (b + 1 < blocks.size()) {
+                block.successors[block.num_successors++] = b + 1;
+            } else {
+                block.leaves = true;
+            }
+        }
+    }
+
+    // A removal can expose another of either kind. The last round removes
+    // nothing, so its liveness holds for the code that is left.
+    bool changed = true;
+    while (changed) {
+        changed = remove_redundant_reloads(code, blocks);
+        changed = remove_dead_stores(code, blocks) || changed;
+    }
+    mark_dead_overflow(code, blocks);
+
+    std::vector<Token> out;
+    out.reserve(tokens.size());
+    dead_overflow.clear();
+    dead_overflow.reserve(tokens.size());
+    size_t next = 0;
+    auto keep = [&](size_t begin, size_t end) {
+        out.insert(out.end(), tokens.begin() + static_cast<std::ptrdiff_t>(begin),
+                   tokens.begin() + static_cast<std::ptrdiff_t>(end));
+        dead_overflow.resize(out.size(), false);
+    };
+    for (const Instruction &instruction : code) {
+        keep(next, instruction.begin);
+        next = instruction.end;
+        if (!instruction.removed) {
+            const size_t mnemonic = out.size();
+            keep(instruction.begin, instruction.end);
+            dead_overflow[mnemonic] = instruction.overflow_dead;
+            continue;
+        }
+
+        const std::string_view label_name = instruction.label.empty() ? "(start)" : instruction.label;
+        Removal removal{std::string(label_name) + "+" + std::to_string(instruction.since_label),
+                        std::string(tokens[instruction.begin].data), instruction.removed};
+        for (size_t t = instruction.begin + 1; t < instruction.end; ++t) {
+            removal.instruction += t == instruction.begin + 1 ? " " : ", ";
+            removal.instruction += tokens[t].data;
+        }
+        removals.push_back(std::move(removal));
+    }
+    keep(next, tokens.size());
+    tokens.swap(out);
+}
+
+void DataflowOptimizer::print_report(std::ostream &out) const {
+    out << "Dataflow removed " << removals.size() << (removals.size() == 1 ? " instruction" : " instructions")
+        << (removals.empty() ? ".\n" : ":\n");
+    for (const Removal &removal : removals) {
+        out << "  " << std::left << std::setw(24) << removal.location << std::setw(28) << removal.instruction
+            << removal.reason << std::right << "\n";
+    }
+}
@@ -0,0 +1,58 @@
+#include "file_identity.h"
+#include "content_hash.h"
+
+#include <climits>
+#include <cstdlib>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#endif
+
+FileVersion file_version(const struct stat &st) {
+#if defined(__APPLE__)
+    const timespec &modified = st.st_mtimespec;
+    const timespec &changed = st.st_ctimespec;
+#else
+    const timespec &modified = st.st_mtim;
+    const timespec &changed = st.st_ctim;
+#endif
+    return {
+        static_cast<uint64_t>(st.st_dev),
+        static_cast<uint64_t>(st.st_ino),
+        static_cast<uint64_t>(st.st_size),
+        int64_t{modified.tv_sec} * 1000000000 + modified.tv_nsec,
+        int64_t{changed.tv_sec} * 1000000000 + changed.tv_nsec,
+    };
+}
+
+std::string executable_path() {
+#if defined(__APPLE__)
+    char path[PATH_MAX];
+    uint32_t size = sizeof(path);
+    char resolved[PATH_MAX];
+    if (::_NSGetExecutablePath(path, &size) == 0 && ::realpath(path, resolved)) {
+        return resolved;
+    }
+#elif defined(__linux__)
+    char path[PATH_MAX];
+    ssize_t length = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length > 0) {
+        return std::string(path, static_cast<size_t>(length));
+    }
+#endif
+    return {};
+}
+
+std::optional<uint64_t> executable_identity() {
+    const std::string path = executable_path();
+    struct stat st{};
+    if (path.empty() || ::stat(path.c_str(), &st) != 0) {
+        return std::nullopt;
+    }
+    const FileVersion version = file_version(st);
+    ContentHash identity;
+    identity.update(version.size);
+    identity.update(static_cast<uint64_t>(version.modified_ns));
+    return identity.value();
+}
@@ -0,0 +1,43 @@
+#ifndef FILE_IDENTITY_H
+#define FILE_IDENTITY_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <sys/stat.h>
+
+/*
+What the caches compare to tell whether what they hold is still current: the
+version of a file, and the identity of the running assembler. Both are read
+the same way on Linux and macOS.
+*/
+
+// One version of a file: writing it changes at least one of these.
+struct FileVersion {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t modified_ns;
+    int64_t changed_ns;
+
+    bool operator==(const FileVersion &) const = default;
+};
+
+// The version of the file 'st' describes.
+FileVersion file_version(const struct stat &st);
+
+// Absolute path of the running executable, or empty if the system does not
+// say.
+std::string executable_path();
+
+/**
+ * A hash of the version of the running executable, which changes whenever
+ * it is rebuilt. Caches on disk key their entries with it, so that a new
+ * assembler never reuses what an older one wrote.
+ *
+ * @return Nullopt if the executable cannot be found; such a cache must then
+ * not be used.
+ */
+std::optional<uint64_t> executable_identity();
+
+#endif // FILE_IDENTITY_H
@@ -0,0 +1,453 @@
+#include "include_cache.h"
+#include "source_buffer.h"
+#include "structural_index.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Changes whenever the way a header is lexed, or its entry format, does.
+constexpr uint64_t kFormatVersion = 2;
+constexpr char kEntryMagic[4] = {'N', 'C', 'I', '2'};
+
+// Where a token's text is in IncludedHeader::storage. Cache entries hold
+// these as they are in memory: an entry is only read by the assembler that
+// wrote it.
+struct PackedToken {
+    uint32_t lexeme_offset;
+    uint32_t lexeme_length;
+    uint32_t data_offset;
+    uint32_t data_length;
+    uint8_t type;
+    uint8_t subtype;
+    uint8_t reserved[2];
+};
+
+// Copy the text of 'tokens' into 'storage'; a token's data shares the copy of
+// its lexeme when it is part of it.
+std::vector<PackedToken> pack(const std::vector<Token> &tokens, std::string &storage) {
+    std::vector<PackedToken> packed;
+    packed.reserve(tokens.size());
+    for (const Token &token : tokens) {
+        PackedToken p{};
+        p.lexeme_offset = static_cast<uint32_t>(storage.size());
+        p.lexeme_length = static_cast<uint32_t>(token.lexeme.size());
+        storage.append(token.lexeme);
+        const char *lexeme_end = token.lexeme.data() + token.lexeme.size();
+        if (token.data.data() >= token.lexeme.data() && token.data.data() + token.data.size() <= lexeme_end) {
+            p.data_offset = p.lexeme_offset + static_cast<uint32_t>(token.data.data() - token.lexeme.data());
+        } else {
+            p.data_offset = static_cast<uint32_t>(storage.size());
+            storage.append(token.data);
+        }
+        p.data_length = static_cast<uint32_t>(token.data.size());
+        p.type = static_cast<uint8_t>(token.type);
+        p.subtype = static_cast<uint8_t>(token.subtype);
+        packed.push_back(p);
+    }
+    return packed;
+}
+
+// The tokens of 'packed', viewing 'storage'.
+std::vector<Token> unpack(const std::vector<PackedToken> &packed, std::string_view storage) {
+    std::vector<Token> tokens;
+    tokens.reserve(packed.size());
+    for (const PackedToken &p : packed) {
+        tokens.push_back({storage.substr(p.lexeme_offset, p.lexeme_length), static_cast<TokenType>(p.type),
+                          static_cast<OperandSubtype>(p.subtype), storage.substr(p.data_offset, p.data_length)});
+    }
+    return tokens;
+}
+
+void put(std::string &out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+void put(std::string &out, std::string_view text) {
+    put(out, static_cast<uint32_t>(text.size()));
+    out.append(text);
+}
+
+// Reads what put() wrote; 'ok' turns false at the first read past the end.
+struct EntryReader {
+    std::string_view in;
+    bool ok = true;
+
+    uint32_t u32() {
+        if (in.size() < 4) {
+            ok = false;
+            return 0;
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= uint32_t{static_cast<unsigned char>(in[i])} << (8 * i);
+        }
+        in.remove_prefix(4);
+        return value;
+    }
+
+    std::string_view text() {
+        uint32_t size = u32();
+        if (!ok || in.size() < size) {
+            ok = false;
+            return {};
+        }
+        std::string_view value = in.substr(0, size);
+        in.remove_prefix(size);
+        return value;
+    }
+};
+
+// The directory part of a canonical path.
+std::string directory_of(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Canonical path of the regular file 'name' names from 'from_directory', or
+// from one of 'include_dirs'; empty if there is none.
+std::string find_header(std::string_view name, const std::string &from_directory,
+                        const std::vector<std::string> &include_dirs) {
+    std::vector<std::string> candidates;
+    if (name.front() == '/') {
+        candidates.emplace_back(name);
+    } else {
+        candidates.push_back(from_directory.empty() ? std::string(name) : from_directory + "/" + std::string(name));
+        for (const std::string &dir : include_dirs) {
+            candidates.push_back(dir + "/" + std::string(name));
+        }
+    }
+    for (const std::string &candidate : candidates) {
+        char resolved[PATH_MAX];
+        struct stat st{};
+        if (::realpath(candidate.c_str(), resolved) && ::stat(resolved, &st) == 0 && S_ISREG(st.st_mode)) {
+            return resolved;
+        }
+    }
+    return {};
+}
+
+void append_tokens(const std::vector<Token> &tokens, const IncludeMap &includes, std::vector<Token> &out,
+                   std::unordered_set<std::string> &included) {
+    for (const Token &token : tokens) {
+        if (token.type != TokenType::Include) {
+            out.push_back(token);
+            continue;
+        }
+        auto it = includes.find(std::string(token.data));
+        if (it != includes.end() && included.insert(it->second->path).second) {
+            append_tokens(it->second->tokens, it->second->includes, out, included);
+        }
+    }
+}
+
+} // namespace
+
+IncludeCache::IncludeCache(std::string directory) : directory_(std::move(directory)) {
+    if (directory_.empty()) {
+        return;
+    }
+    // ObjectCache, given the same directory, reports it.
+    const std::optional<uint64_t> identity = executable_identity();
+    if (!identity) {
+        directory_.clear();
+        return;
+    }
+    assembler_identity_ = *identity;
+    ::mkdir(directory_.c_str(), 0777);
+}
+
+std::shared_ptr<const IncludedHeader> IncludeCache::load(std::string_view name, const std::string &from_directory,
+                                                         const std::vector<std::string> &include_dirs,
+                                                         std::ostream &diagnostics) {
+    const std::string path = find_header(name, from_directory, include_dirs);
+    if (path.empty()) {
+        diagnostics << "Cannot find included file " << name << ".\n";
+        return nullptr;
+    }
+    Loading loading;
+    return load_path(path, include_dirs, diagnostics, loading);
+}
+
+std::shared_ptr<const IncludedHeader> IncludeCache::load_path(const std::string &path,
+                                                              const std::vector<std::string> &include_dirs,
+                                                              std::ostream &diagnostics, Loading &loading) {
+    struct stat st{};
+    if (::stat(path.c_str(), &st) != 0) {
+        diagnostics << "Cannot read included file " << path << ".\n";
+        return nullptr;
+    }
+    const FileVersion version = file_version(st);
+
+    std::string entry_key = path;
+    for (const std::string &dir : include_dirs) {
+        entry_key += '\0';
+        entry_key += dir;
+    }
+    loading.stack.push_back(path);
+
+    // Wait for the header if another call has it or is lexing it, unless
+    // that call waits, directly or not, for this one.
+    std::shared_ptr<const IncludedHeader> header;
+    std::unique_lock lock(mutex_);
+    auto it = entries_.find(entry_key);
+    if (it != entries_.end() && it->second.version == version &&
+        !would_wait_for_itself(it->second.loader, loading)) {
+        auto ready = it->second.header;
+        loading.waiting_for = entry_key;
+        lock.unlock();
+        header = ready.get();
+        lock.lock();
+        loading.waiting_for.clear();
+        lock.unlock();
+        // Still current if the headers it includes are; they report their
+        // errors when it is lexed again.
+        if (header && header->skipped.empty() && includes_current(*header, include_dirs, loading)) {
+            loading.stack.pop_back();
+            return header;
+        }
+        lock.lock();
+        it = entries_.find(entry_key);
+    }
+
+    // Lex it, and have the calls that need it meanwhile wait for this one,
+    // unless another is lexing it already.
+    std::promise<std::shared_ptr<const IncludedHeader>> promise;
+    const bool publish = it == entries_.end() || it->second.loader == nullptr;
+    if (publish) {
+        entries_[entry_key] = {version, promise.get_future().share(), &loading};
+    }
+    lock.unlock();
+    header = lex(path, include_dirs, diagnostics, loading);
+    loading.stack.pop_back();
+    if (publish) {
+        lock.lock();
+        it = entries_.find(entry_key);
+        if (it != entries_.end() && it->second.loader == &loading) {
+            if (header && header->skipped.empty()) {
+                it->second.loader = nullptr;
+            } else {
+                entries_.erase(it);
+            }
+        }
+        lock.unlock();
+        promise.set_value(header);
+    }
+    return header;
+}
+
+bool IncludeCache::includes_current(const IncludedHeader &header, const std::vector<std::string> &include_dirs,
+                                    Loading &loading) {
+    const std::string directory = directory_of(header.path);
+    for (const std::string &name : header.cycles) {
+        if (find_header(name, directory, include_dirs) != header.path) {
+            return false;
+        }
+    }
+    std::ostringstream ignored;
+    for (const auto &[name, nested] : header.includes) {
+        const std::string path = find_header(name, directory, include_dirs);
+        if (path.empty() || std::find(loading.stack.begin(), loading.stack.end(), path) != loading.stack.end()) {
+            return false;
+        }
+        std::shared_ptr<const IncludedHeader> current = load_path(path, include_dirs, ignored, loading);
+        if (!current || current->key != nested->key) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether 'loading' waiting for what 'loader' is lexing would deadlock:
+// whether 'loader' is 'loading', or waits for an entry whose loader does,
+// and so on. Each call checks this before it waits, so the calls waiting
+// never form a cycle, and the walk ends.
+bool IncludeCache::would_wait_for_itself(const Loading *loader, const Loading &loading) const {
+    while (loader) {
+        if (loader == &loading) {
+            return true;
+        }
+        if (loader->waiting_for.empty()) {
+            return false;
+        }
+        auto it = entries_.find(loader->waiting_for);
+        loader = it == entries_.end() ? nullptr : it->second.loader;
+    }
+    return false;
+}
+
+std::shared_ptr<const IncludedHeader> IncludeCache::lex(const std::string &path,
+                                                        const std::vector<std::string> &include_dirs,
+                                                        std::ostream &diagnostics, Loading &loading) {
+    SourceBuffer source;
+    if (!source.open(path) || source.size() > UINT32_MAX) {
+        diagnostics << "Cannot read included file " << path << ".\n";
+        return nullptr;
+    }
+    std::string_view text = source.text();
+
+    auto header = std::make_shared<IncludedHeader>();
+    header->path = path;
+    StructuralIndex index;
+    index.build(text);
+    Lexer lexer;
+    std::ostringstream lexer_diagnostics;
+    lexer.setDiagnostics(lexer_diagnostics);
+    lexer.firstPass(index);
+
+    ContentHash key;
+    key.update(kFormatVersion);
+    key.update(text);
+    const std::string directory = directory_of(path);
+    for (const std::string &name : lexer.includes()) {
+        const std::string nested_path = find_header(name, directory, include_dirs);
+        if (nested_path.empty()) {
+            diagnostics << "Cannot find included file " << name << ".\n"
+                        << "Cannot include " << path << ".\n";
+            return nullptr;
+        }
+        if (std::find(loading.stack.begin(), loading.stack.end(), nested_path) != loading.stack.end()) {
+            // Being included already: skipped, as with an include guard.
+            key.update(nested_path);
+            header->cycles.push_back(name);
+            if (nested_path != path) {
+                header->skipped.push_back(nested_path);
+            }
+            continue;
+        }
+        std::shared_ptr<const IncludedHeader> nested = load_path(nested_path, include_dirs, diagnostics, loading);
+        if (!nested) {
+            diagnostics << "Cannot include " << path << ".\n";
+            return nullptr;
+        }
+        key.update(nested->key);
+        lexer.importMacros(nested->macros);
+        for (const std::string &outer : nested->skipped) {
+            if (outer != path && std::find(header->skipped.begin(), header->skipped.end(), outer) ==
+                                     header->skipped.end()) {
+                header->skipped.push_back(outer);
+            }
+        }
+        header->includes.emplace(name, std::move(nested));
+    }
+    header->key = key.digest();
+    header->macros = lexer.getMacroTable().macros();
+
+    if (!directory_.empty() && read_entry(*header)) {
+        return header;
+    }
+    std::vector<Token> tokens = lexer.secondPass(index);
+    header->diagnostics = std::move(lexer_diagnostics).str();
+    std::vector<PackedToken> packed = pack(tokens, header->storage);
+    header->tokens = unpack(packed, header->storage);
+    if (!directory_.empty()) {
+        write_entry(*header, diagnostics);
+    }
+    return header;
+}
+
+void IncludeCache::splice(std::vector<Token> &tokens, const IncludeMap &includes,
+                          std::unordered_set<std::string> &included) {
+    auto first = std::find_if(tokens.begin(), tokens.end(),
+                              [](const Token &token) { return token.type == TokenType::Include; });
+    if (first == tokens.end()) {
+        return;
+    }
+    std::vector<Token> out(tokens.begin(), first);
+    std::vector<Token> rest(first, tokens.end());
+    append_tokens(rest, includes, out, included);
+    tokens = std::move(out);
+}
+
+std::string IncludeCache::entry_path(const ContentDigest &key) const {
+    ContentHash entry;
+    entry.update(key);
+    entry.update(assembler_identity_);
+    return directory_ + "/" + entry.digest().hex() + ".inc";
+}
+
+// An entry is the magic, the key, the diagnostics and the storage, as put()
+// writes them, then the number of tokens and their PackedTokens.
+bool IncludeCache::read_entry(IncludedHeader &header) const {
+    SourceBuffer file;
+    if (!file.open(entry_path(header.key))) {
+        return false;
+    }
+    EntryReader reader{file.text()};
+    if (!reader.in.starts_with(std::string_view(kEntryMagic, sizeof(kEntryMagic)))) {
+        return false;
+    }
+    reader.in.remove_prefix(sizeof(kEntryMagic));
+    ContentDigest key;
+    for (uint64_t *half : {&key.high, &key.low}) {
+        *half = reader.u32();
+        *half |= uint64_t{reader.u32()} << 32;
+    }
+    std::string_view diagnostics = reader.text();
+    std::string_view storage = reader.text();
+    uint32_t count = reader.u32();
+    if (!reader.ok || key != header.key || reader.in.size() != uint64_t{count} * sizeof(PackedToken)) {
+        return false;
+    }
+    std::vector<PackedToken> packed(count);
+    std::memcpy(packed.data(), reader.in.data(), reader.in.size());
+    for (const PackedToken &p : packed) {
+        if (uint64_t{p.lexeme_offset} + p.lexeme_length > storage.size() ||
+            uint64_t{p.data_offset} + p.data_length > storage.size() ||
+            p.type > static_cast<uint8_t>(TokenType::Unknown) ||
+            p.subtype > static_cast<uint8_t>(OperandSubtype::Unknown)) {
+            return false;
+        }
+    }
+    header.diagnostics = diagnostics;
+    header.storage = storage;
+    header.tokens = unpack(packed, header.storage);
+    return true;
+}
+
+void IncludeCache::write_entry(const IncludedHeader &header, std::ostream &diagnostics) const {
+    std::string entry(kEntryMagic, sizeof(kEntryMagic));
+    for (uint64_t half : {header.key.high, header.key.low}) {
+        put(entry, static_cast<uint32_t>(half));
+        put(entry, static_cast<uint32_t>(half >> 32));
+    }
+    put(entry, header.diagnostics);
+    put(entry, header.storage);
+    put(entry, static_cast<uint32_t>(header.tokens.size()));
+    for (const Token &token : header.tokens) {
+        PackedToken p{};
+        p.lexeme_offset = static_cast<uint32_t>(token.lexeme.data() - header.storage.data());
+        p.lexeme_length = static_cast<uint32_t>(token.lexeme.size());
+        p.data_offset = static_cast<uint32_t>(token.data.data() - header.storage.data());
+        p.data_length = static_cast<uint32_t>(token.data.size());
+        p.type = static_cast<uint8_t>(token.type);
+        p.subtype = static_cast<uint8_t>(token.subtype);
+        entry.append(reinterpret_cast<const char *>(&p), sizeof(p));
+    }
+
+    // Written under a name unique to this thread and renamed into place, so a
+    // concurrent assembler never reads half of it.
+    const std::string path = entry_path(header.key);
+    const std::string temporary = path + ".tmp" + std::to_string(::getpid()) + "." +
+                                  std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(entry.data(), static_cast<std::streamsize>(entry.size()));
+    out.close();
+    if (!out || ::rename(temporary.c_str(), path.c_str()) != 0) {
+        diagnostics << "Cannot add " << header.path << " to the cache: " << std::strerror(errno) << "\n";
+        ::unlink(temporary.c_str());
+    }
+}
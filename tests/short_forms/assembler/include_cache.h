@@ -0,0 +1,130 @@
+#ifndef INCLUDE_CACHE_H
+#define INCLUDE_CACHE_H
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "content_hash.h"
+#include "file_identity.h"
+#include "lexer.h"
+#include "macro_table.h"
+
+/*
+IncludeCache lexes the headers named by '.include "name"' directives: once per
+process, and with a directory once per header contents.
+
+A header is lexed on its own. Its lines are expanded with its own macros and
+those of the headers it includes, never with those of the file including it,
+so its tokens are the same wherever it is included. What is kept is its
+tokens, in which its own include directives are left as Include tokens, and
+its macro table, which also holds the macros of the headers it includes. It is
+used again for as long as the device, inode, size and times of its file are
+unchanged, and the headers it includes are.
+
+With a directory (nc16x32-as --cache-dir), the tokens are also written there,
+under the header's key: a hash of its text and the keys of the headers it
+includes. A later run still reads the text and runs the first lexer pass over
+it, to find the headers it includes and compute the key, but reads the tokens
+instead of expanding and tokenizing every line again.
+
+A name is looked up relative to the directory of the file that includes it,
+then in each include directory (-I) in turn. A directive naming a header that
+is already being included around it is skipped, as an include guard would
+skip it: x.inc including y.inc including x.inc gives x.inc's tokens with
+y.inc's in them, once. A header included again elsewhere is left out by
+splice().
+
+Safe to use from several threads. A header is lexed by one of them, with no
+lock held, while the others that need it wait for it.
+*/
+struct IncludedHeader;
+
+// The headers a file includes, by the name in its directives.
+using IncludeMap = std::unordered_map<std::string, std::shared_ptr<const IncludedHeader>>;
+
+struct IncludedHeader {
+    std::string path;            // Canonical.
+    ContentDigest key;
+    std::string diagnostics;     // What lexing the header reported.
+    std::vector<Token> tokens;   // Views into 'storage'.
+    std::string storage;
+    std::vector<MacroTable::Macro> macros;
+    IncludeMap includes;
+    // Names in its directives that named a header already being included,
+    // so were skipped.
+    std::vector<std::string> cycles;
+    // Canonical paths of the headers around it whose directives it, or a
+    // header it includes, skipped. What it holds then depends on where it
+    // was included, so it is not kept.
+    std::vector<std::string> skipped;
+};
+
+class IncludeCache {
+public:
+    // Keep headers in memory only, or also in 'directory' if it is not empty
+    // and executable_identity() is known.
+    explicit IncludeCache(std::string directory = {});
+
+    /**
+     * The header named 'name' in a directive of a file in 'from_directory'
+     * (the current directory if empty).
+     *
+     * @return Null after reporting to 'diagnostics' if the header, or one it
+     * includes, cannot be found or read.
+     */
+    std::shared_ptr<const IncludedHeader> load(std::string_view name, const std::string &from_directory,
+                                               const std::vector<std::string> &include_dirs,
+                                               std::ostream &diagnostics);
+
+    /**
+     * Replace each Include token in 'tokens' by the tokens of the header it
+     * names in 'includes', and those of the headers that header includes. A
+     * header whose canonical path is in 'included' is left out, and every
+     * header spliced in is added to it, so each is included once.
+     */
+    static void splice(std::vector<Token> &tokens, const IncludeMap &includes,
+                       std::unordered_set<std::string> &included);
+
+private:
+    // One call of load(): the canonical paths of the headers it is loading,
+    // innermost last, and the entry it waits for, if any.
+    struct Loading {
+        std::vector<std::string> stack;
+        std::string waiting_for; // Under mutex_.
+    };
+
+    struct Entry {
+        FileVersion version;
+        std::shared_future<std::shared_ptr<const IncludedHeader>> header;
+        const Loading *loader; // The call lexing the header until it is ready.
+    };
+
+    std::shared_ptr<const IncludedHeader> load_path(const std::string &path,
+                                                    const std::vector<std::string> &include_dirs,
+                                                    std::ostream &diagnostics, Loading &loading);
+    std::shared_ptr<const IncludedHeader> lex(const std::string &path, const std::vector<std::string> &include_dirs,
+                                              std::ostream &diagnostics, Loading &loading);
+    bool includes_current(const IncludedHeader &header, const std::vector<std::string> &include_dirs,
+                          Loading &loading);
+    [[nodiscard]] bool would_wait_for_itself(const Loading *loader, const Loading &loading) const;
+
+    [[nodiscard]] std::string entry_path(const ContentDigest &key) const;
+    bool read_entry(IncludedHeader &header) const;
+    void write_entry(const IncludedHeader &header, std::ostream &diagnostics) const;
+
+    std::mutex mutex_; // Guards entries_, and what Loading says is under it.
+    // By canonical path and include directories, which decide what the
+    // header's own directives name.
+    std::unordered_map<std::string, Entry> entries_;
+    std::string directory_;
+    uint64_t assembler_identity_ = 0; // Only used with a directory.
+};
+
+#endif // INCLUDE_CACHE_H
@@ -0,0 +1,309 @@
+#include "lexer.h"
+
+#include "char_class.h"
+
+#include <algorithm>
+
+using namespace lex;
+
+// -----------------------------------------------
+// Expansion storage
+// -----------------------------------------------
+std::string_view Lexer::storeExpansion(std::string_view text) {
+    constexpr size_t blockSize = 64 * 1024;
+    if (expansionBlocks.empty() || expansionBlockSize - expansionBlockUsed < text.size()) {
+        expansionBlockSize = std::max(blockSize, text.size());
+        expansionBlocks.push_back(std::make_unique<char[]>(expansionBlockSize));
+        expansionBlockUsed = 0;
+    }
+    char *dest = expansionBlocks.back().get() + expansionBlockUsed;
+    std::copy(text.begin(), text.end(), dest);
+    expansionBlockUsed += text.size();
+    return {dest, text.size()};
+}
+
+// -----------------------------------------------
+// Operand Parsing Logic
+// -----------------------------------------------
+OperandSubtype Lexer::parseOperandSubtype(std::string_view operandText) {
+    if (operandText.empty()) {
+        return OperandSubtype::Unknown;
+    }
+    if (operandText.size() >= 2 && operandText.front() == '[' && operandText.back() == ']') {
+        if (operandText.find('+') != std::string_view::npos) {
+            return OperandSubtype::OffsetMemory;
+        }
+        return OperandSubtype::Memory;
+    }
+    if (operandText[0] == '#') {
+        return OperandSubtype::Immediate;
+    }
+
+    // Register: (r)?\d+(\.[HL])?
+    size_t pos = operandText[0] == 'r' ? 1 : 0;
+    size_t digitsEnd = pos;
+    while (digitsEnd < operandText.size() && is(operandText[digitsEnd], kDigit)) ++digitsEnd;
+    if (digitsEnd > pos) {
+        std::string_view rest = operandText.substr(digitsEnd);
+        if (rest.empty() || rest == ".H" || rest == ".L") {
+            return OperandSubtype::Register;
+        }
+    }
+
+    if (is(operandText[0], kIdentStart)) {
+        return OperandSubtype::LabelReference;
+    }
+    return OperandSubtype::Unknown;
+}
+
+// -----------------------------------------------
+// Definition matchers
+// -----------------------------------------------
+bool Lexer::matchMacroDefinition(std::string_view line, MacroTable::Definition &definition) {
+    if (line.empty() || line[0] != '$') {
+        return false;
+    }
+
+    // NAME must be at least two identifier characters. It is followed either by
+    // whitespace or by a parenthesised parameter list and whitespace, and then
+    // by a non-empty body.
+    auto matchFrom = [&](size_t pos) {
+        if (pos >= line.size() || !is(line[pos], kIdentStart)) return false;
+        size_t nameEnd = identRunEnd(line, pos + 1);
+        if (nameEnd == pos + 1 || nameEnd >= line.size()) return false;
+
+        definition.params.clear();
+        definition.is_function = line[nameEnd] == '(';
+        size_t bodyStart = nameEnd;
+        if (definition.is_function) {
+            size_t p = skipSpaces(line, nameEnd + 1);
+            if (p < line.size() && line[p] == ')') {
+                bodyStart = p + 1;
+            } else {
+                while (true) {
+                    if (p >= line.size() || !is(line[p], kIdentStart)) return false;
+                    size_t paramEnd = identRunEnd(line, p);
+                    std::string_view param = line.substr(p, paramEnd - p);
+                    if (std::find(definition.params.begin(), definition.params.end(), param) !=
+                        definition.params.end()) {
+                        return false;
+                    }
+                    definition.params.push_back(param);
+                    p = skipSpaces(line, paramEnd);
+                    if (p >= line.size()) return false;
+                    if (line[p] == ')') break;
+                    if (line[p] != ',') return false;
+                    p = skipSpaces(line, p + 1);
+                }
+                bodyStart = p + 1;
+            }
+        }
+
+        if (bodyStart >= line.size() || !is(line[bodyStart], kSpace)) return false;
+        size_t valueBegin = skipSpaces(line, bodyStart);
+        if (valueBegin >= line.size()) return false;
+        std::string_view body = line.substr(valueBegin);
+        if (body.find_first_of("\r\n") != std::string_view::npos) return false;
+        definition.name = line.substr(pos, nameEnd - pos);
+        definition.body = body;
+        return true;
+    };
+
+    constexpr std::string_view keyword = "MACRO";
+    if (line.substr(1, keyword.size()) == keyword &&
+        line.size() > 1 + keyword.size() && is(line[1 + keyword.size()], kSpace) &&
+        matchFrom(skipSpaces(line, 1 + keyword.size()))) {
+        return true;
+    }
+    return matchFrom(1);
+}
+
+std::string_view Lexer::matchLabelDefinition(std::string_view line) {
+    if (line.size() < 2 || line.back() != ':' || !is(line[0], kIdentStart)) {
+        return {};
+    }
+    if (identRunEnd(line, 1) != line.size() - 1) {
+        return {};
+    }
+    return line.substr(0, line.size() - 1);
+}
+
+std::string_view Lexer::matchIncludeDirective(std::string_view line) {
+    constexpr std::string_view keyword = ".include";
+    if (!line.starts_with(keyword) || line.size() < keyword.size() + 3 || !is(line[keyword.size()], kSpace)) {
+        return {};
+    }
+    std::string_view quoted = trimView(line.substr(keyword.size()));
+    if (quoted.size() < 3 || quoted.front() != '"' || quoted.back() != '"' ||
+        quoted.find_first_of("\"\r\n", 1) != quoted.size() - 1) {
+        return {};
+    }
+    return quoted.substr(1, quoted.size() - 2);
+}
+
+bool Lexer::isDirectiveName(std::string_view text) {
+    return text == ".text" || text == ".data" || text == ".bss" || text == ".space" || text == ".include";
+}
+
+// -----------------------------------------------
+// Tokenizer
+// -----------------------------------------------
+// A token is one of, tried in this order at each non-separator position:
+//   "..."   double-quoted string (no escapes)
+//   '...'   single-quoted string, shortest match
+//   [...]   bracketed operand, shortest match
+//   a maximal run of characters other than ',' and whitespace
+// An opening quote or bracket without its closing character falls through to
+// the last rule.
+void Lexer::tokenizeLine(std::string_view line, std::vector<Token> &tokens) {
+    bool firstTokenOfLine = true;
+    size_t pos = 0;
+
+    while (pos < line.size()) {
+        if (is(line[pos], kSeparator)) {
+            ++pos;
+            continue;
+        }
+
+        size_t end = std::string_view::npos;
+        char open = line[pos];
+        if (open == '"' || open == '\'' || open == '[') {
+            char close = open == '[' ? ']' : open;
+            size_t closePos = line.find(close, pos + 1);
+            if (closePos != std::string_view::npos) {
+                // '.' in the old patterns stopped at line terminators.
+                bool crossesLineEnd = open != '"' &&
+                    line.substr(pos + 1, closePos - pos - 1).find_first_of("\r\n") != std::string_view::npos;
+                if (!crossesLineEnd) end = closePos + 1;
+            }
+        }
+        if (end == std::string_view::npos) {
+            end = pos;
+            while (end < line.size() && !is(line[end], kSeparator)) ++end;
+        }
+
+        std::string_view text = line.substr(pos, end - pos);
+        pos = end;
+
+        Token t;
+        t.lexeme = text;
+        // An identifier first on the line is an instruction, as is the name
+        // of a directive. Any other ".name" is an operand, as it always was.
+        if (firstTokenOfLine &&
+            ((is(text[0], kIdentStart) && identRunEnd(text, 1) == text.size()) || isDirectiveName(text))) {
+            t.type    = TokenType::Instruction;
+            t.subtype = OperandSubtype::Unknown;
+        } else {
+            t.type    = TokenType::Operand;
+            t.subtype = parseOperandSubtype(text);
+        }
+        t.data = t.lexeme;
+        tokens.push_back(t);
+        firstTokenOfLine = false;
+    }
+}
+
+// -----------------------------------------------
+// First Pass: Collect Macros
+// -----------------------------------------------
+void Lexer::firstPass(const StructuralIndex &index) {
+    MacroTable::Definition definition;
+    for (size_t i = 0; i < index.size(); ++i) {
+        // Definitions start with '$'; of the other lines, only include
+        // directives matter.
+        if ((index.line(i).flags & StructuralIndex::kDollar) == 0) {
+            std::string_view code = index.code(i);
+            size_t start = skipSpaces(code, 0);
+            if (start < code.size() && code[start] == '.') {
+                std::string_view name = matchIncludeDirective(trimView(code));
+                if (!name.empty() && std::find(includeNames.begin(), includeNames.end(), name) == includeNames.end()) {
+                    includeNames.emplace_back(name);
+                }
+            }
+            continue;
+        }
+        std::string_view line = trimView(index.code(i));
+        if (line.empty()) continue;
+
+        if (matchMacroDefinition(line, definition)) {
+            macroTable.define(definition);
+        }
+    }
+}
+
+// -----------------------------------------------
+// Second Pass: Tokenize
+// -----------------------------------------------
+void Lexer::tokenizeSourceLine(std::string_view code, std::vector<Token> &tokens, std::string &expanded) {
+    std::string_view line = trimView(code);
+    if (line.empty()) return;
+    if (line[0] == '$') return;
+
+    if (line[0] == '.') {
+        std::string_view name = matchIncludeDirective(line);
+        if (!name.empty()) {
+            tokens.push_back({line, TokenType::Include, OperandSubtype::Unknown, name});
+            return;
+        }
+    }
+
+    std::string_view text = line;
+    if (macroTable.expand(line, expanded)) {
+        // Keep the expanded text alive for as long as the tokens that view it.
+        text = trimView(storeExpansion(expanded));
+        if (text.empty()) return;
+    }
+
+    std::string_view labelName = matchLabelDefinition(text);
+    if (!labelName.empty()) {
+        Token t;
+        t.lexeme  = labelName;
+        t.type    = TokenType::Label;
+        t.subtype = OperandSubtype::Unknown;
+        t.data    = t.lexeme;
+        tokens.push_back(t);
+        return;
+    }
+
+    tokenizeLine(text, tokens);
+}
+
+Lexer::ChunkResult Lexer::tokenizeChunk(const StructuralIndex &index, std::vector<Token> &tokens) {
+    macroTable.compile();
+    std::string expanded;
+    ChunkResult result{0, 0};
+    size_t firstToken = tokens.size();
+
+    for (size_t i = 0; i < index.size(); ++i) {
+        size_t lineStart = tokens.size();
+        tokenizeSourceLine(index.code(i), tokens, expanded);
+        if (tokens.size() > lineStart && lineStart > firstToken &&
+            (tokens[lineStart].type == TokenType::Instruction || tokens[lineStart].type == TokenType::Label)) {
+            result.cutLine = i;
+            result.cutTokens = lineStart - firstToken;
+        }
+    }
+    return result;
+}
+
+std::vector<Token> Lexer::secondPass(const StructuralIndex &index) {
+    std::vector<Token> tokens;
+    // Typical sources average a little over eight bytes per token; reserving
+    // up front avoids repeatedly copying the token vector as it grows.
+    tokens.reserve(index.text().size() / 8);
+    tokenizeChunk(index, tokens);
+    return tokens;
+}
+
+void Lexer::importMacros(const std::vector<MacroTable::Macro> &macros) {
+    for (const MacroTable::Macro &macro : macros) {
+        macroTable.import(macro);
+    }
+}
+
+void Lexer::releaseExpansions() {
+    if (expansionBlocks.size() > 1) {
+        expansionBlocks.erase(expansionBlocks.begin(), expansionBlocks.end() - 1);
+    }
+    expansionBlockUsed = 0;
+}
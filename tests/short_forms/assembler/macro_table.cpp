@@ -0,0 +1,220 @@
+#include "macro_table.h"
+#include "char_class.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+using namespace lex;
+
+// FNV-1a over the name bytes.
+uint64_t MacroTable::hashName(std::string_view name) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : name) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void MacroTable::define(const Definition &definition) {
+    Macro macro;
+    macro.name = std::string(definition.name);
+    macro.body = std::string(definition.body);
+    macro.is_function = definition.is_function;
+    macro.num_params = definition.params.size();
+    macro.hash = hashName(macro.name);
+
+    if (macro.is_function) {
+        // Split the body into literal runs and whole-identifier parameter uses.
+        std::string_view body = macro.body;
+        size_t literal_start = 0;
+        size_t pos = 0;
+        while (pos < body.size()) {
+            if (!is(body[pos], kIdentStart)) {
+                ++pos;
+                continue;
+            }
+            size_t end = identRunEnd(body, pos);
+            std::string_view ident = body.substr(pos, end - pos);
+            for (size_t p = 0; p < definition.params.size(); ++p) {
+                if (definition.params[p] == ident) {
+                    if (pos > literal_start) {
+                        macro.segments.push_back({static_cast<uint32_t>(literal_start),
+                                                  static_cast<uint32_t>(pos - literal_start), -1});
+                    }
+                    macro.segments.push_back({0, 0, static_cast<int32_t>(p)});
+                    literal_start = end;
+                    break;
+                }
+            }
+            pos = end;
+        }
+        if (literal_start < body.size()) {
+            macro.segments.push_back({static_cast<uint32_t>(literal_start),
+                                      static_cast<uint32_t>(body.size() - literal_start), -1});
+        }
+    }
+
+    compiled_ = false;
+    for (auto &existing : macros_) {
+        if (existing.name == macro.name) {
+            existing = std::move(macro);
+            return;
+        }
+    }
+    macros_.push_back(std::move(macro));
+}
+
+void MacroTable::import(const Macro &macro) {
+    for (const auto &existing : macros_) {
+        if (existing.name == macro.name) {
+            return;
+        }
+    }
+    compiled_ = false;
+    macros_.push_back(macro);
+}
+
+void MacroTable::compile() {
+    if (compiled_) {
+        return;
+    }
+    size_t capacity = 8;
+    while (capacity < macros_.size() * 2) capacity <<= 1;
+    slots_.assign(capacity, 0);
+    first_chars_.reset();
+    min_length_ = SIZE_MAX;
+    max_length_ = 0;
+
+    for (size_t i = 0; i < macros_.size(); ++i) {
+        const Macro &macro = macros_[i];
+        size_t slot = macro.hash & (capacity - 1);
+        while (slots_[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        slots_[slot] = static_cast<uint32_t>(i + 1);
+
+        first_chars_.set(static_cast<unsigned char>(macro.name[0]));
+        min_length_ = std::min(min_length_, macro.name.size());
+        max_length_ = std::max(max_length_, macro.name.size());
+    }
+    compiled_ = true;
+}
+
+const MacroTable::Macro *MacroTable::find(std::string_view name) const {
+    if (!compiled_ || name.empty() || name.size() < min_length_ || name.size() > max_length_ ||
+        !first_chars_.test(static_cast<unsigned char>(name[0]))) {
+        return nullptr;
+    }
+    uint64_t hash = hashName(name);
+    size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask; slots_[slot] != 0; slot = (slot + 1) & mask) {
+        const Macro &macro = macros_[slots_[slot] - 1];
+        if (macro.hash == hash && macro.name == name) {
+            return &macro;
+        }
+    }
+    return nullptr;
+}
+
+size_t MacroTable::parseArguments(std::string_view line, size_t open, std::vector<std::string_view> &args) {
+    args.clear();
+    int depth = 0;
+    size_t arg_start = open + 1;
+    for (size_t pos = open + 1; pos < line.size(); ++pos) {
+        char c = line[pos];
+        if (c == '"' || c == '\'') {
+            size_t close = line.find(c, pos + 1);
+            if (close == std::string_view::npos) return std::string_view::npos;
+            pos = close;
+        } else if (c == '(' || c == '[') {
+            ++depth;
+        } else if ((c == ']' || c == ')') && depth > 0) {
+            --depth;
+        } else if (c == ',' && depth == 0) {
+            args.push_back(trimView(line.substr(arg_start, pos - arg_start)));
+            arg_start = pos + 1;
+        } else if (c == ')') {
+            std::string_view last = trimView(line.substr(arg_start, pos - arg_start));
+            if (!last.empty() || !args.empty()) {
+                args.push_back(last);
+            }
+            return pos + 1;
+        }
+    }
+    return std::string_view::npos;
+}
+
+void MacroTable::appendInvocation(const Macro &macro, const std::vector<std::string_view> &args,
+                                  std::string &out) const {
+    // Arguments are expanded once, before substitution.
+    std::vector<std::string> expanded_args(args.size());
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (!expand(args[i], expanded_args[i])) {
+            expanded_args[i] = std::string(args[i]);
+        }
+    }
+    for (const auto &segment : macro.segments) {
+        if (segment.param < 0) {
+            out.append(macro.body, segment.offset, segment.length);
+        } else {
+            out.append(expanded_args[segment.param]);
+        }
+    }
+}
+
+bool MacroTable::expand(std::string_view line, std::string &expanded) const {
+    if (macros_.empty()) {
+        return false;
+    }
+
+    bool substituted = false;
+    size_t copied = 0; // Everything before this offset is already in 'expanded'.
+    size_t pos = 0;
+    std::vector<std::string_view> args;
+
+    auto begin_substitution = [&](size_t upto) {
+        if (!substituted) {
+            expanded.clear();
+            expanded.reserve(line.size() * 2);
+            substituted = true;
+        }
+        expanded.append(line.substr(copied, upto - copied));
+    };
+
+    while (pos < line.size()) {
+        if (!is(line[pos], kIdentStart)) {
+            ++pos;
+            continue;
+        }
+        size_t end = identRunEnd(line, pos);
+        const Macro *macro = find(line.substr(pos, end - pos));
+        if (!macro) {
+            pos = end;
+            continue;
+        }
+
+        if (!macro->is_function) {
+            begin_substitution(pos);
+            expanded.append(macro->body);
+            copied = end;
+        } else if (end < line.size() && line[end] == '(') {
+            size_t close = parseArguments(line, end, args);
+            if (close == std::string_view::npos) {
+                *diagnostics << "Unterminated argument list for macro '" << macro->name << "'\n";
+            } else if (args.size() != macro->num_params) {
+                *diagnostics << "Macro '" << macro->name << "' expects " << macro->num_params
+                          << " argument(s), got " << args.size() << "\n";
+            } else {
+                begin_substitution(pos);
+                appendInvocation(*macro, args, expanded);
+                copied = close;
+                end = close;
+            }
+        }
+        pos = end;
+    }
+    if (substituted) {
+        expanded.append(line.substr(copied));
+    }
+    return substituted;
+}
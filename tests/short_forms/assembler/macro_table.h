@@ -0,0 +1,117 @@
+#ifndef MACRO_TABLE_H
+#define MACRO_TABLE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bitset>
+#include <cstdint>
+#include <iostream>
+
+/*
+MacroTable holds the $MACRO definitions of one translation unit.
+
+Two kinds of macro are supported:
+
+    $MACRO BUF_SIZE 0x40                  ; object-like: NAME -> body
+    $MACRO LOADB(reg, base) mov reg.L, [base + 0]   ; parameterized
+
+After the definitions are collected, compile() builds an open-addressing hash
+index over the names plus a first-character filter, so expanding a line costs
+one pass over its bytes and at most one hash probe per identifier. Bodies of
+parameterized macros are split into literal and parameter segments when they
+are defined, so an invocation is a concatenation, never a rescan. Expanded text
+is not rescanned either, so macros do not nest.
+*/
+class MacroTable {
+public:
+    // A parsed "$MACRO" directive, viewing the source line.
+    struct Definition {
+        std::string_view name;
+        bool is_function = false;
+        std::vector<std::string_view> params;
+        std::string_view body;
+    };
+
+    struct Macro {
+        // A run of the body: literal text, or a reference to parameter 'param'.
+        struct Segment {
+            uint32_t offset;
+            uint32_t length;
+            int32_t param; // -1 for literal text.
+        };
+
+        std::string name;
+        std::string body;
+        bool is_function = false;
+        size_t num_params = 0;
+        std::vector<Segment> segments; // Only used by parameterized macros.
+        uint64_t hash = 0;
+    };
+
+    /**
+     * Add or replace a macro.
+     *
+     * @param definition The parsed directive.
+     */
+    void define(const Definition &definition);
+
+    /**
+     * Add a macro of another table (an included header's), unless one with
+     * its name is already defined.
+     *
+     * @param macro The macro to copy.
+     */
+    void import(const Macro &macro);
+
+    /**
+     * Build the lookup index. Must be called after the last define() and
+     * before expand(); does nothing if the index is already up to date.
+     */
+    void compile();
+
+    /**
+     * Find a macro by name.
+     *
+     * @param name Identifier to look up.
+     * @return The macro, or nullptr if no macro has that name.
+     */
+    [[nodiscard]] const Macro *find(std::string_view name) const;
+
+    /**
+     * Expand every macro in a line.
+     *
+     * @param line The line to process.
+     * @param expanded Receives the expanded text if any macro was substituted.
+     * @return True if the line contained at least one macro.
+     */
+    bool expand(std::string_view line, std::string &expanded) const;
+
+    [[nodiscard]] bool empty() const { return macros_.empty(); }
+    [[nodiscard]] size_t size() const { return macros_.size(); }
+    [[nodiscard]] const std::vector<Macro> &macros() const { return macros_; }
+
+    // Where malformed invocations are reported.
+    std::ostream *diagnostics = &std::cerr;
+
+private:
+    std::vector<Macro> macros_;
+    std::vector<uint32_t> slots_;   // Macro index + 1; 0 marks an empty slot.
+    std::bitset<256> first_chars_;  // First bytes of all macro names.
+    size_t min_length_ = 0;
+    size_t max_length_ = 0;
+    bool compiled_ = false;
+
+    static uint64_t hashName(std::string_view name);
+
+    /**
+     * Parse the argument list of an invocation starting at the '(' at 'open'.
+     *
+     * @return One past the closing ')', or npos if the list is unterminated.
+     */
+    static size_t parseArguments(std::string_view line, size_t open, std::vector<std::string_view> &args);
+
+    void appendInvocation(const Macro &macro, const std::vector<std::string_view> &args, std::string &out) const;
+};
+
+#endif // MACRO_TABLE_H
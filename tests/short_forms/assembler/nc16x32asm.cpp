@@ -0,0 +1,584 @@
+#include "nc16x32asm.h"
+#include "code_generator.h"
+#include "content_hash.h"
+#include "dataflow.h"
+#include "include_cache.h"
+#include "lexer.h"
+#include "machine_description.h"
+#include "object_file_generator.h"
+#include "parser.h"
+#include "peephole.h"
+#include "stats.h"
+#include "structural_index.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <functional>
+#include <sstream>
+#include <unordered_set>
+#include <unistd.h>
+
+namespace {
+
+// Source text hashed at a time, so that a mapped source can be dropped from memory as it goes.
+constexpr size_t kHashSliceBytes = 1 << 20;
+
+// Where one assembly reports; copied into its AssemblyResult at the end.
+struct Reporting {
+    std::ostringstream diagnostics;
+    std::ostringstream report;
+};
+
+// The optimizers an AssemblyOptions asks for; null if not.
+struct Optimizers {
+    explicit Optimizers(const AssemblyOptions &options)
+        : peephole(options.optimization_level >= 1 ? &peephole_optimizer : nullptr),
+          dataflow(options.optimization_level >= 2 ? &dataflow_optimizer : nullptr) {}
+
+    // Their reports, after a successful assembly.
+    void report(std::ostream &out) const {
+        if (dataflow) {
+            dataflow->print_report(out);
+        }
+        if (peephole) {
+            peephole->print_statistics(out);
+        }
+    }
+
+    PeepholeOptimizer peephole_optimizer;
+    DataflowOptimizer dataflow_optimizer;
+    PeepholeOptimizer *peephole;
+    DataflowOptimizer *dataflow;
+};
+
+// The headers one assembly includes, and where they come from.
+struct Headers {
+    explicit Headers(const AssemblyOptions &options)
+        : options(options), cache(options.include_cache ? options.include_cache : &own_cache) {}
+
+    /**
+     * Load the headers named in the directives the lexer's first pass found
+     * and import their macros. What they report goes to 'diagnostics'.
+     *
+     * @return False if a header could not be loaded.
+     */
+    bool load(Lexer &lexer, std::ostream &diagnostics) {
+        included.clear();
+        bool loaded = true;
+        for (const std::string &name : lexer.includes()) {
+            std::shared_ptr<const IncludedHeader> header =
+                cache->load(name, options.source_directory, options.include_dirs, diagnostics);
+            if (!header) {
+                loaded = false;
+                continue;
+            }
+            lexer.importMacros(header->macros);
+            included.emplace(name, std::move(header));
+        }
+        for_each([&](const IncludedHeader &header) { diagnostics << header.diagnostics; });
+        return loaded;
+    }
+
+    // Canonical paths of the headers included, directly or not.
+    [[nodiscard]] std::vector<std::string> paths() const {
+        std::vector<std::string> result;
+        for_each([&](const IncludedHeader &header) { result.push_back(header.path); });
+        return result;
+    }
+
+    // Call 'visit' once for each header included, directly or not, in the
+    // order of their paths.
+    template <typename Visit>
+    void for_each(Visit visit) const {
+        std::unordered_set<const IncludedHeader *> seen;
+        std::vector<const IncludedHeader *> all;
+        std::vector<const IncludeMap *> pending{&included};
+        while (!pending.empty()) {
+            const IncludeMap *map = pending.back();
+            pending.pop_back();
+            for (const auto &[name, header] : *map) {
+                if (seen.insert(header.get()).second) {
+                    all.push_back(header.get());
+                    pending.push_back(&header->includes);
+                }
+            }
+        }
+        std::sort(all.begin(), all.end(), [](auto *a, auto *b) { return a->path < b->path; });
+        for (const IncludedHeader *header : all) {
+            visit(*header);
+        }
+    }
+
+    const AssemblyOptions &options;
+    IncludeCache own_cache;
+    IncludeCache *cache;
+    IncludeMap included; // By the name in the source's directives.
+    // The headers spliced into the token stream so far, each only once.
+    std::unordered_set<std::string> spliced;
+};
+
+// Say how much relaxation shortened the code, if it did.
+void report_relaxation(const Parser::RelaxationResult &result, std::ostream &out) {
+    if (result.instructions != 0) {
+        out << "Relaxation saved " << result.bytes_saved << " bytes in "
+                  << result.instructions << " instructions.\n";
+    }
+}
+
+// Add what the code generation of an assembly produced to 'stats', if not null.
+void count_output(Stats *stats, const Parser &parser, const CodeGenerator &code_generator, uint64_t text_bytes) {
+    if (!stats) {
+        return;
+    }
+    uint64_t total = 0;
+    for (const InstructionFormat &format : instructions) {
+        for (size_t i = 0; i < format.num_specifiers; ++i) {
+            const InstructionSpecifier &spec = format.specifiers[i];
+            if (uint64_t n = parser.specifier_counts[spec.index]) {
+                stats->add_instructions(spec.syntax, n);
+                total += n;
+            }
+        }
+    }
+    stats->add("instructions", total);
+    stats->add("labels", parser.label_address_table.size());
+    stats->add("relocations", code_generator.relocation_entries.size());
+    stats->add("base_fixups", code_generator.base_fixups.size());
+    stats->add("text_bytes", text_bytes);
+    stats->add("data_bytes", parser.data.size());
+    stats->add("bss_bytes", parser.bss_size);
+}
+
+// End of the line that contains the byte before 'limit' (or the end of 'text').
+size_t line_aligned_end(std::string_view text, size_t limit) {
+    size_t newline = text.find('\n', limit > 0 ? limit - 1 : 0);
+    return newline == std::string_view::npos ? text.size() : newline + 1;
+}
+
+// See assembly_hash(). 'chunk_bytes' is 0 unless the code depends on where
+// the stream is cut, which is when -O2 analyses each chunk on its own.
+// 'source', if given, is told when a slice of 'text' has been hashed. Loads
+// the source's headers into 'headers'.
+ContentDigest hash_inputs(std::string_view text, int optimization_level, size_t chunk_bytes, SourceBuffer *source,
+                     Headers &headers) {
+    ContentHash hash;
+    hash.update(machine_description_hash);
+    hash.update(uint64_t{lf::kVersion});
+    hash.update(static_cast<uint64_t>(optimization_level));
+    hash.update(static_cast<uint64_t>(chunk_bytes));
+
+    // The macro table after the first pass.
+    hash.update(static_cast<uint64_t>(text.size()));
+    Lexer lexer;
+    StructuralIndex index;
+    size_t offset = 0;
+    while (offset < text.size()) {
+        size_t end = line_aligned_end(text, std::min(offset + kHashSliceBytes, text.size()));
+        std::string_view slice = text.substr(offset, end - offset);
+        hash.update(slice);
+        index.build(slice);
+        lexer.firstPass(index);
+        if (source) {
+            source->discard_prefix(end);
+        }
+        offset = end;
+    }
+    // The headers, whose keys cover their own text and macros; assembling
+    // reports their errors.
+    std::ostringstream ignored;
+    headers.load(lexer, ignored);
+    for (const std::string &name : lexer.includes()) {
+        hash.update(name);
+        auto it = headers.included.find(name);
+        hash.update(it != headers.included.end() ? it->second->key : ContentDigest{});
+    }
+    for (const MacroTable::Macro &macro : lexer.getMacroTable().macros()) {
+        hash.update(macro.name);
+        hash.update(macro.body);
+        hash.update(uint64_t{macro.is_function});
+        hash.update(static_cast<uint64_t>(macro.num_params));
+        for (const MacroTable::Macro::Segment &segment : macro.segments) {
+            hash.update(uint64_t{segment.offset} << 32 | segment.length);
+            hash.update(static_cast<uint64_t>(static_cast<int64_t>(segment.param)));
+        }
+    }
+    return hash.digest();
+}
+
+// Assemble the whole source in memory and hand the object file generator to
+// 'emit', which writes the object file in one go. The high half of
+// 'content_hash' goes into the header instead of the time if it is set.
+bool assemble_in_memory(std::string_view text, Optimizers &optimizers, Headers &headers, Reporting &reporting,
+                        std::optional<ContentDigest> content_hash, Stats *stats,
+                        const std::function<bool(const ObjectFileGenerator &)> &emit) {
+    // Index the source once, then run both lexer passes over the index.
+    std::vector<Token> tokens;
+    Lexer lexer;
+    lexer.setDiagnostics(reporting.diagnostics);
+    {
+        PhaseTimer timer(stats, "lex");
+        StructuralIndex index;
+        index.build(text);
+        lexer.firstPass(index);
+        if (!headers.load(lexer, reporting.diagnostics)) {
+            return false;
+        }
+        tokens = lexer.secondPass(index);
+        IncludeCache::splice(tokens, headers.included, headers.spliced);
+        if (stats) {
+            stats->add("lines", index.size());
+            stats->add("tokens", tokens.size());
+        }
+    }
+    if (optimizers.dataflow || optimizers.peephole) {
+        PhaseTimer timer(stats, "optimize");
+        if (optimizers.dataflow) {
+            optimizers.dataflow->run(tokens);
+        }
+        if (optimizers.peephole) {
+            optimizers.peephole->run(tokens, optimizers.dataflow ? &optimizers.dataflow->overflow_dead() : nullptr);
+        }
+    }
+
+    // Create the code generator and parser as stack objects.
+    CodeGenerator code_generator(LabelTable{});
+    code_generator.diagnostics = &reporting.diagnostics;
+    Parser parser(std::move(tokens), Parser::Metadata(), code_generator);
+    parser.diagnostics = &reporting.diagnostics;
+    if (stats) {
+        parser.specifier_counts.resize(num_specifiers);
+    }
+
+    // Lay out the code first, so that references to labels in this file can
+    // be encoded with their addresses and instructions can take their
+    // shortest forms, then generate it.
+    {
+        PhaseTimer timer(stats, "layout");
+        parser.layout();
+        report_relaxation(parser.relax(), reporting.report);
+    }
+    {
+        PhaseTimer timer(stats, "encode");
+        code_generator.label_table = parser.label_address_table;
+        parser.rewind();
+        parser.parse();
+    }
+    count_output(stats, parser, code_generator, parser.object_code.size());
+
+    // Write the object file straight from the parser's code buffer.
+    PhaseTimer timer(stats, "write");
+    ObjectFileGenerator object_file_generator(
+        code_generator.relocation_entries,
+        code_generator.base_fixups,
+        parser.label_address_table,
+        parser.object_code,
+        parser.data,
+        parser.bss_size
+    );
+    if (content_hash) {
+        object_file_generator.setContentHash(content_hash->high);
+    }
+    return emit(object_file_generator);
+}
+
+// Tokenize the source in line-aligned chunks of about 'chunk_bytes' and hand
+// each chunk's tokens, with the headers it includes spliced in, to 'consume'.
+// A statement is never split between chunks. The source text before a chunk
+// is dropped from memory once the chunk has been consumed.
+template <typename Consume>
+void for_each_token_chunk(SourceBuffer &source, Lexer &lexer, Headers &headers, size_t chunk_bytes, Stats *stats,
+                          Consume consume) {
+    std::string_view text = source.text();
+    headers.spliced.clear();
+    StructuralIndex index;
+    std::vector<Token> tokens;
+    size_t window = chunk_bytes;
+    size_t offset = 0;
+    while (offset < text.size()) {
+        std::optional<PhaseTimer> lexing(std::in_place, stats, "lex");
+        tokens.clear();
+        lexer.releaseExpansions();
+        size_t end = line_aligned_end(text, std::min(offset + window, text.size()));
+        index.build(text.substr(offset, end - offset));
+        Lexer::ChunkResult chunk = lexer.tokenizeChunk(index, tokens);
+        if (end < text.size()) {
+            if (chunk.cutTokens == 0) {
+                // A single statement is larger than the window; widen it.
+                window *= 2;
+                continue;
+            }
+            // The last statement may continue into the next chunk: lex it again there.
+            tokens.resize(chunk.cutTokens);
+            offset += index.lineBegin(chunk.cutLine);
+        } else {
+            offset = end;
+        }
+        window = chunk_bytes;
+
+        IncludeCache::splice(tokens, headers.included, headers.spliced);
+        lexing.reset();
+        consume(std::move(tokens));
+        tokens = {};
+        source.discard_prefix(offset);
+    }
+}
+
+// Assemble the source a chunk at a time, writing machine code to the output as
+// it is produced. Only the macro and label tables, the relocations and one
+// chunk of tokens and code are resident at any time; the header and the table
+// blocks are written once the code length is known. The optimizers rewrite
+// each chunk the same way in both sweeps. The dataflow optimizer sees one
+// chunk at a time.
+bool assemble_streaming(SourceBuffer &source, const std::string &output_file, size_t chunk_bytes,
+                        Optimizers &optimizers, Headers &headers, Reporting &reporting,
+                        std::optional<ContentDigest> content_hash, Stats *stats) {
+    std::string_view text = source.text();
+    Lexer lexer;
+    lexer.setDiagnostics(reporting.diagnostics);
+    PeepholeOptimizer *optimizer = optimizers.peephole;
+    DataflowOptimizer *dataflow = optimizers.dataflow;
+
+    // First pass, in line-aligned slices so that consumed pages can be dropped.
+    {
+        PhaseTimer timer(stats, "lex");
+        StructuralIndex index;
+        size_t offset = 0;
+        while (offset < text.size()) {
+            size_t end = line_aligned_end(text, std::min(offset + chunk_bytes, text.size()));
+            index.build(text.substr(offset, end - offset));
+            lexer.firstPass(index);
+            if (stats) {
+                stats->add("lines", index.size());
+            }
+            source.discard_prefix(end);
+            offset = end;
+        }
+        if (!headers.load(lexer, reporting.diagnostics)) {
+            return false;
+        }
+    }
+
+    // Lay out the code, chunk by chunk, to find the label addresses and the
+    // instructions' shortest forms.
+    CodeGenerator code_generator(LabelTable{});
+    code_generator.diagnostics = &reporting.diagnostics;
+    Parser parser({}, Parser::Metadata(), code_generator);
+    parser.diagnostics = &reporting.diagnostics;
+    {
+        Parser layout_parser({}, Parser::Metadata(), code_generator);
+        layout_parser.diagnostics = &reporting.diagnostics;
+        PeepholeOptimizer layout_optimizer; // Neither reports its work.
+        DataflowOptimizer layout_dataflow;
+        for_each_token_chunk(source, lexer, headers, chunk_bytes, stats, [&](std::vector<Token> tokens) {
+            if (dataflow || optimizer) {
+                PhaseTimer timer(stats, "optimize");
+                if (dataflow) {
+                    layout_dataflow.run(tokens);
+                }
+                if (optimizer) {
+                    layout_optimizer.run_chunk(tokens, dataflow ? &layout_dataflow.overflow_dead() : nullptr);
+                }
+            }
+            PhaseTimer timer(stats, "layout");
+            layout_parser.set_tokens(std::move(tokens));
+            layout_parser.layout();
+        });
+        std::vector<Token> held;
+        if (optimizer) {
+            PhaseTimer timer(stats, "optimize");
+            held = layout_optimizer.finish();
+        }
+        PhaseTimer timer(stats, "layout");
+        if (optimizer) {
+            layout_parser.set_tokens(std::move(held));
+            layout_parser.layout();
+        }
+        report_relaxation(layout_parser.relax(), reporting.report);
+        code_generator.label_table = std::move(layout_parser.label_address_table);
+        parser.relaxed_specifiers = std::move(layout_parser.relaxed_specifiers);
+    }
+
+    if (stats) {
+        parser.specifier_counts.resize(num_specifiers);
+    }
+
+    std::optional<PhaseTimer> writing(std::in_place, stats, "write");
+    std::ofstream out(output_file, std::ios::binary);
+    if (!out) {
+        reporting.diagnostics << "Error opening output file.\n";
+        return false;
+    }
+    // Placeholder for the header, written last.
+    const std::vector<uint8_t> empty_header(lf::kHeaderSize, 0);
+    out.write(reinterpret_cast<const char*>(empty_header.data()),
+              static_cast<std::streamsize>(empty_header.size()));
+    writing.reset();
+
+    std::vector<uint8_t> code;
+    auto emit = [&](std::vector<Token> tokens) {
+        {
+            PhaseTimer timer(stats, "encode");
+            parser.set_tokens(std::move(tokens));
+            parser.parse();
+            parser.take_object_code(code);
+        }
+        PhaseTimer timer(stats, "write");
+        out.write(reinterpret_cast<const char*>(code.data()), static_cast<std::streamsize>(code.size()));
+    };
+    auto optimize = [&](std::vector<Token> &tokens) {
+        PhaseTimer timer(stats, "optimize");
+        if (dataflow) {
+            dataflow->run(tokens);
+        }
+        if (optimizer) {
+            optimizer->run_chunk(tokens, dataflow ? &dataflow->overflow_dead() : nullptr);
+        }
+    };
+    for_each_token_chunk(source, lexer, headers, chunk_bytes, stats, [&](std::vector<Token> tokens) {
+        if (stats) {
+            stats->add("tokens", tokens.size());
+        }
+        if (dataflow || optimizer) {
+            optimize(tokens);
+        }
+        emit(std::move(tokens));
+    });
+    if (optimizer) {
+        std::vector<Token> held;
+        {
+            PhaseTimer timer(stats, "optimize");
+            held = optimizer->finish();
+        }
+        emit(std::move(held));
+    }
+    count_output(stats, parser, code_generator, code_generator.code_base);
+
+    writing.emplace(stats, "write");
+    const std::vector<uint8_t> no_code;
+    ObjectFileGenerator object_file_generator(
+        code_generator.relocation_entries,
+        code_generator.base_fixups,
+        parser.label_address_table,
+        no_code,
+        parser.data,
+        parser.bss_size
+    );
+    if (content_hash) {
+        object_file_generator.setContentHash(content_hash->high);
+    }
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> tables = object_file_generator.buildTrailer(code_generator.code_base, header);
+    out.write(reinterpret_cast<const char*>(tables.data()), static_cast<std::streamsize>(tables.size()));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+    out.close();
+    if (!out) {
+        reporting.diagnostics << "Error writing output file.\n";
+        return false;
+    }
+
+    return true;
+}
+
+// The chunk size of a streaming assembly; structural indices use 32-bit offsets.
+size_t stream_chunk_bytes(const AssemblyOptions &options) {
+    return std::min<size_t>(options.stream_chunk_bytes, UINT32_MAX / 2);
+}
+
+// See assembly_hash().
+ContentDigest hash_source(SourceBuffer &source, const AssemblyOptions &options, Headers &headers) {
+    PhaseTimer timer(options.stats, "hash");
+    size_t chunk_bytes = options.optimization_level >= 2 ? stream_chunk_bytes(options) : 0;
+    return hash_inputs(source.text(), options.optimization_level, chunk_bytes, &source, headers);
+}
+
+// Fill in what 'result' reports.
+void finish(AssemblyResult &result, const Optimizers &optimizers, Reporting &reporting) {
+    if (result.ok) {
+        optimizers.report(reporting.report);
+    }
+    result.diagnostics = std::move(reporting.diagnostics).str();
+    result.report = std::move(reporting.report).str();
+}
+
+} // namespace
+
+AssemblyResult assemble(std::string_view source, const AssemblyOptions &options) {
+    AssemblyResult result;
+    Reporting reporting;
+    Optimizers optimizers(options);
+    Headers headers(options);
+    if (source.size() > UINT32_MAX) {
+        reporting.diagnostics << "Source too large to assemble in memory.\n";
+        finish(result, optimizers, reporting);
+        return result;
+    }
+    if (options.deterministic) {
+        PhaseTimer timer(options.stats, "hash");
+        result.content_hash = hash_inputs(source, options.optimization_level, 0, nullptr, headers);
+    }
+    auto keep = [&](const ObjectFileGenerator &generator) {
+        result.object = generator.build();
+        return true;
+    };
+    result.ok = assemble_in_memory(source, optimizers, headers, reporting, result.content_hash, options.stats, keep);
+    if (options.stats && result.ok) {
+        options.stats->add("object_bytes", result.object.size());
+    }
+    result.includes = headers.paths();
+    finish(result, optimizers, reporting);
+    return result;
+}
+
+ContentDigest assembly_hash(SourceBuffer &source, const AssemblyOptions &options, std::vector<std::string> *includes) {
+    Headers headers(options);
+    ContentDigest hash = hash_source(source, options, headers);
+    if (includes) {
+        *includes = headers.paths();
+    }
+    return hash;
+}
+
+AssemblyResult assemble_file(SourceBuffer &source, const std::string &output, const AssemblyOptions &options,
+                             std::optional<ContentDigest> content_hash) {
+    AssemblyResult result;
+    Reporting reporting;
+    Optimizers optimizers(options);
+    Headers headers(options);
+    if (options.deterministic && !content_hash) {
+        content_hash = hash_source(source, options, headers);
+    }
+    result.content_hash = options.deterministic ? content_hash : std::nullopt;
+
+    if (options.stream_chunk_bytes != 0) {
+        result.ok = assemble_streaming(source, output, stream_chunk_bytes(options), optimizers, headers, reporting,
+                                       result.content_hash, options.stats);
+    } else if (source.size() > UINT32_MAX) {
+        reporting.diagnostics << "Input file too large to assemble in memory; use --stream.\n";
+    } else {
+        auto write = [&](const ObjectFileGenerator &generator) {
+            int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd < 0) {
+                reporting.diagnostics << "Error opening output file.\n";
+                return false;
+            }
+            bool written = generator.write(fd);
+            if (::close(fd) != 0 || !written) {
+                reporting.diagnostics << "Error writing output file.\n";
+                return false;
+            }
+            return true;
+        };
+        result.ok = assemble_in_memory(source.text(), optimizers, headers, reporting, result.content_hash,
+                                       options.stats, write);
+    }
+    struct stat written{};
+    if (options.stats && result.ok && ::stat(output.c_str(), &written) == 0) {
+        options.stats->add("object_bytes", static_cast<uint64_t>(written.st_size));
+    }
+    result.includes = headers.paths();
+    finish(result, optimizers, reporting);
+    return result;
+}
@@ -0,0 +1,56 @@
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include "content_hash.h"
+
+/*
+ObjectCache keeps assembled object files in a directory, one per content hash
+(assembler --cache-dir). An entry's name is its 128-bit key in hex: the
+content hash combined with executable_identity(), so that a rebuilt assembler
+does not reuse the objects of an older one. Where the assembler cannot find
+its own executable, the cache is not used at all.
+
+Entries are hard links to the objects the assembler wrote, or copies where a
+link is not possible (another file system); a fetched output gets the
+current time, as if it had just been assembled. An entry is added under a
+temporary name and renamed into place, so a concurrent assembler never sees
+half of one. Since an output may share its file with an entry, outputs must
+be detach()ed before they are written.
+*/
+class ObjectCache {
+public:
+    // Use 'directory', creating it if needed; what prevents it is reported
+    // to 'diagnostics', and the cache then holds nothing.
+    ObjectCache(std::string directory, std::ostream &diagnostics);
+
+    /**
+     * Put the entry for 'content_hash', if there is one, at 'output'.
+     *
+     * @return False on a miss, or if the entry could not be linked or copied.
+     */
+    bool fetch(const ContentDigest &content_hash, const std::string &output) const;
+
+    /**
+     * Add the object file at 'object' as the entry for 'content_hash'.
+     * Failures are reported to 'diagnostics' and otherwise ignored.
+     */
+    void store(const ContentDigest &content_hash, const std::string &object, std::ostream &diagnostics) const;
+
+    /**
+     * Unlink 'path' if it is a regular file with other links, so that
+     * writing a new file there cannot change a cache entry.
+     */
+    static void detach(const std::string &path);
+
+private:
+    [[nodiscard]] std::string entry_path(const ContentDigest &content_hash) const;
+
+    std::string directory_;
+    std::optional<uint64_t> assembler_identity_; // Nullopt if the cache is off.
+};
+
+#endif // OBJECT_CACHE_H
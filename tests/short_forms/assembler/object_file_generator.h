@@ -0,0 +1,269 @@
+#ifndef OBJECT_FILE_GENERATOR_H
+#define OBJECT_FILE_GENERATOR_H
+
+#include <algorithm> // For std::ranges::sort
+#include "code_generator.h"
+#include "object_format.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <sys/uio.h>
+#include <unordered_map>
+
+//
+// Created by Dulat S on 2/13/24.
+//
+
+
+/*
+ObjectFileGenerator builds an object file in the LF02 format described in object_format.h:
+the header, the machine code as the code section, the data section, then the symbol,
+relocation and string sections and the section header table. The code, data and bss sections
+are always present, in that order, so a Section value is also its index in the table.
+
+Every label becomes a symbol record in its section, in name order. References to labels
+defined in the same file hold the label's address relative to the start of its section, and
+get a base relocation so that the linker can add the address at which it places that section;
+references to labels defined elsewhere get an external relocation that names the label. Each
+distinct name is stored once in the string section.
+*/
+class ObjectFileGenerator {
+public:
+    // Constructor accepts the relocation table, label-to-address mapping, machine code, and the
+    // contents of .data and size of .bss.
+    ObjectFileGenerator(const std::vector<CodeGenerator::RelocationEntry>& relocationEntries,
+                        const std::vector<CodeGenerator::BaseFixup>& baseFixups,
+                        const LabelTable& labelTable,
+                        const std::vector<uint8_t>& machineCode,
+                        const std::vector<uint8_t>& data,
+                        uint32_t bssSize)
+        : relocationEntries_(relocationEntries),
+          baseFixups_(baseFixups),
+          labelTable_(labelTable),
+          machineCode_(machineCode),
+          data_(data),
+          bssSize_(bssSize)
+    {
+    }
+
+    // Stamp the header with 'hash', a hash of everything the object file was
+    // built from, instead of the current time, making the file reproducible.
+    void setContentHash(uint64_t hash) {
+        contentHash_ = hash;
+    }
+
+    // Builds and returns the complete object file as a vector of bytes.
+    [[nodiscard]] std::vector<uint8_t> build() const {
+        auto machineCodeLength = static_cast<uint32_t>(machineCode_.size());
+        std::vector<uint8_t> buffer;
+        std::vector<uint8_t> tables = buildTrailer(machineCodeLength, buffer);
+
+        // --- Append the code section, then the rest ---
+        buffer.reserve(buffer.size() + machineCode_.size() + tables.size());
+        buffer.insert(buffer.end(), machineCode_.begin(), machineCode_.end());
+        buffer.insert(buffer.end(), tables.begin(), tables.end());
+        return buffer;
+    }
+
+    // Writes the complete object file to 'fd' without assembling it in memory:
+    // the header, the machine code straight from the caller's buffer and the
+    // sections that follow it go out in one writev(). Returns false, with
+    // errno set, if a write fails.
+    [[nodiscard]] bool write(int fd) const {
+        std::vector<uint8_t> header;
+        std::vector<uint8_t> tables = buildTrailer(static_cast<uint32_t>(machineCode_.size()), header);
+        iovec parts[3] = {
+            {header.data(), header.size()},
+            {const_cast<uint8_t*>(machineCode_.data()), machineCode_.size()},
+            {tables.data(), tables.size()},
+        };
+        return writeFully(fd, parts, 3);
+    }
+
+    // Builds everything that follows a code section of the given length, in
+    // one buffer, and fills 'header' with the header describing it. Streaming
+    // writers use this directly: the machine code is written separately and
+    // never passed to the generator.
+    [[nodiscard]] std::vector<uint8_t> buildTrailer(uint32_t machineCodeLength, std::vector<uint8_t>& header) const {
+        const SymbolTable symbols = buildSymbolTable();
+
+        // --- Lay out the sections, then fill them in place ---
+        const size_t codeEnd = lf::kHeaderSize + machineCodeLength;
+        const size_t dataOffset = lf::align(codeEnd);
+        const size_t symbolsOffset = lf::align(dataOffset + data_.size());
+        const size_t symbolsSize = sizeof(lf::Symbol) * symbols.symbols.size();
+        const size_t relocationsOffset = symbolsOffset + symbolsSize;
+        const size_t relocationsSize = sizeof(lf::Relocation) * (baseFixups_.size() + relocationEntries_.size());
+        const size_t stringsOffset = relocationsOffset + relocationsSize;
+        const size_t sectionTableOffset = lf::align(stringsOffset + symbols.strings.size());
+        std::vector<uint8_t> tables(sectionTableOffset + sizeof(lf::SectionHeader) * kSectionCount - codeEnd);
+        auto at = [&](size_t fileOffset) { return tables.data() + (fileOffset - codeEnd); };
+
+        std::ranges::copy(data_, at(dataOffset));
+        writeSymbolSection(at(symbolsOffset), symbols);
+        writeRelocationSection(at(relocationsOffset), symbols);
+        std::ranges::copy(symbols.strings, at(stringsOffset));
+
+        const lf::SectionHeader sections[kSectionCount] = {
+            sectionHeader(lf::kSectionCode, lf::kHeaderSize, machineCodeLength, 0),
+            sectionHeader(lf::kSectionData, dataOffset, data_.size(), 0),
+            sectionHeader(lf::kSectionBss, 0, bssSize_, 0),
+            sectionHeader(lf::kSectionSymbols, symbolsOffset, symbolsSize, sizeof(lf::Symbol)),
+            sectionHeader(lf::kSectionRelocations, relocationsOffset, relocationsSize, sizeof(lf::Relocation)),
+            sectionHeader(lf::kSectionStrings, stringsOffset, symbols.strings.size(), 0),
+        };
+        std::memcpy(at(sectionTableOffset), sections, sizeof(sections));
+
+        // --- Now fill in the header ---
+        lf::Header fields{};
+        std::ranges::copy(lf::kMagic, fields.magic);
+        fields.version[0] = static_cast<uint8_t>(lf::kVersion >> 8);
+        fields.version[1] = static_cast<uint8_t>(lf::kVersion);
+        // Timestamp: the content hash, or system_clock now in microseconds.
+        uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        if (contentHash_) {
+            fields.flags[1] = static_cast<uint8_t>(lf::kFlagContentHash);
+            timestamp = *contentHash_;
+        }
+        for (int i = 0; i < 8; ++i) {
+            fields.timestamp[i] = static_cast<uint8_t>(timestamp >> (56 - 8 * i));
+        }
+        fields.section_table_offset.set(static_cast<uint32_t>(sectionTableOffset));
+        fields.section_count.set(kSectionCount);
+        fields.section_header_size.set(sizeof(lf::SectionHeader));
+        header.resize(lf::kHeaderSize);
+        std::memcpy(header.data(), &fields, sizeof(fields));
+
+        return tables;
+    }
+
+private:
+    const std::vector<CodeGenerator::RelocationEntry>& relocationEntries_;
+    const std::vector<CodeGenerator::BaseFixup>& baseFixups_;
+    const LabelTable& labelTable_;
+    const std::vector<uint8_t>& machineCode_;
+    const std::vector<uint8_t>& data_;
+    uint32_t bssSize_;
+    std::optional<uint64_t> contentHash_;
+
+    // Entries of the section header table: the three of Section, then the tables.
+    static constexpr uint32_t kSectionCount = ::kSectionCount + 3;
+
+    struct Symbol {
+        std::string_view name;
+        LabelAddress label;
+        uint32_t nameOffset; // In the string table.
+    };
+
+    // The labels sorted by name, and the string table that all the sections
+    // refer to. Built once per object file.
+    struct SymbolTable {
+        std::vector<Symbol> symbols;
+        std::vector<uint32_t> relocationNameOffsets; // In the order of relocationEntries_.
+        std::vector<uint8_t> strings;
+    };
+
+    // Sort the labels once, and store each distinct name once: a hash index
+    // from name to string table offset finds the names already stored, so
+    // that a relocation to a label shares the label's name.
+    [[nodiscard]] SymbolTable buildSymbolTable() const {
+        SymbolTable table;
+        table.symbols.reserve(labelTable_.size());
+        for (const auto& [name, label] : labelTable_) {
+            table.symbols.push_back({name, label, 0});
+        }
+        std::ranges::sort(table.symbols, {}, &Symbol::name);
+
+        std::unordered_map<std::string_view, uint32_t> nameOffsets;
+        nameOffsets.reserve(table.symbols.size() + relocationEntries_.size());
+        auto intern = [&](std::string_view name) {
+            auto [it, inserted] = nameOffsets.try_emplace(name, static_cast<uint32_t>(table.strings.size()));
+            if (inserted) {
+                table.strings.insert(table.strings.end(), name.begin(), name.end());
+                table.strings.push_back(0x00);
+            }
+            return it->second;
+        };
+        for (Symbol& symbol : table.symbols) {
+            symbol.nameOffset = intern(symbol.name);
+        }
+        table.relocationNameOffsets.reserve(relocationEntries_.size());
+        for (const auto& reloc : relocationEntries_) {
+            table.relocationNameOffsets.push_back(intern(reloc.label));
+        }
+        return table;
+    }
+
+    static lf::SectionHeader sectionHeader(lf::SectionType type, size_t offset, size_t size, size_t entrySize) {
+        lf::SectionHeader section{};
+        section.type.set(type);
+        section.offset.set(static_cast<uint32_t>(offset));
+        section.size.set(static_cast<uint32_t>(size));
+        section.entry_size.set(static_cast<uint32_t>(entrySize));
+        return section;
+    }
+
+    // writev() all of 'parts', resuming after partial writes and interruptions.
+    static bool writeFully(int fd, iovec* parts, int count) {
+        while (count > 0) {
+            ssize_t written = ::writev(fd, parts, count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            auto remaining = static_cast<size_t>(written);
+            while (count > 0 && remaining >= parts->iov_len) {
+                remaining -= parts->iov_len;
+                ++parts;
+                --count;
+            }
+            if (count > 0) {
+                parts->iov_base = static_cast<uint8_t*>(parts->iov_base) + remaining;
+                parts->iov_len -= remaining;
+            }
+        }
+        return true;
+    }
+
+    // --- Symbol Section ---
+    // One lf::Symbol per label, in name order.
+    static void writeSymbolSection(uint8_t* out, const SymbolTable& table) {
+        for (const Symbol& symbol : table.symbols) {
+            lf::Symbol record{};
+            record.value.set(symbol.label.address);
+            record.name.set(symbol.nameOffset);
+            record.kind = lf::kSymbolLabel;
+            record.section = static_cast<uint8_t>(section_index(symbol.label.section));
+            std::memcpy(out, &record, sizeof(record));
+            out += sizeof(record);
+        }
+    }
+
+    // --- Relocation Section ---
+    // One lf::Relocation per base fixup, then one per external reference.
+    void writeRelocationSection(uint8_t* out, const SymbolTable& table) const {
+        for (const CodeGenerator::BaseFixup& fixup : baseFixups_) {
+            lf::Relocation record{};
+            record.offset.set(fixup.address);
+            record.target.set(static_cast<uint32_t>(section_index(fixup.target)));
+            record.kind = lf::kRelocationBase;
+            record.section = static_cast<uint8_t>(section_index(fixup.section));
+            std::memcpy(out, &record, sizeof(record));
+            out += sizeof(record);
+        }
+        for (size_t i = 0; i < relocationEntries_.size(); ++i) {
+            lf::Relocation record{};
+            record.offset.set(relocationEntries_[i].address);
+            record.target.set(table.relocationNameOffsets[i]);
+            record.kind = lf::kRelocationExternal;
+            record.section = static_cast<uint8_t>(section_index(relocationEntries_[i].section));
+            std::memcpy(out, &record, sizeof(record));
+            out += sizeof(record);
+        }
+    }
+};
+
+#endif //OBJECT_FILE_GENERATOR_H
@@ -0,0 +1,444 @@
+//
+// Created by gitpod on 2/7/24.
+//
+
+#include "parser.h"
+#include "code_generator.h"
+#include <iostream>
+#include "assembler.h"
+#include <algorithm>
+#include <bit>
+
+static inline void trim(std::string &s) {
+    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
+        return !std::isspace(ch);
+    }));
+    s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
+        return !std::isspace(ch);
+    }).base(), s.end());
+}
+
+void Parser::parse() {
+    // currentTokenIndex starts at 0, or past tokens that an error in the
+    // previous chunk already skipped (see set_tokens).
+    while (currentTokenIndex < tokens.size()) {
+        const Token &current_token = tokens[currentTokenIndex];
+
+        if (current_token.type == TokenType::Label) {
+            // Skip labels, assuming they're handled elsewhere.
+            label_address_table[std::string(current_token.data)] = {current_address(), section};
+            currentTokenIndex++;
+        } else if (current_token.type == TokenType::Instruction && current_token.data == "db") {
+            parse_data_definition();
+            continue;
+        } else if (current_token.type == TokenType::Instruction && current_token.data.starts_with('.')) {
+            parse_directive(false);
+        } else if (current_token.type == TokenType::Instruction) {
+            try {
+                parse_instruction();
+            } catch (const std::exception &e) {
+                *diagnostics << e.what() << "\n";
+                currentTokenIndex++;
+            }
+        } else {
+            *diagnostics << "Unexpected token: " << current_token.data
+                    << " at index " << tokenIndexBase + currentTokenIndex << "\n";
+            currentTokenIndex++;
+        }
+    }
+}
+
+uint32_t Parser::current_address() const {
+    switch (section) {
+        case Section::Data:
+            return static_cast<uint32_t>(data.size());
+        case Section::Bss:
+            return bss_size;
+        default:
+            return code_generator.code_base + static_cast<uint32_t>(object_code.size());
+    }
+}
+
+void Parser::take_object_code(std::vector<uint8_t> &out) {
+    code_generator.code_base += static_cast<uint32_t>(object_code.size());
+    out.swap(object_code);
+    object_code.clear();
+}
+
+void Parser::layout() {
+    while (currentTokenIndex < tokens.size()) {
+        const Token &current_token = tokens[currentTokenIndex];
+
+        if (current_token.type == TokenType::Label) {
+            label_address_table[std::string(current_token.data)] = {laidOutBytes[section_index(section)], section};
+            currentTokenIndex++;
+        } else if (current_token.type == TokenType::Instruction && current_token.data == "db") {
+            currentTokenIndex++;
+            while (currentTokenIndex < tokens.size() && tokens[currentTokenIndex].type == TokenType::Operand) {
+                if (section != Section::Bss) {
+                    laidOutBytes[section_index(section)] += data_operand_size(tokens[currentTokenIndex]);
+                }
+                currentTokenIndex++;
+            }
+        } else if (current_token.type == TokenType::Instruction && current_token.data.starts_with('.')) {
+            parse_directive(true);
+        } else if (current_token.type == TokenType::Instruction) {
+            currentTokenIndex++;
+            std::span<const Token> operand_tokens = take_operands();
+            if (section != Section::Text) {
+                // parse() reports it, and skips one more token.
+                currentTokenIndex++;
+                continue;
+            }
+            const InstructionFormat *format = lookup_instruction(current_token.data);
+            RelaxationCandidates candidates;
+            const InstructionSpecifier *spec = format ? select_specifier(format, operand_tokens, &candidates) : nullptr;
+            if (spec) {
+                if (candidates.count != 0) {
+                    note_relaxable(format, candidates, operand_tokens);
+                }
+                laidOutBytes[section_index(Section::Text)] += spec->length;
+            } else {
+                // parse() skips one more token after a failed instruction.
+                currentTokenIndex++;
+            }
+        } else {
+            currentTokenIndex++;
+        }
+    }
+}
+
+void Parser::note_relaxable(const InstructionFormat *format, const RelaxationCandidates &candidates,
+                            std::span<const Token> operand_tokens) {
+    RelaxableInstruction instruction{laidOutBytes[section_index(Section::Text)], format, candidates, 0, 0, {}};
+    // The default specifier is kept even if its operands are in error; the
+    // code generator reports them.
+    const uint8_t last = candidates.count - 1;
+    instruction.usable = static_cast<uint8_t>(1u << last);
+    for (uint8_t i = 0; i < last; ++i) {
+        std::string_view label;
+        if (!CodeGenerator::operands_fit(&format->specifiers[candidates.indices[i]], operand_tokens, label)) {
+            continue;
+        }
+        if (!label.empty()) {
+            if (instruction.target.empty()) {
+                instruction.target = label;
+            } else if (instruction.target != label) {
+                continue;
+            }
+        }
+        instruction.usable |= static_cast<uint8_t>(1u << i);
+    }
+    relaxable.push_back(std::move(instruction));
+}
+
+Parser::RelaxationResult Parser::relax() {
+    relaxed_specifiers.clear();
+    nextRelaxed = 0;
+    if (relaxable.empty()) {
+        return {0, 0};
+    }
+
+    auto candidate = [](const RelaxableInstruction &instruction, uint8_t i) -> const InstructionSpecifier & {
+        return instruction.format->specifiers[instruction.candidates.indices[i]];
+    };
+    auto relative_width = [](const InstructionSpecifier &spec) -> unsigned {
+        for (size_t i = 0; i < spec.num_fields; ++i) {
+            if (spec.fields[i].relative) return spec.fields[i].bit_width;
+        }
+        return 0;
+    };
+
+    // Where each relative target was laid out. A label that is not in this
+    // file's .text is out of reach of every relative field.
+    const size_t count = relaxable.size();
+    std::vector<uint32_t> target_address(count, 0);
+    for (size_t i = 0; i < count; ++i) {
+        RelaxableInstruction &instruction = relaxable[i];
+        if (!instruction.target.empty()) {
+            auto label = label_address_table.find(instruction.target);
+            if (label != label_address_table.end() && label->second.section == Section::Text) {
+                target_address[i] = label->second.address;
+            } else {
+                for (uint8_t c = 0; c + 1 < instruction.candidates.count; ++c) {
+                    if (relative_width(candidate(instruction, c)) != 0) {
+                        instruction.usable &= static_cast<uint8_t>(~(1u << c));
+                    }
+                }
+            }
+        }
+        instruction.chosen = static_cast<uint8_t>(std::countr_zero(instruction.usable));
+    }
+
+    // saved[i]: bytes saved by the relaxable instructions before instruction i.
+    std::vector<uint32_t> saved(count + 1, 0);
+    auto saved_before = [&](uint32_t address) {
+        auto next = std::lower_bound(relaxable.begin(), relaxable.end(), address,
+                                     [](const RelaxableInstruction &r, uint32_t a) { return r.address < a; });
+        return saved[static_cast<size_t>(next - relaxable.begin())];
+    };
+
+    // Instructions only ever grow, so this reaches a fixed point.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < count; ++i) {
+            const RelaxableInstruction &instruction = relaxable[i];
+            const uint8_t default_length = candidate(instruction, instruction.candidates.count - 1).length;
+            saved[i + 1] = saved[i] + default_length - candidate(instruction, instruction.chosen).length;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            RelaxableInstruction &instruction = relaxable[i];
+            while (instruction.chosen + 1 < instruction.candidates.count) {
+                const unsigned width = relative_width(candidate(instruction, instruction.chosen));
+                if (width == 0) break;
+                const int64_t displacement =
+                    static_cast<int64_t>(target_address[i] - saved_before(target_address[i])) -
+                    static_cast<int64_t>(instruction.address - saved[i]);
+                if (CodeGenerator::displacement_fits(displacement, width)) break;
+                do {
+                    ++instruction.chosen;
+                } while ((instruction.usable >> instruction.chosen & 1) == 0);
+                changed = true;
+            }
+        }
+    }
+
+    for (auto &[name, label] : label_address_table) {
+        if (label.section == Section::Text) {
+            label.address -= saved_before(label.address);
+        }
+    }
+    RelaxationResult result{saved[count], 0};
+    relaxed_specifiers.reserve(count);
+    for (const RelaxableInstruction &instruction : relaxable) {
+        relaxed_specifiers.push_back(&candidate(instruction, instruction.chosen));
+        if (instruction.chosen + 1 != instruction.candidates.count) {
+            ++result.instructions;
+        }
+    }
+    relaxable.clear();
+    relaxable.shrink_to_fit();
+    return result;
+}
+
+std::span<const Token> Parser::take_operands() {
+    const size_t operands_begin = currentTokenIndex;
+    while (currentTokenIndex < tokens.size()) {
+        const Token &lookahead = tokens[currentTokenIndex];
+
+        if (lookahead.type == TokenType::Instruction ||
+            lookahead.type == TokenType::Label) {
+            break;
+        }
+        currentTokenIndex++;
+    }
+    return {tokens.data() + operands_begin, currentTokenIndex - operands_begin};
+}
+
+void Parser::parse_instruction() {
+    const Token &inst_token = tokens[currentTokenIndex];
+    std::string_view inst_name = inst_token.data;
+    currentTokenIndex++;
+
+    // The operands are the tokens up to the next instruction or label.
+    std::span<const Token> operand_tokens = take_operands();
+    if (section != Section::Text) {
+        throw std::runtime_error("Instruction '" + std::string(inst_name) + "' outside .text");
+    }
+
+    // The format is looked up once here and handed to the code generator.
+    const InstructionFormat *instruction_format = lookup_instruction(inst_name);
+    if (!instruction_format) {
+        throw std::runtime_error("Unknown instruction: " + std::string(inst_name));
+    }
+
+    RelaxationCandidates candidates;
+    const InstructionSpecifier *chosen_spec = select_specifier(instruction_format, operand_tokens, &candidates);
+    if (!chosen_spec) {
+        throw std::runtime_error(
+            "No matching syntax for '" + std::string(inst_name) + "' with given operands."
+        );
+    }
+    if (candidates.count != 0 && nextRelaxed < relaxed_specifiers.size()) {
+        chosen_spec = relaxed_specifiers[nextRelaxed++];
+    }
+
+    this->code_generator.assemble_instruction(instruction_format, chosen_spec, operand_tokens, object_code);
+    if (!specifier_counts.empty()) {
+        ++specifier_counts[chosen_spec->index];
+    }
+}
+
+OperandKind Parser::operand_kind(const Token &token) {
+    switch (token.subtype) {
+        case OperandSubtype::Register: {
+            // The lexer only accepts an optional ".H" or ".L" suffix on registers.
+            std::string_view data = token.data;
+            if (data.size() >= 2 && data[data.size() - 2] == '.') {
+                return data.back() == 'H' ? OperandKind::RegisterHigh : OperandKind::RegisterLow;
+            }
+            return OperandKind::Register;
+        }
+        case OperandSubtype::Immediate:
+            return OperandKind::Immediate;
+        case OperandSubtype::Memory:
+            return OperandKind::Memory;
+        case OperandSubtype::OffsetMemory:
+            return OperandKind::OffsetMemory;
+        case OperandSubtype::LabelReference:
+            return OperandKind::Label;
+        default:
+            return OperandKind::None;
+    }
+}
+
+const InstructionSpecifier *Parser::select_specifier(const InstructionFormat *format,
+                                                     std::span<const Token> operand_tokens,
+                                                     RelaxationCandidates *candidates) {
+    if (operand_tokens.size() > max_operands) {
+        return nullptr;
+    }
+    OperandKind kinds[max_operands] = {};
+    for (size_t i = 0; i < operand_tokens.size(); ++i) {
+        kinds[i] = operand_kind(operand_tokens[i]);
+        if (kinds[i] == OperandKind::None) {
+            return nullptr;
+        }
+    }
+    return lookup_specifier(format, operand_signature(kinds, operand_tokens.size()), candidates);
+}
+
+void Parser::parse_data_definition() {
+    // Assume the current token is the "db" directive.
+    // Move past the directive token.
+    currentTokenIndex++;
+    if (section == Section::Bss) {
+        *diagnostics << "Error: db in .bss, which has no contents; use .space\n";
+        while (currentTokenIndex < tokens.size() && tokens[currentTokenIndex].type == TokenType::Operand) {
+            currentTokenIndex++;
+        }
+        return;
+    }
+    std::vector<uint8_t> &out = section_bytes();
+
+    // Process all subsequent tokens that are operands.
+    while (currentTokenIndex < tokens.size() && tokens[currentTokenIndex].type == TokenType::Operand) {
+        const Token &operandToken = tokens[currentTokenIndex];
+        std::string op(operandToken.data);
+        trim(op); // Remove any leading/trailing whitespace
+        if (operandToken.subtype == OperandSubtype::LabelReference) {
+            // A 32-bit address: the section-relative address of a label in
+            // this file, rebased by the linker, or a 0 placeholder and a relocation.
+            uint32_t address = 0;
+            // Record the current position so the linker can patch it later.
+            uint32_t patch_position = current_address();
+            auto label = code_generator.label_table.find(op);
+            if (label != code_generator.label_table.end()) {
+                address = label->second.address;
+                code_generator.base_fixups.push_back({patch_position, section, label->second.section});
+            } else {
+                this->code_generator.relocation_entries.emplace_back(this->code_generator.intern_label(op),
+                                                                     patch_position, section);
+            }
+            out.push_back(static_cast<uint8_t>((address >> 24) & 0xFF));
+            out.push_back(static_cast<uint8_t>((address >> 16) & 0xFF));
+            out.push_back(static_cast<uint8_t>((address >> 8) & 0xFF));
+            out.push_back(static_cast<uint8_t>(address & 0xFF));
+        }
+        // Check if the operand is a string literal (quoted with " or ')
+        else if (op.size() >= 2 &&
+            ((op.front() == '"' && op.back() == '"') || (op.front() == '\'' && op.back() == '\''))) {
+            // Remove the surrounding quotes.
+            std::string asciiString = op.substr(1, op.size() - 2);
+            // Append each character as a byte.
+            for (char ch: asciiString) {
+                out.push_back(static_cast<uint8_t>(ch));
+            }
+        } else {
+            // Otherwise, assume the operand is a numeric literal.
+            try {
+                // std::stoi supports decimal and hexadecimal (if prefixed with "0x")
+                int value = std::stoi(op, nullptr, 0);
+                if (value < 0 || value > 0xFF) {
+                    throw std::runtime_error("Data byte value out of range: " + op);
+                }
+                out.push_back(static_cast<uint8_t>(value));
+            } catch (const std::exception &e) {
+                *diagnostics << "Error parsing data byte '" << op << "': " << e.what() << "\n";
+            }
+        }
+        currentTokenIndex++;
+    }
+}
+
+void Parser::parse_directive(bool laying_out) {
+    const std::string_view name = tokens[currentTokenIndex].data;
+    currentTokenIndex++;
+    std::span<const Token> operand_tokens = take_operands();
+
+    if (name == ".text" || name == ".data" || name == ".bss") {
+        if (!operand_tokens.empty() && !laying_out) {
+            *diagnostics << "Error: " << name << " takes no operands\n";
+        }
+        section = name == ".text" ? Section::Text : name == ".data" ? Section::Data : Section::Bss;
+        return;
+    }
+    if (name == ".space") {
+        // A byte count, decimal or 0x-hexadecimal, with an optional '#'.
+        int64_t size = -1;
+        if (operand_tokens.size() == 1) {
+            std::string_view text = operand_tokens[0].data;
+            if (text.starts_with('#')) text.remove_prefix(1);
+            if (!parse_integer(text, size) || size > UINT32_MAX) size = -1;
+        }
+        if (size < 0) {
+            if (!laying_out) {
+                *diagnostics << "Error: .space takes one byte count\n";
+            }
+            return;
+        }
+        // The section's addresses are 32-bit; past them, its size would
+        // wrap, and filling it would take gigabytes.
+        const uint32_t used = laying_out ? laidOutBytes[section_index(section)] : current_address();
+        if (static_cast<uint64_t>(size) > UINT32_MAX - used) {
+            if (!laying_out) {
+                *diagnostics << "Error: .space " << size << " does not fit in the 32-bit section\n";
+            }
+            return;
+        }
+        const auto bytes = static_cast<uint32_t>(size);
+        if (laying_out) {
+            laidOutBytes[section_index(section)] += bytes;
+        } else if (section == Section::Bss) {
+            bss_size += bytes;
+        } else {
+            std::vector<uint8_t> &out = section_bytes();
+            out.insert(out.end(), bytes, 0);
+        }
+        return;
+    }
+    if (!laying_out) {
+        // The lexer turns a well-formed one into an Include token.
+        *diagnostics << "Error: .include takes one quoted file name\n";
+    }
+}
+
+uint32_t Parser::data_operand_size(const Token &operand) {
+    if (operand.subtype == OperandSubtype::LabelReference) {
+        return 4;
+    }
+    std::string op(operand.data);
+    trim(op);
+    if (op.size() >= 2 &&
+        ((op.front() == '"' && op.back() == '"') || (op.front() == '\'' && op.back() == '\''))) {
+        return static_cast<uint32_t>(op.size() - 2);
+    }
+    // A numeric literal is one byte, or nothing if it is invalid.
+    try {
+        int value = std::stoi(op, nullptr, 0);
+        return value >= 0 && value <= 0xFF ? 1 : 0;
+    } catch (const std::exception &) {
+        return 0;
+    }
+}
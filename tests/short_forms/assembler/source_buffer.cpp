@@ -0,0 +1,100 @@
+#include "source_buffer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceBuffer::~SourceBuffer() {
+    release();
+}
+
+SourceBuffer::SourceBuffer(SourceBuffer &&other) noexcept {
+    *this = std::move(other);
+}
+
+SourceBuffer &SourceBuffer::operator=(SourceBuffer &&other) noexcept {
+    if (this != &other) {
+        release();
+        mapped_ = other.mapped_;
+        owned_ = std::move(other.owned_);
+        shared_ = std::move(other.shared_);
+        size_ = other.size_;
+        data_ = mapped_ || shared_ ? other.data_ : owned_.data();
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.mapped_ = false;
+    }
+    return *this;
+}
+
+void SourceBuffer::release() {
+    if (mapped_ && data_) {
+        munmap(const_cast<char *>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    owned_.clear();
+    shared_.reset();
+}
+
+void SourceBuffer::share(std::shared_ptr<const std::string> text) {
+    release();
+    shared_ = std::move(text);
+    data_ = shared_->data();
+    size_ = shared_->size();
+}
+
+void SourceBuffer::discard_prefix(size_t offset) {
+    if (!mapped_) {
+        return;
+    }
+    auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t length = std::min(offset, size_) / page * page;
+    if (length > 0) {
+        madvise(const_cast<char *>(data_), length, MADV_DONTNEED);
+    }
+}
+
+bool SourceBuffer::open(const std::string &path) {
+    release();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) {
+            ::close(fd);
+            return true;
+        }
+        void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            ::close(fd);
+            madvise(addr, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char *>(addr);
+            mapped_ = true;
+            return true;
+        }
+        size_ = 0;
+    }
+    ::close(fd);
+
+    // Fall back to reading the whole stream.
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    owned_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data_ = owned_.data();
+    size_ = owned_.size();
+    return true;
+}
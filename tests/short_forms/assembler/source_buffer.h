@@ -0,0 +1,66 @@
+#ifndef SOURCE_BUFFER_H
+#define SOURCE_BUFFER_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <memory>
+
+/*
+SourceBuffer owns the bytes of one assembly source file for the whole run.
+
+Regular files are mapped read-only with mmap, so reading the input costs no
+copy and no per-line allocation; anything that cannot be mapped (pipes,
+character devices) is read into an owned string instead. A buffer can also
+view text held by someone else, such as the server's file cache (see
+FileCache). Tokens produced by
+the Lexer are views into this buffer, so it must outlive them.
+*/
+class SourceBuffer {
+public:
+    SourceBuffer() = default;
+    ~SourceBuffer();
+
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+    SourceBuffer(SourceBuffer &&other) noexcept;
+    SourceBuffer &operator=(SourceBuffer &&other) noexcept;
+
+    /**
+     * Map (or read) the file at 'path', replacing any previous contents.
+     *
+     * @param path Path of the source file.
+     * @return False if the file could not be opened or read.
+     */
+    bool open(const std::string &path);
+
+    /**
+     * View 'text', keeping it alive, instead of any previous contents.
+     *
+     * @param text The source; must not be null.
+     */
+    void share(std::shared_ptr<const std::string> text);
+
+    /**
+     * Tell the kernel that the bytes before 'offset' will not be read again,
+     * so their pages can be dropped from the resident set. The contents stay
+     * readable (they are faulted back in from the file if touched).
+     *
+     * @param offset End of the consumed prefix.
+     */
+    void discard_prefix(size_t offset);
+
+    [[nodiscard]] std::string_view text() const { return {data_, size_}; }
+    [[nodiscard]] size_t size() const { return size_; }
+
+private:
+    void release();
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::string owned_; // Used when the file cannot be mapped.
+    std::shared_ptr<const std::string> shared_; // Set by share().
+};
+
+#endif // SOURCE_BUFFER_H
@@ -0,0 +1,177 @@
+#include "structural_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define STRUCTURAL_INDEX_X86 1
+#endif
+
+namespace {
+
+constexpr size_t kBlockSize = 64;
+// Stage 1 runs over this many blocks at a time so that its output stays in L1.
+constexpr size_t kBatchBlocks = 64;
+
+// One bit per byte of a 64-byte block, for each character of interest.
+struct BlockMasks {
+    uint64_t newline;
+    uint64_t semicolon;
+    uint64_t dollar;
+};
+
+using ClassifyFn = void (*)(const char *data, size_t blocks, BlockMasks *out);
+
+#ifdef STRUCTURAL_INDEX_X86
+
+inline uint64_t matchSse2(__m128i v0, __m128i v1, __m128i v2, __m128i v3, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    uint64_t m0 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v0, needle)));
+    uint64_t m1 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v1, needle)));
+    uint64_t m2 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v2, needle)));
+    uint64_t m3 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v3, needle)));
+    return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+}
+
+void classifySse2(const char *data, size_t blocks, BlockMasks *out) {
+    for (size_t b = 0; b < blocks; ++b, data += kBlockSize) {
+        const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16));
+        const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32));
+        const __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48));
+        out[b].newline   = matchSse2(v0, v1, v2, v3, '\n');
+        out[b].semicolon = matchSse2(v0, v1, v2, v3, ';');
+        out[b].dollar    = matchSse2(v0, v1, v2, v3, '$');
+    }
+}
+
+__attribute__((target("avx2")))
+inline uint64_t matchAvx2(__m256i lo, __m256i hi, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    uint64_t mlo = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle)));
+    uint64_t mhi = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle)));
+    return mlo | (mhi << 32);
+}
+
+__attribute__((target("avx2")))
+void classifyAvx2(const char *data, size_t blocks, BlockMasks *out) {
+    for (size_t b = 0; b < blocks; ++b, data += kBlockSize) {
+        const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+        const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 32));
+        out[b].newline   = matchAvx2(lo, hi, '\n');
+        out[b].semicolon = matchAvx2(lo, hi, ';');
+        out[b].dollar    = matchAvx2(lo, hi, '$');
+    }
+}
+
+#else
+
+void classifyScalar(const char *data, size_t blocks, BlockMasks *out) {
+    for (size_t b = 0; b < blocks; ++b, data += kBlockSize) {
+        BlockMasks m{0, 0, 0};
+        for (size_t i = 0; i < kBlockSize; ++i) {
+            uint64_t bit = uint64_t{1} << i;
+            switch (data[i]) {
+                case '\n': m.newline |= bit; break;
+                case ';': m.semicolon |= bit; break;
+                case '$': m.dollar |= bit; break;
+                default: break;
+            }
+        }
+        out[b] = m;
+    }
+}
+
+#endif // STRUCTURAL_INDEX_X86
+
+ClassifyFn selectClassifier() {
+#ifdef STRUCTURAL_INDEX_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return classifyAvx2;
+    }
+    return classifySse2;
+#else
+    return classifyScalar;
+#endif
+}
+
+const ClassifyFn classify = selectClassifier();
+
+// Stage 2: turns block masks into line records. Lines may span blocks, so the
+// state of the current line is carried from one block to the next.
+class LineWalker {
+public:
+    explicit LineWalker(std::vector<StructuralIndex::Line> &lines) : lines_(lines) {}
+
+    void block(size_t base, const BlockMasks &m) {
+        uint64_t newlines = m.newline;
+        uint64_t current = ~uint64_t{0}; // Bits at or after the start of the current line.
+        while (true) {
+            uint64_t firstNewline = newlines & (~newlines + 1);
+            uint64_t segment = current & (firstNewline - 1); // firstNewline == 0 selects all bits.
+            if (!inComment_) {
+                uint64_t semicolons = m.semicolon & segment;
+                if (semicolons != 0) {
+                    commentAt_ = base + static_cast<size_t>(__builtin_ctzll(semicolons));
+                    inComment_ = true;
+                    segment &= (semicolons & (~semicolons + 1)) - 1;
+                }
+                if (m.dollar & segment) flags_ |= StructuralIndex::kDollar;
+            }
+            if (newlines == 0) break;
+
+            finishLine(base + static_cast<size_t>(__builtin_ctzll(newlines)));
+            lineBegin_ = base + static_cast<size_t>(__builtin_ctzll(newlines)) + 1;
+            current = ~((firstNewline << 1) - 1);
+            newlines &= newlines - 1;
+        }
+    }
+
+    void finish(size_t end) {
+        if (lineBegin_ < end) finishLine(end);
+    }
+
+private:
+    void finishLine(size_t end) {
+        size_t codeEnd = inComment_ ? commentAt_ : end;
+        uint8_t flags = flags_ | (inComment_ ? StructuralIndex::kComment : 0);
+        lines_.push_back({static_cast<uint32_t>(lineBegin_), static_cast<uint32_t>(codeEnd - lineBegin_), flags});
+        inComment_ = false;
+        flags_ = 0;
+    }
+
+    std::vector<StructuralIndex::Line> &lines_;
+    size_t lineBegin_ = 0;
+    size_t commentAt_ = 0;
+    bool inComment_ = false;
+    uint8_t flags_ = 0;
+};
+
+} // namespace
+
+void StructuralIndex::build(std::string_view text) {
+    text_ = text;
+    lines_.clear();
+
+    LineWalker walker(lines_);
+    BlockMasks masks[kBatchBlocks];
+    const size_t fullBlocks = text.size() / kBlockSize;
+    for (size_t first = 0; first < fullBlocks; first += kBatchBlocks) {
+        size_t count = std::min(kBatchBlocks, fullBlocks - first);
+        classify(text.data() + first * kBlockSize, count, masks);
+        for (size_t b = 0; b < count; ++b) {
+            walker.block((first + b) * kBlockSize, masks[b]);
+        }
+    }
+
+    // The last partial block is padded with NULs, which match nothing.
+    size_t tail = text.size() - fullBlocks * kBlockSize;
+    if (tail > 0) {
+        char padded[kBlockSize] = {};
+        std::memcpy(padded, text.data() + fullBlocks * kBlockSize, tail);
+        classify(padded, 1, masks);
+        walker.block(fullBlocks * kBlockSize, masks[0]);
+    }
+    walker.finish(text.size());
+}
@@ -0,0 +1,79 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include "assembler/lexer.h"
+#include "assembler/structural_index.h"
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+Helpers for the tests in tests/. Each test is a program that runs its checks
+and exits with 1 if any failed (make test). Sources are written one statement
+per line; token streams are compared in their rendered form, statements
+separated by "; ".
+*/
+namespace test {
+
+inline int failures = 0;
+
+inline void check_equal(const std::string &actual, const std::string &expected, const char *file, int line) {
+    if (actual != expected) {
+        std::fprintf(stderr, "%s:%d: expected\n  %s\ngot\n  %s\n", file, line, expected.c_str(), actual.c_str());
+        ++failures;
+    }
+}
+
+inline void check(bool condition, const char *text, const char *file, int line) {
+    if (!condition) {
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+        ++failures;
+    }
+}
+
+// The tokens of 'source', which must outlive them, like 'lexer'.
+inline std::vector<Token> lex(std::string_view source, Lexer &lexer) {
+    StructuralIndex index;
+    index.build(source);
+    lexer.firstPass(index);
+    return lexer.secondPass(index);
+}
+
+// "start:; add 1, #0; bro start"
+inline std::string render(const std::vector<Token> &tokens) {
+    std::string text;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const Token &token = tokens[i];
+        if (token.type == TokenType::Operand) {
+            text += tokens[i - 1].type == TokenType::Operand ? ", " : " ";
+            text += token.lexeme;
+            continue;
+        }
+        if (!text.empty()) text += "; ";
+        if (token.type == TokenType::Label) {
+            text += token.data;
+            text += ":";
+        } else {
+            text += token.lexeme;
+        }
+    }
+    return text;
+}
+
+inline int result(const char *name) {
+    if (failures) {
+        std::fprintf(stderr, "%s: %d failed\n", name, failures);
+        return 1;
+    }
+    std::printf("%s: passed\n", name);
+    return 0;
+}
+
+} // namespace test
+
+#define CHECK(condition) test::check((condition), #condition, __FILE__, __LINE__)
+#define CHECK_EQUAL(actual, expected) test::check_equal((actual), (expected), __FILE__, __LINE__)
+
+#endif // TEST_UTIL_H